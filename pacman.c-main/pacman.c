@@ -40,7 +40,10 @@
     while now for all my hobby code). An interesting side effect of this
     upfront-defined static memory layout is that there are no dynamic
     allocations in the entire game code (only a handful allocations during
-    initialization of the Sokol headers).
+    initialization of the Sokol headers). The simulation state of a game
+    instance (the 'game_ctx_t' struct) is separated from the per-process
+    state (gfx resources, audio, frame timing), all simulation functions
+    take a pointer to the game instance they operate on as first parameter.
 
     Instead of "wasting" time thinking too much about high-level abstractions
     and reusability, the code has been written in a fairly adhoc-manner "from
@@ -112,16 +115,16 @@
 
         // if a monster has been eaten, trigger the 'monster eaten' action:
         if (monster_eaten()) {
-            start(&state.game.monster_eaten);
+            start(ctx, &ctx->game.monster_eaten);
         }
 
         // ...somewhere else, we might increase the score if a monster has been eaten:
-        if (now(state.game.monster_eaten)) {
-            state.game.score += 10;
+        if (now(ctx, ctx->game.monster_eaten)) {
+            ctx->game.score += 10;
         }
 
         // ...and yet somewhere else in the code, we might want to play a sound effect
-        if (now(state.game.monster_eaten)) {
+        if (now(ctx, ctx->game.monster_eaten)) {
             // play sound effect...
         }
 
@@ -131,22 +134,159 @@
         // start fading out now, after one second (60 ticks) start a new
         // game round, and fade in, after another second when fadein has
         // finished, start the actual game loop
-        start(&state.gfx.fadeout);
-        start_after(&state.game.started, 60);
-        start_after(&state.gfx.fadein, 60);
-        start_after(&state.game.gameloop_started, 2*60);
+        start(ctx, &ctx->vid.fadeout);
+        start_after(ctx, &ctx->game.started, 60);
+        start_after(ctx, &ctx->vid.fadein, 60);
+        start_after(ctx, &ctx->game.gameloop_started, 2*60);
 
     As mentioned above, there's a whole little function vocabulary built around
     time triggers, but those are hopefully all self-explanatory.
 */
+// build configuration defines (usually set by CMakeLists.txt)
+#ifndef PACMAN_HEADLESS
+#define PACMAN_HEADLESS     (0)     // set to (1) for a simulation-only build without window, GPU or audio
+#endif
+#ifndef PACMAN_ATLAS
+#define PACMAN_ATLAS        (0)     // set to (1) to use the pre-decoded tile atlas in pacman_atlas.h instead of decoding at startup
+#endif
+#ifndef PACMAN_ATLASGEN
+#define PACMAN_ATLASGEN     (0)     // set to (1) in a headless build to build the pacman_atlas.h generator instead of the runner
+#endif
+#if PACMAN_ATLASGEN && !PACMAN_HEADLESS
+#error "the tile atlas generator requires PACMAN_HEADLESS"
+#endif
+#ifndef PACMAN_BENCH
+#define PACMAN_BENCH        (0)     // set to (1) in a headless build to build the benchmark suite instead of the runner
+#endif
+#if PACMAN_BENCH && (!PACMAN_HEADLESS || PACMAN_ATLASGEN)
+#error "the benchmark suite requires PACMAN_HEADLESS"
+#endif
+#ifndef PACMAN_REPLAY
+#if PACMAN_BENCH || defined(__EMSCRIPTEN__)
+#define PACMAN_REPLAY       (0)
+#else
+#define PACMAN_REPLAY       (1)     // set to (0) to build without input recording and replay
+#endif
+#endif
+#if PACMAN_HEADLESS && !PACMAN_ATLASGEN && !PACMAN_BENCH && !PACMAN_REPLAY
+#error "the headless runner requires PACMAN_REPLAY"
+#endif
+#ifndef PACMAN_NETPLAY
+#if PACMAN_HEADLESS || defined(__EMSCRIPTEN__)
+#define PACMAN_NETPLAY      (0)
+#else
+#define PACMAN_NETPLAY      (1)     // set to (0) to build without the networked two-player mode
+#endif
+#endif
+#ifndef PACMAN_SPECTATE
+#if PACMAN_HEADLESS || defined(__EMSCRIPTEN__)
+#define PACMAN_SPECTATE     (0)
+#else
+#define PACMAN_SPECTATE     (1)     // set to (0) to build without the spectator stream
+#endif
+#endif
+#if PACMAN_SPECTATE && !PACMAN_NETPLAY
+#error "the spectator stream requires PACMAN_NETPLAY"
+#endif
+#ifndef PACMAN_TELEMETRY
+#if PACMAN_ATLASGEN || defined(__EMSCRIPTEN__)
+#define PACMAN_TELEMETRY    (0)
+#else
+#define PACMAN_TELEMETRY    (1)     // set to (0) to build without the gameplay telemetry log
+#endif
+#endif
+#ifndef PACMAN_AUTOPLAY
+#if PACMAN_ATLASGEN || PACMAN_BENCH || defined(__EMSCRIPTEN__)
+#define PACMAN_AUTOPLAY     (0)
+#else
+#define PACMAN_AUTOPLAY     (1)     // set to (0) to build without the autoplay bot
+#endif
+#endif
+#ifndef PACMAN_PROFILER
+#if PACMAN_HEADLESS
+#define PACMAN_PROFILER     (0)
+#else
+#define PACMAN_PROFILER     (1)     // set to (0) to build without the frame profiler
+#endif
+#endif
+#if PACMAN_PROFILER && PACMAN_HEADLESS
+#error "the frame profiler requires a windowed build"
+#endif
+#ifndef PACMAN_SOUND_CACHE
+#if PACMAN_HEADLESS
+#define PACMAN_SOUND_CACHE  (0)
+#else
+#define PACMAN_SOUND_CACHE  (1)     // set to (0) to always play sound effects through the voice emulation
+#endif
+#endif
+#ifndef PACMAN_AUDIO_STREAM
+#if PACMAN_HEADLESS || defined(__EMSCRIPTEN__)
+#define PACMAN_AUDIO_STREAM (0)
+#else
+#define PACMAN_AUDIO_STREAM (1)     // set to (0) to synthesize audio on the main thread and push it to sokol-audio
+#endif
+#endif
+
+#if !PACMAN_HEADLESS
 #include "sokol_app.h"
 #include "sokol_gfx.h"
 #include "sokol_audio.h"
 #include "sokol_log.h"
 #include "sokol_glue.h"
+#endif
 #include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h> // offsetof()
 #include <string.h> // memset()
 #include <stdlib.h> // abs()
+#include <time.h>   // clock_gettime()
+#include <stdio.h>  // printf(), snprintf(), fopen()
+#if PACMAN_HEADLESS
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>    // CreateThread()
+#else
+#include <pthread.h>    // pthread_create()
+#include <unistd.h>     // sysconf()
+#endif
+#endif
+#if PACMAN_NETPLAY
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>      // getaddrinfo()
+#include <fcntl.h>
+#include <unistd.h>     // close()
+#endif
+#endif
+#if !PACMAN_ATLASGEN
+#if defined(__EMSCRIPTEN__)
+#include <emscripten/emscripten.h>  // emscripten_async_wget_data()
+#elif defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>    // MapViewOfFile()
+#else
+#include <sys/mman.h>   // mmap()
+#include <sys/stat.h>   // fstat()
+#include <fcntl.h>      // open()
+#include <unistd.h>     // close()
+#endif
+#endif
+#if (PACMAN_TELEMETRY || PACMAN_AUTOPLAY) && !defined(_WIN32)
+#include <pthread.h>    // pthread_create()
+#endif
+#if (PACMAN_AUDIO_STREAM || PACMAN_TELEMETRY) && defined(_MSC_VER)
+#include <intrin.h>     // _InterlockedExchange()
+#endif
+#if PACMAN_ATLAS && !PACMAN_HEADLESS
+#include "pacman_atlas.h"   // atlas_tile_pixels[], atlas_color_palette[] (generated by pacman_atlasgen)
+#endif
 
 // config defines and global constants
 #define AUDIO_VOLUME (0.5f)
@@ -172,6 +312,11 @@
 #define NUM_VOICES           (3)            // number of sound voices
 #define NUM_SOUNDS           (3)            // max number of sounds effects that can be active at a time
 #define NUM_SAMPLES          (128)          // max number of audio samples in local sample buffer
+#define NUM_CACHED_SOUNDS    (6)            // number of sound effects which are pre-rendered to PCM
+#define SND_CACHE_SAMPLES    (384*1024)     // max size of the pre-rendered sound effect sample pool
+#define SND_PCM_SCALE        (32767.0f)     // pre-rendered samples are stored as int16 scaled by this
+#define SND_QUEUE_SIZE       (64)           // number of voice register updates in the audio thread queue (must be 2^N)
+#define SND_QUEUE_MAX_BACKLOG (4)           // max number of queued ticks before the audio thread skips ahead
 #define DISABLED_TICKS       (0xFFFFFFFF)   // magic tick value for a disabled timer
 #define TILE_WIDTH           (8)            // width and height of a background tile in pixels
 #define TILE_HEIGHT          (8)
@@ -181,24 +326,87 @@
 #define DISPLAY_TILES_Y      (36)
 #define DISPLAY_PIXELS_X     (DISPLAY_TILES_X * TILE_WIDTH)
 #define DISPLAY_PIXELS_Y     (DISPLAY_TILES_Y * TILE_HEIGHT)
-#define NUM_SPRITES          (8)
+#define MAX_PLAYERS          (8)            // max number of Pacman players in battle mode
+#define NUM_SPRITES          (6 + MAX_PLAYERS - 1)  // Pacman, 4 ghosts, fruit and the other battle mode players
 #define NUM_DEBUG_MARKERS    (16)
+#define INPUT_QUEUE_SIZE     (64)           // max number of queued key events (must be 2^N)
+#define NUM_TIME_SCALES      (5)            // number of selectable time scales (see timing_scales[])
+#define UNCAPPED_BUDGET_NS   (12000000)     // per-frame time budget for game ticks with the uncapped time scale
 #define TILE_TEXTURE_WIDTH   (256 * TILE_WIDTH)
 #define TILE_TEXTURE_HEIGHT  (TILE_HEIGHT + SPRITE_HEIGHT)
-#define MAX_VERTICES         (((DISPLAY_TILES_X * DISPLAY_TILES_Y) + NUM_SPRITES + NUM_DEBUG_MARKERS) * 6)
+#if PACMAN_PROFILER
+#define PROF_NUM_FRAMES      (1024)         // number of frames in the profiler's sample ring
+#define PROF_HUD_QUADS       ((NUM_PROF_SCOPES + 1) * DISPLAY_TILES_X)  // one tile row per scope plus header
+#else
+#define PROF_HUD_QUADS       (0)
+#endif
+#define MAX_QUADS            (NUM_SPRITES + NUM_DEBUG_MARKERS + 1 + PROF_HUD_QUADS)   // sprites, debug markers, fade quad and profiler HUD
+#define QUAD_POS_BIAS        (256)  // added to quad pixel positions so that partially offscreen sprites fit into an unsigned 16-bit value
+#define PLAYFIELD_BANDS      (6)    // the playfield quads are split into bands of rows which are updated separately
+#define PLAYFIELD_BAND_TILES_Y (DISPLAY_TILES_Y / PLAYFIELD_BANDS)
+#define PLAYFIELD_BAND_QUADS (DISPLAY_TILES_X * PLAYFIELD_BAND_TILES_Y)
+#define PLAYFIELD_QUADS      (DISPLAY_TILES_X * DISPLAY_TILES_Y)
+#define MAX_WALL_GAMES       (16)   // max number of games in the cabinet wall mode
+#define WALL_GAME_QUADS      (PLAYFIELD_QUADS + NUM_SPRITES + NUM_DEBUG_MARKERS + 1)  // playfield, sprites, debug markers and fade quad of one game
 #define FADE_TICKS           (30)   // duration of fade-in/out
 #define NUM_LIVES            (6)
 #define NUM_STATUS_FRUITS    (7)    // max number of displayed fruits at bottom right
-#define NUM_DOTS             (244)  // 240 small dots + 4 pills
+#define NUM_GHOST_FIELDS     (NUM_GHOSTS + 1)   // one direction field per scatter target, plus one for the eyes (see game_init_ghost_fields())
+#define GHOST_FIELD_EYES     (NUM_GHOSTS)
 #define NUM_PILLS            (4)    // number of energizer pills on playfield
-#define ANTEPORTAS_X         (14*TILE_WIDTH)  // pixel position of the ghost house enter/leave point
-#define ANTEPORTAS_Y         (14*TILE_HEIGHT + TILE_HEIGHT/2)
+#define MAZE_FIRST_ROW       (3)    // the maze covers the tile rows 3..33
+#define MAZE_TILES_Y         (31)
+#define LEVELPACK_MAGIC      (0x564C4D50)   // the bytes 'PMLV' at the start of a level pack file
+#define LEVELPACK_VERSION    (3)
+#define LEVELPACK_HASH_SEED  (0xCBF29CE484222325)   // FNV-1a offset basis (see levelpack_hash())
+#define LEVELPACK_MAX_MAZES  (256)
+#define LEVELPACK_MAX_LEVELS (256)
+#define TELEM_RING_SIZE      (4096)     // telemetry records per game (must be 2^N)
+#define TELEM_MAX_GAMES      (MAX_WALL_GAMES)
+#define TELEM_MAGIC          (0x4C544D50)   // the bytes 'PMTL' at the start of a telemetry log file
+#define TELEM_VERSION        (1)
+#define TELEM_DEFAULT_PORT   (7002)     // default UDP port of a telemetry receiver
+#define TELEM_UDP_RECORDS    (64)       // max number of telemetry records per UDP packet
+#define BOT_STEP_TICKS       (8)        // ticks a bot action holds its key, about one tile of Pacman movement
+#define BOT_MAX_DEPTH        (12)       // bot actions from the current tick to the end of a rollout
+#define BOT_MAX_NODES        (4096)     // search tree nodes per bot worker
+#define BOT_MAX_THREADS      (16)
+#define BOT_BUDGET_NS        (8000000)  // bot search time per move in the game window, half a 60Hz frame
+#define BOT_DEFAULT_THREADS  (4)        // bot workers of the headless runner
+#define BOT_DEFAULT_ITERATIONS (32)     // rollouts per bot worker and move in the headless runner
+#define BOT_SCORE_SCALE      (10)       // score gain (score/10) of a rollout which earns the full score reward
+#define BOT_DOT_RANGE        (32)       // max distance in tiles to look for the nearest dot after a rollout
+#define BOT_EXPLORATION      (0.2f)     // weight of the exploration term in the tree search
 #define GHOST_EATEN_FREEZE_TICKS (60)  // number of ticks the game freezes after Pacman eats a ghost
 #define PACMAN_EATEN_TICKS   (60)       // number of ticks to freeze game when Pacman is eaten
 #define PACMAN_DEATH_TICKS   (150)      // number of ticks to show the Pacman death sequence before starting new round
 #define GAMEOVER_TICKS       (3*60)     // number of ticks the game over message is shown
 #define ROUNDWON_TICKS       (4*60)     // number of ticks to wait after a round was won
 #define FRUITACTIVE_TICKS    (10*60)    // number of ticks a bonus fruit is shown
+#define NET_DEFAULT_PORT     (7000)     // default UDP port for netplay
+#define NET_MAX_ROLLBACK     (8)        // max number of ticks the remote netplay input is predicted
+#define NET_NUM_SNAPSHOTS    (2*NET_MAX_ROLLBACK)
+#define NET_INPUT_RING_SIZE  (128)      // must be 2^N
+#define NET_MAX_PACKET_INPUTS (32)
+#define NET_PACKET_HEADER_SIZE (41)
+#define NET_MAGIC            (0x504D4E50)   // 'PMNP'
+#define SPEC_DEFAULT_PORT    (7001)     // default UDP port for spectators
+#define SPEC_MAGIC           (0x504D5350)   // 'PMSP', stream packets
+#define SPEC_HELLO_MAGIC     (0x504D5356)   // 'PMSV', viewer subscribe packets
+#define SPEC_PACKET_HEADER_SIZE (10)
+#define SPEC_PACKET_TICKS    (10)       // number of tick records per stream packet
+#define SPEC_KEYFRAME_TICKS  (30*60)    // interval of the periodic keyframes
+#define SPEC_MAX_DELTA_CELLS (64)       // more changed tiles than this are sent as a keyframe
+#define SPEC_MAX_RECORD_SIZE (2304)     // upper bound of an encoded tick record in bytes
+#define SPEC_MAX_PACKET_SIZE (4096)
+#define SPEC_MAX_VIEWERS     (32)
+#define SPEC_HELLO_TICKS     (60)       // interval of the viewer's subscribe packets
+#define SPEC_VIEWER_TIMEOUT_TICKS (5*60)    // viewers are dropped after this many ticks without subscribe packet
+#define SPEC_NUM_PACKETS     (16)       // viewer's buffer of received packets (must be 2^N)
+#define REPLAY_MAGIC         (0x504D5250)   // 'PMRP'
+#define REPLAY_VERSION       (4)
+#define REPLAY_SNAPSHOT_TICKS (10*60)   // interval of the snapshots embedded in replay files
+#define XORSHIFT_SEED        (0x12345678)   // default random-number-generator seed
 
 /* common tile, sprite and color codes, these are the same as on the Pacman
    arcade machine and extracted by looking at memory locations of a Pacman emulator
@@ -273,6 +481,39 @@ typedef enum {
     NUM_DIRS
 } dir_t;
 
+// per-tile maze navigation flags (see game_init_nav())
+typedef enum {
+    NAV_EXIT_RIGHT  = (1<<DIR_RIGHT),   // the neighbour tile in this direction isn't blocking
+    NAV_EXIT_DOWN   = (1<<DIR_DOWN),
+    NAV_EXIT_LEFT   = (1<<DIR_LEFT),
+    NAV_EXIT_UP     = (1<<DIR_UP),
+    NAV_REDZONE     = (1<<4),           // ghosts may not move upward from here
+} navflag_t;
+
+// the precomputed navigation tables of a maze (see maze_t)
+typedef enum {
+    MAZENAV_DRAWN,      // the freshly drawn maze
+    MAZENAV_CLEARED,    // after clearing the PLAYER ONE/TWO text, which also clears the ghost house side walls
+    NUM_MAZENAVS,
+} mazenav_t;
+
+// input keys used by the game, decoupled from sokol-app keycodes so that
+// the headless build can be driven by scripted input
+typedef enum {
+    INPUTKEY_OTHER,     // any other key (only counts as 'anykey')
+    INPUTKEY_UP,
+    INPUTKEY_DOWN,
+    INPUTKEY_LEFT,
+    INPUTKEY_RIGHT,
+    INPUTKEY_ESC,
+    INPUTKEY_W,
+    INPUTKEY_S,
+    INPUTKEY_A,
+    INPUTKEY_D,
+    INPUTKEY_L,
+    NUM_INPUTKEYS
+} inputkey_t;
+
 // bonus fruit types
 typedef enum {
     FRUIT_NONE,
@@ -295,6 +536,7 @@ typedef enum {
     SPRITE_INKY,
     SPRITE_CLYDE,
     SPRITE_FRUIT,
+    SPRITE_PLAYERS,     // players 1..MAX_PLAYERS-1 in battle mode (player 0 is SPRITE_PACMAN)
 } sprite_index_t;
 
 // ghost types
@@ -358,17 +600,26 @@ typedef struct {
     uint16_t dot_limit;
 } ghost_t;
 
-// pacman state
+/* the tile- and sprite-renderer's per-quad instance data, the vertex shader
+   expands each instance into a quad by combining it with the 4 corners
+   of the shared unit-quad vertex buffer (see gfx_create_resources())
+*/
 typedef struct {
-    actor_t actor;
-} pacman_t;
+    uint16_t x, y;      // pixel position of the top-left corner plus QUAD_POS_BIAS
+    uint8_t tile;       // tile or sprite code
+    uint8_t color;      // color code
+    uint8_t opacity;    // opacity (only used for fade effect)
+    uint8_t flags;      // quad kind and flip bits (QUADFLAG_*)
+} instance_t;
 
-// the tile- and sprite-renderer's vertex structure
-typedef struct {
-    float x, y;         // screen coords [0..1]
-    float u, v;         // tile texture coords
-    uint32_t attr;      // x: color code, y: opacity (opacity only used for fade effect)
-} vertex_t;
+typedef enum {
+    QUADFLAG_TILE = 0,          // an 8x8 tile
+    QUADFLAG_SPRITE = 1,        // a 16x16 sprite
+    QUADFLAG_FULLSCREEN = 2,    // a 16x16 sprite stretched over the whole display
+    QUADFLAG_FLIPX = (1<<2),
+    QUADFLAG_FLIPY = (1<<3),
+    QUADFLAG_CELL = (1<<4),     // multiplied with the render target cell in the cabinet wall mode (upper 4 bits)
+} quadflag_t;
 
 // sprite state
 typedef struct {
@@ -396,14 +647,26 @@ typedef struct {
     bool voice[3];          // true to activate voice
 } sound_desc_t;
 
+// a sound effect pre-rendered to PCM at the device sample rate (see snd_cache_init())
+typedef struct {
+    const sound_desc_t* desc;
+    const int16_t* samples; // the mixed and scaled output of the sound's voices (times SND_PCM_SCALE)
+    uint32_t num_samples;
+    uint32_t num_ticks;     // length in 60Hz ticks
+} snd_pcm_t;
+
+// the playback position of a pre-rendered sound effect
+typedef struct {
+    const snd_pcm_t* pcm;
+    uint32_t pos;
+} snd_pcm_play_t;
+
 // a sound 'hardware' voice
 typedef struct {
     uint32_t counter;   // 20-bit counter, top 5 bits are index into wavetable ROM
     uint32_t frequency; // 20-bit frequency (added to counter at 96kHz)
     uint8_t waveform;   // 3-bit waveform index
     uint8_t volume;     // 4-bit volume
-    float sample_acc;   // current float sample accumulator
-    float sample_div;   // current float sample divisor
 } voice_t;
 
 // flags for sound_t.flags
@@ -421,18 +684,158 @@ typedef struct {
     uint32_t num_ticks;     // length of register dump sound effect in 60Hz ticks
     uint32_t stride;        // number of uint32_t values per tick (only for register dump effects)
     const uint32_t* data;   // 3 * num_ticks register dump values
+    const snd_pcm_t* pcm;   // pre-rendered samples (if a cached sound)
     uint8_t flags;          // combination of soundflag_t (active voices)
 } sound_t;
 
-// all state is in a single nested struct
-static struct {
+// the voice registers after a 60Hz sound tick, queued for the audio thread
+typedef struct {
+    voice_t voice[NUM_VOICES];  // the counter is owned by the audio thread and ignored
+    const snd_pcm_t* pcm[NUM_SOUNDS];   // the pre-rendered sound in each sound slot
+    uint32_t pcm_tick[NUM_SOUNDS];      // the tick of the pre-rendered sound which plays next
+} snd_regs_t;
+
+// the input state of one player
+typedef struct {
+    bool enabled;
+    bool up;
+    bool down;
+    bool left;
+    bool right;
+    bool esc;       // only for debugging (see DBG_ESCACPE)
+    bool anykey;
+    bool l;
+} input_t;
+
+// the frame profiler's scopes (see PROF_BEGIN() and PROF_END())
+typedef enum {
+    PROF_FRAME,         // the whole frame callback
+    PROF_SND_TICK,      // snd_tick()
+    PROF_SIM_TICK,      // intro_tick() or game_tick(), including the three below
+    PROF_ACTORS,        // game_update_actors()
+    PROF_TILES,         // game_update_tiles()
+    PROF_SPRITES,       // game_update_sprites()
+    PROF_GFX_QUADS,     // instance data generation in gfx_draw()
+    PROF_GFX_UPLOAD,    // sg_update_buffer() and sg_update_image()
+    PROF_GFX_COMMIT,    // render passes and sg_commit()
+    PROF_SND_FRAME,     // snd_frame() (only when not streaming audio)
+    PROF_AUTOPLAY,      // the autoplay bot's search in bot_tick()
+    NUM_PROF_SCOPES
+} profscope_t;
+
+// a key event from the sokol-app event callback, queued until the tick it belongs to
+typedef struct {
+    uint64_t time_ns;       // time_now_ns() when the event was received
+    uint8_t key;            // inputkey_t
+    bool btn_down;
+} input_event_t;
+
+#if PACMAN_NETPLAY
+#if defined(_WIN32)
+typedef SOCKET net_socket_t;
+#define NET_INVALID_SOCKET (INVALID_SOCKET)
+#else
+typedef int net_socket_t;
+#define NET_INVALID_SOCKET (-1)
+#endif
+#endif
+
+#if PACMAN_TELEMETRY
+// gameplay telemetry event types (see TELEMETRY LOG)
+typedef enum {
+    TELEM_DOT_EATEN,        // actor: player, arg: dots eaten in this round
+    TELEM_PILL_EATEN,       // actor: player, arg: dots eaten in this round
+    TELEM_GHOST_EATEN,      // actor: ghost, arg: ghosts eaten with the current pill
+    TELEM_FRUIT_EATEN,      // actor: player, arg: fruit_t
+    TELEM_PACMAN_DEATH,     // actor: ghost, arg: bit mask of the caught players
+    TELEM_ROUND_WON,        // actor: none, arg: lives left
+    TELEM_GHOST_STATE,      // actor: ghost, arg: old ghoststate_t << 8 | new ghoststate_t
+    TELEM_REWIND,           // the game was reset or restored to the record's tick, drop any later records of the game
+    TELEM_DROPPED,          // arg: number of records dropped before this one because the ring was full
+} telemevent_t;
+
+// a telemetry record as written to the log
+typedef struct {
+    uint32_t tick;          // game tick of the event
+    uint16_t game;          // index of the game instance (see telem_attach())
+    uint8_t type;           // telemevent_t
+    uint8_t actor;          // player index or ghosttype_t
+    int16_t x;              // actor position (pixel coords)
+    int16_t y;
+    uint16_t arg;           // depends on type
+    uint8_t round;
+    uint8_t reserved;
+} telem_record_t;
+
+// a single-producer/single-consumer ring of telemetry records, filled by
+// the game's tick and drained by the writer thread
+typedef struct {
+    volatile uint32_t head;     // written by the game thread
+    volatile uint32_t tail;     // written by the writer thread
+    uint32_t num_dropped;       // records dropped since the last push (game thread only)
+    uint16_t game;
+    telem_record_t records[TELEM_RING_SIZE];
+} telem_ring_t;
+
+#if defined(_WIN32)
+typedef HANDLE telem_thread_t;
+#else
+typedef pthread_t telem_thread_t;
+#endif
+#endif
+
+/* the records of a level pack (see LEVEL PACKS), these have a fixed size
+   and layout without pointers, so that a level pack file can be used
+   straight from memory after mapping it, all values are little-endian
+*/
+typedef struct {
+    uint32_t magic;             // LEVELPACK_MAGIC
+    uint16_t version;           // LEVELPACK_VERSION
+    uint16_t header_size;       // sizeof(levelpack_header_t)
+    uint16_t maze_size;         // sizeof(maze_t)
+    uint16_t level_size;        // sizeof(levelspec_t)
+    uint16_t num_mazes;
+    uint16_t num_levels;        // the last level repeats
+    uint64_t hash;              // hash over the maze and level records
+} levelpack_header_t;
+
+// a maze with everything the game needs at round start already decoded
+typedef struct {
+    uint8_t tiles[MAZE_TILES_Y][DISPLAY_TILES_X];   // tile codes of the rows 3..33
+    uint8_t colors[MAZE_TILES_Y][DISPLAY_TILES_X];  // color codes of the rows 3..33
+    uint8_t nav[NUM_MAZENAVS][DISPLAY_TILES_Y][DISPLAY_TILES_X + 2];  // NAV_* flags per tile (see game_init_nav())
+    uint16_t ghost_fields[NUM_MAZENAVS][NUM_GHOST_FIELDS][DISPLAY_TILES_Y][DISPLAY_TILES_X + 2];  // see game_init_ghost_fields()
+    int2_t pacman_start;                    // starting position of the players (pixel coords)
+    int2_t ghost_start[NUM_GHOSTS];         // starting positions of the ghosts (pixel coords)
+    int2_t ghost_house_target[NUM_GHOSTS];  // targets of ghosts entering the ghost house (pixel coords)
+    int2_t house_door;                      // the ghost house enter/leave point (pixel coords)
+    int2_t eyes_target;                     // target of ghost eyes heading to the house door (tile coords)
+    int2_t scatter_target[NUM_GHOSTS];      // scatter target positions (tile coords)
+    uint8_t tunnel_y;                       // the teleport tunnel is in this row...
+    uint8_t tunnel_left;                    // ...at x <= tunnel_left
+    uint8_t tunnel_right;                   // ...and x >= tunnel_right
+    uint8_t num_dots;                       // number of dots and pills
+} maze_t;
+
+// level specifications (see pacman_dossier.pdf)
+typedef struct {
+    uint16_t bonus_fruit;       // fruit_t
+    uint16_t bonus_score;
+    uint16_t fright_ticks;
+    uint16_t maze;              // index of the maze in the level pack
+    // FIXME: the various Pacman and ghost speeds
+} levelspec_t;
+
+/* all simulation state of one game instance is in a single nested struct,
+   this is passed explicitly into all gameplay functions so that more than
+   one game can be simulated in the same process
+*/
+typedef struct {
 
     gamestate_t gamestate;  // the current gamestate (intro => game => intro)
 
     struct {
         uint32_t tick;          // the central game tick, this drives the whole game
-        uint64_t laptime_store; // helper variable to measure frame duration
-        int32_t tick_accum;     // helper variable to decouple ticks from frame rate
     } timing;
 
     // intro state
@@ -442,6 +845,7 @@ static struct {
 
     // game state
     struct {
+        uint32_t seed;              // xorshift seed at the start of each round
         uint32_t xorshift;          // current xorshift random-number-generator state
         uint32_t hiscore;           // hiscore / 10
         trigger_t started;
@@ -461,73 +865,256 @@ static struct {
         uint32_t score;                 // score / 10
         int8_t num_lives;
         uint8_t num_ghosts_eaten;       // number of ghosts easten with current pill
-        uint8_t num_dots_eaten;         // if == NUM_DOTS, Pacman wins the round
+        uint8_t num_dots_eaten;         // if == the maze's num_dots, Pacman wins the round
         bool global_dot_counter_active;     // set to true when Pacman loses a life
         uint8_t global_dot_counter;         // the global dot counter for the ghost-house-logic
         ghost_t ghost[NUM_GHOSTS];
-        pacman_t pacman1;
-        pacman_t pacman2;
-        bool player2;
+        // the Pacman players as structure-of-arrays, so that the ghost collision
+        // and chase target checks can test all players in one pass
+        struct {
+            int16_t pos_x[MAX_PLAYERS];     // position of sprite center in pixel coords
+            int16_t pos_y[MAX_PLAYERS];
+            uint8_t dir[MAX_PLAYERS];       // dir_t
+            uint32_t anim_tick[MAX_PLAYERS];
+        } players;
+        uint8_t num_players;    // 2 in the regular game, up to MAX_PLAYERS in battle mode
+        uint8_t active_player;  // the regular game only moves the player who pressed a key last
+        bool battle;            // in battle mode all players move at the same time
         fruit_t active_fruit;
+        uint8_t nav_index;      // mazenav_t, the current maze's navigation table (see game_use_nav())
     } game;
 
     // the current input state
+    input_t input1;
+    input_t input2;
+    uint16_t held_keys;     // keys held down in the last tick (see input_keys())
+    uint8_t battle_dirs[MAX_PLAYERS];   // wanted dir_t of the battle mode players without keyboard
+
+    // the 'video hardware' state which is rendered by the gfx subsystem
     struct {
-        bool enabled;
-        bool up;
-        bool down;
-        bool left;
-        bool right;
-        bool esc;       // only for debugging (see DBG_ESCACPE)
-        bool anykey;
-        bool l;
-    } input1;
+        // fade-in/out timers and current value
+        trigger_t fadein;
+        trigger_t fadeout;
+        uint8_t fade;
+
+        // the 36x28 tile framebuffer
+        uint8_t video_ram[DISPLAY_TILES_Y][DISPLAY_TILES_X]; // tile codes
+        uint8_t color_ram[DISPLAY_TILES_Y][DISPLAY_TILES_X]; // color codes
+        uint64_t tile_hash;     // incrementally updated hash over video_ram (see vid_put())
+
+        // Pacman, ghosts, fruit and the battle mode players
+        sprite_t sprite[NUM_SPRITES];
+    } vid;
+
+    // NOTE: everything above is the deterministic simulation state which
+    // is captured by game_snapshot(), everything below is not
+
+    // up to 16 debug markers
+    debugmarker_t debug_marker[NUM_DEBUG_MARKERS];
+
+    // if true, the gameplay code starts sound effects (only one game
+    // instance per process can be connected to the audio subsystem)
+    bool audible;
+
+    #if PACMAN_TELEMETRY
+    // receives the gameplay events if the telemetry log is active (see TELEMETRY LOG)
+    telem_ring_t* telem;
+    #endif
+
+    // point to the maze's navigation table selected by game.nav_index, with
+    // an extra column left and right for the teleport tunnel, and to the
+    // ghost direction fields derived from it (see game_use_nav())
+    const uint8_t (*nav)[DISPLAY_TILES_X + 2];
+    const uint16_t (*ghost_fields)[DISPLAY_TILES_Y][DISPLAY_TILES_X + 2];
+
+    #if !PACMAN_HEADLESS || PACMAN_BENCH
+    // one bit per tile column for each tile row, set when a tile or color
+    // changed since the last gfx_draw() (see vid_dirty())
+    uint32_t dirty_tiles[DISPLAY_TILES_Y];
+    #endif
+} game_ctx_t;
+
+// a snapshot of a game instance's simulation state (see game_snapshot() and
+// game_restore()), this is a flat blob without pointers of about 2.5 KBytes
+typedef struct {
+    uint8_t data[offsetof(game_ctx_t, debug_marker)];
+} game_snapshot_t;
+
+#if PACMAN_AUTOPLAY
+// a node of an autoplay bot's search tree (see AUTOPLAY BOT)
+typedef struct {
+    uint16_t child[NUM_DIRS];   // node index per action (dir_t), 0 while not expanded (node 0 is the root)
+    uint32_t visits;            // number of rollouts through the node
+    float value;                // sum of the rewards of these rollouts
+} bot_node_t;
+
+#if defined(_WIN32)
+typedef HANDLE bot_thread_t;
+#else
+typedef pthread_t bot_thread_t;
+#endif
+
+// an autoplay bot search worker with its own search tree and game copy
+typedef struct {
+    bot_thread_t thread;
+    bool running;           // true if the worker runs on its own thread
+    uint32_t rng;           // xorshift state of the rollout policy
+    uint32_t num_nodes;
+    uint32_t num_iterations;
+    game_ctx_t ctx;         // the game copy a rollout is simulated on
+    bot_node_t nodes[BOT_MAX_NODES];
+} bot_worker_t;
+#endif
+
+#if PACMAN_REPLAY
+// a run of ticks with the same keys held down during replay playback
+typedef struct {
+    uint32_t tick;          // first tick of the run
+    uint16_t keys;          // bit mask of (1<<inputkey_t)
+} replay_run_t;
+
+// a snapshot embedded in a replay file
+typedef struct {
+    uint32_t tick;          // the snapshot was taken before this tick
+    uint64_t hash;          // game_hash() of the snapshot's simulation state
+    game_snapshot_t snapshot;
+} replay_snapshot_t;
+#endif
+
+#if PACMAN_SPECTATE || (PACMAN_HEADLESS && !PACMAN_ATLASGEN && !PACMAN_BENCH)
+// the video state known to both sides of a spectator stream, records are encoded
+// and decoded as the difference to this state (see SPECTATOR STREAM)
+typedef struct {
+    uint8_t video_ram[DISPLAY_TILES_Y][DISPLAY_TILES_X];
+    uint8_t color_ram[DISPLAY_TILES_Y][DISPLAY_TILES_X];
+    sprite_t sprite[NUM_SPRITES];
+    uint8_t fade;
+    int2_t move[NUM_SPRITES];   // last position change per sprite, predicts the next one
+} spec_frame_t;
+
+// reads or writes a bit stream in a byte buffer
+typedef struct {
+    uint8_t* data;
+    uint32_t num_bits;      // capacity in bits
+    uint32_t pos;           // current position in bits
+    bool overflow;          // true after reading or writing past the end
+} spec_bits_t;
+
+// the sending side of a spectator stream
+typedef struct {
+    spec_frame_t ref;
+    uint32_t seq;               // stream tick of the next record
+    uint32_t keyframe_seq;      // stream tick of the last keyframe
+    uint32_t num_records;       // number of records in the current packet
+    spec_bits_t bits;
+    uint8_t packet[SPEC_MAX_PACKET_SIZE];   // the packet under construction
+    uint8_t out[SPEC_MAX_PACKET_SIZE];      // the last completed packet
+} spec_stream_t;
+#endif
+
+#if PACMAN_SPECTATE
+// the receiving side of a spectator stream
+typedef struct {
+    uint16_t packet_size[SPEC_NUM_PACKETS];
+    uint8_t packet[SPEC_NUM_PACKETS][SPEC_MAX_PACKET_SIZE];    // ring buffer of received packets
+    uint8_t cur_packet[SPEC_MAX_PACKET_SIZE];   // the packet whose records are played back
+    spec_frame_t ref;
+} spec_recv_t;
+#endif
+
+#if !PACMAN_ATLASGEN
+// per-process state (frame timing, the game instance driven by the
+// application callbacks, audio and GPU resources) is in a single nested struct
+static struct {
 
+    struct {
+        uint64_t laptime_store; // helper variable to measure frame duration
+        int64_t tick_accum;     // helper variable to decouple ticks from frame rate
+        int time_scale;         // index into timing_scales[]
+    } timing;
+
+    #if !PACMAN_HEADLESS
+    struct {
+        const char* path;       // the level pack file given with -levels (see LEVEL PACKS)
+    } levels;
+    #endif
+
+    #if PACMAN_PROFILER
+    // the frame profiler, durations are in nanoseconds per frame
     struct {
         bool enabled;
-        bool up;
-        bool down;
-        bool left;
-        bool right;
-        bool esc;       // only for debugging (see DBG_ESCACPE)
-        bool anykey;
-        bool l;
-    } input2;
+        const char* csv_path;       // dump the sample ring to this CSV file on exit
+        uint64_t begin_ns[NUM_PROF_SCOPES];
+        uint32_t cur[NUM_PROF_SCOPES];  // accumulated durations of the current frame
+        uint32_t num_frames;            // number of frames recorded so far
+        uint32_t (*frames)[NUM_PROF_SCOPES];   // ring of PROF_NUM_FRAMES frames, allocated in prof_alloc()
+        uint32_t* sorted;               // PROF_NUM_FRAMES durations sorted by prof_update_stats()
+        uint32_t stats[NUM_PROF_SCOPES][3]; // min, avg, p99 in microseconds (see prof_update_stats())
+    } prof;
+    #endif
 
+    #if !PACMAN_HEADLESS
+    // key events waiting for the game tick they belong to (see input_queue_tick())
+    struct {
+        uint64_t frame_ns;      // time_now_ns() of the previous frame
+        uint32_t head;
+        uint32_t tail;
+        input_event_t events[INPUT_QUEUE_SIZE];
+    } input;
+    #endif
 
+    // the game instance driven by the frame- and event-callbacks
+    game_ctx_t ctx;
+
+    #if !PACMAN_HEADLESS || PACMAN_BENCH
     // the audio subsystem is essentially a Namco arcade board sound emulator
     struct {
         voice_t voice[NUM_VOICES];
         sound_t sound[NUM_SOUNDS];
+        bool muted;
         int32_t voice_tick_accum;
         int32_t voice_tick_period;
         int32_t sample_duration_ns;
+        #if PACMAN_AUDIO_STREAM
+        // single-producer/single-consumer queue from snd_tick() to the audio thread
+        struct {
+            volatile uint32_t head;     // only written by snd_tick()
+            volatile uint32_t tail;     // only written by the audio thread
+            snd_regs_t regs[SND_QUEUE_SIZE];
+        } queue;
+        // the audio thread's state, the voice counters advance in here
+        struct {
+            volatile uint32_t ready;    // set by snd_init() once the fields below are valid
+            voice_t voice[NUM_VOICES];
+            snd_pcm_play_t play[NUM_SOUNDS];
+            int32_t tick_accum;         // helper variable to apply queued registers at the tick rate
+            uint32_t tick_samples;      // remaining samples until the next queued registers are applied
+        } stream;
+        #else
+        snd_pcm_play_t play[NUM_SOUNDS];
         int32_t sample_accum;
         uint32_t num_samples;
         float sample_buffer[NUM_SAMPLES];
+        #endif
+        #if PACMAN_SOUND_CACHE
+        // the pre-rendered sound effects
+        struct {
+            uint32_t num_pcm;
+            snd_pcm_t pcm[NUM_CACHED_SOUNDS];
+            uint32_t num_samples;
+            int16_t* samples;   // sized for the device sample rate in snd_cache_init()
+        } cache;
+        #endif
     } audio;
 
     // the gfx subsystem implements a simple tile+sprite renderer
     struct {
-        // fade-in/out timers and current value
-        trigger_t fadein;
-        trigger_t fadeout;
-        uint8_t fade;
-
-        // the 36x28 tile framebuffer
-        uint8_t video_ram[DISPLAY_TILES_Y][DISPLAY_TILES_X]; // tile codes
-        uint8_t color_ram[DISPLAY_TILES_Y][DISPLAY_TILES_X]; // color codes
-
-        // up to 8 sprites
-        sprite_t sprite[NUM_SPRITES];
-
-        // up to 16 debug markers
-        debugmarker_t debug_marker[NUM_DEBUG_MARKERS];
-
+        #if !PACMAN_HEADLESS
         // sokol-gfx resources
         sg_pass_action pass_action;
         struct {
             sg_buffer vbuf;
+            sg_buffer playfield_vbuf[PLAYFIELD_BANDS];
             sg_image tile_img;
             sg_image palette_img;
             sg_image render_target;
@@ -540,25 +1127,225 @@ static struct {
             sg_pipeline pip;
             sg_sampler sampler;
         } display;
+        // the direct mode renders tiles and sprites straight into the
+        // default pass when the upscale factor is an integer
+        struct {
+            bool forced;            // -direct: always, with the largest integer scale which fits
+            sg_pipeline pip;        // the offscreen pipelines with the default pass pixel formats
+            sg_pipeline tilemap_pip;
+        } direct;
+        // the picture of the last rendered frame, frames where it hasn't
+        // changed aren't rendered again (see gfx_frame_changed())
+        struct {
+            bool valid;         // false forces the next frame to be rendered
+            bool direct;        // the last frame was rendered in the direct mode
+            #if PACMAN_PROFILER
+            bool prof_hud;      // the last frame showed the profiler HUD
+            #endif
+            uint8_t fade[MAX_WALL_GAMES];
+            sprite_t sprite[MAX_WALL_GAMES][NUM_SPRITES];
+            debugmarker_t debug_marker[MAX_WALL_GAMES][NUM_DEBUG_MARKERS];
+        } drawn;
+        // alternative playfield renderer which looks up tiles in the fragment shader
+        struct {
+            bool enabled;
+            sg_image video_img;     // video_ram as 28x36 R8 texture
+            sg_image color_img;     // color_ram as 28x36 R8 texture
+            sg_pipeline pip;
+        } tilemap;
+        #endif
 
-        // intermediate vertex buffer for tile- and sprite-rendering
-        int num_vertices;
-        vertex_t vertices[MAX_VERTICES];
+        // persistent playfield quads, only the quads of changed tiles are
+        // rebuilt, and only bands with changed tiles are uploaded
+        instance_t playfield_quads[PLAYFIELD_QUADS];
 
-        // scratch-buffer for tile-decoding (only happens once)
-        uint8_t tile_pixels[TILE_TEXTURE_HEIGHT][TILE_TEXTURE_WIDTH];
+        // intermediate instance buffer for sprite-, debug-marker and fade-rendering
+        int num_quads;
+        instance_t quads[MAX_QUADS];
 
-        // scratch buffer for the color palette
-        uint32_t color_palette[256];
+        // the render target cell of the quads (see QUADFLAG_CELL), this is
+        // the game's cell in the cabinet wall mode, otherwise always 0
+        uint8_t cell;
     } gfx;
+    #endif
+
+    #if !PACMAN_HEADLESS
+    // the cabinet wall mode, more games in the same window which are all
+    // rendered into cells of one render target (see CABINET WALL)
+    struct {
+        int num_games;      // number of games including state.ctx, 0 if the wall mode is off
+        int cols;           // cells of the render target
+        int rows;
+        int num_quads;      // number of quads in the instance buffer
+        uint32_t rng[MAX_WALL_GAMES];       // random-walk input state of the attract-mode games
+        uint8_t key[MAX_WALL_GAMES];        // the key currently held down in the attract-mode games
+        game_ctx_t* ctx;    // the attract-mode games besides state.ctx (allocated in wall_init())
+        // playfield quads of all games (rebuilt per changed tile), followed
+        // by the sprite quads of all games, uploaded into one buffer per
+        // frame (wall_max_quads() items, allocated in wall_init())
+        instance_t* quads;
+    } wall;
+    #endif
+
+    #if PACMAN_REPLAY
+    // input recording and replay playback (see INPUT RECORDING AND REPLAY)
+    struct {
+        bool active;                // true if recording or playback was started from the command line
+        bool recording;
+        bool playing;
+        const char* record_path;
+        const char* replay_path;
+        uint32_t seek_tick;
+        uint16_t live_keys;         // keys currently held down on the keyboard
+
+        // recording
+        FILE* file;
+        uint16_t run_keys;          // keys of the current input run
+        uint32_t run_ticks;         // length of the current input run in ticks
+
+        // playback
+        uint32_t seed;
+        uint32_t num_ticks;
+        bool has_end;               // false if the replay file was truncated
+        uint64_t end_hash;          // the recorded game_hash() after the last tick
+        uint32_t cur_run;
+        uint32_t num_runs;
+        replay_run_t* runs;
+        uint32_t num_snapshots;
+        replay_snapshot_t* snapshots;
+    } replay;
+    #endif
+
+    #if PACMAN_NETPLAY
+    // the rollback netcode state for the networked two-player mode
+    struct {
+        bool active;                // true if netplay was requested on the command line
+        bool host;                  // true if this side hosts the game (controls player 1)
+        bool connected;             // true once a packet from the other side was received
+        const char* address;        // the host address when joining a game
+        uint16_t port;
+        net_socket_t sock;
+        struct sockaddr_in peer;
+
+        uint16_t local_keys;        // canonical keys currently held down on the local keyboard
+        uint32_t tick;              // the next tick to simulate
+        uint32_t remote_tick;       // remote input is known for all ticks before this one
+        uint32_t acked_tick;        // the other side has received the local input for all ticks before this one
+        uint32_t remote_cur_tick;   // the other side's current tick (as last reported)
+        int32_t remote_advantage;   // the other side's tick advantage (as last reported)
+        uint32_t rollback_tick;     // earliest mispredicted tick, or DISABLED_TICKS
+        uint32_t sync_cooldown;     // ticks until the next tick may be skipped for time sync
+        uint32_t remote_hash_tick;  // the tick of the last state hash received from the other side, or DISABLED_TICKS
+        uint64_t remote_hash;       // the other side's state hash after that tick
+        bool desync;                // true once the game states of both sides have diverged
+        bool pack_mismatch;         // true once a packet from a side with another level pack was received
+
+        uint16_t local_input[NET_INPUT_RING_SIZE];
+        uint16_t remote_input[NET_INPUT_RING_SIZE];     // received or predicted remote input
+        uint64_t hash[NET_INPUT_RING_SIZE];             // state hash after a tick (see game_hash())
+        game_snapshot_t* snapshot;      // NET_NUM_SNAPSHOTS simulation states before a tick, allocated in net_init()
+    } net;
+    #endif
+
+    #if PACMAN_SPECTATE
+    // the spectator stream, either broadcast to viewers, or received in viewer mode
+    struct {
+        bool broadcasting;          // true if spectators were requested with -broadcast
+        bool viewing;               // true in viewer mode (-spectate), the local game doesn't run
+        const char* address;        // the broadcaster's address in viewer mode
+        uint16_t port;
+        net_socket_t sock;
+
+        // broadcaster side
+        spec_stream_t* stream;      // allocated in spec_init() when broadcasting
+        bool keyframe;              // a viewer requested a keyframe
+        int num_viewers;
+        struct {
+            struct sockaddr_in addr;
+            uint32_t last_seen;     // stream tick of the viewer's last subscribe packet
+        } viewers[SPEC_MAX_VIEWERS];
+
+        // viewer side
+        struct sockaddr_in peer;
+        uint32_t hello_ticks;       // ticks until the next subscribe packet
+        bool synced;                // true while the received records are applied without gaps
+        uint32_t next_seq;          // stream tick of the next record to apply
+        uint32_t head, tail;        // ring buffer of received packets in recv
+        uint32_t num_records;       // records left in recv->cur_packet
+        spec_bits_t bits;
+        spec_recv_t* recv;          // allocated in spec_init() in viewer mode
+    } spec;
+    #endif
+
+    #if PACMAN_TELEMETRY
+    // the gameplay telemetry log (see TELEMETRY LOG)
+    struct {
+        bool active;                // true while the writer thread runs
+        const char* path;           // the log file given with -telemetry
+        FILE* file;
+        #if PACMAN_NETPLAY
+        const char* address;        // the receiver given with -telemetry-udp
+        uint16_t port;
+        net_socket_t sock;
+        struct sockaddr_in peer;
+        #endif
+        telem_thread_t thread;
+        volatile uint32_t stop;         // set by the game thread to end the writer thread
+        volatile uint32_t num_rings;    // published by the game thread after a ring was added
+        telem_ring_t* rings[TELEM_MAX_GAMES];
+        uint64_t num_written;       // records written by the writer thread
+        uint64_t num_dropped;       // records dropped by the game threads because a ring was full
+    } telem;
+    #endif
+
+    #if PACMAN_AUTOPLAY
+    // the autoplay bot (see AUTOPLAY BOT)
+    struct {
+        bool active;
+        int key_set;                // 1: arrow keys (input1), 2: WASD (input2)
+        int num_threads;            // search workers, including the calling thread
+        uint32_t max_iterations;    // rollouts per worker and move, 0 for no limit
+        uint64_t budget_ns;         // search time per move, 0 for no limit
+        uint64_t deadline_ns;       // end of the current search
+        const game_ctx_t* root;     // the game searched from, read-only during a search
+        uint16_t keys;              // keys currently held by the bot, bit mask of (1<<inputkey_t)
+        uint32_t move_tick;         // game tick of the last move
+        #if !PACMAN_HEADLESS
+        uint64_t search_frame;      // frame count of the last search
+        #endif
+        bot_worker_t* workers;      // num_threads workers on the heap
+        uint64_t num_moves;
+        uint64_t num_iterations;
+        uint64_t search_ns;
+    } bot;
+    #endif
 } state;
+#endif // !PACMAN_ATLASGEN
+
+// frame profiler instrumentation, this is only a branch while the profiler is off
+#if PACMAN_PROFILER
+static void prof_begin(profscope_t scope);
+static void prof_end(profscope_t scope);
+#define PROF_BEGIN(scope) do { if (state.prof.enabled) { prof_begin(scope); } } while (0)
+#define PROF_END(scope) do { if (state.prof.enabled) { prof_end(scope); } } while (0)
+#else
+#define PROF_BEGIN(scope) ((void)0)
+#define PROF_END(scope) ((void)0)
+#endif
+#if PACMAN_TELEMETRY
+static void telem_push(game_ctx_t* ctx, telemevent_t type, int actor, int2_t pos, uint32_t arg);
+#define TELEM(ctx, type, actor, pos, arg) do { if ((ctx)->telem) { telem_push((ctx), (type), (actor), (pos), (arg)); } } while (0)
+#else
+#define TELEM(ctx, type, actor, pos, arg) ((void)0)
+#endif
 
-// scatter target positions (in tile coords)
+#if !PACMAN_ATLASGEN
+// scatter target positions of the built-in maze (in tile coords)
 static const int2_t ghost_scatter_targets[NUM_GHOSTS] = {
     { 25, 0 }, { 2, 0 }, { 27, 34 }, { 0, 34 }
 };
 
-// starting positions for ghosts (pixel coords)
+// starting positions for ghosts in the built-in maze (pixel coords)
 static const int2_t ghost_starting_pos[NUM_GHOSTS] = {
     { 14*8, 14*8 + 4 },
     { 14*8, 17*8 + 4 },
@@ -566,7 +1353,10 @@ static const int2_t ghost_starting_pos[NUM_GHOSTS] = {
     { 16*8, 17*8 + 4 },
 };
 
-// target positions for ghost entering the ghost house (pixel coords)
+// target position for ghost eyes heading back to the ghost house door in the built-in maze (tile coords)
+static const int2_t ghost_eyes_target_pos = { 13, 14 };
+
+// target positions for ghost entering the ghost house in the built-in maze (pixel coords)
 static const int2_t ghost_house_target_pos[NUM_GHOSTS] = {
     { 14*8, 17*8 + 4 },
     { 14*8, 17*8 + 4 },
@@ -600,46 +1390,54 @@ static const uint8_t fruit_score_tiles[NUM_FRUITS][4] = {
     { 0x8B, 0x8C, 0x8D, 0x8E }, // FRUIT_KEY: 5000
 };
 
-// level specifications (see pacman_dossier.pdf)
-typedef struct {
-    fruit_t bonus_fruit;
-    uint16_t bonus_score;
-    uint16_t fright_ticks;
-    // FIXME: the various Pacman and ghost speeds
-} levelspec_t;
-
+// the levels of the built-in level pack
 enum {
     MAX_LEVELSPEC = 21,
 };
 static const levelspec_t levelspec_table[MAX_LEVELSPEC] = {
-    { FRUIT_CHERRIES,   10,  6*60, },
-    { FRUIT_STRAWBERRY, 30,  5*60, },
-    { FRUIT_PEACH,      50,  4*60, },
-    { FRUIT_PEACH,      50,  3*60, },
-    { FRUIT_APPLE,      70,  2*60, },
-    { FRUIT_APPLE,      70,  5*60, },
-    { FRUIT_GRAPES,     100, 2*60, },
-    { FRUIT_GRAPES,     100, 2*60, },
-    { FRUIT_GALAXIAN,   200, 1*60, },
-    { FRUIT_GALAXIAN,   200, 5*60, },
-    { FRUIT_BELL,       300, 2*60, },
-    { FRUIT_BELL,       300, 1*60, },
-    { FRUIT_KEY,        500, 1*60, },
-    { FRUIT_KEY,        500, 3*60, },
-    { FRUIT_KEY,        500, 1*60, },
-    { FRUIT_KEY,        500, 1*60, },
-    { FRUIT_KEY,        500, 1,    },
-    { FRUIT_KEY,        500, 1*60, },
-    { FRUIT_KEY,        500, 1,    },
-    { FRUIT_KEY,        500, 1,    },
-    { FRUIT_KEY,        500, 1,    },
+    { FRUIT_CHERRIES,   10,  6*60,  0 },
+    { FRUIT_STRAWBERRY, 30,  5*60,  0 },
+    { FRUIT_PEACH,      50,  4*60,  0 },
+    { FRUIT_PEACH,      50,  3*60,  0 },
+    { FRUIT_APPLE,      70,  2*60,  0 },
+    { FRUIT_APPLE,      70,  5*60,  0 },
+    { FRUIT_GRAPES,     100, 2*60,  0 },
+    { FRUIT_GRAPES,     100, 2*60,  0 },
+    { FRUIT_GALAXIAN,   200, 1*60,  0 },
+    { FRUIT_GALAXIAN,   200, 5*60,  0 },
+    { FRUIT_BELL,       300, 2*60,  0 },
+    { FRUIT_BELL,       300, 1*60,  0 },
+    { FRUIT_KEY,        500, 1*60,  0 },
+    { FRUIT_KEY,        500, 3*60,  0 },
+    { FRUIT_KEY,        500, 1*60,  0 },
+    { FRUIT_KEY,        500, 1*60,  0 },
+    { FRUIT_KEY,        500, 1,     0 },
+    { FRUIT_KEY,        500, 1*60,  0 },
+    { FRUIT_KEY,        500, 1,     0 },
+    { FRUIT_KEY,        500, 1,     0 },
+    { FRUIT_KEY,        500, 1,     0 },
     // from here on repeating
 };
 
+// the level pack used by all game instances, either the built-in pack,
+// or a level pack file mapped into memory (see LEVEL PACKS)
+static struct {
+    const maze_t* mazes;
+    const levelspec_t* levels;
+    uint16_t num_mazes;
+    uint16_t num_levels;
+    uint64_t hash;      // hash over the records, replays and netplay games need the same level pack
+    bool fetching;      // true while the WASM version fetches a level pack file
+} levelpack;
+#endif // !PACMAN_ATLASGEN
+
+#if !PACMAN_HEADLESS || PACMAN_BENCH
 // forward-declared sound-effect register dumps (recorded from Pacman arcade emulator)
 static const uint32_t snd_dump_prelude[490];
 static const uint32_t snd_dump_dead[90];
+#endif
 
+#if !PACMAN_HEADLESS
 // procedural sound effect callbacks
 static void snd_func_eatdot1(int slot);
 static void snd_func_eatdot2(int slot);
@@ -691,209 +1489,803 @@ static const sound_desc_t snd_frightened = {
     .voice = { false, true, false }
 };
 
+#if PACMAN_SOUND_CACHE
+// the sound effects which are pre-rendered to PCM, snd_weeooh and
+// snd_frightened loop until stopped and always use the voice emulation
+static const sound_desc_t* snd_cached[NUM_CACHED_SOUNDS] = {
+    &snd_prelude, &snd_dead, &snd_eatdot1, &snd_eatdot2, &snd_eatghost, &snd_eatfruit
+};
+#endif
+
+#endif // !PACMAN_HEADLESS
+
 // forward declarations
+#if !PACMAN_HEADLESS
 static void init(void);
 static void frame(void);
 static void cleanup(void);
 static void input(const sapp_event*);
 static void input2(const sapp_event*);
+static void timing_parse_args(int argc, char* argv[]);
+static void levelpack_parse_args(int argc, char* argv[]);
+static void timing_cycle_scale(void);
+static void input_queue_push(inputkey_t key, bool btn_down);
+static void input_queue_tick(uint64_t until_ns);
+static void input_forward_key(inputkey_t key, bool btn_down);
+#endif
+#if PACMAN_PROFILER
+static void prof_parse_args(int argc, char* argv[]);
+static void prof_toggle(void);
+static void prof_frame_end(void);
+static void prof_shutdown(void);
+#endif
 
+#if !PACMAN_ATLASGEN
+static void start(game_ctx_t* ctx, trigger_t* t);
+static void disable(trigger_t* t);
+static bool now(game_ctx_t* ctx, trigger_t t);
+
+static bool levelpack_init(const char* path);
+static uint64_t time_now_ns(void);
+
+static int2_t i2(int16_t x, int16_t y);
+static void sim_init(game_ctx_t* ctx);
+static void sim_tick(game_ctx_t* ctx);
+static void game_use_nav(game_ctx_t* ctx, mazenav_t nav_index);
+static void intro_tick(game_ctx_t* ctx);
+static void game_tick(game_ctx_t* ctx);
+
+static void vid_fade(game_ctx_t* ctx);
+static uint64_t vid_full_hash(const game_ctx_t* ctx);
+static void vid_dirty_all(game_ctx_t* ctx);
+
+static void input_enable(game_ctx_t* ctx);
+static void input_disable(game_ctx_t* ctx);
+static void input_key(game_ctx_t* ctx, inputkey_t key, bool btn_down);
+#if PACMAN_HEADLESS || PACMAN_NETPLAY || PACMAN_REPLAY
+static void input_keys(game_ctx_t* ctx, uint16_t keys);
+#endif
+#endif // !PACMAN_ATLASGEN
 
-static void start(trigger_t* t);
-static bool now(trigger_t t);
-
-static void intro_tick(void);
-static void game_tick(void);
-
-static void input_enable(void);
-static void input_disable(void);
-
+#if !PACMAN_HEADLESS
+static void gfx_parse_args(int argc, char* argv[]);
 static void gfx_init(void);
+static void gfx_toggle_tilemap(game_ctx_t* ctx);
 static void gfx_shutdown(void);
-static void gfx_fade(void);
-static void gfx_draw(void);
+static void gfx_draw(game_ctx_t* ctx);
+
+static void wall_parse_args(int argc, char* argv[]);
+static void wall_init(void);
+static void wall_shutdown(void);
+static void wall_tick(void);
+static int wall_max_quads(void);
+
+static void mem_report(void);
 
 static void snd_init(void);
 static void snd_shutdown(void);
 static void snd_tick(void); // called per game tick
+#if !PACMAN_AUDIO_STREAM
 static void snd_frame(int32_t frame_time_ns);   // called per frame
+#endif
 static void snd_clear(void);
 static void snd_start(int sound_slot, const sound_desc_t* snd);
 static void snd_stop(int sound_slot);
+static void snd_mute(bool muted);
+#endif
+
+#if PACMAN_REPLAY && !PACMAN_HEADLESS
+static void replay_parse_args(int argc, char* argv[]);
+static void replay_init(game_ctx_t* ctx);
+static void replay_shutdown(game_ctx_t* ctx);
+static void replay_key(inputkey_t key, bool btn_down);
+static void replay_tick(game_ctx_t* ctx);
+#endif
+
+#if PACMAN_NETPLAY
+static void net_parse_args(int argc, char* argv[]);
+static void net_init(void);
+static void net_shutdown(void);
+static void net_key(inputkey_t key, bool btn_down);
+static void net_poll(void);
+static void net_tick(void);
+static void net_send(void);
+static bool net_socket_open(net_socket_t* sock, uint16_t bind_port, const char* address, uint16_t port, struct sockaddr_in* out_peer);
+static void net_socket_close(net_socket_t* sock);
+#endif
+
+#if PACMAN_TELEMETRY
+#if !PACMAN_HEADLESS
+static void telem_parse_args(int argc, char* argv[]);
+#endif
+#if !PACMAN_BENCH
+static bool telem_init(void);
+static void telem_attach(game_ctx_t* ctx, int game);
+static void telem_shutdown(void);
+#endif
+#endif
+
+#if PACMAN_AUTOPLAY
+#if !PACMAN_HEADLESS
+static void bot_parse_args(int argc, char* argv[]);
+static void bot_tick(game_ctx_t* ctx);
+#endif
+static bool bot_init(void);
+static void bot_shutdown(void);
+static uint16_t bot_keys(game_ctx_t* ctx, bool may_search);
+#endif
+
+#if PACMAN_SPECTATE
+static void spec_parse_args(int argc, char* argv[]);
+static void spec_init(void);
+static void spec_shutdown(void);
+static void spec_poll(void);
+static void spec_tick(game_ctx_t* ctx);
+static void spec_view_tick(game_ctx_t* ctx);
+#endif
+#if PACMAN_SPECTATE || (PACMAN_HEADLESS && !PACMAN_ATLASGEN && !PACMAN_BENCH)
+static int spec_stream_tick(spec_stream_t* stream, const game_ctx_t* ctx, bool keyframe);
+static int spec_stream_flush(spec_stream_t* stream);
+static bool spec_packet_header(const uint8_t* data, int size, uint32_t* out_seq, uint32_t* out_num_records, bool* out_keyframe);
+static bool spec_decode(spec_frame_t* ref, spec_bits_t* bits, game_ctx_t* ctx);
+static void spec_bits_init(spec_bits_t* bits, uint8_t* data, uint32_t num_bytes);
+#endif
+#if PACMAN_HEADLESS && !PACMAN_ATLASGEN && !PACMAN_BENCH
+static bool spec_frame_equal(const spec_frame_t* frame, const game_ctx_t* ctx);
+#endif
+
+#if PACMAN_ATLASGEN || (!PACMAN_HEADLESS && !PACMAN_ATLAS)
+static void gfx_decode_tiles(uint8_t pixels[TILE_TEXTURE_HEIGHT][TILE_TEXTURE_WIDTH]);
+static void gfx_decode_color_palette(uint32_t palette[256]);
 
 // forward-declared ROM dumps
 static const uint8_t rom_tiles[4096];
 static const uint8_t rom_sprites[4096];
 static const uint8_t rom_hwcolors[32];
 static const uint8_t rom_palette[256];
+#endif
+#if !PACMAN_HEADLESS || PACMAN_BENCH
 static const uint8_t rom_wavetable[256];
+#endif
 
 /*== APPLICATION ENTRY AND CALLBACKS =========================================*/
+#if !PACMAN_HEADLESS
+// the selectable number of game ticks per real-time tick, 0 is uncapped
+static const uint32_t timing_scales[NUM_TIME_SCALES] = { 1, 2, 8, 64, 0 };
+
 sapp_desc sokol_main(int argc, char* argv[]) {
-    (void)argc; (void)argv;
+    timing_parse_args(argc, argv);
+    levelpack_parse_args(argc, argv);
+    gfx_parse_args(argc, argv);
+    wall_parse_args(argc, argv);
+    #if PACMAN_PROFILER
+        prof_parse_args(argc, argv);
+    #endif
+    #if PACMAN_REPLAY
+        replay_parse_args(argc, argv);
+    #endif
+    #if PACMAN_NETPLAY
+        net_parse_args(argc, argv);
+    #endif
+    #if PACMAN_SPECTATE
+        spec_parse_args(argc, argv);
+    #endif
+    #if PACMAN_TELEMETRY
+        telem_parse_args(argc, argv);
+    #endif
+    #if PACMAN_AUTOPLAY
+        bot_parse_args(argc, argv);
+    #endif
     return (sapp_desc) {
         .init_cb = init,
         .frame_cb = frame,
         .cleanup_cb = cleanup,
         .event_cb = input,
-        .width = DISPLAY_TILES_X * TILE_WIDTH * 2,
-        .height = DISPLAY_TILES_Y * TILE_HEIGHT * 2,
+        // the cabinet wall starts with 1x cells
+        .width = DISPLAY_TILES_X * TILE_WIDTH * ((state.wall.num_games > 0) ? state.wall.cols : 2),
+        .height = DISPLAY_TILES_Y * TILE_HEIGHT * ((state.wall.num_games > 0) ? state.wall.rows : 2),
         .window_title = "Team-3_Pacman.c",
         .logger.func = slog_func,
     };
 }
 
 static void init(void) {
+    if (!levelpack_init(state.levels.path)) {
+        slog_func("pacman", 2, 0, "levels: failed to load level pack, using the built-in levels", __LINE__, __FILE__, 0);
+    }
     gfx_init();
     snd_init();
-
-    // start into intro screen
-    #if DBG_SKIP_INTRO
-        start(&state.game.started);
-    #else
-        start(&state.intro.started);
+    sim_init(&state.ctx);
+    state.ctx.audible = true;
+    wall_init();
+    #if PACMAN_NETPLAY
+        net_init();
     #endif
-}
-
-static void frame(void) {
-
-    // run the game at a fixed tick rate regardless of frame rate
+    #if PACMAN_SPECTATE
+        spec_init();
+    #endif
+    #if PACMAN_REPLAY
+        // recording and replays only work in local games
+        bool local_game = true;
+        #if PACMAN_NETPLAY
+            local_game = !state.net.active;
+        #endif
+        #if PACMAN_SPECTATE
+            local_game &= !state.spec.viewing;
+        #endif
+        if (local_game) {
+            replay_init(&state.ctx);
+        }
+    #endif
+    #if PACMAN_TELEMETRY
+        if (!telem_init()) {
+            slog_func("pacman", 2, 0, "telemetry: failed to open the telemetry log", __LINE__, __FILE__, 0);
+        }
+        // each game of the cabinet wall has its own ring buffer
+        telem_attach(&state.ctx, 0);
+        for (int i = 1; i < state.wall.num_games; i++) {
+            telem_attach(&state.wall.ctx[i - 1], i);
+        }
+    #endif
+    #if PACMAN_AUTOPLAY
+        // the bot plays the local game, it can't steer a networked or spectated game
+        #if PACMAN_NETPLAY
+        if (state.bot.active && state.net.active) {
+            slog_func("pacman", 2, 0, "autoplay: not available in networked games", __LINE__, __FILE__, 0);
+            state.bot.active = false;
+        }
+        #endif
+        #if PACMAN_SPECTATE
+        if (state.bot.active && state.spec.viewing) {
+            slog_func("pacman", 2, 0, "autoplay: not available when spectating", __LINE__, __FILE__, 0);
+            state.bot.active = false;
+        }
+        #endif
+        if (!bot_init()) {
+            slog_func("pacman", 2, 0, "autoplay: failed to allocate the search workers", __LINE__, __FILE__, 0);
+        }
+    #endif
+    mem_report();
+}
+
+// advance the game driven by the app callbacks by one tick, after
+// applying the key events which were received until until_ns
+static void frame_tick(uint64_t until_ns) {
+    input_queue_tick(until_ns);
+
+    #if defined(__EMSCRIPTEN__)
+    if (levelpack.fetching) {
+        // hold the games until the level pack has arrived
+        return;
+    }
+    #endif
+
+    // the autoplay bot presses its keys before the tick like a player
+    #if PACMAN_AUTOPLAY
+        bot_tick(&state.ctx);
+    #endif
+
+    // call per-tick sound function (updates sound 'registers' with current sound effect values)
+    PROF_BEGIN(PROF_SND_TICK);
+    snd_tick();
+    PROF_END(PROF_SND_TICK);
+
+    // the attract-mode games of the cabinet wall run along with any kind of game
+    wall_tick();
+
+    #if PACMAN_SPECTATE
+    if (state.spec.viewing) {
+        // the viewer only plays back the received video state
+        spec_view_tick(&state.ctx);
+        return;
+    }
+    #endif
+
+    // advance the simulation by one tick
+    #if PACMAN_NETPLAY
+    if (state.net.active) {
+        net_tick();
+    }
+    else
+    #endif
+    {
+        #if PACMAN_REPLAY
+            replay_tick(&state.ctx);
+        #endif
+        sim_tick(&state.ctx);
+    }
+    #if PACMAN_SPECTATE
+        spec_tick(&state.ctx);
+    #endif
+}
+
+static void frame(void) {
+    PROF_BEGIN(PROF_FRAME);
+
+    // run the game at a fixed tick rate regardless of frame rate
     uint32_t frame_time_ns = (uint32_t) (sapp_frame_duration() * 1000000000.0);
     // clamp max frame time (so the timing isn't messed up when stopping in the debugger)
     if (frame_time_ns > 33333333) {
         frame_time_ns = 33333333;
     }
-    state.timing.tick_accum += frame_time_ns;
-    while (state.timing.tick_accum > -TICK_TOLERANCE_NS) {
-        state.timing.tick_accum -= TICK_DURATION_NS;
-        state.timing.tick++;
-
-        // call per-tick sound function (updates sound 'registers' with current sound effect values)
-        snd_tick();
-
-        // check for game state change
-        if (now(state.intro.started)) {
-            state.gamestate = GAMESTATE_INTRO;
+    #if PACMAN_NETPLAY
+        // receive remote netplay input (and roll back on misprediction)
+        net_poll();
+    #endif
+    #if PACMAN_SPECTATE
+        // receive spectator subscriptions, or the stream in viewer mode
+        spec_poll();
+    #endif
+    // the time scale only changes how many ticks run per frame, the ticks
+    // themselves are the same, so a fast-forwarded game stays deterministic
+    uint32_t time_scale = timing_scales[state.timing.time_scale];
+    #if PACMAN_NETPLAY
+    if (state.net.active) {
+        // the remote side runs in real time
+        time_scale = 1;
+    }
+    #endif
+    #if PACMAN_SPECTATE
+    if (state.spec.viewing) {
+        // the stream is played back in real time
+        time_scale = 1;
+    }
+    #endif
+    snd_mute(time_scale != 1);
+    const uint64_t now_ns = time_now_ns();
+    if (time_scale == 0) {
+        // uncapped: run ticks until the frame's time budget is used up
+        do {
+            for (int i = 0; i < 16; i++) {
+                frame_tick(now_ns);
+            }
+        } while ((time_now_ns() - now_ns) < UNCAPPED_BUDGET_NS);
+        state.timing.tick_accum = 0;
+    }
+    else {
+        state.timing.tick_accum += (int64_t)frame_time_ns * time_scale;
+        uint32_t num_ticks = 0;
+        while (state.timing.tick_accum > -TICK_TOLERANCE_NS) {
+            state.timing.tick_accum -= TICK_DURATION_NS;
+            num_ticks++;
         }
-        if (now(state.game.started)) {
-            state.gamestate = GAMESTATE_GAME;
+        /* the ticks of this frame stand for the time since the previous
+           frame, each tick gets the key events of its share of that time,
+           and all events received until now are applied before the final
+           tick so that the rendered frame reflects the latest input
+        */
+        const uint64_t start_ns = state.input.frame_ns ? state.input.frame_ns : now_ns;
+        for (uint32_t i = 0; i < num_ticks; i++) {
+            const uint64_t until_ns = ((i + 1) == num_ticks) ? now_ns : start_ns + ((now_ns - start_ns) * (i + 1)) / num_ticks;
+            frame_tick(until_ns);
         }
+    }
+    state.input.frame_ns = now_ns;
+    #if PACMAN_NETPLAY
+        net_send();
+    #endif
+    gfx_draw(&state.ctx);
+    #if !PACMAN_AUDIO_STREAM
+        PROF_BEGIN(PROF_SND_FRAME);
+        snd_frame(frame_time_ns);
+        PROF_END(PROF_SND_FRAME);
+    #endif
+    PROF_END(PROF_FRAME);
+    #if PACMAN_PROFILER
+        prof_frame_end();
+    #endif
+}
 
-        // call the top-level game state update function
-        switch (state.gamestate) {
-            case GAMESTATE_INTRO:
-                intro_tick();
-                break;
-            case GAMESTATE_GAME:
-                game_tick();
-                break;
+static void input(const sapp_event* ev) {
+    if ((ev->type == SAPP_EVENTTYPE_KEY_DOWN) && (ev->key_code == SAPP_KEYCODE_F2) && !ev->key_repeat) {
+        // switch between the tile-quad and tilemap playfield renderer
+        gfx_toggle_tilemap(&state.ctx);
+        return;
+    }
+    if ((ev->type == SAPP_EVENTTYPE_KEY_DOWN) && (ev->key_code == SAPP_KEYCODE_F3) && !ev->key_repeat) {
+        // fast-forward with the next time scale
+        timing_cycle_scale();
+        return;
+    }
+    #if PACMAN_PROFILER
+    if ((ev->type == SAPP_EVENTTYPE_KEY_DOWN) && (ev->key_code == SAPP_KEYCODE_F4) && !ev->key_repeat) {
+        // switch the frame profiler and its HUD on or off
+        prof_toggle();
+        return;
+    }
+    #endif
+    if (((ev->type == SAPP_EVENTTYPE_KEY_DOWN) && !ev->key_repeat) || (ev->type == SAPP_EVENTTYPE_KEY_UP)) {
+        bool btn_down = ev->type == SAPP_EVENTTYPE_KEY_DOWN;
+        inputkey_t key;
+        switch (ev->key_code) {
+            case SAPP_KEYCODE_UP:       key = INPUTKEY_UP; break;
+            case SAPP_KEYCODE_DOWN:     key = INPUTKEY_DOWN; break;
+            case SAPP_KEYCODE_LEFT:     key = INPUTKEY_LEFT; break;
+            case SAPP_KEYCODE_RIGHT:    key = INPUTKEY_RIGHT; break;
+            case SAPP_KEYCODE_ESCAPE:   key = INPUTKEY_ESC; break;
+            case SAPP_KEYCODE_W:        key = INPUTKEY_W; break;
+            case SAPP_KEYCODE_S:        key = INPUTKEY_S; break;
+            case SAPP_KEYCODE_A:        key = INPUTKEY_A; break;
+            case SAPP_KEYCODE_D:        key = INPUTKEY_D; break;
+            case SAPP_KEYCODE_L:        key = INPUTKEY_L; break;
+            default:                    key = INPUTKEY_OTHER; break;
         }
+        input_queue_push(key, btn_down);
     }
-    gfx_draw();
-    snd_frame(frame_time_ns);
 }
 
-static void input(const sapp_event* ev) {
-    if (state.input1.enabled) {
-        if ((ev->type == SAPP_EVENTTYPE_KEY_DOWN) || (ev->type == SAPP_EVENTTYPE_KEY_UP)) {
-            bool btn_down = ev->type == SAPP_EVENTTYPE_KEY_DOWN;
-            switch (ev->key_code) {
-                case SAPP_KEYCODE_UP:
-                    state.input1.up = state.input1.anykey = btn_down;
-                    state.game.player2 = false;
-                    break;
-                case SAPP_KEYCODE_DOWN:
-                    state.input1.down = state.input1.anykey = btn_down;
-                    state.game.player2 = false;
-                    break;
-                case SAPP_KEYCODE_LEFT:
-                    state.input1.left = state.input1.anykey = btn_down;
-                    state.game.player2 = false;
-                    break;
-                case SAPP_KEYCODE_RIGHT:
-                    state.input1.right = state.input1.anykey = btn_down;
-                    state.game.player2 = false;
-                    break;
-                case SAPP_KEYCODE_ESCAPE:
-                    state.input1.esc = state.input1.anykey = btn_down;
-                    break;
+// queue a key event for the game tick it belongs to (see frame())
+static void input_queue_push(inputkey_t key, bool btn_down) {
+    if ((state.input.head - state.input.tail) == INPUT_QUEUE_SIZE) {
+        // the game isn't ticking (e.g. while minimized), a dropped key-up would
+        // leave the key stuck, so drop the new event if it's a key-down, and
+        // otherwise make room by dropping the newest queued key-down
+        if (btn_down) {
+            return;
+        }
+        uint32_t i = state.input.head;
+        while ((i != state.input.tail) && !state.input.events[(i - 1) & (INPUT_QUEUE_SIZE-1)].btn_down) {
+            i--;
+        }
+        if (i == state.input.tail) {
+            // only key-ups are queued
+            return;
+        }
+        for (; i != state.input.head; i++) {
+            state.input.events[(i - 1) & (INPUT_QUEUE_SIZE-1)] = state.input.events[i & (INPUT_QUEUE_SIZE-1)];
+        }
+        state.input.head--;
+    }
+    state.input.events[state.input.head++ & (INPUT_QUEUE_SIZE-1)] = (input_event_t) {
+        .time_ns = time_now_ns(),
+        .key = (uint8_t)key,
+        .btn_down = btn_down,
+    };
+}
 
+// pass a key change to the game driven by the app callbacks, or to the
+// netplay or replay input if active (keyboard and autoplay bot input)
+static void input_forward_key(inputkey_t key, bool btn_down) {
+    #if PACMAN_NETPLAY
+    if (state.net.active) {
+        net_key(key, btn_down);
+        return;
+    }
+    #endif
+    #if PACMAN_REPLAY
+    if (state.replay.active) {
+        replay_key(key, btn_down);
+        return;
+    }
+    #endif
+    input_key(&state.ctx, key, btn_down);
+}
 
-                case SAPP_KEYCODE_W:
-                    state.input2.up = state.input2.anykey = btn_down;
-                    state.game.player2 = true;
-                    break;
-                case SAPP_KEYCODE_S:
-                    state.input2.down = state.input2.anykey = btn_down;
-                    state.game.player2 = true;
+/* apply the queued key events which were received until until_ns before
+   the next game tick, a key changes at most once per tick, so that a key
+   pressed and released within the same tick is still seen by the game
+   (the release is deferred to the next tick)
+*/
+static void input_queue_tick(uint64_t until_ns) {
+    uint16_t changed = 0;
+    while (state.input.tail != state.input.head) {
+        const input_event_t* ev = &state.input.events[state.input.tail & (INPUT_QUEUE_SIZE-1)];
+        if ((ev->time_ns > until_ns) || (changed & (1<<ev->key))) {
+            break;
+        }
+        changed |= (uint16_t)(1<<ev->key);
+        state.input.tail++;
+        input_forward_key((inputkey_t)ev->key, ev->btn_down);
+    }
+}
 
-                    break;
-                case SAPP_KEYCODE_A:
-                    state.input2.left = state.input2.anykey = btn_down;
-                    state.game.player2 = true;
 
-                    break;
-                case SAPP_KEYCODE_D:
-                    state.input2.right = state.input2.anykey = btn_down;
-                    state.game.player2 = true;
 
-                    break;
 
 
-                case SAPP_KEYCODE_L:
-                    state.input1.l = btn_down;
-                    state.input1.l = btn_down;
-                    break;
 
 
+static void cleanup(void) {
+    #if PACMAN_TELEMETRY
+        telem_shutdown();
+    #endif
+    #if PACMAN_PROFILER
+        prof_shutdown();
+    #endif
+    #if PACMAN_REPLAY
+        replay_shutdown(&state.ctx);
+    #endif
+    #if PACMAN_SPECTATE
+        spec_shutdown();
+    #endif
+    #if PACMAN_NETPLAY
+        net_shutdown();
+    #endif
+    #if PACMAN_AUTOPLAY
+        bot_shutdown();
+    #endif
+    snd_shutdown();
+    gfx_shutdown();
+    wall_shutdown();
+}
 
+/* log the memory used by each subsystem at startup, the size of its part
+   of the global state plus what it has allocated for this run, the
+   simulation state of a game (game_ctx_t) should stay small enough to fit
+   into a per-core cache when simulating many games in parallel
+*/
+static void mem_report(void) {
+    const struct {
+        const char* name;
+        size_t state_bytes;
+        size_t heap_bytes;
+    } items[] = {
+        { "game", sizeof(state.ctx), 0 },
+        { "snapshot", sizeof(game_snapshot_t), 0 },
+        { "timing", sizeof(state.timing), 0 },
+        { "input", sizeof(state.input), 0 },
+        { "gfx", sizeof(state.gfx), 0 },
+        #if PACMAN_SOUND_CACHE
+        { "audio", sizeof(state.audio), state.audio.cache.num_samples * sizeof(int16_t) },
+        #else
+        { "audio", sizeof(state.audio), 0 },
+        #endif
+        { "wall", sizeof(state.wall), (state.wall.num_games > 0) ? ((size_t)(state.wall.num_games - 1) * sizeof(game_ctx_t) + (size_t)wall_max_quads() * sizeof(instance_t)) : 0 },
+        #if PACMAN_PROFILER
+        { "profiler", sizeof(state.prof), state.prof.frames ? (PROF_NUM_FRAMES * (sizeof(state.prof.frames[0]) + sizeof(uint32_t))) : 0 },
+        #endif
+        #if PACMAN_REPLAY
+        { "replay", sizeof(state.replay), state.replay.num_runs * sizeof(replay_run_t) + state.replay.num_snapshots * sizeof(replay_snapshot_t) },
+        #endif
+        #if PACMAN_NETPLAY
+        { "netplay", sizeof(state.net), state.net.snapshot ? (NET_NUM_SNAPSHOTS * sizeof(game_snapshot_t)) : 0 },
+        #endif
+        #if PACMAN_SPECTATE
+        { "spectate", sizeof(state.spec), (state.spec.stream ? sizeof(spec_stream_t) : 0) + (state.spec.recv ? sizeof(spec_recv_t) : 0) },
+        #endif
+        #if PACMAN_TELEMETRY
+        { "telemetry", sizeof(state.telem), state.telem.num_rings * sizeof(telem_ring_t) },
+        #endif
+        #if PACMAN_AUTOPLAY
+        { "autoplay", sizeof(state.bot), state.bot.active ? ((size_t)state.bot.num_threads * sizeof(bot_worker_t)) : 0 },
+        #endif
+    };
+    char msg[128];
+    size_t heap_bytes = 0;
+    for (size_t i = 0; i < sizeof(items) / sizeof(items[0]); i++) {
+        snprintf(msg, sizeof(msg), "memory: %-10s %8u bytes state, %8u bytes heap", items[i].name, (unsigned)items[i].state_bytes, (unsigned)items[i].heap_bytes);
+        slog_func("pacman", 3, 0, msg, __LINE__, __FILE__, 0);
+        heap_bytes += items[i].heap_bytes;
+    }
+    snprintf(msg, sizeof(msg), "memory: %-10s %8u bytes state, %8u bytes heap", "total", (unsigned)sizeof(state), (unsigned)heap_bytes);
+    slog_func("pacman", 3, 0, msg, __LINE__, __FILE__, 0);
+}
 
-                default:
-                    state.input1.anykey = btn_down;
-                    state.input2.anykey = btn_down;
-                    break;
+// parse the time scale command line arg ("-timescale 8" or "-timescale max"), called from sokol_main()
+static void timing_parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < (argc - 1); i++) {
+        if (0 == strcmp(argv[i], "-timescale")) {
+            const char* arg = argv[++i];
+            const uint32_t scale = (0 == strcmp(arg, "max")) ? 0 : (uint32_t) strtoul(arg, 0, 10);
+            for (int s = 0; s < NUM_TIME_SCALES; s++) {
+                if (timing_scales[s] == scale) {
+                    state.timing.time_scale = s;
+                }
             }
         }
     }
 }
 
+// switch to the next time scale, wrapping around to real time
+static void timing_cycle_scale(void) {
+    state.timing.time_scale = (state.timing.time_scale + 1) % NUM_TIME_SCALES;
+    state.timing.tick_accum = 0;
+}
+#endif // !PACMAN_HEADLESS
+
+#if !PACMAN_ATLASGEN
+// initialize a game instance and start into the intro screen
+static void sim_init(game_ctx_t* ctx) {
+    memset(ctx, 0, sizeof(game_ctx_t));
+    ctx->vid.tile_hash = vid_full_hash(ctx);
+    vid_dirty_all(ctx);
+    ctx->game.seed = XORSHIFT_SEED;
+    ctx->game.num_players = 2;
+    ctx->game.active_player = 1;
+    disable(&ctx->vid.fadein);
+    disable(&ctx->vid.fadeout);
+    ctx->vid.fade = 0xFF;
+    #if DBG_SKIP_INTRO
+        start(ctx, &ctx->game.started);
+    #else
+        start(ctx, &ctx->intro.started);
+    #endif
+}
 
+// advance the simulation by one 60Hz tick (called from the frame callback or the headless runner)
+static void sim_tick(game_ctx_t* ctx) {
+    ctx->timing.tick++;
 
+    // check for game state change
+    if (now(ctx, ctx->intro.started)) {
+        ctx->gamestate = GAMESTATE_INTRO;
+    }
+    if (now(ctx, ctx->game.started)) {
+        ctx->gamestate = GAMESTATE_GAME;
+    }
 
+    // call the top-level game state update function
+    PROF_BEGIN(PROF_SIM_TICK);
+    switch (ctx->gamestate) {
+        case GAMESTATE_INTRO:
+            intro_tick(ctx);
+            break;
+        case GAMESTATE_GAME:
+            game_tick(ctx);
+            break;
+    }
+    PROF_END(PROF_SIM_TICK);
 
+    // handle fade in/out
+    vid_fade(ctx);
+}
 
-static void cleanup(void) {
-    snd_shutdown();
-    gfx_shutdown();
+#if PACMAN_HEADLESS || PACMAN_NETPLAY || PACMAN_REPLAY
+// store the simulation state of a game instance into a snapshot (used by the headless runner, netplay and replays)
+static void game_snapshot(const game_ctx_t* ctx, game_snapshot_t* snapshot) {
+    memcpy(snapshot->data, ctx, sizeof(snapshot->data));
+}
+
+// restore a game instance's simulation state from a snapshot, this leaves
+// debug markers and the audible flag alone, and points the game instance
+// back to the maze's navigation table which isn't part of the snapshot
+static void game_restore(game_ctx_t* ctx, const game_snapshot_t* snapshot) {
+    memcpy(ctx, snapshot->data, sizeof(snapshot->data));
+    game_use_nav(ctx, (mazenav_t) ctx->game.nav_index);
+    vid_dirty_all(ctx);
+    TELEM(ctx, TELEM_REWIND, 0, i2(0, 0), 0);
+}
+
+static uint64_t game_hash_u32(uint64_t hash, uint32_t val) {
+    return (((hash<<5) | (hash>>59)) ^ val) * 0x9E3779B97F4A7C15;
+}
+
+static uint64_t game_hash_actor(uint64_t hash, const actor_t* actor) {
+    hash = game_hash_u32(hash, (uint32_t)actor->dir);
+    hash = game_hash_u32(hash, ((uint32_t)(uint16_t)actor->pos.x<<16) | (uint16_t)actor->pos.y);
+    return game_hash_u32(hash, actor->anim_tick);
 }
 
+/* a cheap deterministic 64-bit hash of the simulation state to detect
+   desyncs in netplay and to verify replays, this covers the game state,
+   all triggers, the actors and (via the incrementally updated video_ram
+   hash) the dot layout, and costs only a small fraction of a tick, so
+   it can be computed after every tick
+
+   The hash is computed per field (not over the raw struct bytes), so it
+   doesn't depend on struct padding and is the same across compilers.
+*/
+static uint64_t game_hash(const game_ctx_t* ctx) {
+    uint64_t hash = ctx->vid.tile_hash;
+    hash = game_hash_u32(hash, (uint32_t)ctx->gamestate);
+    hash = game_hash_u32(hash, ctx->timing.tick);
+    hash = game_hash_u32(hash, ctx->intro.started.tick);
+    const trigger_t* triggers[] = {
+        &ctx->game.started, &ctx->game.ready_started, &ctx->game.round_started, &ctx->game.round_won,
+        &ctx->game.game_over, &ctx->game.dot_eaten, &ctx->game.pill_eaten, &ctx->game.ghost_eaten,
+        &ctx->game.pacman_eaten, &ctx->game.fruit_eaten, &ctx->game.force_leave_house, &ctx->game.fruit_active,
+        &ctx->vid.fadein, &ctx->vid.fadeout,
+    };
+    for (size_t i = 0; i < sizeof(triggers) / sizeof(triggers[0]); i++) {
+        hash = game_hash_u32(hash, triggers[i]->tick);
+    }
+    hash = game_hash_u32(hash, ctx->game.xorshift);
+    hash = game_hash_u32(hash, ctx->game.hiscore);
+    hash = game_hash_u32(hash, ctx->game.score);
+    hash = game_hash_u32(hash, ((uint32_t)ctx->game.freeze<<24) | ((uint32_t)ctx->game.round<<16) | ((uint32_t)(uint8_t)ctx->game.num_lives<<8) | ctx->game.num_ghosts_eaten);
+    hash = game_hash_u32(hash, ((uint32_t)ctx->game.num_dots_eaten<<24) | ((uint32_t)ctx->game.global_dot_counter_active<<16) | ((uint32_t)ctx->game.global_dot_counter<<8) | (ctx->game.active_player == 0));
+    hash = game_hash_u32(hash, ((uint32_t)ctx->game.active_fruit<<8) | ctx->vid.fade);
+    for (int i = 0; i < NUM_GHOSTS; i++) {
+        const ghost_t* ghost = &ctx->game.ghost[i];
+        hash = game_hash_actor(hash, &ghost->actor);
+        hash = game_hash_u32(hash, ((uint32_t)ghost->type<<16) | ((uint32_t)ghost->next_dir<<8) | (uint32_t)ghost->state);
+        hash = game_hash_u32(hash, ((uint32_t)(uint16_t)ghost->target_pos.x<<16) | (uint16_t)ghost->target_pos.y);
+        hash = game_hash_u32(hash, ghost->frightened.tick);
+        hash = game_hash_u32(hash, ghost->eaten.tick);
+        hash = game_hash_u32(hash, ((uint32_t)ghost->dot_counter<<16) | ghost->dot_limit);
+    }
+    // the extra players are only hashed in battle mode, so that the regular game's hashes stay comparable
+    const int num_players = ctx->game.battle ? ctx->game.num_players : 2;
+    for (int p = 0; p < num_players; p++) {
+        hash = game_hash_u32(hash, ctx->game.players.dir[p]);
+        hash = game_hash_u32(hash, ((uint32_t)(uint16_t)ctx->game.players.pos_x[p]<<16) | (uint16_t)ctx->game.players.pos_y[p]);
+        hash = game_hash_u32(hash, ctx->game.players.anim_tick[p]);
+    }
+    return hash;
+}
+#endif
+
+#endif // !PACMAN_ATLASGEN
+
 /*== GRAB BAG OF HELPER FUNCTIONS ============================================*/
+#if !PACMAN_ATLASGEN
+// monotonic time in nanoseconds (unaffected by wall-clock adjustments)
+static uint64_t time_now_ns(void) {
+    #if defined(_WIN32)
+        LARGE_INTEGER freq, count;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&count);
+        return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000 + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000 / (uint64_t)freq.QuadPart;
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    #endif
+}
+
+#if PACMAN_NETPLAY || PACMAN_REPLAY
+// read and write little-endian values in network packets and replay files
+static uint16_t get_u16(const uint8_t* ptr) {
+    return (uint16_t)(ptr[0] | (ptr[1]<<8));
+}
+
+static uint32_t get_u32(const uint8_t* ptr) {
+    return (uint32_t)ptr[0] | ((uint32_t)ptr[1]<<8) | ((uint32_t)ptr[2]<<16) | ((uint32_t)ptr[3]<<24);
+}
+
+static void put_u16(uint8_t* ptr, uint16_t val) {
+    ptr[0] = (uint8_t)val;
+    ptr[1] = (uint8_t)(val>>8);
+}
+
+static void put_u32(uint8_t* ptr, uint32_t val) {
+    ptr[0] = (uint8_t)val;
+    ptr[1] = (uint8_t)(val>>8);
+    ptr[2] = (uint8_t)(val>>16);
+    ptr[3] = (uint8_t)(val>>24);
+}
+#endif
 
 // xorshift random number generator
-static uint32_t xorshift32(void) {
-    uint32_t x = state.game.xorshift;
+static uint32_t xorshift32(game_ctx_t* ctx) {
+    uint32_t x = ctx->game.xorshift;
     x ^= x<<13;
     x ^= x>>17;
     x ^= x<<5;
-    return state.game.xorshift = x;
+    return ctx->game.xorshift = x;
 }
 // get level spec for a game round
 static levelspec_t levelspec(int round) {
-    assert(round >= 0);
-    if (round >= MAX_LEVELSPEC) {
-        round = MAX_LEVELSPEC-1;
+    assert((round >= 0) && (levelpack.num_levels > 0));
+    if (round >= levelpack.num_levels) {
+        round = levelpack.num_levels-1;
     }
-    return levelspec_table[round];
+    return levelpack.levels[round];
+}
+
+// get the maze of the current game round
+static const maze_t* game_maze(const game_ctx_t* ctx) {
+    return &levelpack.mazes[levelspec(ctx->game.round).maze];
+}
+
+// point the game instance to one of the current maze's navigation tables
+// and its ghost direction fields, only the index is part of the snapshot
+// (see game_restore())
+static void game_use_nav(game_ctx_t* ctx, mazenav_t nav_index) {
+    const maze_t* maze = game_maze(ctx);
+    ctx->game.nav_index = (uint8_t) nav_index;
+    ctx->nav = maze->nav[nav_index];
+    ctx->ghost_fields = maze->ghost_fields[nav_index];
 }
 
 // set time trigger to the next game tick
-static void start(trigger_t* t) {
-    t->tick = state.timing.tick + 1;
+static void start(game_ctx_t* ctx, trigger_t* t) {
+    t->tick = ctx->timing.tick + 1;
 }
 
 // set time trigger to a future tick
-static void start_after(trigger_t* t, uint32_t ticks) {
-    t->tick = state.timing.tick + ticks;
+static void start_after(game_ctx_t* ctx, trigger_t* t, uint32_t ticks) {
+    t->tick = ctx->timing.tick + ticks;
 }
 
 // deactivate a time trigger
@@ -907,14 +2299,14 @@ static trigger_t disabled_timer(void) {
 }
 
 // check if a time trigger is triggered
-static bool now(trigger_t t) {
-    return t.tick == state.timing.tick;
+static bool now(game_ctx_t* ctx, trigger_t t) {
+    return t.tick == ctx->timing.tick;
 }
 
 // return the number of ticks since a time trigger was triggered
-static uint32_t since(trigger_t t) {
-    if (state.timing.tick >= t.tick) {
-        return state.timing.tick - t.tick;
+static uint32_t since(game_ctx_t* ctx, trigger_t t) {
+    if (ctx->timing.tick >= t.tick) {
+        return ctx->timing.tick - t.tick;
     }
     else {
         return DISABLED_TICKS;
@@ -922,10 +2314,10 @@ static uint32_t since(trigger_t t) {
 }
 
 // check if a time trigger is between begin and end tick
-static bool between(trigger_t t, uint32_t begin, uint32_t end) {
+static bool between(game_ctx_t* ctx, trigger_t t, uint32_t begin, uint32_t end) {
     assert(begin < end);
     if (t.tick != DISABLED_TICKS) {
-        uint32_t ticks = since(t);
+        uint32_t ticks = since(ctx, t);
         return (ticks >= begin) && (ticks < end);
     }
     else {
@@ -934,13 +2326,13 @@ static bool between(trigger_t t, uint32_t begin, uint32_t end) {
 }
 
 // check if a time trigger was triggered exactly N ticks ago
-static bool after_once(trigger_t t, uint32_t ticks) {
-    return since(t) == ticks;
+static bool after_once(game_ctx_t* ctx, trigger_t t, uint32_t ticks) {
+    return since(ctx, t) == ticks;
 }
 
 // check if a time trigger was triggered more than N ticks ago
-static bool after(trigger_t t, uint32_t ticks) {
-    uint32_t s = since(t);
+static bool after(game_ctx_t* ctx, trigger_t t, uint32_t ticks) {
+    uint32_t s = since(ctx, t);
     if (s != DISABLED_TICKS) {
         return s >= ticks;
     }
@@ -949,9 +2341,9 @@ static bool after(trigger_t t, uint32_t ticks) {
     }
 }
 
-// same as between(t, 0, ticks)
-static bool before(trigger_t t, uint32_t ticks) {
-    uint32_t s = since(t);
+// same as between(ctx, t, 0, ticks)
+static bool before(game_ctx_t* ctx, trigger_t t, uint32_t ticks) {
+    uint32_t s = since(ctx, t);
     if (s != DISABLED_TICKS) {
         return s < ticks;
     }
@@ -961,41 +2353,107 @@ static bool before(trigger_t t, uint32_t ticks) {
 }
 
 // clear input state and disable input
-static void input_disable(void) {
-    memset(&state.input1, 0, sizeof(state.input1));
-    memset(&state.input2, 0, sizeof(state.input2));
+static void input_disable(game_ctx_t* ctx) {
+    memset(&ctx->input1, 0, sizeof(ctx->input1));
+    memset(&ctx->input2, 0, sizeof(ctx->input2));
 }
 
 // enable input again
-static void input_enable(void) {
-    state.input1.enabled = true;
-    state.input2.enabled = true;
+static void input_enable(game_ctx_t* ctx) {
+    ctx->input1.enabled = true;
+    ctx->input2.enabled = true;
 }
 
-// get the current input as dir_t
-static dir_t input_dir(dir_t default_dir) {
-    if (state.input1.up) {
-        return DIR_UP;
-    }
-    else if (state.input1.down) {
-        return DIR_DOWN;
-    }
-    else if (state.input1.right) {
-        return DIR_RIGHT;
+// handle a key press or release (called from the sokol-app event callback
+// or from the headless runner's input script)
+static void input_key(game_ctx_t* ctx, inputkey_t key, bool btn_down) {
+    if (ctx->input1.enabled) {
+        switch (key) {
+            case INPUTKEY_UP:
+                ctx->input1.up = ctx->input1.anykey = btn_down;
+                ctx->game.active_player = 1;
+                break;
+            case INPUTKEY_DOWN:
+                ctx->input1.down = ctx->input1.anykey = btn_down;
+                ctx->game.active_player = 1;
+                break;
+            case INPUTKEY_LEFT:
+                ctx->input1.left = ctx->input1.anykey = btn_down;
+                ctx->game.active_player = 1;
+                break;
+            case INPUTKEY_RIGHT:
+                ctx->input1.right = ctx->input1.anykey = btn_down;
+                ctx->game.active_player = 1;
+                break;
+            case INPUTKEY_ESC:
+                ctx->input1.esc = ctx->input1.anykey = btn_down;
+                break;
+
+
+            case INPUTKEY_W:
+                ctx->input2.up = ctx->input2.anykey = btn_down;
+                ctx->game.active_player = 0;
+                break;
+            case INPUTKEY_S:
+                ctx->input2.down = ctx->input2.anykey = btn_down;
+                ctx->game.active_player = 0;
+
+                break;
+            case INPUTKEY_A:
+                ctx->input2.left = ctx->input2.anykey = btn_down;
+                ctx->game.active_player = 0;
+
+                break;
+            case INPUTKEY_D:
+                ctx->input2.right = ctx->input2.anykey = btn_down;
+                ctx->game.active_player = 0;
+
+                break;
+
+
+            case INPUTKEY_L:
+                ctx->input1.l = btn_down;
+                ctx->input1.l = btn_down;
+                break;
+
+
+
+
+            default:
+                ctx->input1.anykey = btn_down;
+                ctx->input2.anykey = btn_down;
+                break;
+        }
     }
-    else if (state.input1.left) {
-        return DIR_LEFT;
+}
+
+#if PACMAN_HEADLESS || PACMAN_NETPLAY || PACMAN_REPLAY
+// forward changes of the keys held down during a tick (bit mask of
+// (1<<inputkey_t)) as key-down/up events, this is used where input is
+// recorded per tick instead of per event (headless runner, netplay and replays)
+static void input_keys(game_ctx_t* ctx, uint16_t keys) {
+    const uint16_t changed = ctx->held_keys ^ keys;
+    for (int key = 0; key < NUM_INPUTKEYS; key++) {
+        if (changed & (1<<key)) {
+            input_key(ctx, (inputkey_t)key, 0 != (keys & (1<<key)));
+        }
     }
-    else if (state.input2.up) {
+    ctx->held_keys = keys;
+}
+#endif
+
+// the direction pressed on one of the two key sets
+static dir_t input_keys_dir(const input_t* input, dir_t default_dir) {
+    if (input->up) {
         return DIR_UP;
     }
-    else if (state.input2.down) {
+    else if (input->down) {
         return DIR_DOWN;
     }
-    else if (state.input2.right) {
+    else if (input->right) {
         return DIR_RIGHT;
     }
-    else if (state.input2.left) {
+    else if (input->left) {
         return DIR_LEFT;
     }
     else {
@@ -1003,6 +2461,22 @@ static dir_t input_dir(dir_t default_dir) {
     }
 }
 
+static dir_t input_dir(game_ctx_t* ctx, dir_t default_dir) {
+    return input_keys_dir(&ctx->input1, input_keys_dir(&ctx->input2, default_dir));
+}
+
+// the wanted direction of a player: in the regular game, both key sets steer
+// the active player, in battle mode the keys steer player 0 and the other
+// players are steered through battle_dirs[] (by the headless runner or a bot)
+static dir_t input_player_dir(game_ctx_t* ctx, int player, dir_t default_dir) {
+    if (ctx->game.battle && (player > 0)) {
+        return (dir_t)ctx->battle_dirs[player];
+    }
+    else {
+        return input_dir(ctx, default_dir);
+    }
+}
+
 // shortcut to create an int2_t
 static int2_t i2(int16_t x, int16_t y) {
     return (int2_t) { x, y };
@@ -1049,17 +2523,82 @@ int2_t dist_to_tile_mid(int2_t pos) {
     return i2((TILE_WIDTH/2) - pos.x % TILE_WIDTH, (TILE_HEIGHT/2) - pos.y % TILE_HEIGHT);
 }
 
+/* the hash over video_ram is the XOR of a pseudo-random key per tile
+   position and tile code (Zobrist hashing), so that a tile change only
+   needs to XOR out the old and XOR in the new key instead of rehashing
+   the whole video_ram (see game_hash())
+*/
+static uint64_t vid_tile_key(int x, int y, uint8_t tile_code) {
+    // splitmix64 finalizer
+    uint64_t z = (((uint64_t)(y * DISPLAY_TILES_X + x))<<8) | tile_code;
+    z = (z ^ (z>>30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z>>27)) * 0x94D049BB133111EB;
+    return z ^ (z>>31);
+}
+
+// recompute the video_ram hash from scratch (after bulk changes to video_ram)
+static uint64_t vid_full_hash(const game_ctx_t* ctx) {
+    uint64_t hash = 0;
+    for (int y = 0; y < DISPLAY_TILES_Y; y++) {
+        for (int x = 0; x < DISPLAY_TILES_X; x++) {
+            hash ^= vid_tile_key(x, y, ctx->vid.video_ram[y][x]);
+        }
+    }
+    return hash;
+}
+
+/* mark a tile as changed, so that the renderer only needs to rebuild the
+   quads of changed tiles (see gfx_update_playfield_quads()), the
+   headless runner doesn't render, so it doesn't track changed tiles
+*/
+static void vid_dirty(game_ctx_t* ctx, int x, int y) {
+    #if PACMAN_HEADLESS && !PACMAN_BENCH
+        (void)ctx; (void)x; (void)y;
+    #else
+        ctx->dirty_tiles[y] |= 1u<<x;
+    #endif
+}
+
+// mark all tiles as changed (after bulk changes to video_ram and color_ram)
+static void vid_dirty_all(game_ctx_t* ctx) {
+    #if PACMAN_HEADLESS && !PACMAN_BENCH
+        (void)ctx;
+    #else
+        memset(ctx->dirty_tiles, 0xFF, sizeof(ctx->dirty_tiles));
+    #endif
+}
+
+// write a tile code into video_ram and update the video_ram hash
+static void vid_put(game_ctx_t* ctx, int x, int y, uint8_t tile_code) {
+    const uint8_t old_tile_code = ctx->vid.video_ram[y][x];
+    if (old_tile_code != tile_code) {
+        ctx->vid.tile_hash ^= vid_tile_key(x, y, old_tile_code) ^ vid_tile_key(x, y, tile_code);
+        ctx->vid.video_ram[y][x] = tile_code;
+        vid_dirty(ctx, x, y);
+    }
+}
+
+// write a color code into color_ram
+static void vid_put_color(game_ctx_t* ctx, int x, int y, uint8_t color_code) {
+    if (ctx->vid.color_ram[y][x] != color_code) {
+        ctx->vid.color_ram[y][x] = color_code;
+        vid_dirty(ctx, x, y);
+    }
+}
+
 // clear tile and color buffer
-static void vid_clear(uint8_t tile_code, uint8_t color_code) {
-    memset(&state.gfx.video_ram, tile_code, sizeof(state.gfx.video_ram));
-    memset(&state.gfx.color_ram, color_code, sizeof(state.gfx.color_ram));
+static void vid_clear(game_ctx_t* ctx, uint8_t tile_code, uint8_t color_code) {
+    memset(&ctx->vid.video_ram, tile_code, sizeof(ctx->vid.video_ram));
+    memset(&ctx->vid.color_ram, color_code, sizeof(ctx->vid.color_ram));
+    ctx->vid.tile_hash = vid_full_hash(ctx);
+    vid_dirty_all(ctx);
 }
 
 // clear the playfield's rectangle in the color buffer
-static void vid_color_playfield(uint8_t color_code) {
+static void vid_color_playfield(game_ctx_t* ctx, uint8_t color_code) {
     for (int y = 3; y < DISPLAY_TILES_Y-2; y++) {
         for (int x = 0; x < DISPLAY_TILES_X; x++) {
-            state.gfx.color_ram[y][x] = color_code;
+            vid_put_color(ctx, x, y, color_code);
         }
     }
 }
@@ -1070,22 +2609,22 @@ static bool valid_tile_pos(int2_t tile_pos) {
 }
 
 // put a color into the color buffer
-static void vid_color(int2_t tile_pos, uint8_t color_code) {
+static void vid_color(game_ctx_t* ctx, int2_t tile_pos, uint8_t color_code) {
     assert(valid_tile_pos(tile_pos));
-    state.gfx.color_ram[tile_pos.y][tile_pos.x] = color_code;
+    vid_put_color(ctx, tile_pos.x, tile_pos.y, color_code);
 }
 
 // put a tile into the tile buffer
-static void vid_tile(int2_t tile_pos, uint8_t tile_code) {
+static void vid_tile(game_ctx_t* ctx, int2_t tile_pos, uint8_t tile_code) {
     assert(valid_tile_pos(tile_pos));
-    state.gfx.video_ram[tile_pos.y][tile_pos.x] = tile_code;
+    vid_put(ctx, tile_pos.x, tile_pos.y, tile_code);
 }
 
 // put a colored tile into the tile and color buffers
-static void vid_color_tile(int2_t tile_pos, uint8_t color_code, uint8_t tile_code) {
+static void vid_color_tile(game_ctx_t* ctx, int2_t tile_pos, uint8_t color_code, uint8_t tile_code) {
     assert(valid_tile_pos(tile_pos));
-    state.gfx.video_ram[tile_pos.y][tile_pos.x] = tile_code;
-    state.gfx.color_ram[tile_pos.y][tile_pos.x] = color_code;
+    vid_put(ctx, tile_pos.x, tile_pos.y, tile_code);
+    vid_put_color(ctx, tile_pos.x, tile_pos.y, color_code);
 }
 
 // translate ASCII char into "NAMCO char"
@@ -1102,25 +2641,25 @@ static char conv_char(char c) {
 }
 
 // put colored char into tile+color buffers
-static void vid_color_char(int2_t tile_pos, uint8_t color_code, char chr) {
+static void vid_color_char(game_ctx_t* ctx, int2_t tile_pos, uint8_t color_code, char chr) {
     assert(valid_tile_pos(tile_pos));
-    state.gfx.video_ram[tile_pos.y][tile_pos.x] = conv_char(chr);
-    state.gfx.color_ram[tile_pos.y][tile_pos.x] = color_code;
+    vid_put(ctx, tile_pos.x, tile_pos.y, (uint8_t)conv_char(chr));
+    vid_put_color(ctx, tile_pos.x, tile_pos.y, color_code);
 }
 
 // put char into tile buffer
-static void vid_char(int2_t tile_pos, char chr) {
+static void vid_char(game_ctx_t* ctx, int2_t tile_pos, char chr) {
     assert(valid_tile_pos(tile_pos));
-    state.gfx.video_ram[tile_pos.y][tile_pos.x] = conv_char(chr);
+    vid_put(ctx, tile_pos.x, tile_pos.y, (uint8_t)conv_char(chr));
 }
 
 // put colored text into the tile+color buffers
-static void vid_color_text(int2_t tile_pos, uint8_t color_code, const char* text) {
+static void vid_color_text(game_ctx_t* ctx, int2_t tile_pos, uint8_t color_code, const char* text) {
     assert(valid_tile_pos(tile_pos));
     uint8_t chr;
     while ((chr = (uint8_t) *text++)) {
         if (tile_pos.x < DISPLAY_TILES_X) {
-            vid_color_char(tile_pos, color_code, chr);
+            vid_color_char(ctx, tile_pos, color_code, chr);
             tile_pos.x++;
         }
         else {
@@ -1130,12 +2669,12 @@ static void vid_color_text(int2_t tile_pos, uint8_t color_code, const char* text
 }
 
 // put text into the tile buffer
-static void vid_text(int2_t tile_pos, const char* text) {
+static void vid_text(game_ctx_t* ctx, int2_t tile_pos, const char* text) {
     assert(valid_tile_pos(tile_pos));
     uint8_t chr;
     while ((chr = (uint8_t) *text++)) {
         if (tile_pos.x < DISPLAY_TILES_X) {
-            vid_char(tile_pos, chr);
+            vid_char(ctx, tile_pos, chr);
             tile_pos.x++;
         }
         else {
@@ -1149,18 +2688,18 @@ static void vid_text(int2_t tile_pos, const char* text) {
     a zero-score will print as '00' (this is the same as on
     the Pacman arcade machine)
 */
-static void vid_color_score(int2_t tile_pos, uint8_t color_code, uint32_t score) {
-    vid_color_char(tile_pos, color_code, '0');
-    tile_pos.x--;
-    for (int digit = 0; digit < 8; digit++) {
-        char chr = (score % 10) + '0';
-        if (valid_tile_pos(tile_pos)) {
-            vid_color_char(tile_pos, color_code, chr);
-            tile_pos.x--;
-            score /= 10;
-            if (0 == score) {
-                break;
-            }
+static void vid_color_score(game_ctx_t* ctx, int2_t tile_pos, uint8_t color_code, uint32_t score) {
+    // the scores are printed in each game tick, so this writes the digits
+    // directly (conv_char() doesn't change them)
+    assert(valid_tile_pos(tile_pos));
+    vid_put(ctx, tile_pos.x, tile_pos.y, '0');
+    vid_put_color(ctx, tile_pos.x, tile_pos.y, color_code);
+    for (int x = tile_pos.x - 1; (x >= 0) && (x >= (tile_pos.x - 8)); x--) {
+        vid_put(ctx, x, tile_pos.y, (uint8_t)('0' + (score % 10)));
+        vid_put_color(ctx, x, tile_pos.y, color_code);
+        score /= 10;
+        if (0 == score) {
+            break;
         }
     }
 }
@@ -1172,65 +2711,86 @@ static void vid_color_score(int2_t tile_pos, uint8_t color_code, uint32_t score)
    This is (for instance) used to render the current "lives" and fruit
    symbols at the lower border.
 */
-static void vid_draw_tile_quad(int2_t tile_pos, uint8_t color_code, uint8_t tile_code) {
+static void vid_draw_tile_quad(game_ctx_t* ctx, int2_t tile_pos, uint8_t color_code, uint8_t tile_code) {
     for (int yy=0; yy<2; yy++) {
         for (int xx=0; xx<2; xx++) {
             uint8_t t = tile_code + yy*2 + (1-xx);
-            vid_color_tile(i2(xx + tile_pos.x, yy + tile_pos.y), color_code, t);
+            vid_color_tile(ctx, i2(xx + tile_pos.x, yy + tile_pos.y), color_code, t);
         }
     }
 }
 
 // draw the fruit bonus score tiles (when Pacman has eaten the bonus fruit)
-static void vid_fruit_score(fruit_t fruit_type) {
+static void vid_fruit_score(game_ctx_t* ctx, fruit_t fruit_type) {
     assert((fruit_type >= 0) && (fruit_type < NUM_FRUITS));
     uint8_t color_code = (fruit_type == FRUIT_NONE) ? COLOR_DOT : COLOR_FRUIT_SCORE;
     for (int i = 0; i < 4; i++) {
-        vid_color_tile(i2(12+i, 20), color_code, fruit_score_tiles[fruit_type][i]);
+        vid_color_tile(ctx, i2(12+i, 20), color_code, fruit_score_tiles[fruit_type][i]);
         
     }
 }
 
+// handle fadein/fadeout
+static void vid_fade(game_ctx_t* ctx) {
+    if (between(ctx, ctx->vid.fadein, 0, FADE_TICKS)) {
+        float t = (float)since(ctx, ctx->vid.fadein) / FADE_TICKS;
+        ctx->vid.fade = (uint8_t) (255.0f * (1.0f - t));
+    }
+    if (after_once(ctx, ctx->vid.fadein, FADE_TICKS)) {
+        ctx->vid.fade = 0;
+    }
+    if (between(ctx, ctx->vid.fadeout, 0, FADE_TICKS)) {
+        float t = (float)since(ctx, ctx->vid.fadeout) / FADE_TICKS;
+        ctx->vid.fade = (uint8_t) (255.0f * t);
+    }
+    if (after_once(ctx, ctx->vid.fadeout, FADE_TICKS)) {
+        ctx->vid.fade = 255;
+    }
+}
+
 // disable and clear all sprites
-static void spr_clear(void) {
-    memset(&state.gfx.sprite, 0, sizeof(state.gfx.sprite));
+static void spr_clear(game_ctx_t* ctx) {
+    memset(&ctx->vid.sprite, 0, sizeof(ctx->vid.sprite));
 }
 
 // get pointer to pacman sprite
-static sprite_t* spr_pacman(void) {
-    return &state.gfx.sprite[SPRITE_PACMAN];
+static sprite_t* spr_pacman(game_ctx_t* ctx) {
+    return &ctx->vid.sprite[SPRITE_PACMAN];
+}
+
+// get pointer to the sprite of a player, in the regular game the Pacman sprite shows the active player
+static sprite_t* spr_player(game_ctx_t* ctx, int player) {
+    assert((player >= 0) && (player < MAX_PLAYERS));
+    return (ctx->game.battle && (player > 0)) ? &ctx->vid.sprite[SPRITE_PLAYERS + player - 1] : spr_pacman(ctx);
 }
 
 // get pointer to ghost sprite
-static sprite_t* spr_ghost(ghosttype_t type) {
+static sprite_t* spr_ghost(game_ctx_t* ctx, ghosttype_t type) {
     assert((type >= 0) && (type < NUM_GHOSTS));
-    return &state.gfx.sprite[SPRITE_BLINKY + type];
+    return &ctx->vid.sprite[SPRITE_BLINKY + type];
 }
 
 // get pointer to fruit sprite
-static sprite_t* spr_fruit(void) {
-    return &state.gfx.sprite[SPRITE_FRUIT];
+static sprite_t* spr_fruit(game_ctx_t* ctx) {
+    return &ctx->vid.sprite[SPRITE_FRUIT];
 }
 
 // set sprite to animated Pacman
-static void spr_anim_pacman(dir_t dir, uint32_t tick) {
+static void spr_anim_pacman(sprite_t* spr, dir_t dir, uint32_t tick) {
     // animation frames for horizontal and vertical movement
     static const uint8_t tiles[2][4] = {
         { 44, 46, 48, 46 }, // horizontal (needs flipx)
         { 45, 47, 48, 47 }  // vertical (needs flipy)
     };
-    sprite_t* spr = spr_pacman();
     uint32_t phase = (tick / 2) & 3;
     spr->tile  = tiles[dir & 1][phase];
-    spr->color = COLOR_PACMAN;
     spr->flipx = (dir == DIR_LEFT);
     spr->flipy = (dir == DIR_UP);
 }
 
 // set sprite to Pacman's death sequence
-static void spr_anim_pacman_death(uint32_t tick) {
+static void spr_anim_pacman_death(sprite_t* spr, uint32_t tick) {
     // the death animation tile sequence starts at sprite tile number 52 and ends at 63
-    sprite_t* spr = spr_pacman();
     uint32_t tile = 52 + (tick / 8);
     if (tile > 63) {
         tile = 63;
@@ -1240,7 +2800,7 @@ static void spr_anim_pacman_death(uint32_t tick) {
 }
 
 // set sprite to animated ghost
-static void spr_anim_ghost(ghosttype_t ghost_type, dir_t dir, uint32_t tick) {
+static void spr_anim_ghost(game_ctx_t* ctx, ghosttype_t ghost_type, dir_t dir, uint32_t tick) {
     assert((dir >= 0) && (dir < NUM_DIRS));
     static const uint8_t tiles[4][2]  = {
         { 32, 33 }, // right
@@ -1249,7 +2809,7 @@ static void spr_anim_ghost(ghosttype_t ghost_type, dir_t dir, uint32_t tick) {
         { 38, 39 }, // up
     };
     uint32_t phase = (tick / 8) & 1;
-    sprite_t* spr = spr_ghost(ghost_type);
+    sprite_t* spr = spr_ghost(ctx, ghost_type);
     spr->tile = tiles[dir][phase];
     spr->color = COLOR_BLINKY + 2*ghost_type;
     spr->flipx = false;
@@ -1257,12 +2817,12 @@ static void spr_anim_ghost(ghosttype_t ghost_type, dir_t dir, uint32_t tick) {
 }
 
 // set sprite to frightened ghost
-static void spr_anim_ghost_frightened(ghosttype_t ghost_type, uint32_t tick) {
+static void spr_anim_ghost_frightened(game_ctx_t* ctx, ghosttype_t ghost_type, uint32_t tick) {
     static const uint8_t tiles[2] = { 28, 29 };
     uint32_t phase = (tick / 4) & 1;
-    sprite_t* spr = spr_ghost(ghost_type);
+    sprite_t* spr = spr_ghost(ctx, ghost_type);
     spr->tile = tiles[phase];
-    if (tick > (uint32_t)(levelspec(state.game.round).fright_ticks - 60)) {
+    if (tick > (uint32_t)(levelspec(ctx->game.round).fright_ticks - 60)) {
         // towards end of frightening period, start blinking
         spr->color = (tick & 0x10) ? COLOR_FRIGHTENED : COLOR_FRIGHTENED_BLINKING;
     }
@@ -1277,10 +2837,10 @@ static void spr_anim_ghost_frightened(ghosttype_t ghost_type, uint32_t tick) {
     images but with a different color code which makes
     only the eyes visible
 */
-static void spr_anim_ghost_eyes(ghosttype_t ghost_type, dir_t dir) {
+static void spr_anim_ghost_eyes(game_ctx_t* ctx, ghosttype_t ghost_type, dir_t dir) {
     assert((dir >= 0) && (dir < NUM_DIRS));
     static const uint8_t tiles[NUM_DIRS] = { 32, 34, 36, 38 };
-    sprite_t* spr = spr_ghost(ghost_type);
+    sprite_t* spr = spr_ghost(ctx, ghost_type);
     spr->tile = tiles[dir];
     spr->color = COLOR_EYES;
     spr->flipx = false;
@@ -1328,30 +2888,30 @@ static dir_t reverse_dir(dir_t dir) {
 }
 
 // return tile code at tile position
-static uint8_t tile_code_at(int2_t tile_pos) {
+static uint8_t tile_code_at(game_ctx_t* ctx, int2_t tile_pos) {
     assert((tile_pos.x >= 0) && (tile_pos.x < DISPLAY_TILES_X));
     assert((tile_pos.y >= 0) && (tile_pos.y < DISPLAY_TILES_Y));
-    return state.gfx.video_ram[tile_pos.y][tile_pos.x];
+    return ctx->vid.video_ram[tile_pos.y][tile_pos.x];
 }
 
 // check if a tile position contains a blocking tile (walls and ghost house door)
-static bool is_blocking_tile(int2_t tile_pos) {
-    return tile_code_at(tile_pos) >= 0xC0;
+static bool is_blocking_tile(game_ctx_t* ctx, int2_t tile_pos) {
+    return tile_code_at(ctx, tile_pos) >= 0xC0;
 }
 
 // check if a tile position contains a dot tile
-static bool is_dot(int2_t tile_pos) {
-    return tile_code_at(tile_pos) == TILE_DOT;
+static bool is_dot(game_ctx_t* ctx, int2_t tile_pos) {
+    return tile_code_at(ctx, tile_pos) == TILE_DOT;
 }
 
 // check if a tile position contains a pill tile
-static bool is_pill(int2_t tile_pos) {
-    return tile_code_at(tile_pos) == TILE_PILL;
+static bool is_pill(game_ctx_t* ctx, int2_t tile_pos) {
+    return tile_code_at(ctx, tile_pos) == TILE_PILL;
 }
 
-// check if a tile position is in the teleport tunnel
-static bool is_tunnel(int2_t tile_pos) {
-    return (tile_pos.y == 17) && ((tile_pos.x <= 5) || (tile_pos.x >= 22));
+// check if a tile position is in the maze's teleport tunnel
+static bool is_tunnel(const maze_t* maze, int2_t tile_pos) {
+    return (tile_pos.y == maze->tunnel_y) && ((tile_pos.x <= maze->tunnel_left) || (tile_pos.x >= maze->tunnel_right));
 }
 
 // check if a position is in the ghost's red zone, where upward movement is forbidden
@@ -1360,9 +2920,17 @@ static bool is_redzone(int2_t tile_pos) {
     return ((tile_pos.x >= 11) && (tile_pos.x <= 16) && ((tile_pos.y == 14) || (tile_pos.y == 26)));
 }
 
+// lookup the navigation flags of a tile position, the x coordinate may be
+// one tile outside the playfield when looking ahead in the teleport tunnel
+static uint8_t nav_at(game_ctx_t* ctx, int2_t tile_pos) {
+    assert((tile_pos.x >= -1) && (tile_pos.x <= DISPLAY_TILES_X));
+    assert((tile_pos.y >= 0) && (tile_pos.y < DISPLAY_TILES_Y));
+    return ctx->nav[tile_pos.y][tile_pos.x + 1];
+}
+
 // test if movement from a pixel position in a wanted direction is possible,
 // allow_cornering is Pacman's feature to take a diagonal shortcut around corners
-static bool can_move(int2_t pos, dir_t wanted_dir, bool allow_cornering) {
+static bool can_move(game_ctx_t* ctx, int2_t pos, dir_t wanted_dir, bool allow_cornering) {
     const int2_t dir_vec = dir_to_vec(wanted_dir);
     const int2_t dist_mid = dist_to_tile_mid(pos);
 
@@ -1378,9 +2946,7 @@ static bool can_move(int2_t pos, dir_t wanted_dir, bool allow_cornering) {
     }
 
     // look one tile ahead in movement direction
-    const int2_t tile_pos = pixel_to_tile_pos(pos);
-    const int2_t check_pos = clamped_tile_pos(add_i2(tile_pos, dir_vec));
-    const bool is_blocked = is_blocking_tile(check_pos);
+    const bool is_blocked = 0 == (nav_at(ctx, pixel_to_tile_pos(pos)) & (1<<wanted_dir));
     if ((!allow_cornering && (0 != perp_dist_mid)) || (is_blocked && (0 == move_dist_mid))) {
         // way is blocked
         return false;
@@ -1421,9 +2987,9 @@ static int2_t move(int2_t pos, dir_t dir, bool allow_cornering) {
 
 // set a debug marker
 #if DBG_MARKERS
-static void dbg_marker(int index, int2_t tile_pos, uint8_t tile_code, uint8_t color_code) {
+static void dbg_marker(game_ctx_t* ctx, int index, int2_t tile_pos, uint8_t tile_code, uint8_t color_code) {
     assert((index >= 0) && (index < NUM_DEBUG_MARKERS));
-    state.gfx.debug_marker[index] = (debugmarker_t) {
+    ctx->debug_marker[index] = (debugmarker_t) {
         .enabled = true,
         .tile = tile_code,
         .color = color_code,
@@ -1432,164 +2998,184 @@ static void dbg_marker(int index, int2_t tile_pos, uint8_t tile_code, uint8_t co
 }
 #endif
 
+#endif // !PACMAN_ATLASGEN
+
 /*== GAMEPLAY CODE ===========================================================*/
+#if !PACMAN_ATLASGEN
 
-// initialize the playfield tiles
-static void game_init_playfield(void) {
-    vid_color_playfield(COLOR_DOT);
-    // decode the playfield from an ASCII map into tiles codes
-    static const char* tiles =
-       //0123456789012345678901234567
-        "0UUUUUUUUUUUU45UUUUUUUUUUUU1" // 3
-        "L............rl............R" // 4
-        "L.ebbf.ebbbf.rl.ebbbf.ebbf.R" // 5
-        "LPr  l.r   l.rl.r   l.r  lPR" // 6
-        "L.guuh.guuuh.gh.guuuh.guuh.R" // 7
-        "L..........................R" // 8
-        "L.ebbf.ef.ebbbbbbf.ef.ebbf.R" // 9
-        "L.guuh.rl.guuyxuuh.rl.guuh.R" // 10
-        "L......rl....rl....rl......R" // 11
-        "2BBBBf.rzbbf rl ebbwl.eBBBB3" // 12
-        "     L.rxuuh gh guuyl.R     " // 13
-        "     L.rl          rl.R     " // 14
-        "     L.rl mjs--tjn rl.R     " // 15
-        "UUUUUh.gh i      q gh.gUUUUU" // 16
-        "      .   i      q   .      " // 17
-        "BBBBBf.ef i      q ef.eBBBBB" // 18
-        "     L.rl okkkkkkp rl.R     " // 19
-        "     L.rl          rl.R     " // 20
-        "     L.rl ebbbbbbf rl.R     " // 21
-        "0UUUUh.gh guuyxuuh gh.gUUUU1" // 22
-        "L............rl............R" // 23
-        "L.ebbf.ebbbf.rl.ebbbf.ebbf.R" // 24
-        "L.guyl.guuuh.gh.guuuh.rxuh.R" // 25
-        "LP..rl.......  .......rl..PR" // 26
-        "6bf.rl.ef.ebbbbbbf.ef.rl.eb8" // 27
-        "7uh.gh.rl.guuyxuuh.rl.gh.gu9" // 28
-        "L......rl....rl....rl......R" // 29
-        "L.ebbbbwzbbf.rl.ebbwzbbbbf.R" // 30
-        "L.guuuuuuuuh.gh.guuuuuuuuh.R" // 31
-        "L..........................R" // 32
-        "2BBBBBBBBBBBBBBBBBBBBBBBBBB3"; // 33
-       //0123456789012345678901234567
-    uint8_t t[128];
-    for (int i = 0; i < 128; i++) { t[i]=TILE_DOT; }
-    t[' ']=0x40; t['0']=0xD1; t['1']=0xD0; t['2']=0xD5; t['3']=0xD4; t['4']=0xFB;
-    t['5']=0xFA; t['6']=0xD7; t['7']=0xD9; t['8']=0xD6; t['9']=0xD8; t['U']=0xDB;
-    t['L']=0xD3; t['R']=0xD2; t['B']=0xDC; t['b']=0xDF; t['e']=0xE7; t['f']=0xE6;
-    t['g']=0xEB; t['h']=0xEA; t['l']=0xE8; t['r']=0xE9; t['u']=0xE5; t['w']=0xF5;
-    t['x']=0xF2; t['y']=0xF3; t['z']=0xF4; t['m']=0xED; t['n']=0xEC; t['o']=0xEF;
-    t['p']=0xEE; t['j']=0xDD; t['i']=0xD2; t['k']=0xDB; t['q']=0xD3; t['s']=0xF1;
-    t['t']=0xF0; t['-']=TILE_DOOR; t['P']=TILE_PILL;
-    for (int y = 3, i = 0; y <= 33; y++) {
-        for (int x = 0; x < 28; x++, i++) {
-            state.gfx.video_ram[y][x] = t[tiles[i] & 127];
+// sound effects are only started by the game instance connected to the audio subsystem
+#if !PACMAN_HEADLESS
+static void game_snd_start(game_ctx_t* ctx, int sound_slot, const sound_desc_t* snd) {
+    if (ctx->audible) {
+        snd_start(sound_slot, snd);
+    }
+}
+
+static void game_snd_clear(game_ctx_t* ctx) {
+    if (ctx->audible) {
+        snd_clear();
+    }
+}
+#else
+// the headless build has no audio, sound effects are ignored
+#define game_snd_start(ctx, sound_slot, snd) ((void)(ctx))
+#define game_snd_clear(ctx) ((void)(ctx))
+#endif
+
+/* build a maze navigation table from the tiles in video_ram, for each tile
+   this has one bit per direction which is set if the (clamped) neighbour
+   tile in that direction isn't blocking, and a flag for the ghost red
+   zones, this saves the ghost AI and can_move() from looking at tile codes
+   each tick
+
+   NOTE: blocking tiles don't change while a round is running (eaten dots
+   and the READY! text don't block), the only change between rounds is
+   that clearing the PLAYER ONE/TWO text also clears the side walls of the
+   ghost house, so each maze has one table for the freshly drawn maze and
+   one for the cleared text, which are both built when decoding the maze
+   (see game_use_nav() and LEVEL PACKS).
+*/
+static void game_init_nav(game_ctx_t* ctx, uint8_t nav[DISPLAY_TILES_Y][DISPLAY_TILES_X + 2]) {
+    for (int y = 0; y < DISPLAY_TILES_Y; y++) {
+        for (int x = -1; x <= DISPLAY_TILES_X; x++) {
+            const int2_t tile_pos = i2(x, y);
+            uint8_t flags = 0;
+            for (int dir = 0; dir < NUM_DIRS; dir++) {
+                if (!is_blocking_tile(ctx, clamped_tile_pos(add_i2(tile_pos, dir_to_vec((dir_t)dir))))) {
+                    flags |= 1<<dir;
+                }
+            }
+            if (is_redzone(tile_pos)) {
+                flags |= NAV_REDZONE;
+            }
+            nav[y][x + 1] = flags;
         }
     }
-    // ghost house gate colors
-    vid_color(i2(13,15), 0x18);
-    vid_color(i2(14,15), 0x18);
+}
+
+// clear the "PLAYER ONE/TWO" text, this also clears the side walls of the ghost house
+static void game_clear_player_text(game_ctx_t* ctx) {
+    vid_color_text(ctx, i2(9,14), 0x10, "          ");
+    vid_color_text(ctx, i2(9,16), 0x10, "          ");
+}
+
+/* initialize the playfield tiles and colors from the current round's maze,
+   this also selects the maze's precomputed navigation table, so that
+   switching to a new maze between rounds is just a few memory copies
+*/
+static void game_init_playfield(game_ctx_t* ctx) {
+    const maze_t* maze = game_maze(ctx);
+    memcpy(&ctx->vid.video_ram[MAZE_FIRST_ROW], maze->tiles, sizeof(maze->tiles));
+    memcpy(&ctx->vid.color_ram[MAZE_FIRST_ROW], maze->colors, sizeof(maze->colors));
+    ctx->vid.tile_hash = vid_full_hash(ctx);
+    vid_dirty_all(ctx);
+    game_use_nav(ctx, MAZENAV_DRAWN);
 }
 
 // disable all game loop timers
-static void game_disable_timers(void) {
-    disable(&state.game.round_won);
-    disable(&state.game.game_over);
-    disable(&state.game.dot_eaten);
-    disable(&state.game.pill_eaten);
-    disable(&state.game.ghost_eaten);
-    disable(&state.game.pacman_eaten);
-    disable(&state.game.fruit_eaten);
-    disable(&state.game.force_leave_house);
-    disable(&state.game.fruit_active);
+static void game_disable_timers(game_ctx_t* ctx) {
+    disable(&ctx->game.round_won);
+    disable(&ctx->game.game_over);
+    disable(&ctx->game.dot_eaten);
+    disable(&ctx->game.pill_eaten);
+    disable(&ctx->game.ghost_eaten);
+    disable(&ctx->game.pacman_eaten);
+    disable(&ctx->game.fruit_eaten);
+    disable(&ctx->game.force_leave_house);
+    disable(&ctx->game.fruit_active);
 }
 
 // one-time init at start of game state
-static void game_init(void) {
-    input_enable();
-    game_disable_timers();
-    state.game.round = DBG_START_ROUND;
-    state.game.freeze = FREEZETYPE_PRELUDE;
-    state.game.num_lives = NUM_LIVES;
-    state.game.global_dot_counter_active = false;
-    state.game.global_dot_counter = 0;
-    state.game.num_dots_eaten = 0;
-    state.game.score = 0;
+static void game_init(game_ctx_t* ctx) {
+    input_enable(ctx);
+    game_disable_timers(ctx);
+    ctx->game.round = DBG_START_ROUND;
+    ctx->game.freeze = FREEZETYPE_PRELUDE;
+    ctx->game.num_lives = NUM_LIVES;
+    ctx->game.global_dot_counter_active = false;
+    ctx->game.global_dot_counter = 0;
+    ctx->game.num_dots_eaten = 0;
+    ctx->game.score = 0;
 
     // draw the playfield and PLAYER ONE READY! message
-    vid_clear(TILE_SPACE, COLOR_DOT);
-    vid_color_text(i2(9,0), COLOR_DEFAULT, "HIGH SCORE");
-    game_init_playfield();
-    vid_color_text(i2(9,14), 0x5, "PLAYER ONE");
-    vid_color_text(i2(9,16), 0x5, "PLAYER TWO");
-    vid_color_text(i2(11, 20), 0x9, "READY!");
+    vid_clear(ctx, TILE_SPACE, COLOR_DOT);
+    vid_color_text(ctx, i2(9,0), COLOR_DEFAULT, "HIGH SCORE");
+    game_init_playfield(ctx);
+    vid_color_text(ctx, i2(9,14), 0x5, "PLAYER ONE");
+    vid_color_text(ctx, i2(9,16), 0x5, "PLAYER TWO");
+    vid_color_text(ctx, i2(11, 20), 0x9, "READY!");
 }
 
 // setup state at start of a game round
-static void game_round_init(void) {
-    spr_clear();
+static void game_round_init(game_ctx_t* ctx) {
+    spr_clear(ctx);
 
     // clear the "PLAYER ONE" text
-    vid_color_text(i2(9,14), 0x10, "          ");
-    vid_color_text(i2(9,16), 0x10, "          ");
+    game_clear_player_text(ctx);
 
     /* if a new round was started because Pacman has "won" (eaten all dots),
         redraw the playfield and reset the global dot counter
     */
-    if (state.game.num_dots_eaten == NUM_DOTS) {
-        state.game.round++;
-        state.game.num_dots_eaten = 0;
-        game_init_playfield();
-        state.game.global_dot_counter_active = false;
+    if (ctx->game.num_dots_eaten == game_maze(ctx)->num_dots) {
+        ctx->game.round++;
+        ctx->game.num_dots_eaten = 0;
+        game_init_playfield(ctx);
+        ctx->game.global_dot_counter_active = false;
     }
     else {
         /* if the previous round was lost, use the global dot counter
            to detect when ghosts should leave the ghost house instead
            of the per-ghost dot counter
         */
-        if (state.game.num_lives != NUM_LIVES) {
-            state.game.global_dot_counter_active = true;
-            state.game.global_dot_counter = 0;
+        if (ctx->game.num_lives != NUM_LIVES) {
+            ctx->game.global_dot_counter_active = true;
+            ctx->game.global_dot_counter = 0;
         }
-        state.game.num_lives--;
+        ctx->game.num_lives--;
+
+        // the maze isn't redrawn, so the text above has cleared the side
+        // walls of the ghost house until the next round
+        game_use_nav(ctx, MAZENAV_CLEARED);
     }
-    assert(state.game.num_lives >= 0);
+    assert(ctx->game.num_lives >= 0);
+    const maze_t* maze = game_maze(ctx);
 
-    state.game.active_fruit = FRUIT_NONE;
-    state.game.freeze = FREEZETYPE_READY;
-    state.game.xorshift = 0x12345678;   // random-number-generator seed
-    state.game.num_ghosts_eaten = 0;
-    game_disable_timers();
+    ctx->game.active_fruit = FRUIT_NONE;
+    ctx->game.freeze = FREEZETYPE_READY;
+    ctx->game.xorshift = ctx->game.seed;    // random-number-generator seed
+    ctx->game.num_ghosts_eaten = 0;
+    game_disable_timers(ctx);
 
-    vid_color_text(i2(11, 20), 0x9, "READY!");
+    vid_color_text(ctx, i2(11, 20), 0x9, "READY!");
 
     // the force-house timer forces ghosts out of the house if Pacman isn't
     // eating dots for a while
-    start(&state.game.force_leave_house);
-
-    // Pacman starts running to the left
-    state.game.pacman1 = (pacman_t) {
-        .actor = {
-            .dir = DIR_LEFT,
-            .pos = { 14*8, 26*8+4 },
-        },
-    };
-
-    state.game.pacman2 = (pacman_t){
-        .actor = {
-            .dir = DIR_RIGHT,
-            .pos = { 14 * 8, 26 * 8 + 4 },
-        },
-    };
-
-
-    state.gfx.sprite[SPRITE_PACMAN] = (sprite_t) { .enabled = true, .color = COLOR_PACMAN };
+    start(ctx, &ctx->game.force_leave_house);
+
+    // all players start at the same position, the even players running to
+    // the left, and the odd players to the right
+    for (int p = 0; p < MAX_PLAYERS; p++) {
+        ctx->game.players.pos_x[p] = maze->pacman_start.x;
+        ctx->game.players.pos_y[p] = maze->pacman_start.y;
+        ctx->game.players.dir[p] = (p & 1) ? DIR_RIGHT : DIR_LEFT;
+        ctx->game.players.anim_tick[p] = 0;
+    }
+    ctx->vid.sprite[SPRITE_PACMAN] = (sprite_t) { .enabled = true, .color = COLOR_PACMAN };
+    if (ctx->game.battle) {
+        // the other battle mode players are told apart by color
+        static const uint8_t player_colors[MAX_PLAYERS - 1] = {
+            COLOR_PINKY, COLOR_INKY, COLOR_CLYDE, COLOR_BLINKY, COLOR_CHERRIES, COLOR_PEACH, COLOR_GRAPES
+        };
+        for (int p = 1; p < ctx->game.num_players; p++) {
+            *spr_player(ctx, p) = (sprite_t) { .enabled = true, .color = player_colors[p - 1] };
+        }
+    }
 
     // Blinky starts outside the ghost house, looking to the left, and in scatter mode
-    state.game.ghost[GHOSTTYPE_BLINKY] = (ghost_t) {
+    ctx->game.ghost[GHOSTTYPE_BLINKY] = (ghost_t) {
         .actor = {
             .dir = DIR_LEFT,
-            .pos = ghost_starting_pos[GHOSTTYPE_BLINKY],
+            .pos = maze->ghost_start[GHOSTTYPE_BLINKY],
         },
         .type = GHOSTTYPE_BLINKY,
         .next_dir = DIR_LEFT,
@@ -1599,13 +3185,13 @@ static void game_round_init(void) {
         .dot_counter = 0,
         .dot_limit = 0
     };
-    state.gfx.sprite[SPRITE_BLINKY] = (sprite_t) { .enabled = true, .color = COLOR_BLINKY };
+    ctx->vid.sprite[SPRITE_BLINKY] = (sprite_t) { .enabled = true, .color = COLOR_BLINKY };
 
     // Pinky starts in the middle slot of the ghost house, moving down
-    state.game.ghost[GHOSTTYPE_PINKY] = (ghost_t) {
+    ctx->game.ghost[GHOSTTYPE_PINKY] = (ghost_t) {
         .actor = {
             .dir = DIR_DOWN,
-            .pos = ghost_starting_pos[GHOSTTYPE_PINKY],
+            .pos = maze->ghost_start[GHOSTTYPE_PINKY],
         },
         .type = GHOSTTYPE_PINKY,
         .next_dir = DIR_DOWN,
@@ -1615,13 +3201,13 @@ static void game_round_init(void) {
         .dot_counter = 0,
         .dot_limit = 0
     };
-    state.gfx.sprite[SPRITE_PINKY] = (sprite_t) { .enabled = true, .color = COLOR_PINKY };
+    ctx->vid.sprite[SPRITE_PINKY] = (sprite_t) { .enabled = true, .color = COLOR_PINKY };
 
     // Inky starts in the left slot of the ghost house moving up
-    state.game.ghost[GHOSTTYPE_INKY] = (ghost_t) {
+    ctx->game.ghost[GHOSTTYPE_INKY] = (ghost_t) {
         .actor = {
             .dir = DIR_UP,
-            .pos = ghost_starting_pos[GHOSTTYPE_INKY],
+            .pos = maze->ghost_start[GHOSTTYPE_INKY],
         },
         .type = GHOSTTYPE_INKY,
         .next_dir = DIR_UP,
@@ -1632,13 +3218,13 @@ static void game_round_init(void) {
         // FIXME: needs to be adjusted by current round!
         .dot_limit = 30
     };
-    state.gfx.sprite[SPRITE_INKY] = (sprite_t) { .enabled = true, .color = COLOR_INKY };
+    ctx->vid.sprite[SPRITE_INKY] = (sprite_t) { .enabled = true, .color = COLOR_INKY };
 
     // Clyde starts in the right slot of the ghost house, moving up
-    state.game.ghost[GHOSTTYPE_CLYDE] = (ghost_t) {
+    ctx->game.ghost[GHOSTTYPE_CLYDE] = (ghost_t) {
         .actor = {
             .dir = DIR_UP,
-            .pos = ghost_starting_pos[GHOSTTYPE_CLYDE],
+            .pos = maze->ghost_start[GHOSTTYPE_CLYDE],
         },
         .type = GHOSTTYPE_CLYDE,
         .next_dir = DIR_UP,
@@ -1649,303 +3235,214 @@ static void game_round_init(void) {
         // FIXME: needs to be adjusted by current round!
         .dot_limit = 60,
     };
-    state.gfx.sprite[SPRITE_CLYDE] = (sprite_t) { .enabled = true, .color = COLOR_CLYDE };
+    ctx->vid.sprite[SPRITE_CLYDE] = (sprite_t) { .enabled = true, .color = COLOR_CLYDE };
 }
 
 // update dynamic background tiles
-static void game_update_tiles(void) {
+static void game_update_tiles(game_ctx_t* ctx) {
     // print score and hiscore
-    vid_color_score(i2(6,1), COLOR_DEFAULT, state.game.score);
-    if (state.game.hiscore > 0) {
-        vid_color_score(i2(16,1), COLOR_DEFAULT, state.game.hiscore);
+    vid_color_score(ctx, i2(6,1), COLOR_DEFAULT, ctx->game.score);
+    if (ctx->game.hiscore > 0) {
+        vid_color_score(ctx, i2(16,1), COLOR_DEFAULT, ctx->game.hiscore);
     }
 
     // update the energizer pill colors (blinking/non-blinking)
     static const int2_t pill_pos[NUM_PILLS] = { { 1, 6 }, { 26, 6 }, { 1, 26 }, { 26, 26 } };
     for (int i = 0; i < NUM_PILLS; i++) {
-        if (state.game.freeze) {
-            vid_color(pill_pos[i], COLOR_DOT);
+        if (ctx->game.freeze) {
+            vid_color(ctx, pill_pos[i], COLOR_DOT);
         }
         else {
-            vid_color(pill_pos[i], (state.timing.tick & 0x8) ? 0x10:0);
+            vid_color(ctx, pill_pos[i], (ctx->timing.tick & 0x8) ? 0x10:0);
         }
     }
 
     // clear the fruit-eaten score after Pacman has eaten a bonus fruit
-    if (after_once(state.game.fruit_eaten, 2*60)) {
-        vid_fruit_score(FRUIT_NONE);
+    if (after_once(ctx, ctx->game.fruit_eaten, 2*60)) {
+        vid_fruit_score(ctx, FRUIT_NONE);
     }
 
     // remaining lives at bottom left screen
     for (int i = 0; i < NUM_LIVES; i++) {
-        uint8_t color = (i < state.game.num_lives) ? COLOR_PACMAN : 0;
-        vid_draw_tile_quad(i2(2+2*i,34), color, TILE_LIFE);
+        uint8_t color = (i < ctx->game.num_lives) ? COLOR_PACMAN : 0;
+        vid_draw_tile_quad(ctx, i2(2+2*i,34), color, TILE_LIFE);
     }
 
     // bonus fruit list in bottom-right corner
     {
         int16_t x = 24;
-        for (int i = ((int)state.game.round - NUM_STATUS_FRUITS + 1); i <= (int)state.game.round; i++) {
+        for (int i = ((int)ctx->game.round - NUM_STATUS_FRUITS + 1); i <= (int)ctx->game.round; i++) {
             if (i >= 0) {
                 fruit_t fruit = levelspec(i).bonus_fruit;
                 uint8_t tile_code = fruit_tiles_colors[fruit][0];
                 uint8_t color_code = fruit_tiles_colors[fruit][2];
-                vid_draw_tile_quad(i2(x,34), color_code, tile_code);
+                vid_draw_tile_quad(ctx, i2(x,34), color_code, tile_code);
                 x -= 2;
             }
         }
     }
 
     // if game round was won, render the entire playfield as blinking blue/white
-    if (after(state.game.round_won, 1*60)) {
-        if (since(state.game.round_won) & 0x10) {
-            vid_color_playfield(COLOR_DOT);
+    if (after(ctx, ctx->game.round_won, 1*60)) {
+        if (since(ctx, ctx->game.round_won) & 0x10) {
+            vid_color_playfield(ctx, COLOR_DOT);
         }
         else {
-            vid_color_playfield(COLOR_WHITE_BORDER);
+            vid_color_playfield(ctx, COLOR_WHITE_BORDER);
         }
     }
 }
 
-// this function takes care of updating all sprite images during gameplay
-static void game_update_sprites(void) {
-    // update Pacman sprite
-    {
-        sprite_t* spr1 = spr_pacman();
-        sprite_t* spr2 = spr_pacman();
-
-        if (spr1->enabled) {
-            const actor_t* actor1 = &state.game.pacman1.actor;
-            const actor_t* actor2 = &state.game.pacman2.actor;
-
-            /*
-
-
-            if (state.game.player2) {
-                spr1->pos = actor_to_sprite_pos(actor1->pos);
-            }
-            else {
-                spr2->pos = actor_to_sprite_pos(actor2->pos);
-            }
-
-            if (state.game.freeze & FREEZETYPE_EAT_GHOST) {
-                // hide Pacman shortly after he's eaten a ghost (via an invisible Sprite tile)
-
-                spr1->tile = SPRITETILE_INVISIBLE;
-                spr2->tile = SPRITETILE_INVISIBLE;
-
-            }
-            else if (state.game.freeze & (FREEZETYPE_PRELUDE|FREEZETYPE_READY)) {
-                // special case game frozen at start of round, show Pacman with 'closed mouth'
-                if (state.game.player2) {
-                    spr1->tile = SPRITETILE_PACMAN_CLOSED_MOUTH;
-                }
-                else {
-                    spr2->tile = SPRITETILE_PACMAN_CLOSED_MOUTH;
-                }
-
-
-                //spr1->tile = SPRITETILE_PACMAN_CLOSED_MOUTH;
-                //spr2->tile = SPRITETILE_PACMAN_CLOSED_MOUTH;
-
-            }
-            else if (state.game.freeze & FREEZETYPE_DEAD) {
-                // play the Pacman-death-animation after a short pause
-                if (after(state.game.pacman_eaten, PACMAN_EATEN_TICKS)) {
-                    spr_anim_pacman_death(since(state.game.pacman_eaten) - PACMAN_EATEN_TICKS);
-                }
-            }
-            else {
-                // regular Pacman animation
-                if (state.game.player2) {
-                    spr_anim_pacman(actor2->dir, actor2->anim_tick);
-
-                }
-                else {
-                    spr_anim_pacman(actor1->dir, actor1->anim_tick);
-
-                }
-                //spr_anim_pacman(actor1->dir, actor1->anim_tick);
-                //spr_anim_pacman(actor2->dir, actor2->anim_tick);
-
-            }
-
-*/
-
-
-
-            if (state.game.player2) {
-                spr1->pos = actor_to_sprite_pos(actor1->pos);
-                if (state.game.freeze & FREEZETYPE_EAT_GHOST) {
-                    // hide Pacman shortly after he's eaten a ghost (via an invisible Sprite tile)
-
-                    spr1->tile = SPRITETILE_INVISIBLE;
-                }
-                else if (state.game.freeze & (FREEZETYPE_PRELUDE | FREEZETYPE_READY)) {
-                    spr1->tile = SPRITETILE_PACMAN_CLOSED_MOUTH;
-                }
-                else if (state.game.freeze & FREEZETYPE_DEAD) {
-                    // play the Pacman-death-animation after a short pause
-                    if (after(state.game.pacman_eaten, PACMAN_EATEN_TICKS)) {
-                        spr_anim_pacman_death(since(state.game.pacman_eaten) - PACMAN_EATEN_TICKS);
-                    }
-                }
-                else {
-                    spr_anim_pacman(actor1->dir, actor1->anim_tick);
-                }
-            }
-            else {
-                spr2->pos = actor_to_sprite_pos(actor2->pos);
-                if (state.game.freeze & FREEZETYPE_EAT_GHOST) {
-                    // hide Pacman shortly after he's eaten a ghost (via an invisible Sprite tile)
-
-                    spr2->tile = SPRITETILE_INVISIBLE;
-                }
-                else if (state.game.freeze & (FREEZETYPE_PRELUDE | FREEZETYPE_READY)) {
-                    spr2->tile = SPRITETILE_PACMAN_CLOSED_MOUTH;
-                }
-                else if (state.game.freeze & FREEZETYPE_DEAD) {
-                    // play the Pacman-death-animation after a short pause
-                    if (after(state.game.pacman_eaten, PACMAN_EATEN_TICKS)) {
-                        spr_anim_pacman_death(since(state.game.pacman_eaten) - PACMAN_EATEN_TICKS);
-                    }
-                }
-                else {
-                    spr_anim_pacman(actor2->dir, actor2->anim_tick);
-                }
-            }
-                
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+// update the sprite image of one player
+static void game_update_player_sprite(game_ctx_t* ctx, int player) {
+    sprite_t* spr = spr_player(ctx, player);
+    if (!spr->enabled) {
+        return;
+    }
+    spr->pos = actor_to_sprite_pos(i2(ctx->game.players.pos_x[player], ctx->game.players.pos_y[player]));
+    if (ctx->game.freeze & FREEZETYPE_EAT_GHOST) {
+        // hide Pacman shortly after he's eaten a ghost (via an invisible Sprite tile)
+        spr->tile = SPRITETILE_INVISIBLE;
+    }
+    else if (ctx->game.freeze & (FREEZETYPE_PRELUDE | FREEZETYPE_READY)) {
+        // special case game frozen at start of round, show Pacman with 'closed mouth'
+        spr->tile = SPRITETILE_PACMAN_CLOSED_MOUTH;
+    }
+    else if (ctx->game.freeze & FREEZETYPE_DEAD) {
+        // play the Pacman-death-animation after a short pause
+        if (after(ctx, ctx->game.pacman_eaten, PACMAN_EATEN_TICKS)) {
+            spr_anim_pacman_death(spr, since(ctx, ctx->game.pacman_eaten) - PACMAN_EATEN_TICKS);
+        }
+    }
+    else {
+        spr_anim_pacman(spr, (dir_t)ctx->game.players.dir[player], ctx->game.players.anim_tick[player]);
+    }
+}
 
+// this function takes care of updating all sprite images during gameplay
+static void game_update_sprites(game_ctx_t* ctx) {
+    // update the Pacman sprites, in the regular game only the active player is visible
+    if (ctx->game.battle) {
+        for (int p = 0; p < ctx->game.num_players; p++) {
+            game_update_player_sprite(ctx, p);
         }
     }
+    else {
+        game_update_player_sprite(ctx, ctx->game.active_player);
+    }
 
     // update ghost sprites
     for (int i = 0; i < NUM_GHOSTS; i++) {
-        sprite_t* sprite = spr_ghost(i);
+        sprite_t* sprite = spr_ghost(ctx, i);
         if (sprite->enabled) {
-            const ghost_t* ghost = &state.game.ghost[i];
+            const ghost_t* ghost = &ctx->game.ghost[i];
             sprite->pos = actor_to_sprite_pos(ghost->actor.pos);
             // if Pacman has just died, hide ghosts
-            if (state.game.freeze & FREEZETYPE_DEAD) {
-                if (after(state.game.pacman_eaten, PACMAN_EATEN_TICKS)) {
+            if (ctx->game.freeze & FREEZETYPE_DEAD) {
+                if (after(ctx, ctx->game.pacman_eaten, PACMAN_EATEN_TICKS)) {
                     sprite->tile = SPRITETILE_INVISIBLE;
                 }
             }
             // if Pacman has won the round, hide ghosts
-            else if (state.game.freeze & FREEZETYPE_WON) {
+            else if (ctx->game.freeze & FREEZETYPE_WON) {
                 sprite->tile = SPRITETILE_INVISIBLE;
             }
             else switch (ghost->state) {
                 case GHOSTSTATE_EYES:
-                    if (before(ghost->eaten, GHOST_EATEN_FREEZE_TICKS)) {
+                    if (before(ctx, ghost->eaten, GHOST_EATEN_FREEZE_TICKS)) {
                         // if the ghost was *just* eaten by Pacman, the ghost's sprite
                         // is replaced with a score number for a short time
                         // (200 for the first ghost, followed by 400, 800 and 1600)
-                        sprite->tile = SPRITETILE_SCORE_200 + state.game.num_ghosts_eaten - 1;
+                        sprite->tile = SPRITETILE_SCORE_200 + ctx->game.num_ghosts_eaten - 1;
                         sprite->color = COLOR_GHOST_SCORE;
                     }
                     else {
                         // afterwards, the ghost's eyes are shown, heading back to the ghost house
-                        spr_anim_ghost_eyes(i, ghost->next_dir);
+                        spr_anim_ghost_eyes(ctx, i, ghost->next_dir);
                     }
                     break;
                 case GHOSTSTATE_ENTERHOUSE:
                     // ...still show the ghost eyes while entering the ghost house
-                    spr_anim_ghost_eyes(i, ghost->actor.dir);
+                    spr_anim_ghost_eyes(ctx, i, ghost->actor.dir);
                     break;
                 case GHOSTSTATE_FRIGHTENED:
                     // when inside the ghost house, show the normal ghost images
                     // (FIXME: ghost's inside the ghost house also show the
                     // frightened appearance when Pacman has eaten an energizer pill)
-                    spr_anim_ghost_frightened(i, since(ghost->frightened));
+                    spr_anim_ghost_frightened(ctx, i, since(ctx, ghost->frightened));
                     break;
                 default:
                     // show the regular ghost sprite image, the ghost's
                     // 'next_dir' is used to visualize the direction the ghost
                     // is heading to, this has the effect that ghosts already look
                     // into the direction they will move into one tile ahead
-                    spr_anim_ghost(i, ghost->next_dir, ghost->actor.anim_tick);
+                    spr_anim_ghost(ctx, i, ghost->next_dir, ghost->actor.anim_tick);
                     break;
             }
         }
     }
 
     // hide or display the currently active bonus fruit
-    if (state.game.active_fruit == FRUIT_NONE) {
-        spr_fruit()->enabled = false;
+    if (ctx->game.active_fruit == FRUIT_NONE) {
+        spr_fruit(ctx)->enabled = false;
     }
     else {
-        sprite_t* spr = spr_fruit();
+        sprite_t* spr = spr_fruit(ctx);
         spr->enabled = true;
         spr->pos = i2(13 * TILE_WIDTH, 19 * TILE_HEIGHT + TILE_HEIGHT/2);
-        spr->tile = fruit_tiles_colors[state.game.active_fruit][1];
-        spr->color = fruit_tiles_colors[state.game.active_fruit][2];
+        spr->tile = fruit_tiles_colors[ctx->game.active_fruit][1];
+        spr->color = fruit_tiles_colors[ctx->game.active_fruit][2];
     }
 }
 
 // return true if Pacman should move in this tick, when eating dots, Pacman
 // is slightly slower than ghosts, otherwise slightly faster
-static bool game_pacman_should_move(void) {
-    if (now(state.game.dot_eaten)) {
+static bool game_pacman_should_move(game_ctx_t* ctx) {
+    if (now(ctx, ctx->game.dot_eaten)) {
         // eating a dot causes Pacman to stop for 1 tick
         return false;
     }
-    else if (since(state.game.pill_eaten) < 3) {
+    else if (since(ctx, ctx->game.pill_eaten) < 3) {
         // eating an energizer pill causes Pacman to stop for 3 ticks
         return false;
     }
     else {
-        return 0 != (state.timing.tick % 8);
+        return 0 != (ctx->timing.tick % 8);
     }
 }
 
 // return number of pixels a ghost should move this tick, this can't be a simple
 // move/don't move boolean return value, because ghosts in eye state move faster
 // than one pixel per tick
-static int game_ghost_speed(const ghost_t* ghost) {
+static int game_ghost_speed(game_ctx_t* ctx, const ghost_t* ghost) {
     assert(ghost);
     switch (ghost->state) {
         case GHOSTSTATE_HOUSE:
         case GHOSTSTATE_LEAVEHOUSE:
             // inside house at half speed (estimated)
-            return state.timing.tick & 1;
+            return ctx->timing.tick & 1;
         case GHOSTSTATE_FRIGHTENED:
             // move at 50% speed when frightened
-            return state.timing.tick & 1;
+            return ctx->timing.tick & 1;
         case GHOSTSTATE_EYES:
         case GHOSTSTATE_ENTERHOUSE:
             // estimated 1.5x when in eye state, Pacman Dossier is silent on this
-            return (state.timing.tick & 1) ? 1 : 2;
+            return (ctx->timing.tick & 1) ? 1 : 2;
         default:
-            if (is_tunnel(pixel_to_tile_pos(ghost->actor.pos))) {
+            if (is_tunnel(game_maze(ctx), pixel_to_tile_pos(ghost->actor.pos))) {
                 // move drastically slower when inside tunnel
-                return ((state.timing.tick * 2) % 4) ? 1 : 0;
+                return ((ctx->timing.tick * 2) % 4) ? 1 : 0;
             }
             else {
                 // otherwise move just a bit slower than Pacman
-                return (state.timing.tick % 7) ? 1 : 0;
+                return (ctx->timing.tick % 7) ? 1 : 0;
             }
     }
 }
 
 // return the current global scatter or chase phase
-static ghoststate_t game_scatter_chase_phase(void) {
-    uint32_t t = since(state.game.round_started);
+static ghoststate_t game_scatter_chase_phase(game_ctx_t* ctx) {
+    uint32_t t = since(ctx, ctx->game.round_started);
     if (t < 7*60)       return GHOSTSTATE_SCATTER;
     else if (t < 27*60) return GHOSTSTATE_CHASE;
     else if (t < 34*60) return GHOSTSTATE_SCATTER;
@@ -1959,7 +3456,7 @@ static ghoststate_t game_scatter_chase_phase(void) {
 // this function takes care of switching ghosts into a new state, this is one
 // of two important functions of the ghost AI (the other being the target selection
 // function below)
-static void game_update_ghost_state(ghost_t* ghost) {
+static void game_update_ghost_state(game_ctx_t* ctx, ghost_t* ghost) {
     assert(ghost);
     ghoststate_t new_state = ghost->state;
     switch (ghost->state) {
@@ -1968,14 +3465,14 @@ static void game_update_ghost_state(ghost_t* ghost) {
             // target position in front of the ghost house has been reached, then
             // switch into ENTERHOUSE state. Since ghosts in eye state move faster
             // than one pixel per tick, do a fuzzy comparison with the target pos
-            if (nearequal_i2(ghost->actor.pos, i2(ANTEPORTAS_X, ANTEPORTAS_Y), 1)) {
+            if (nearequal_i2(ghost->actor.pos, game_maze(ctx)->house_door, 1)) {
                 new_state = GHOSTSTATE_ENTERHOUSE;
             }
             break;
         case GHOSTSTATE_ENTERHOUSE:
             // Ghosts that enter the ghost house during the gameplay loop immediately
             // leave the house again after reaching their target position inside the house.
-            if (nearequal_i2(ghost->actor.pos, ghost_house_target_pos[ghost->type], 1)) {
+            if (nearequal_i2(ghost->actor.pos, game_maze(ctx)->ghost_house_target[ghost->type], 1)) {
                 new_state = GHOSTSTATE_LEAVEHOUSE;
             }
             break;
@@ -1983,26 +3480,26 @@ static void game_update_ghost_state(ghost_t* ghost) {
             // Ghosts only remain in the "house state" after a new game round
             // has been started. The conditions when ghosts leave the house
             // are a bit complicated, best to check the Pacman Dossier for the details.
-            if (after_once(state.game.force_leave_house, 4*60)) {
+            if (after_once(ctx, ctx->game.force_leave_house, 4*60)) {
                 // if Pacman hasn't eaten dots for 4 seconds, the next ghost
                 // is forced out of the house
                 // FIXME: time is reduced to 3 seconds after round 5
                 new_state = GHOSTSTATE_LEAVEHOUSE;
-                start(&state.game.force_leave_house);
+                start(ctx, &ctx->game.force_leave_house);
             }
-            else if (state.game.global_dot_counter_active) {
+            else if (ctx->game.global_dot_counter_active) {
                 // if Pacman has lost a life this round, the global dot counter is used
-                if ((ghost->type == GHOSTTYPE_PINKY) && (state.game.global_dot_counter == 7)) {
+                if ((ghost->type == GHOSTTYPE_PINKY) && (ctx->game.global_dot_counter == 7)) {
                     new_state = GHOSTSTATE_LEAVEHOUSE;
                 }
-                else if ((ghost->type == GHOSTTYPE_INKY) && (state.game.global_dot_counter == 17)) {
+                else if ((ghost->type == GHOSTTYPE_INKY) && (ctx->game.global_dot_counter == 17)) {
                     new_state = GHOSTSTATE_LEAVEHOUSE;
                 }
-                else if ((ghost->type == GHOSTTYPE_CLYDE) && (state.game.global_dot_counter == 32)) {
+                else if ((ghost->type == GHOSTTYPE_CLYDE) && (ctx->game.global_dot_counter == 32)) {
                     new_state = GHOSTSTATE_LEAVEHOUSE;
                     // NOTE that global dot counter is deactivated if (and only if) Clyde
                     // is in the house and the dot counter reaches 32
-                    state.game.global_dot_counter_active = false;
+                    ctx->game.global_dot_counter_active = false;
                 }
             }
             else if (ghost->dot_counter == ghost->dot_limit) {
@@ -2012,17 +3509,17 @@ static void game_update_ghost_state(ghost_t* ghost) {
             break;
         case GHOSTSTATE_LEAVEHOUSE:
             // ghosts immediately switch to scatter mode after leaving the ghost house
-            if (ghost->actor.pos.y == ANTEPORTAS_Y) {
+            if (ghost->actor.pos.y == game_maze(ctx)->house_door.y) {
                 new_state = GHOSTSTATE_SCATTER;
             }
             break;
         default:
             // switch between frightened, scatter and chase mode
-            if (before(ghost->frightened, levelspec(state.game.round).fright_ticks)) {
+            if (before(ctx, ghost->frightened, levelspec(ctx->game.round).fright_ticks)) {
                 new_state = GHOSTSTATE_FRIGHTENED;
             }
             else {
-                new_state = game_scatter_chase_phase();
+                new_state = game_scatter_chase_phase(ctx);
             }
     }
     // handle state transitions
@@ -2047,13 +3544,15 @@ static void game_update_ghost_state(ghost_t* ghost) {
             default:
                 break;
         }
+        TELEM(ctx, TELEM_GHOST_STATE, ghost->type, ghost->actor.pos, ((uint32_t)ghost->state << 8) | new_state);
         ghost->state = new_state;
     }
 }
 
 // update the ghost's target position, this is the other important function
-// of the ghost's AI
-static void game_update_ghost_target(ghost_t* ghost) {
+// of the ghost's AI, in battle mode the ghosts chase their nearest player
+// (see game_nearest_players())
+static void game_update_ghost_target(game_ctx_t* ctx, ghost_t* ghost, int nearest_player) {
     assert(ghost);
     int2_t pos = ghost->target_pos;
     switch (ghost->state) {
@@ -2061,41 +3560,37 @@ static void game_update_ghost_target(ghost_t* ghost) {
             // when in scatter mode, each ghost heads to its own scatter
             // target position in the playfield corners
             assert((ghost->type >= 0) && (ghost->type < NUM_GHOSTS));
-            pos = ghost_scatter_targets[ghost->type];
+            pos = game_maze(ctx)->scatter_target[ghost->type];
             break;
         case GHOSTSTATE_CHASE:
             // when in chase mode, each ghost has its own particular
             // chase behaviour (see the Pacman Dossier for details)
             {
-                const actor_t* pm1 = &state.game.pacman1.actor;
-                const int2_t pm1_pos = pixel_to_tile_pos(pm1->pos);
-                const int2_t pm1_dir = dir_to_vec(pm1->dir);
-
-                const actor_t* pm2 = &state.game.pacman2.actor;
-                const int2_t pm2_pos = pixel_to_tile_pos(pm2->pos);
-                const int2_t pm2_dir = dir_to_vec(pm2->dir);
+                // in the regular game, Inky and Clyde chase player 0, and
+                // Blinky, Pinky and Clyde (when close to player 0) player 1
+                const int pm1 = ctx->game.battle ? nearest_player : 0;
+                const int pm2 = ctx->game.battle ? nearest_player : 1;
+                const int2_t pm1_pos = pixel_to_tile_pos(i2(ctx->game.players.pos_x[pm1], ctx->game.players.pos_y[pm1]));
+                const int2_t pm1_dir = dir_to_vec((dir_t)ctx->game.players.dir[pm1]);
+                const int2_t pm2_pos = pixel_to_tile_pos(i2(ctx->game.players.pos_x[pm2], ctx->game.players.pos_y[pm2]));
+                const int2_t pm2_dir = dir_to_vec((dir_t)ctx->game.players.dir[pm2]);
 
                 switch (ghost->type) {
                     case GHOSTTYPE_BLINKY:
                         // Blinky directly chases Pacman
-                        pos = pm1_pos;
                         pos = pm2_pos;
-
                         break;
                     case GHOSTTYPE_PINKY:
                         // Pinky target is 4 tiles ahead of Pacman
                         // FIXME: does not reproduce 'diagonal overflow'
-                        pos = add_i2(pm1_pos, mul_i2(pm1_dir, 4));
                         pos = add_i2(pm2_pos, mul_i2(pm2_dir, 4));
-
                         break;
                     case GHOSTTYPE_INKY:
                         // Inky targets an extrapolated pos along a line two tiles
                         // ahead of Pacman through Blinky
                         {
-                            const int2_t blinky_pos = pixel_to_tile_pos(state.game.ghost[GHOSTTYPE_BLINKY].actor.pos);
+                            const int2_t blinky_pos = pixel_to_tile_pos(ctx->game.ghost[GHOSTTYPE_BLINKY].actor.pos);
                             const int2_t p = add_i2(pm1_pos, mul_i2(pm1_dir, 2));
-
                             const int2_t d = sub_i2(p, blinky_pos);
                             pos = add_i2(blinky_pos, mul_i2(d, 2));
                         }
@@ -2110,7 +3605,7 @@ static void game_update_ghost_target(ghost_t* ghost) {
                             pos = pm2_pos;
                         }
                         else {
-                            pos = ghost_scatter_targets[GHOSTTYPE_CLYDE];
+                            pos = game_maze(ctx)->scatter_target[GHOSTTYPE_CLYDE];
                         }
                         break;
                     default:
@@ -2122,11 +3617,11 @@ static void game_update_ghost_target(ghost_t* ghost) {
             // in frightened state just select a random target position
             // this has the effect that ghosts in frightened state
             // move in a random direction at each intersection
-            pos = i2(xorshift32() % DISPLAY_TILES_X, xorshift32() % DISPLAY_TILES_Y);
+            pos = i2(xorshift32(ctx) % DISPLAY_TILES_X, xorshift32(ctx) % DISPLAY_TILES_Y);
             break;
         case GHOSTSTATE_EYES:
             // move towards the ghost house door
-            pos = i2(13, 14);
+            pos = game_maze(ctx)->eyes_target;
             break;
         default:
             break;
@@ -2134,17 +3629,90 @@ static void game_update_ghost_target(ghost_t* ghost) {
     ghost->target_pos = pos;
 }
 
+/* the original ghost AI's direction decision at a tile midpoint: look one
+   tile ahead in the current direction, and from there try each direction in
+   the order UP, LEFT, DOWN, RIGHT, taking the first one that moves closest
+   to the target, ghosts never reverse direction and (except eyes) never move
+   upward in the red zones, returns NUM_DIRS if no direction is possible
+*/
+static dir_t game_ghost_greedy_dir(game_ctx_t* ctx, int2_t lookahead_pos, dir_t cur_dir, int2_t target_pos, bool redzone) {
+    const dir_t dirs[NUM_DIRS] = { DIR_UP, DIR_LEFT, DIR_DOWN, DIR_RIGHT };
+    const uint8_t nav = nav_at(ctx, lookahead_pos);
+    dir_t next_dir = NUM_DIRS;
+    int min_dist = 100000;
+    int dist = 0;
+    for (int i = 0; i < NUM_DIRS; i++) {
+        const dir_t dir = dirs[i];
+        // if ghost is in one of the two 'red zones', forbid upward movement
+        // (see Pacman Dossier "Areas To Exploit")
+        if (redzone && (nav & NAV_REDZONE) && (dir == DIR_UP)) {
+            continue;
+        }
+        const dir_t revdir = reverse_dir(dir);
+        if ((revdir != cur_dir) && (nav & (1<<dir))) {
+            const int2_t test_pos = clamped_tile_pos(add_i2(lookahead_pos, dir_to_vec(dir)));
+            if ((dist = squared_distance_i2(test_pos, target_pos)) < min_dist) {
+                min_dist = dist;
+                next_dir = dir;
+            }
+        }
+    }
+    return next_dir;
+}
+
+/* precompute the greedy ghost direction decisions for the fixed targets
+   (the four scatter corners, and the ghost house door for eyes), since the
+   maze doesn't change within a round, these never change either, so a
+   ghost heading to a fixed target only needs a table lookup
+
+   The fields only depend on the maze, so like the navigation tables they
+   are built when decoding the maze, once per navigation table, and all
+   game instances share them read-only (see game_use_nav() and LEVEL PACKS),
+   the ctx must point to the navigation table the fields are built for.
+   For each lookahead tile a field has 3 bits per current direction.
+*/
+static void game_init_ghost_fields(game_ctx_t* ctx, const maze_t* maze, uint16_t fields[NUM_GHOST_FIELDS][DISPLAY_TILES_Y][DISPLAY_TILES_X + 2]) {
+    for (int field = 0; field < NUM_GHOST_FIELDS; field++) {
+        const bool eyes = field == GHOST_FIELD_EYES;
+        const int2_t target_pos = eyes ? maze->eyes_target : maze->scatter_target[field];
+        for (int y = 0; y < DISPLAY_TILES_Y; y++) {
+            for (int x = -1; x <= DISPLAY_TILES_X; x++) {
+                uint16_t dirs = 0;
+                for (int cur_dir = 0; cur_dir < NUM_DIRS; cur_dir++) {
+                    const dir_t dir = game_ghost_greedy_dir(ctx, i2(x, y), (dir_t)cur_dir, target_pos, !eyes);
+                    dirs |= (uint16_t)(dir << (cur_dir * 3));
+                }
+                fields[field][y][x + 1] = dirs;
+            }
+        }
+    }
+}
+
+// return the direction field for the ghost's current target, or -1 if the target isn't fixed
+static int game_ghost_field(const maze_t* maze, const ghost_t* ghost) {
+    if (ghost->state == GHOSTSTATE_EYES) {
+        return equal_i2(ghost->target_pos, maze->eyes_target) ? GHOST_FIELD_EYES : -1;
+    }
+    else {
+        // this also covers Clyde chasing his scatter target
+        return equal_i2(ghost->target_pos, maze->scatter_target[ghost->type]) ? (int)ghost->type : -1;
+    }
+}
+
 // compute the next ghost direction, return true if resulting movement
 // should always happen regardless of current ghost position or blocking
 // tiles (this special case is used for movement inside the ghost house)
-static bool game_update_ghost_dir(ghost_t* ghost) {
+static bool game_update_ghost_dir(game_ctx_t* ctx, ghost_t* ghost) {
     assert(ghost);
+    const maze_t* maze = game_maze(ctx);
+    const int2_t door_pos = maze->house_door;
     // inside ghost-house, just move up and down
     if (ghost->state == GHOSTSTATE_HOUSE) {
-        if (ghost->actor.pos.y <= 17*TILE_HEIGHT) {
+        const int16_t mid_y = maze->ghost_house_target[ghost->type].y;
+        if (ghost->actor.pos.y <= (mid_y - TILE_HEIGHT/2)) {
             ghost->next_dir = DIR_DOWN;
         }
-        else if (ghost->actor.pos.y >= 18*TILE_HEIGHT) {
+        else if (ghost->actor.pos.y >= (mid_y + TILE_HEIGHT/2)) {
             ghost->next_dir = DIR_UP;
         }
         ghost->actor.dir = ghost->next_dir;
@@ -2154,13 +3722,13 @@ static bool game_update_ghost_dir(ghost_t* ghost) {
     // navigate the ghost out of the ghost house
     else if (ghost->state == GHOSTSTATE_LEAVEHOUSE) {
         const int2_t pos = ghost->actor.pos;
-        if (pos.x == ANTEPORTAS_X) {
-            if (pos.y > ANTEPORTAS_Y) {
+        if (pos.x == door_pos.x) {
+            if (pos.y > door_pos.y) {
                 ghost->next_dir = DIR_UP;
             }
         }
         else {
-            const int16_t mid_y = 17*TILE_HEIGHT + TILE_HEIGHT/2;
+            const int16_t mid_y = maze->ghost_house_target[ghost->type].y;
             if (pos.y > mid_y) {
                 ghost->next_dir = DIR_UP;
             }
@@ -2168,7 +3736,7 @@ static bool game_update_ghost_dir(ghost_t* ghost) {
                 ghost->next_dir = DIR_DOWN;
             }
             else {
-                ghost->next_dir = (pos.x > ANTEPORTAS_X) ? DIR_LEFT:DIR_RIGHT;
+                ghost->next_dir = (pos.x > door_pos.x) ? DIR_LEFT:DIR_RIGHT;
             }
         }
         ghost->actor.dir = ghost->next_dir;
@@ -2178,10 +3746,10 @@ static bool game_update_ghost_dir(ghost_t* ghost) {
     else if (ghost->state == GHOSTSTATE_ENTERHOUSE) {
         const int2_t pos = ghost->actor.pos;
         const int2_t tile_pos = pixel_to_tile_pos(pos);
-        const int2_t tgt_pos = ghost_house_target_pos[ghost->type];
-        if (tile_pos.y == 14) {
-            if (pos.x != ANTEPORTAS_X) {
-                ghost->next_dir = (pos.x < ANTEPORTAS_X) ? DIR_RIGHT:DIR_LEFT;
+        const int2_t tgt_pos = maze->ghost_house_target[ghost->type];
+        if (tile_pos.y == (door_pos.y / TILE_HEIGHT)) {
+            if (pos.x != door_pos.x) {
+                ghost->next_dir = (pos.x < door_pos.x) ? DIR_RIGHT:DIR_LEFT;
             }
             else {
                 ghost->next_dir = DIR_DOWN;
@@ -2205,25 +3773,21 @@ static bool game_update_ghost_dir(ghost_t* ghost) {
             const int2_t dir_vec = dir_to_vec(ghost->actor.dir);
             const int2_t lookahead_pos = add_i2(pixel_to_tile_pos(ghost->actor.pos), dir_vec);
 
-            // try each direction and take the one that moves closest to the target
-            const dir_t dirs[NUM_DIRS] = { DIR_UP, DIR_LEFT, DIR_DOWN, DIR_RIGHT };
-            int min_dist = 100000;
-            int dist = 0;
-            for (int i = 0; i < NUM_DIRS; i++) {
-                const dir_t dir = dirs[i];
-                // if ghost is in one of the two 'red zones', forbid upward movement
-                // (see Pacman Dossier "Areas To Exploit")
-                if (is_redzone(lookahead_pos) && (dir == DIR_UP) && (ghost->state != GHOSTSTATE_EYES)) {
-                    continue;
-                }
-                const dir_t revdir = reverse_dir(dir);
-                const int2_t test_pos = clamped_tile_pos(add_i2(lookahead_pos, dir_to_vec(dir)));
-                if ((revdir != ghost->actor.dir) && !is_blocking_tile(test_pos)) {
-                    if ((dist = squared_distance_i2(test_pos, ghost->target_pos)) < min_dist) {
-                        min_dist = dist;
-                        ghost->next_dir = dir;
-                    }
-                }
+            // take the direction that moves closest to the target, for fixed
+            // targets this decision has been precomputed
+            dir_t next_dir;
+            const int field = game_ghost_field(maze, ghost);
+            if (field >= 0) {
+                assert((lookahead_pos.x >= -1) && (lookahead_pos.x <= DISPLAY_TILES_X));
+                assert((lookahead_pos.y >= 0) && (lookahead_pos.y < DISPLAY_TILES_Y));
+                const uint16_t dirs = ctx->ghost_fields[field][lookahead_pos.y][lookahead_pos.x + 1];
+                next_dir = (dir_t)((dirs >> (ghost->actor.dir * 3)) & 7);
+            }
+            else {
+                next_dir = game_ghost_greedy_dir(ctx, lookahead_pos, ghost->actor.dir, ghost->target_pos, ghost->state != GHOSTSTATE_EYES);
+            }
+            if (next_dir != NUM_DIRS) {
+                ghost->next_dir = next_dir;
             }
         }
         return false;
@@ -2247,19 +3811,19 @@ static bool game_update_ghost_dir(ghost_t* ghost) {
     If pacman doesn't eat dots for a while, the next ghost is forced out of the
     house using a timer.
 */
-static void game_update_ghosthouse_dot_counters(void) {
+static void game_update_ghosthouse_dot_counters(game_ctx_t* ctx) {
     // if the new round was started because Pacman lost a life, use the global
     // dot counter (this mode will be deactivated again after all ghosts left the
     // house)
-    if (state.game.global_dot_counter_active) {
-        state.game.global_dot_counter++;
+    if (ctx->game.global_dot_counter_active) {
+        ctx->game.global_dot_counter++;
     }
     else {
         // otherwise each ghost has his own personal dot counter to decide
         // when to leave the ghost house
         for (int i = 0; i < NUM_GHOSTS; i++) {
-            if (state.game.ghost[i].dot_counter < state.game.ghost[i].dot_limit) {
-                state.game.ghost[i].dot_counter++;
+            if (ctx->game.ghost[i].dot_counter < ctx->game.ghost[i].dot_limit) {
+                ctx->game.ghost[i].dot_counter++;
                 break;
             }
         }
@@ -2269,218 +3833,207 @@ static void game_update_ghosthouse_dot_counters(void) {
 // called when a dot or pill has been eaten, checks if a round has been won
 // (all dots and pills eaten), whether to show the bonus fruit, and finally
 // plays the dot-eaten sound effect
-static void game_update_dots_eaten(void) {
-    state.game.num_dots_eaten++;
-    if (state.game.num_dots_eaten == NUM_DOTS) {
+static void game_update_dots_eaten(game_ctx_t* ctx) {
+    ctx->game.num_dots_eaten++;
+    if (ctx->game.num_dots_eaten == game_maze(ctx)->num_dots) {
         // all dots eaten, round won
-        start(&state.game.round_won);
-        snd_clear();
+        start(ctx, &ctx->game.round_won);
+        game_snd_clear(ctx);
+        TELEM(ctx, TELEM_ROUND_WON, 0, i2(0, 0), (uint32_t)ctx->game.num_lives);
     }
-    else if ((state.game.num_dots_eaten == 70) || (state.game.num_dots_eaten == 170)) {
+    else if ((ctx->game.num_dots_eaten == 70) || (ctx->game.num_dots_eaten == 170)) {
         // at 70 and 170 dots, show the bonus fruit
-        start(&state.game.fruit_active);
+        start(ctx, &ctx->game.fruit_active);
     }
 
     // play alternating crunch sound effect when a dot has been eaten
-    if (state.game.num_dots_eaten & 1) {
-        snd_start(2, &snd_eatdot1);
+    if (ctx->game.num_dots_eaten & 1) {
+        game_snd_start(ctx, 2, &snd_eatdot1);
     }
     else {
-        snd_start(2, &snd_eatdot2);
+        game_snd_start(ctx, 2, &snd_eatdot2);
     }
 }
 
-// the central Pacman and ghost behaviour function, called once per game tick
-static void game_update_actors(void) {
-    // Pacman "AI"
-    if (game_pacman_should_move() && state.game.player2) {
-        // move Pacman with cornering allowed
-        actor_t* actor1 = &state.game.pacman1.actor;
-        const dir_t wanted_dir = input_dir(actor1->dir);
-        const bool allow_cornering = true;
-        // look ahead to check if the wanted direction is blocked
-        if (can_move(actor1->pos, wanted_dir, allow_cornering)) {
-            actor1->dir = wanted_dir;
-        }
-        // move into the selected direction
-        if (can_move(actor1->pos, actor1->dir, allow_cornering)) {
-            actor1->pos = move(actor1->pos, actor1->dir, allow_cornering);
-            actor1->anim_tick++;
-        }
-        // eat dot or energizer pill?
-        const int2_t tile_pos = pixel_to_tile_pos(actor1->pos);
-        if (is_dot(tile_pos)) {
-            vid_tile(tile_pos, TILE_SPACE);
-            state.game.score += 1;
-            start(&state.game.dot_eaten);
-            start(&state.game.force_leave_house);
-            game_update_dots_eaten();
-            game_update_ghosthouse_dot_counters();
-        }
-        if (is_pill(tile_pos)) {
-            vid_tile(tile_pos, TILE_SPACE);
-            state.game.score += 5;
-            game_update_dots_eaten();
-            start(&state.game.pill_eaten);
-            state.game.num_ghosts_eaten = 0;
-            for (int i = 0; i < NUM_GHOSTS; i++) {
-                start(&state.game.ghost[i].frightened);
-            }
-            snd_start(1, &snd_frightened);
-        }
-        // check if Pacman eats the bonus fruit
-        if (state.game.active_fruit != FRUIT_NONE) {
-            const int2_t test_pos = pixel_to_tile_pos(add_i2(actor1->pos, i2(TILE_WIDTH/2, 0)));
-            if (equal_i2(test_pos, i2(14, 20))) {
-                start(&state.game.fruit_eaten);
-                uint32_t score = levelspec(state.game.round).bonus_score;
-                state.game.score += score;
-                vid_fruit_score(state.game.active_fruit);
-                state.game.active_fruit = FRUIT_NONE;
-                snd_start(2, &snd_eatfruit);
-                //Added by Tommy Pham
-                start(&state.game.pill_eaten);
-                state.game.num_ghosts_eaten = 0;
+// move one player with cornering allowed, and let it eat dots, pills and the bonus fruit
+static void game_update_player(game_ctx_t* ctx, int player) {
+    int2_t pos = i2(ctx->game.players.pos_x[player], ctx->game.players.pos_y[player]);
+    dir_t dir = (dir_t)ctx->game.players.dir[player];
+    const dir_t wanted_dir = input_player_dir(ctx, player, dir);
+    const bool allow_cornering = true;
+    // look ahead to check if the wanted direction is blocked
+    if (can_move(ctx, pos, wanted_dir, allow_cornering)) {
+        dir = wanted_dir;
+    }
+    // move into the selected direction
+    if (can_move(ctx, pos, dir, allow_cornering)) {
+        pos = move(pos, dir, allow_cornering);
+        ctx->game.players.anim_tick[player]++;
+    }
+    ctx->game.players.pos_x[player] = pos.x;
+    ctx->game.players.pos_y[player] = pos.y;
+    ctx->game.players.dir[player] = (uint8_t)dir;
+    // eat dot or energizer pill?
+    const int2_t tile_pos = pixel_to_tile_pos(pos);
+    if (is_dot(ctx, tile_pos)) {
+        vid_tile(ctx, tile_pos, TILE_SPACE);
+        ctx->game.score += 1;
+        start(ctx, &ctx->game.dot_eaten);
+        start(ctx, &ctx->game.force_leave_house);
+        TELEM(ctx, TELEM_DOT_EATEN, player, pos, ctx->game.num_dots_eaten + 1u);
+        game_update_dots_eaten(ctx);
+        game_update_ghosthouse_dot_counters(ctx);
+    }
+    if (is_pill(ctx, tile_pos)) {
+        vid_tile(ctx, tile_pos, TILE_SPACE);
+        ctx->game.score += 5;
+        TELEM(ctx, TELEM_PILL_EATEN, player, pos, ctx->game.num_dots_eaten + 1u);
+        game_update_dots_eaten(ctx);
+        start(ctx, &ctx->game.pill_eaten);
+        ctx->game.num_ghosts_eaten = 0;
+        for (int i = 0; i < NUM_GHOSTS; i++) {
+            start(ctx, &ctx->game.ghost[i].frightened);
+        }
+        game_snd_start(ctx, 1, &snd_frightened);
+    }
+    // check if Pacman eats the bonus fruit
+    if (ctx->game.active_fruit != FRUIT_NONE) {
+        const int2_t test_pos = pixel_to_tile_pos(add_i2(pos, i2(TILE_WIDTH/2, 0)));
+        if (equal_i2(test_pos, i2(14, 20))) {
+            start(ctx, &ctx->game.fruit_eaten);
+            TELEM(ctx, TELEM_FRUIT_EATEN, player, pos, ctx->game.active_fruit);
+            uint32_t score = levelspec(ctx->game.round).bonus_score;
+            ctx->game.score += score;
+            vid_fruit_score(ctx, ctx->game.active_fruit);
+            ctx->game.active_fruit = FRUIT_NONE;
+            game_snd_start(ctx, 2, &snd_eatfruit);
+            //Added by Tommy Pham
+            if (player == 0) {
+                start(ctx, &ctx->game.pill_eaten);
+                ctx->game.num_ghosts_eaten = 0;
                 for (int i = 0; i < NUM_GHOSTS; i++) {
-                    start(&state.game.ghost[i].frightened);
-
+                    start(ctx, &ctx->game.ghost[i].frightened);
                 }
-                snd_start(1, &snd_frightened);
-                
+                game_snd_start(ctx, 1, &snd_frightened);
             }
         }
-        // check if Pacman collides with any ghost
-        for (int i = 0; i < NUM_GHOSTS; i++) {
-            ghost_t* ghost = &state.game.ghost[i];
-            const int2_t ghost_tile_pos = pixel_to_tile_pos(ghost->actor.pos);
-            if (equal_i2(tile_pos, ghost_tile_pos)) {
-                if (ghost->state == GHOSTSTATE_FRIGHTENED) {
-                    // Pacman eats a frightened ghost
-                    ghost->state = GHOSTSTATE_EYES;
-                    start(&ghost->eaten);
-                    start(&state.game.ghost_eaten);
-                    state.game.num_ghosts_eaten++;
-                    // increase score by 20, 40, 80, 160
-                    state.game.score += 10 * (1<<state.game.num_ghosts_eaten);
-                    state.game.freeze |= FREEZETYPE_EAT_GHOST;
-                    snd_start(2, &snd_eatghost);
-                }
-                else if ((ghost->state == GHOSTSTATE_CHASE) || (ghost->state == GHOSTSTATE_SCATTER)) {
-                    // otherwise, ghost eats Pacman, Pacman loses a life
-                    #if !DBG_GODMODE
-                    snd_clear();
-                    start(&state.game.pacman_eaten);
-                    state.game.freeze |= FREEZETYPE_DEAD;
-                    // if Pacman has any lives left start a new round, otherwise start the game-over sequence
-                    if (state.game.num_lives > 0) {
-                        start_after(&state.game.ready_started, PACMAN_EATEN_TICKS+PACMAN_DEATH_TICKS);
-                    }
-                    else {
-                        start_after(&state.game.game_over, PACMAN_EATEN_TICKS+PACMAN_DEATH_TICKS);
-                    }
-                    #endif
-                }
+    }
+}
+
+// check the players which moved in this tick (a bit mask) for collisions with
+// the ghosts, only the players in the current game are visited
+static void game_update_player_collisions(game_ctx_t* ctx, uint32_t moved) {
+    const int num_players = ctx->game.num_players;
+    for (int i = 0; i < NUM_GHOSTS; i++) {
+        ghost_t* ghost = &ctx->game.ghost[i];
+        const int2_t ghost_tile_pos = pixel_to_tile_pos(ghost->actor.pos);
+        uint32_t hits = 0;
+        for (int p = 0; p < num_players; p++) {
+            if ((moved & (1u<<p)) &&
+                ((ctx->game.players.pos_x[p] / TILE_WIDTH) == ghost_tile_pos.x) &&
+                ((ctx->game.players.pos_y[p] / TILE_HEIGHT) == ghost_tile_pos.y))
+            {
+                hits |= 1u<<p;
+            }
+        }
+        if (0 == hits) {
+            continue;
+        }
+        if (ghost->state == GHOSTSTATE_FRIGHTENED) {
+            // Pacman eats a frightened ghost
+            ghost->state = GHOSTSTATE_EYES;
+            start(ctx, &ghost->eaten);
+            start(ctx, &ctx->game.ghost_eaten);
+            ctx->game.num_ghosts_eaten++;
+            TELEM(ctx, TELEM_GHOST_EATEN, ghost->type, ghost->actor.pos, ctx->game.num_ghosts_eaten);
+            // increase score by 20, 40, 80, 160
+            ctx->game.score += 10 * (1<<ctx->game.num_ghosts_eaten);
+            ctx->game.freeze |= FREEZETYPE_EAT_GHOST;
+            game_snd_start(ctx, 2, &snd_eatghost);
+        }
+        else if ((ghost->state == GHOSTSTATE_CHASE) || (ghost->state == GHOSTSTATE_SCATTER)) {
+            // otherwise, ghost eats Pacman, Pacman loses a life
+            #if !DBG_GODMODE
+            TELEM(ctx, TELEM_PACMAN_DEATH, ghost->type, ghost->actor.pos, hits);
+            game_snd_clear(ctx);
+            start(ctx, &ctx->game.pacman_eaten);
+            ctx->game.freeze |= FREEZETYPE_DEAD;
+            // if Pacman has any lives left start a new round, otherwise start the game-over sequence
+            if (ctx->game.num_lives > 0) {
+                start_after(ctx, &ctx->game.ready_started, PACMAN_EATEN_TICKS+PACMAN_DEATH_TICKS);
+            }
+            else {
+                start_after(ctx, &ctx->game.game_over, PACMAN_EATEN_TICKS+PACMAN_DEATH_TICKS);
             }
+            #endif
         }
     }
+}
 
-
-    if (game_pacman_should_move() && !state.game.player2) {
-        // move Pacman with cornering allowed
-        actor_t* actor2 = &state.game.pacman2.actor;
-        const dir_t wanted_dir = input_dir(actor2->dir);
-        const bool allow_cornering = true;
-        // look ahead to check if the wanted direction is blocked
-        if (can_move(actor2->pos, wanted_dir, allow_cornering)) {
-            actor2->dir = wanted_dir;
-        }
-        // move into the selected direction
-        if (can_move(actor2->pos, actor2->dir, allow_cornering)) {
-            actor2->pos = move(actor2->pos, actor2->dir, allow_cornering);
-            actor2->anim_tick++;
-        }
-        // eat dot or energizer pill?
-        const int2_t tile_pos = pixel_to_tile_pos(actor2->pos);
-        if (is_dot(tile_pos)) {
-            vid_tile(tile_pos, TILE_SPACE);
-            state.game.score += 1;
-            start(&state.game.dot_eaten);
-            start(&state.game.force_leave_house);
-            game_update_dots_eaten();
-            game_update_ghosthouse_dot_counters();
-        }
-        if (is_pill(tile_pos)) {
-            vid_tile(tile_pos, TILE_SPACE);
-            state.game.score += 5;
-            game_update_dots_eaten();
-            start(&state.game.pill_eaten);
-            state.game.num_ghosts_eaten = 0;
-            for (int i = 0; i < NUM_GHOSTS; i++) {
-                start(&state.game.ghost[i].frightened);
-            }
-            snd_start(1, &snd_frightened);
-        }
-        // check if Pacman eats the bonus fruit
-        if (state.game.active_fruit != FRUIT_NONE) {
-            const int2_t test_pos = pixel_to_tile_pos(add_i2(actor2->pos, i2(TILE_WIDTH / 2, 0)));
-            if (equal_i2(test_pos, i2(14, 20))) {
-                start(&state.game.fruit_eaten);
-                uint32_t score = levelspec(state.game.round).bonus_score;
-                state.game.score += score;
-                vid_fruit_score(state.game.active_fruit);
-                state.game.active_fruit = FRUIT_NONE;
-                snd_start(2, &snd_eatfruit);
+// find the player nearest to each ghost (the battle mode chase targets), the
+// squared tile distances to all players are computed in one pass per ghost,
+// on equal distance the lower player index wins
+static void game_nearest_players(game_ctx_t* ctx, uint8_t nearest[NUM_GHOSTS]) {
+    const int num_players = ctx->game.num_players;
+    int32_t tile_x[MAX_PLAYERS], tile_y[MAX_PLAYERS];
+    for (int p = 0; p < num_players; p++) {
+        tile_x[p] = ctx->game.players.pos_x[p] / TILE_WIDTH;
+        tile_y[p] = ctx->game.players.pos_y[p] / TILE_HEIGHT;
+    }
+    for (int i = 0; i < NUM_GHOSTS; i++) {
+        const int2_t ghost_tile_pos = pixel_to_tile_pos(ctx->game.ghost[i].actor.pos);
+        uint8_t best = 0;
+        int32_t best_dist = INT32_MAX;
+        for (int p = 0; p < num_players; p++) {
+            const int32_t dx = tile_x[p] - ghost_tile_pos.x;
+            const int32_t dy = tile_y[p] - ghost_tile_pos.y;
+            const int32_t dist = dx*dx + dy*dy;
+            if (dist < best_dist) {
+                best = (uint8_t)p;
+                best_dist = dist;
             }
         }
-        // check if Pacman collides with any ghost
-        for (int i = 0; i < NUM_GHOSTS; i++) {
-            ghost_t* ghost = &state.game.ghost[i];
-            const int2_t ghost_tile_pos = pixel_to_tile_pos(ghost->actor.pos);
-            if (equal_i2(tile_pos, ghost_tile_pos)) {
-                if (ghost->state == GHOSTSTATE_FRIGHTENED) {
-                    // Pacman eats a frightened ghost
-                    ghost->state = GHOSTSTATE_EYES;
-                    start(&ghost->eaten);
-                    start(&state.game.ghost_eaten);
-                    state.game.num_ghosts_eaten++;
-                    // increase score by 20, 40, 80, 160
-                    state.game.score += 10 * (1 << state.game.num_ghosts_eaten);
-                    state.game.freeze |= FREEZETYPE_EAT_GHOST;
-                    snd_start(2, &snd_eatghost);
-                }
-                else if ((ghost->state == GHOSTSTATE_CHASE) || (ghost->state == GHOSTSTATE_SCATTER)) {
-                    // otherwise, ghost eats Pacman, Pacman loses a life
-#if !DBG_GODMODE
-                    snd_clear();
-                    start(&state.game.pacman_eaten);
-                    state.game.freeze |= FREEZETYPE_DEAD;
-                    // if Pacman has any lives left start a new round, otherwise start the game-over sequence
-                    if (state.game.num_lives > 0) {
-                        start_after(&state.game.ready_started, PACMAN_EATEN_TICKS + PACMAN_DEATH_TICKS);
-                    }
-                    else {
-                        start_after(&state.game.game_over, PACMAN_EATEN_TICKS + PACMAN_DEATH_TICKS);
-                    }
-#endif
-                }
+        nearest[i] = best;
+    }
+}
+
+// the central Pacman and ghost behaviour function, called once per game tick
+static void game_update_actors(game_ctx_t* ctx) {
+    // Pacman "AI", in the regular game only the player who pressed a key
+    // last moves, in battle mode all players move at the same time
+    if (game_pacman_should_move(ctx)) {
+        uint32_t moved = 0;
+        if (ctx->game.battle) {
+            for (int p = 0; p < ctx->game.num_players; p++) {
+                game_update_player(ctx, p);
+                moved |= 1u<<p;
             }
         }
+        else {
+            game_update_player(ctx, ctx->game.active_player);
+            moved = 1u<<ctx->game.active_player;
+        }
+        game_update_player_collisions(ctx, moved);
     }
 
     // Ghost "AIs"
+    uint8_t nearest[NUM_GHOSTS] = { 0 };
+    if (ctx->game.battle) {
+        game_nearest_players(ctx, nearest);
+    }
     for (int ghost_index = 0; ghost_index < NUM_GHOSTS; ghost_index++) {
-        ghost_t* ghost = &state.game.ghost[ghost_index];
+        ghost_t* ghost = &ctx->game.ghost[ghost_index];
         // handle ghost-state transitions
-        game_update_ghost_state(ghost);
+        game_update_ghost_state(ctx, ghost);
         // update the ghost's target position
-        game_update_ghost_target(ghost);
+        game_update_ghost_target(ctx, ghost, nearest[ghost_index]);
         // finally, move the ghost towards the current target position
-        const int num_move_ticks = game_ghost_speed(ghost);
+        const int num_move_ticks = game_ghost_speed(ctx, ghost);
         for (int i = 0; i < num_move_ticks; i++) {
-            bool force_move = game_update_ghost_dir(ghost);
+            bool force_move = game_update_ghost_dir(ctx, ghost);
             actor_t* actor = &ghost->actor;
             const bool allow_cornering = false;
-            if (force_move || can_move(actor->pos, actor->dir, allow_cornering)) {
+            if (force_move || can_move(ctx, actor->pos, actor->dir, allow_cornering)) {
                 actor->pos = move(actor->pos, actor->dir, allow_cornering);
                 actor->anim_tick++;
             }
@@ -2489,7 +4042,7 @@ static void game_update_actors(void) {
 }
 
 // the central game tick function, called at 60 Hz
-static void game_tick(void) {
+static void game_tick(game_ctx_t* ctx) {
     // debug: skip prelude
     #if DBG_SKIP_PRELUDE
         const int prelude_ticks_per_sec = 1;
@@ -2498,88 +4051,94 @@ static void game_tick(void) {
     #endif
 
     // initialize game state once
-    if (now(state.game.started)) {
-        start(&state.gfx.fadein);
-        start_after(&state.game.ready_started, 2*prelude_ticks_per_sec);
-        snd_start(0, &snd_prelude);
-        game_init();
+    if (now(ctx, ctx->game.started)) {
+        start(ctx, &ctx->vid.fadein);
+        start_after(ctx, &ctx->game.ready_started, 2*prelude_ticks_per_sec);
+        game_snd_start(ctx, 0, &snd_prelude);
+        game_init(ctx);
     }
     // initialize new round (each time Pacman looses a life), make actors visible, remove "PLAYER ONE", start a new life
-    if (now(state.game.ready_started)) {
-        game_round_init();
+    if (now(ctx, ctx->game.ready_started)) {
+        game_round_init(ctx);
         // after 2 seconds start the interactive game loop
-        start_after(&state.game.round_started, 2*60+10);
+        start_after(ctx, &ctx->game.round_started, 2*60+10);
     }
-    if (now(state.game.round_started)) {
-        state.game.freeze &= ~FREEZETYPE_READY;
+    if (now(ctx, ctx->game.round_started)) {
+        ctx->game.freeze &= ~FREEZETYPE_READY;
         // clear the 'READY!' message
-        vid_color_text(i2(11,20), 0x10, "      ");
-        snd_start(1, &snd_weeooh);
+        vid_color_text(ctx, i2(11,20), 0x10, "      ");
+        game_snd_start(ctx, 1, &snd_weeooh);
     }
 
     // activate/deactivate bonus fruit
-    if (now(state.game.fruit_active)) {
-        state.game.active_fruit = levelspec(state.game.round).bonus_fruit;
+    if (now(ctx, ctx->game.fruit_active)) {
+        ctx->game.active_fruit = levelspec(ctx->game.round).bonus_fruit;
     }
-    else if (after_once(state.game.fruit_active, FRUITACTIVE_TICKS)) {
-        state.game.active_fruit = FRUIT_NONE;
+    else if (after_once(ctx, ctx->game.fruit_active, FRUITACTIVE_TICKS)) {
+        ctx->game.active_fruit = FRUIT_NONE;
     }
 
     // stop frightened sound and start weeooh sound
-    if (after_once(state.game.pill_eaten, levelspec(state.game.round).fright_ticks)) {
-        snd_start(1, &snd_weeooh);
+    if (after_once(ctx, ctx->game.pill_eaten, levelspec(ctx->game.round).fright_ticks)) {
+        game_snd_start(ctx, 1, &snd_weeooh);
     }
 
     // if game is frozen because Pacman ate a ghost, unfreeze after a while
-    if (state.game.freeze & FREEZETYPE_EAT_GHOST) {
-        if (after_once(state.game.ghost_eaten, GHOST_EATEN_FREEZE_TICKS)) {
-            state.game.freeze &= ~FREEZETYPE_EAT_GHOST;
+    if (ctx->game.freeze & FREEZETYPE_EAT_GHOST) {
+        if (after_once(ctx, ctx->game.ghost_eaten, GHOST_EATEN_FREEZE_TICKS)) {
+            ctx->game.freeze &= ~FREEZETYPE_EAT_GHOST;
         }
     }
 
     // play pacman-death sound
-    if (after_once(state.game.pacman_eaten, PACMAN_EATEN_TICKS)) {
-        snd_start(2, &snd_dead);
+    if (after_once(ctx, ctx->game.pacman_eaten, PACMAN_EATEN_TICKS)) {
+        game_snd_start(ctx, 2, &snd_dead);
     }
 
     // the actually important part: update Pacman and ghosts, update dynamic
     // background tiles, and update the sprite images
-    if (!state.game.freeze) {
-        game_update_actors();
-    }
-    game_update_tiles();
-    game_update_sprites();
+    if (!ctx->game.freeze) {
+        PROF_BEGIN(PROF_ACTORS);
+        game_update_actors(ctx);
+        PROF_END(PROF_ACTORS);
+    }
+    PROF_BEGIN(PROF_TILES);
+    game_update_tiles(ctx);
+    PROF_END(PROF_TILES);
+    PROF_BEGIN(PROF_SPRITES);
+    game_update_sprites(ctx);
+    PROF_END(PROF_SPRITES);
 
     // update hiscore
-    if (state.game.score > state.game.hiscore) {
-        state.game.hiscore = state.game.score;
+    if (ctx->game.score > ctx->game.hiscore) {
+        ctx->game.hiscore = ctx->game.score;
     }
 
     // check for end-round condition
-    if (now(state.game.round_won)) {
-        state.game.freeze |= FREEZETYPE_WON;
-        start_after(&state.game.ready_started, ROUNDWON_TICKS);
+    if (now(ctx, ctx->game.round_won)) {
+        ctx->game.freeze |= FREEZETYPE_WON;
+        start_after(ctx, &ctx->game.ready_started, ROUNDWON_TICKS);
     }
-    if (now(state.game.game_over)) {
+    if (now(ctx, ctx->game.game_over)) {
         // display game over string
-        vid_color_text(i2(9,20), 0x01, "GAME  OVER");
-        input_disable();
-        start_after(&state.gfx.fadeout, GAMEOVER_TICKS);
-        start_after(&state.intro.started, GAMEOVER_TICKS+FADE_TICKS);
+        vid_color_text(ctx, i2(9,20), 0x01, "GAME  OVER");
+        input_disable(ctx);
+        start_after(ctx, &ctx->vid.fadeout, GAMEOVER_TICKS);
+        start_after(ctx, &ctx->intro.started, GAMEOVER_TICKS+FADE_TICKS);
     }
 
     #if DBG_ESCAPE
-        if (state.input1.esc) {
-            input_disable();
-            start(&state.gfx.fadeout);
-            start_after(&state.intro.started, FADE_TICKS);
+        if (ctx->input1.esc) {
+            input_disable(ctx);
+            start(ctx, &ctx->vid.fadeout);
+            start_after(ctx, &ctx->intro.started, FADE_TICKS);
         }
     #endif
 
     #if DBG_MARKERS
         // visualize current ghost targets
         for (int i = 0; i < NUM_GHOSTS; i++) {
-            const ghost_t* ghost = &state.game.ghost[i];
+            const ghost_t* ghost = &ctx->game.ghost[i];
             uint8_t tile = 'X';
             switch (ghost->state) {
                 case GHOSTSTATE_NONE:       tile = 'N'; break;
@@ -2591,29 +4150,32 @@ static void game_tick(void) {
                 case GHOSTSTATE_LEAVEHOUSE: tile = 'L'; break;
                 case GHOSTSTATE_ENTERHOUSE: tile = 'E'; break;
             }
-            dbg_marker(i, state.game.ghost[i].target_pos, tile, COLOR_BLINKY+2*i);
+            dbg_marker(ctx, i, ctx->game.ghost[i].target_pos, tile, COLOR_BLINKY+2*i);
         }
     #endif
 }
 
+#endif // !PACMAN_ATLASGEN
+
 /*== INTRO GAMESTATE CODE ====================================================*/
+#if !PACMAN_ATLASGEN
 
-static void intro_tick(void) {
+static void intro_tick(game_ctx_t* ctx) {
 
     // on intro-state enter, enable input and draw any initial text
-    if (now(state.intro.started)) {
-        snd_clear();
-        spr_clear();
-        start(&state.gfx.fadein);
-        input_enable();
-        vid_clear(TILE_SPACE, COLOR_DEFAULT);
-        vid_text(i2(3,0),  "1UP   HIGH SCORE   2UP");
-        vid_color_score(i2(6,1), COLOR_DEFAULT, 0);
-        if (state.game.hiscore > 0) {
-            vid_color_score(i2(16,1), COLOR_DEFAULT, state.game.hiscore);
+    if (now(ctx, ctx->intro.started)) {
+        game_snd_clear(ctx);
+        spr_clear(ctx);
+        start(ctx, &ctx->vid.fadein);
+        input_enable(ctx);
+        vid_clear(ctx, TILE_SPACE, COLOR_DEFAULT);
+        vid_text(ctx, i2(3,0),  "1UP   HIGH SCORE   2UP");
+        vid_color_score(ctx, i2(6,1), COLOR_DEFAULT, 0);
+        if (ctx->game.hiscore > 0) {
+            vid_color_score(ctx, i2(16,1), COLOR_DEFAULT, ctx->game.hiscore);
         }
-        vid_text(i2(7,5),  "CHARACTER / NICKNAME");
-        vid_text(i2(3,35), "CREDIT  0");
+        vid_text(ctx, i2(7,5),  "CHARACTER / NICKNAME");
+        vid_text(ctx, i2(3,35), "CREDIT  0");
     }
 
     // draw the animated 'ghost image.. name.. nickname' lines
@@ -2626,163 +4188,4118 @@ static void intro_tick(void) {
         const uint8_t y = 3*i + 6;
         // 2*3 ghost image created from tiles (no sprite!)
         delay += 30;
-        if (after_once(state.intro.started, delay)) {
-            vid_color_tile(i2(4,y+0), color, TILE_GHOST+0); vid_color_tile(i2(5,y+0), color, TILE_GHOST+1);
-            vid_color_tile(i2(4,y+1), color, TILE_GHOST+2); vid_color_tile(i2(5,y+1), color, TILE_GHOST+3);
-            vid_color_tile(i2(4,y+2), color, TILE_GHOST+4); vid_color_tile(i2(5,y+2), color, TILE_GHOST+5);
+        if (after_once(ctx, ctx->intro.started, delay)) {
+            vid_color_tile(ctx, i2(4,y+0), color, TILE_GHOST+0); vid_color_tile(ctx, i2(5,y+0), color, TILE_GHOST+1);
+            vid_color_tile(ctx, i2(4,y+1), color, TILE_GHOST+2); vid_color_tile(ctx, i2(5,y+1), color, TILE_GHOST+3);
+            vid_color_tile(ctx, i2(4,y+2), color, TILE_GHOST+4); vid_color_tile(ctx, i2(5,y+2), color, TILE_GHOST+5);
         }
         // after 1 second, the name of the ghost
         delay += 60;
-        if (after_once(state.intro.started, delay)) {
-            vid_color_text(i2(7,y+1), color, names[i]);
+        if (after_once(ctx, ctx->intro.started, delay)) {
+            vid_color_text(ctx, i2(7,y+1), color, names[i]);
         }
         // after 0.5 seconds, the nickname of the ghost
         delay += 30;
-        if (after_once(state.intro.started, delay)) {
-            vid_color_text(i2(17,y+1), color, nicknames[i]);
+        if (after_once(ctx, ctx->intro.started, delay)) {
+            vid_color_text(ctx, i2(17,y+1), color, nicknames[i]);
         }
     }
 
     // . 10 PTS
     // O 50 PTS
     delay += 60;
-    if (after_once(state.intro.started, delay)) {
-        vid_color_tile(i2(10,24), COLOR_DOT, TILE_DOT);
-        vid_text(i2(12,24), "10 \x5D\x5E\x5F");
-        vid_color_tile(i2(10,26), COLOR_DOT, TILE_PILL);
-        vid_text(i2(12,26), "50 \x5D\x5E\x5F");
+    if (after_once(ctx, ctx->intro.started, delay)) {
+        vid_color_tile(ctx, i2(10,24), COLOR_DOT, TILE_DOT);
+        vid_text(ctx, i2(12,24), "10 \x5D\x5E\x5F");
+        vid_color_tile(ctx, i2(10,26), COLOR_DOT, TILE_PILL);
+        vid_text(ctx, i2(12,26), "50 \x5D\x5E\x5F");
 
-        vid_color_text(i2(1, 29), 3, "PRESS L TO LEARN THE RULES");
+        vid_color_text(ctx, i2(1, 29), 3, "PRESS L TO LEARN THE RULES");
     }
 
     // blinking "press any key" text
     delay += 60;
-    if (after(state.intro.started, delay)) {
-        if (since(state.intro.started) & 0x20) {
-            vid_color_text(i2(3,31), 3, "                       ");
+    if (after(ctx, ctx->intro.started, delay)) {
+        if (since(ctx, ctx->intro.started) & 0x20) {
+            vid_color_text(ctx, i2(3,31), 3, "                       ");
         }
         else {
-            vid_color_text(i2(3,31), 3, "PRESS ANY KEY TO START!");
+            vid_color_text(ctx, i2(3,31), 3, "PRESS ANY KEY TO START!");
         }
     }
 
     // FIXME: animated chase sequence
 
     // if a key is pressed, advance to game state
-    if (state.input1.anykey) {
-        input_disable();
-        start(&state.gfx.fadeout);
-        start_after(&state.game.started, FADE_TICKS);
+    if (ctx->input1.anykey) {
+        input_disable(ctx);
+        start(ctx, &ctx->vid.fadeout);
+        start_after(ctx, &ctx->game.started, FADE_TICKS);
     }
 
-    if (state.input1.l) {
-        vid_color_text(i2(3, 5), 3, "RULES AN ADDED FEATURES");
+    if (ctx->input1.l) {
+        vid_color_text(ctx, i2(3, 5), 3, "RULES AN ADDED FEATURES");
 
         for (int i = 0; i <= 30; i++) {
-            vid_color_text(i2(1, i), 4, "                              ");
+            vid_color_text(ctx, i2(1, i), 4, "                              ");
         }
-        vid_color_text(i2(0, 7), 3, "THIS UPDATE HAS A MULTLI-");
-        vid_color_text(i2(0, 9), 3, "PLAYER FEATURE WHERE ONE");
-        vid_color_text(i2(0, 11), 3, "PLAYER USES THE ARROW KEYS");
-        vid_color_text(i2(0, 13), 3, "AND THE OTHER USES TEH WASD");
-        vid_color_text(i2(0, 15), 3, "KEYS! THERE ARE ALSO POWER-");
-        vid_color_text(i2(0, 17), 3, "UPS SO THE PLAYER USING THE");
-        vid_color_text(i2(0, 19), 3, "WASD KEYS GETS THE FRUIT");
-        vid_color_text(i2(0, 21), 3, "BONUS POWERUP WHILE THE");
-        vid_color_text(i2(0, 23), 3, "PLAYER WITH THE ARROW KEYS");
-        vid_color_text(i2(0, 25), 3, "GETS THE REGULAR FRUITS");
-        vid_color_text(i2(0, 27), 3, "POWERUP! THE ESC KEY EXITS");
-        vid_color_text(i2(0, 29), 3, "THE GAME");
+        vid_color_text(ctx, i2(0, 7), 3, "THIS UPDATE HAS A MULTLI-");
+        vid_color_text(ctx, i2(0, 9), 3, "PLAYER FEATURE WHERE ONE");
+        vid_color_text(ctx, i2(0, 11), 3, "PLAYER USES THE ARROW KEYS");
+        vid_color_text(ctx, i2(0, 13), 3, "AND THE OTHER USES TEH WASD");
+        vid_color_text(ctx, i2(0, 15), 3, "KEYS! THERE ARE ALSO POWER-");
+        vid_color_text(ctx, i2(0, 17), 3, "UPS SO THE PLAYER USING THE");
+        vid_color_text(ctx, i2(0, 19), 3, "WASD KEYS GETS THE FRUIT");
+        vid_color_text(ctx, i2(0, 21), 3, "BONUS POWERUP WHILE THE");
+        vid_color_text(ctx, i2(0, 23), 3, "PLAYER WITH THE ARROW KEYS");
+        vid_color_text(ctx, i2(0, 25), 3, "GETS THE REGULAR FRUITS");
+        vid_color_text(ctx, i2(0, 27), 3, "POWERUP! THE ESC KEY EXITS");
+        vid_color_text(ctx, i2(0, 29), 3, "THE GAME");
     }
 
 }
 
-/*== GFX SUBSYSTEM ===========================================================*/
-////////////////////////IMAGES AND PIXELING/////////////////////////////////////////
-/* create all sokol-gfx resources */
-static void gfx_create_resources(void) {
-    // pass action for clearing the background to black
-    state.gfx.pass_action = (sg_pass_action) {
-        .colors[0] = { .load_action = SG_LOADACTION_CLEAR, .clear_value = { 0.0f, 0.0f, 0.0f, 1.0f } }
+#endif // !PACMAN_ATLASGEN
+
+/*== LEVEL PACKS =============================================================*/
+#if !PACMAN_ATLASGEN
+/*
+    A level pack holds the mazes of a game, and the level specifications
+    which pick the bonus fruit, fright time and maze of each round.
+    Everything the game derives from a maze (the tile and color codes, the
+    navigation tables, the ghost direction fields, the ghost house positions
+    and the scatter targets) is decoded when the pack is built, so starting
+    a round in a new maze only copies a few KBytes (see game_init_playfield()).
+
+    A level pack file is the in-memory layout of the records (all values
+    little-endian), and is used in place after mapping it into memory with
+    mmap() or MapViewOfFile(), the WASM version loads it with a single fetch:
+
+        levelpack_header_t
+        maze_t[num_mazes]
+        levelspec_t[num_levels]
+
+    The record sizes in the header reject files written with a different
+    record layout, and the hash rejects damaged files. Without a level pack
+    file, the built-in pack with the classic maze and the level table from
+    the Pacman Dossier is used, which is decoded once at startup.
+
+    The headless runner writes level packs from ASCII mazes in the same
+    format as the built-in maze below (31 lines of 28 characters, lines
+    starting with '#' are ignored), the ghost house, tunnel and starting
+    positions are those of the classic maze, and the mazes take turns
+    round by round:
+
+        pacman_headless -write-levels out.lvl -maze a.txt -maze b.txt
+        pacman -levels out.lvl
+
+    All games of a process use the same level pack, the pack's hash is
+    stored in replay files and sent in each netplay packet, so that replays
+    and networked games are refused with a different pack.
+*/
+
+// the classic maze as ASCII map
+static const char levelpack_classic_maze[MAZE_TILES_Y * DISPLAY_TILES_X + 1] =
+   //0123456789012345678901234567
+    "0UUUUUUUUUUUU45UUUUUUUUUUUU1" // 3
+    "L............rl............R" // 4
+    "L.ebbf.ebbbf.rl.ebbbf.ebbf.R" // 5
+    "LPr  l.r   l.rl.r   l.r  lPR" // 6
+    "L.guuh.guuuh.gh.guuuh.guuh.R" // 7
+    "L..........................R" // 8
+    "L.ebbf.ef.ebbbbbbf.ef.ebbf.R" // 9
+    "L.guuh.rl.guuyxuuh.rl.guuh.R" // 10
+    "L......rl....rl....rl......R" // 11
+    "2BBBBf.rzbbf rl ebbwl.eBBBB3" // 12
+    "     L.rxuuh gh guuyl.R     " // 13
+    "     L.rl          rl.R     " // 14
+    "     L.rl mjs--tjn rl.R     " // 15
+    "UUUUUh.gh i      q gh.gUUUUU" // 16
+    "      .   i      q   .      " // 17
+    "BBBBBf.ef i      q ef.eBBBBB" // 18
+    "     L.rl okkkkkkp rl.R     " // 19
+    "     L.rl          rl.R     " // 20
+    "     L.rl ebbbbbbf rl.R     " // 21
+    "0UUUUh.gh guuyxuuh gh.gUUUU1" // 22
+    "L............rl............R" // 23
+    "L.ebbf.ebbbf.rl.ebbbf.ebbf.R" // 24
+    "L.guyl.guuuh.gh.guuuh.rxuh.R" // 25
+    "LP..rl.......  .......rl..PR" // 26
+    "6bf.rl.ef.ebbbbbbf.ef.rl.eb8" // 27
+    "7uh.gh.rl.guuyxuuh.rl.gh.gu9" // 28
+    "L......rl....rl....rl......R" // 29
+    "L.ebbbbwzbbf.rl.ebbwzbbbbf.R" // 30
+    "L.guuuuuuuuh.gh.guuuuuuuuh.R" // 31
+    "L..........................R" // 32
+    "2BBBBBBBBBBBBBBBBBBBBBBBBBB3"; // 33
+   //0123456789012345678901234567
+
+static maze_t levelpack_builtin_maze;
+
+// FNV-1a hash over the records of a level pack, continuing from a
+// previous hash (or LEVELPACK_HASH_SEED) so the records can be hashed piecewise
+static uint64_t levelpack_hash(uint64_t hash, const void* ptr, size_t num_bytes) {
+    const uint8_t* bytes = (const uint8_t*) ptr;
+    for (size_t i = 0; i < num_bytes; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3;
+    }
+    return hash;
+}
+
+// build everything which is derived from a maze's tiles and positions,
+// the navigation tables are built on a scratch game instance showing
+// only the maze (the other tile rows never block), and the ghost fields
+// from the navigation tables
+static void levelpack_derive_maze(maze_t* maze) {
+    static game_ctx_t scratch;
+    memset(&scratch, 0, sizeof(scratch));
+    vid_clear(&scratch, TILE_SPACE, COLOR_DOT);
+    memcpy(&scratch.vid.video_ram[MAZE_FIRST_ROW], maze->tiles, sizeof(maze->tiles));
+    game_init_nav(&scratch, maze->nav[MAZENAV_DRAWN]);
+    game_clear_player_text(&scratch);
+    game_init_nav(&scratch, maze->nav[MAZENAV_CLEARED]);
+    for (int i = 0; i < NUM_MAZENAVS; i++) {
+        scratch.nav = maze->nav[i];
+        game_init_ghost_fields(&scratch, maze, maze->ghost_fields[i]);
+    }
+}
+
+// check that a position in pixel coordinates is inside the maze rows
+static bool levelpack_valid_pixel_pos(int2_t pos) {
+    return (pos.x >= 0) && (pos.x < (DISPLAY_TILES_X * TILE_WIDTH)) &&
+           (pos.y >= (MAZE_FIRST_ROW * TILE_HEIGHT)) && (pos.y < ((MAZE_FIRST_ROW + MAZE_TILES_Y) * TILE_HEIGHT));
+}
+
+// flood-fill a navigation table from the starting positions of Pacman, the
+// ghosts and the ghost house door, the reachable tiles may only touch the
+// maze's border in the teleport tunnel
+static bool levelpack_valid_nav(const maze_t* maze, mazenav_t nav_index) {
+    bool visited[DISPLAY_TILES_Y][DISPLAY_TILES_X] = { { false } };
+    int2_t stack[DISPLAY_TILES_Y * DISPLAY_TILES_X];
+    int num_stack = 0;
+    const int2_t start_pos[] = {
+        maze->pacman_start, maze->house_door,
+        maze->ghost_start[0], maze->ghost_start[1], maze->ghost_start[2], maze->ghost_start[3],
     };
+    for (size_t i = 0; i < sizeof(start_pos) / sizeof(start_pos[0]); i++) {
+        const int2_t pos = pixel_to_tile_pos(start_pos[i]);
+        if (!visited[pos.y][pos.x]) {
+            visited[pos.y][pos.x] = true;
+            stack[num_stack++] = pos;
+        }
+    }
+    while (num_stack > 0) {
+        const int2_t pos = stack[--num_stack];
+        const bool border_x = (pos.x == 0) || (pos.x == (DISPLAY_TILES_X - 1));
+        const bool border_y = (pos.y <= MAZE_FIRST_ROW) || (pos.y >= (MAZE_FIRST_ROW + MAZE_TILES_Y - 1));
+        if (border_y || (border_x && (pos.y != maze->tunnel_y))) {
+            return false;
+        }
+        for (int dir = 0; dir < NUM_DIRS; dir++) {
+            const int2_t next_pos = add_i2(pos, dir_to_vec((dir_t)dir));
+            // the tunnel exits wrap around to the other side
+            if ((maze->nav[nav_index][pos.y][pos.x + 1] & (1<<dir)) && valid_tile_pos(next_pos) && !visited[next_pos.y][next_pos.x]) {
+                visited[next_pos.y][next_pos.x] = true;
+                stack[num_stack++] = next_pos;
+            }
+        }
+    }
+    return true;
+}
 
-    // create a dynamic vertex buffer for the tile and sprite quads
-    state.gfx.offscreen.vbuf = sg_make_buffer(&(sg_buffer_desc){
-        .type = SG_BUFFERTYPE_VERTEXBUFFER,
-        .usage = SG_USAGE_STREAM,
-        .size = sizeof(state.gfx.vertices),
-    });
+/* check that a maze can be used without further range checks:
 
-    // create a simple quad vertex buffer for rendering the offscreen render target to the display
-    float quad_verts[]= { 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f };
-    state.gfx.display.quad_vbuf = sg_make_buffer(&(sg_buffer_desc){
-        .data = SG_RANGE(quad_verts)
-    });
+    - the positions are inside the maze (the scatter targets and the eyes
+      target anywhere on the display), and the tunnel is in a maze row
+    - num_dots matches the dots and pills in the tiles
+    - the READY! and GAME OVER text doesn't overwrite walls (the navigation
+      tables don't change when it does)
+    - the navigation tables only hold NAV_* flags, and the ghost fields
+      only directions (or NUM_DIRS where no direction is possible)
+    - all tiles reachable from the starting positions stay inside the maze
 
-    // shader sources for all platforms (FIXME: should we use precompiled shader blobs instead?)
-    const char* offscreen_vs_src = 0;
-    const char* offscreen_fs_src = 0;
-    const char* display_vs_src = 0;
-    const char* display_fs_src = 0;
-    switch (sg_query_backend()) {
-        case SG_BACKEND_METAL_MACOS:
-            offscreen_vs_src =
-                "#include <metal_stdlib>\n"
-                "using namespace metal;\n"
-                "struct vs_in {\n"
-                "  float4 pos [[attribute(0)]];\n"
-                "  float2 uv [[attribute(1)]];\n"
-                "  float4 data [[attribute(2)]];\n"
-                "};\n"
-                "struct vs_out {\n"
-                "  float4 pos [[position]];\n"
-                "  float2 uv;\n"
-                "  float4 data;\n"
-                "};\n"
-                "vertex vs_out _main(vs_in in [[stage_in]]) {\n"
-                "  vs_out out;\n"
-                "  out.pos = float4((in.pos.xy - 0.5) * float2(2.0, -2.0), 0.5, 1.0);\n"
-                "  out.uv  = in.uv;"
-                "  out.data = in.data;\n"
-                "  return out;\n"
-                "}\n";
-            offscreen_fs_src =
-                "#include <metal_stdlib>\n"
-                "using namespace metal;\n"
-                "struct ps_in {\n"
-                "  float2 uv;\n"
-                "  float4 data;\n"
-                "};\n"
-                "fragment float4 _main(ps_in in [[stage_in]],\n"
-                "                      texture2d<float> tile_tex [[texture(0)]],\n"
-                "                      texture2d<float> pal_tex [[texture(1)]],\n"
-                "                      sampler tile_smp [[sampler(0)]],\n"
-                "                      sampler pal_smp [[sampler(1)]])\n"
-                "{\n"
-                "  float color_code = in.data.x;\n" // (0..31) / 255
-                "  float tile_color = tile_tex.sample(tile_smp, in.uv).x;\n" // (0..3) / 255
-                "  float2 pal_uv = float2(color_code * 4 + tile_color, 0);\n"
-                "  float4 color = pal_tex.sample(pal_smp, pal_uv) * float4(1, 1, 1, in.data.y);\n"
-                "  return color;\n"
-                "}\n";
-            display_vs_src =
-                "#include <metal_stdlib>\n"
-                "using namespace metal;\n"
-                "struct vs_in {\n"
-                "  float4 pos [[attribute(0)]];\n"
-                "};\n"
-                "struct vs_out {\n"
-                "  float4 pos [[position]];\n"
-                "  float2 uv;\n"
-                "};\n"
-                "vertex vs_out _main(vs_in in[[stage_in]]) {\n"
-                "  vs_out out;\n"
-                "  out.pos = float4((in.pos.xy - 0.5) * float2(2.0, -2.0), 0.0, 1.0);\n"
-                "  out.uv = in.pos.xy;\n"
-                "  return out;\n"
-                "}\n";
-            display_fs_src =
-                "#include <metal_stdlib>\n"
+   The tables are used as stored, the pack's hash already rejects damaged
+   files, and actors only move where the navigation table allows.
+*/
+static bool levelpack_valid_maze(const maze_t* maze) {
+    bool valid = levelpack_valid_pixel_pos(maze->pacman_start) &&
+        levelpack_valid_pixel_pos(maze->house_door) &&
+        valid_tile_pos(maze->eyes_target) &&
+        (maze->tunnel_y >= MAZE_FIRST_ROW) && (maze->tunnel_y < (MAZE_FIRST_ROW + MAZE_TILES_Y)) &&
+        (maze->tunnel_left < maze->tunnel_right) && (maze->tunnel_right < DISPLAY_TILES_X);
+    for (int i = 0; i < NUM_GHOSTS; i++) {
+        valid = valid &&
+            levelpack_valid_pixel_pos(maze->ghost_start[i]) &&
+            levelpack_valid_pixel_pos(maze->ghost_house_target[i]) &&
+            valid_tile_pos(maze->scatter_target[i]);
+    }
+    if (!valid) {
+        return false;
+    }
+    int num_dots = 0;
+    for (int y = 0; y < MAZE_TILES_Y; y++) {
+        for (int x = 0; x < DISPLAY_TILES_X; x++) {
+            if ((maze->tiles[y][x] == TILE_DOT) || (maze->tiles[y][x] == TILE_PILL)) {
+                num_dots++;
+            }
+        }
+    }
+    if ((num_dots == 0) || (num_dots != maze->num_dots)) {
+        return false;
+    }
+    for (int x = 9; x <= 18; x++) {
+        if (maze->tiles[20 - MAZE_FIRST_ROW][x] >= 0xC0) {
+            return false;
+        }
+    }
+    const uint8_t* nav = &maze->nav[0][0][0];
+    for (size_t i = 0; i < sizeof(maze->nav); i++) {
+        if (nav[i] & ~(NAV_EXIT_RIGHT|NAV_EXIT_DOWN|NAV_EXIT_LEFT|NAV_EXIT_UP|NAV_REDZONE)) {
+            return false;
+        }
+    }
+    const uint16_t* fields = &maze->ghost_fields[0][0][0][0];
+    for (size_t i = 0; i < (sizeof(maze->ghost_fields) / sizeof(uint16_t)); i++) {
+        if (fields[i] >> (NUM_DIRS * 3)) {
+            return false;
+        }
+        for (int dir = 0; dir < NUM_DIRS; dir++) {
+            if (((fields[i] >> (dir * 3)) & 7) > NUM_DIRS) {
+                return false;
+            }
+        }
+    }
+    return levelpack_valid_nav(maze, MAZENAV_DRAWN) && levelpack_valid_nav(maze, MAZENAV_CLEARED);
+}
+
+// decode an ASCII maze into tile codes, and precompute everything which
+// is derived from it, returns false if the maze isn't valid
+static bool levelpack_decode_maze(maze_t* maze, const char* ascii) {
+    uint8_t t[128];
+    for (int i = 0; i < 128; i++) { t[i]=TILE_DOT; }
+    t[' ']=0x40; t['0']=0xD1; t['1']=0xD0; t['2']=0xD5; t['3']=0xD4; t['4']=0xFB;
+    t['5']=0xFA; t['6']=0xD7; t['7']=0xD9; t['8']=0xD6; t['9']=0xD8; t['U']=0xDB;
+    t['L']=0xD3; t['R']=0xD2; t['B']=0xDC; t['b']=0xDF; t['e']=0xE7; t['f']=0xE6;
+    t['g']=0xEB; t['h']=0xEA; t['l']=0xE8; t['r']=0xE9; t['u']=0xE5; t['w']=0xF5;
+    t['x']=0xF2; t['y']=0xF3; t['z']=0xF4; t['m']=0xED; t['n']=0xEC; t['o']=0xEF;
+    t['p']=0xEE; t['j']=0xDD; t['i']=0xD2; t['k']=0xDB; t['q']=0xD3; t['s']=0xF1;
+    t['t']=0xF0; t['-']=TILE_DOOR; t['P']=TILE_PILL;
+    memset(maze, 0, sizeof(maze_t));
+    int num_dots = 0;
+    for (int y = 0, i = 0; y < MAZE_TILES_Y; y++) {
+        for (int x = 0; x < DISPLAY_TILES_X; x++, i++) {
+            const uint8_t tile_code = t[ascii[i] & 127];
+            maze->tiles[y][x] = tile_code;
+            maze->colors[y][x] = COLOR_DOT;
+            if ((tile_code == TILE_DOT) || (tile_code == TILE_PILL)) {
+                num_dots++;
+            }
+        }
+    }
+    if (num_dots > 255) {
+        return false;
+    }
+    maze->num_dots = (uint8_t) num_dots;
+
+    // ghost house gate colors
+    maze->colors[15 - MAZE_FIRST_ROW][13] = 0x18;
+    maze->colors[15 - MAZE_FIRST_ROW][14] = 0x18;
+
+    // the positions of the classic maze
+    maze->pacman_start = i2(14*TILE_WIDTH, 26*TILE_HEIGHT + TILE_HEIGHT/2);
+    maze->house_door = i2(14*TILE_WIDTH, 14*TILE_HEIGHT + TILE_HEIGHT/2);
+    maze->eyes_target = ghost_eyes_target_pos;
+    for (int i = 0; i < NUM_GHOSTS; i++) {
+        maze->ghost_start[i] = ghost_starting_pos[i];
+        maze->ghost_house_target[i] = ghost_house_target_pos[i];
+        maze->scatter_target[i] = ghost_scatter_targets[i];
+    }
+    maze->tunnel_y = 17;
+    maze->tunnel_left = 5;
+    maze->tunnel_right = 22;
+    levelpack_derive_maze(maze);
+    return levelpack_valid_maze(maze);
+}
+
+// check a level pack in memory, and if valid use it for all game
+// instances from the next round on, the data must stay valid
+static bool levelpack_use(const void* data, size_t size) {
+    const levelpack_header_t* header = (const levelpack_header_t*) data;
+    if ((size < sizeof(levelpack_header_t)) ||
+        (header->magic != LEVELPACK_MAGIC) ||
+        (header->version != LEVELPACK_VERSION) ||
+        (header->header_size != sizeof(levelpack_header_t)) ||
+        (header->maze_size != sizeof(maze_t)) ||
+        (header->level_size != sizeof(levelspec_t)) ||
+        (header->num_mazes == 0) || (header->num_mazes > LEVELPACK_MAX_MAZES) ||
+        (header->num_levels == 0) || (header->num_levels > LEVELPACK_MAX_LEVELS))
+    {
+        return false;
+    }
+    const size_t records_size = header->num_mazes * sizeof(maze_t) + header->num_levels * sizeof(levelspec_t);
+    if ((size != (sizeof(levelpack_header_t) + records_size)) ||
+        (header->hash != levelpack_hash(LEVELPACK_HASH_SEED, header + 1, records_size)))
+    {
+        return false;
+    }
+    const maze_t* mazes = (const maze_t*) (header + 1);
+    const levelspec_t* levels = (const levelspec_t*) (mazes + header->num_mazes);
+    for (int i = 0; i < header->num_mazes; i++) {
+        if (!levelpack_valid_maze(&mazes[i])) {
+            return false;
+        }
+    }
+    for (int i = 0; i < header->num_levels; i++) {
+        if ((levels[i].maze >= header->num_mazes) || (levels[i].bonus_fruit >= NUM_FRUITS)) {
+            return false;
+        }
+    }
+    levelpack.mazes = mazes;
+    levelpack.levels = levels;
+    levelpack.num_mazes = header->num_mazes;
+    levelpack.num_levels = header->num_levels;
+    levelpack.hash = header->hash;
+    return true;
+}
+
+#if defined(__EMSCRIPTEN__)
+static void levelpack_fetched(void* user_data, void* data, int size) {
+    (void)user_data;
+    // the fetched data is only valid during the callback
+    void* copy = malloc((size_t)size);
+    if (copy) {
+        memcpy(copy, data, (size_t)size);
+    }
+    if (!copy || !levelpack_use(copy, (size_t)size)) {
+        free(copy);
+        slog_func("pacman", 2, 0, "levels: invalid level pack, using the built-in levels", __LINE__, __FILE__, 0);
+    }
+    levelpack.fetching = false;
+}
+
+static void levelpack_fetch_failed(void* user_data) {
+    (void)user_data;
+    slog_func("pacman", 2, 0, "levels: failed to fetch level pack, using the built-in levels", __LINE__, __FILE__, 0);
+    levelpack.fetching = false;
+}
+#endif
+
+// map a level pack file into memory and use it, the mapping is kept until
+// the process exits, in the WASM version the file is fetched asynchronously
+// and the games are held until it has arrived (see frame_tick())
+static bool levelpack_load(const char* path) {
+    #if defined(__EMSCRIPTEN__)
+        levelpack.fetching = true;
+        emscripten_async_wget_data(path, 0, levelpack_fetched, levelpack_fetch_failed);
+        return true;
+    #elif defined(_WIN32)
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER size = { 0 };
+        HANDLE mapping = 0;
+        if (GetFileSizeEx(file, &size) && (size.QuadPart > 0)) {
+            mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+        }
+        CloseHandle(file);
+        if (!mapping) {
+            return false;
+        }
+        // the view keeps the mapping alive
+        void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!data) {
+            return false;
+        }
+        if (!levelpack_use(data, (size_t)size.QuadPart)) {
+            UnmapViewOfFile(data);
+            return false;
+        }
+        return true;
+    #else
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        void* data = MAP_FAILED;
+        if ((0 == fstat(fd, &st)) && (st.st_size > 0)) {
+            data = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        // the mapping stays valid after closing the file
+        close(fd);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        if (!levelpack_use(data, (size_t)st.st_size)) {
+            munmap(data, (size_t)st.st_size);
+            return false;
+        }
+        return true;
+    #endif
+}
+
+// decode the built-in level pack, and load a level pack file if one
+// was given, returns false if the file isn't a valid level pack
+static bool levelpack_init(const char* path) {
+    bool ok = levelpack_decode_maze(&levelpack_builtin_maze, levelpack_classic_maze);
+    assert(ok && (levelpack_builtin_maze.num_dots == 244));
+    levelpack.mazes = &levelpack_builtin_maze;
+    levelpack.levels = levelspec_table;
+    levelpack.num_mazes = 1;
+    levelpack.num_levels = MAX_LEVELSPEC;
+    // the same hash as a level pack file written without mazes
+    levelpack.hash = levelpack_hash(levelpack_hash(LEVELPACK_HASH_SEED, &levelpack_builtin_maze, sizeof(maze_t)), levelspec_table, sizeof(levelspec_table));
+    if (path) {
+        ok = levelpack_load(path);
+    }
+    return ok;
+}
+
+#if !PACMAN_HEADLESS
+static void levelpack_parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < (argc - 1); i++) {
+        if (0 == strcmp(argv[i], "-levels")) {
+            state.levels.path = argv[++i];
+        }
+    }
+}
+#endif
+
+#if PACMAN_HEADLESS && !PACMAN_BENCH
+// read an ASCII maze file (see above), shorter lines are padded with spaces
+static bool levelpack_read_maze(const char* path, char ascii[MAZE_TILES_Y * DISPLAY_TILES_X]) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        return false;
+    }
+    memset(ascii, ' ', MAZE_TILES_Y * DISPLAY_TILES_X);
+    char line[256];
+    int y = 0;
+    while ((y < MAZE_TILES_Y) && fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#') {
+            continue;
+        }
+        for (int x = 0; (x < DISPLAY_TILES_X) && (line[x] != 0) && (line[x] != '\n') && (line[x] != '\r'); x++) {
+            ascii[y * DISPLAY_TILES_X + x] = line[x];
+        }
+        y++;
+    }
+    fclose(fp);
+    return y == MAZE_TILES_Y;
+}
+
+// write a level pack with the given ASCII mazes (or the classic maze if none
+// are given), the level table is the built-in one with the mazes taking turns
+static bool levelpack_write(const char* path, const char** maze_paths, int num_maze_paths) {
+    if (num_maze_paths > LEVELPACK_MAX_MAZES) {
+        fprintf(stderr, "too many mazes, the max is %d\n", LEVELPACK_MAX_MAZES);
+        return false;
+    }
+    const int num_mazes = (num_maze_paths > 0) ? num_maze_paths : 1;
+    const int num_levels = (num_mazes > MAX_LEVELSPEC) ? num_mazes : MAX_LEVELSPEC;
+    const size_t records_size = (size_t)num_mazes * sizeof(maze_t) + (size_t)num_levels * sizeof(levelspec_t);
+    uint8_t* records = (uint8_t*) calloc(1, records_size);
+    assert(records);
+    maze_t* mazes = (maze_t*) records;
+    levelspec_t* levels = (levelspec_t*) (mazes + num_mazes);
+    bool ok = true;
+    for (int i = 0; ok && (i < num_maze_paths); i++) {
+        char ascii[MAZE_TILES_Y * DISPLAY_TILES_X];
+        if (!levelpack_read_maze(maze_paths[i], ascii)) {
+            fprintf(stderr, "failed to read maze file '%s', expected %d lines\n", maze_paths[i], MAZE_TILES_Y);
+            ok = false;
+        }
+        else if (!levelpack_decode_maze(&mazes[i], ascii)) {
+            fprintf(stderr, "maze file '%s' must be enclosed by walls, have between 1 and 255 dots and pills, and no walls where READY! is shown\n", maze_paths[i]);
+            ok = false;
+        }
+    }
+    if (0 == num_maze_paths) {
+        mazes[0] = levelpack_builtin_maze;
+    }
+    for (int i = 0; i < num_levels; i++) {
+        levels[i] = levelspec_table[(i < MAX_LEVELSPEC) ? i : (MAX_LEVELSPEC - 1)];
+        levels[i].maze = (uint16_t)(i % num_mazes);
+    }
+    if (ok) {
+        const levelpack_header_t header = {
+            .magic = LEVELPACK_MAGIC,
+            .version = LEVELPACK_VERSION,
+            .header_size = sizeof(levelpack_header_t),
+            .maze_size = sizeof(maze_t),
+            .level_size = sizeof(levelspec_t),
+            .num_mazes = (uint16_t) num_mazes,
+            .num_levels = (uint16_t) num_levels,
+            .hash = levelpack_hash(LEVELPACK_HASH_SEED, records, records_size),
+        };
+        FILE* fp = fopen(path, "wb");
+        ok = (0 != fp) && (1 == fwrite(&header, sizeof(header), 1, fp)) && (1 == fwrite(records, records_size, 1, fp));
+        if (fp) {
+            ok &= (0 == fclose(fp));
+        }
+        if (!ok) {
+            fprintf(stderr, "failed to write level pack '%s'\n", path);
+        }
+    }
+    free(records);
+    return ok;
+}
+#endif
+#endif // !PACMAN_ATLASGEN
+
+/*== TELEMETRY LOG ===========================================================*/
+#if PACMAN_TELEMETRY
+/*
+    The telemetry log is a stream of gameplay events for balancing and fraud
+    analysis: dots, pills, ghosts and fruits eaten, Pacman deaths, rounds won
+    and the ghost state transitions, each with the game tick, the round and
+    the position of the actor.
+
+    The gameplay code pushes fixed-size records (telem_record_t) into a ring
+    buffer per game with the TELEM() macro, which is only a null pointer check
+    while the log is off (and compiles to nothing with PACMAN_TELEMETRY=0).
+    A writer thread drains the rings into the log file or a UDP socket, so
+    the game tick never waits for I/O. When a ring is full, the new records
+    are dropped and counted, and a TELEM_DROPPED record with the number of
+    dropped records is pushed once there's room again.
+
+    A log file starts with a 16-byte header, followed by the records of all
+    games interleaved in the order they were drained (all values are
+    little-endian):
+
+        uint32_t magic      TELEM_MAGIC ('PMTL')
+        uint16_t version    TELEM_VERSION
+        uint16_t rec_size   sizeof(telem_record_t)
+        uint64_t reserved
+        telem_record_t[]
+
+    UDP packets carry up to TELEM_UDP_RECORDS records without a header.
+
+    When a game is rewound (restoring a snapshot in a netplay rollback or
+    when seeking in a replay), a TELEM_REWIND record with the restored tick
+    is pushed, and the game's following records replace the records with the
+    same or a later tick which were logged before.
+
+        pacman -telemetry events.bin
+        pacman -telemetry-udp 192.168.0.10:7002
+        pacman_headless -telemetry events.bin -seed 1234
+*/
+#if defined(_MSC_VER)
+static uint32_t telem_atomic_load(volatile uint32_t* ptr) {
+    return (uint32_t)_InterlockedCompareExchange((volatile long*)ptr, 0, 0);
+}
+
+static void telem_atomic_store(volatile uint32_t* ptr, uint32_t val) {
+    _InterlockedExchange((volatile long*)ptr, (long)val);
+}
+#else
+static uint32_t telem_atomic_load(volatile uint32_t* ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static void telem_atomic_store(volatile uint32_t* ptr, uint32_t val) {
+    __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+#endif
+
+// push a record into the game's ring buffer (called through the TELEM() macro)
+static void telem_push(game_ctx_t* ctx, telemevent_t type, int actor, int2_t pos, uint32_t arg) {
+    telem_ring_t* ring = ctx->telem;
+    uint32_t head = ring->head;
+    const uint32_t num_free = TELEM_RING_SIZE - (head - telem_atomic_load(&ring->tail));
+    if (num_free < ((ring->num_dropped > 0) ? 2u : 1u)) {
+        ring->num_dropped++;
+        state.telem.num_dropped++;
+        return;
+    }
+    if (ring->num_dropped > 0) {
+        ring->records[head++ & (TELEM_RING_SIZE - 1)] = (telem_record_t) {
+            .tick = ctx->timing.tick,
+            .game = ring->game,
+            .type = TELEM_DROPPED,
+            .arg = (uint16_t)((ring->num_dropped > 0xFFFF) ? 0xFFFF : ring->num_dropped),
+            .round = ctx->game.round,
+        };
+        ring->num_dropped = 0;
+    }
+    ring->records[head++ & (TELEM_RING_SIZE - 1)] = (telem_record_t) {
+        .tick = ctx->timing.tick,
+        .game = ring->game,
+        .type = (uint8_t)type,
+        .actor = (uint8_t)actor,
+        .x = (int16_t)pos.x,
+        .y = (int16_t)pos.y,
+        .arg = (uint16_t)arg,
+        .round = ctx->game.round,
+    };
+    telem_atomic_store(&ring->head, head);
+}
+
+// the benchmark suite only runs the push side of the log
+#if !PACMAN_BENCH
+// write a contiguous run of records to the log file and/or socket
+static void telem_write(const telem_record_t* records, uint32_t num_records) {
+    if (state.telem.file) {
+        fwrite(records, sizeof(telem_record_t), num_records, state.telem.file);
+    }
+    #if PACMAN_NETPLAY
+        if (state.telem.sock != NET_INVALID_SOCKET) {
+            for (uint32_t i = 0; i < num_records; i += TELEM_UDP_RECORDS) {
+                const uint32_t num = ((num_records - i) < TELEM_UDP_RECORDS) ? (num_records - i) : TELEM_UDP_RECORDS;
+                sendto(state.telem.sock, (const char*)&records[i], (int)(num * sizeof(telem_record_t)), 0, (const struct sockaddr*)&state.telem.peer, sizeof(state.telem.peer));
+            }
+        }
+    #endif
+}
+
+// drain all rings, returns the number of records written
+static uint32_t telem_drain(void) {
+    uint32_t num_written = 0;
+    const uint32_t num_rings = telem_atomic_load(&state.telem.num_rings);
+    for (uint32_t i = 0; i < num_rings; i++) {
+        telem_ring_t* ring = state.telem.rings[i];
+        const uint32_t head = telem_atomic_load(&ring->head);
+        uint32_t tail = ring->tail;
+        while (tail != head) {
+            // up to the end of the ring, then from its start
+            const uint32_t index = tail & (TELEM_RING_SIZE - 1);
+            const uint32_t num_records = ((head - tail) < (TELEM_RING_SIZE - index)) ? (head - tail) : (TELEM_RING_SIZE - index);
+            telem_write(&ring->records[index], num_records);
+            tail += num_records;
+            num_written += num_records;
+            // only now the game thread may overwrite the records
+            telem_atomic_store(&ring->tail, tail);
+        }
+    }
+    state.telem.num_written += num_written;
+    return num_written;
+}
+
+static void telem_writer(void) {
+    while (!telem_atomic_load(&state.telem.stop)) {
+        if (0 == telem_drain()) {
+            // nothing to do, sleep for a millisecond (a ring holds a few seconds of events in a running game)
+            #if defined(_WIN32)
+                Sleep(1);
+            #else
+                nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, 0);
+            #endif
+        }
+    }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI telem_thread_func(LPVOID arg) {
+    (void)arg;
+    telem_writer();
+    return 0;
+}
+#else
+static void* telem_thread_func(void* arg) {
+    (void)arg;
+    telem_writer();
+    return 0;
+}
+#endif
+
+#if !PACMAN_HEADLESS
+static void telem_parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < (argc - 1); i++) {
+        if (0 == strcmp(argv[i], "-telemetry")) {
+            state.telem.path = argv[++i];
+        }
+        #if PACMAN_NETPLAY
+        else if (0 == strcmp(argv[i], "-telemetry-udp")) {
+            static char address[256];
+            strncpy(address, argv[++i], sizeof(address) - 1);
+            char* sep = strchr(address, ':');
+            if (sep) {
+                *sep = 0;
+                state.telem.port = (uint16_t)atoi(sep + 1);
+            }
+            state.telem.address = address;
+        }
+        #endif
+    }
+    #if PACMAN_NETPLAY
+        if (0 == state.telem.port) {
+            state.telem.port = TELEM_DEFAULT_PORT;
+        }
+    #endif
+}
+#endif
+
+// open the log file and/or socket and start the writer thread if the
+// telemetry log was requested, returns false if this failed
+static bool telem_init(void) {
+    bool requested = 0 != state.telem.path;
+    bool ok = true;
+    #if PACMAN_NETPLAY
+        state.telem.sock = NET_INVALID_SOCKET;
+        if (state.telem.address) {
+            requested = true;
+            ok = net_socket_open(&state.telem.sock, 0, state.telem.address, state.telem.port, &state.telem.peer);
+        }
+    #endif
+    if (ok && state.telem.path) {
+        state.telem.file = fopen(state.telem.path, "wb");
+        const struct { uint32_t magic; uint16_t version; uint16_t rec_size; uint64_t reserved; } header = {
+            .magic = TELEM_MAGIC,
+            .version = TELEM_VERSION,
+            .rec_size = sizeof(telem_record_t),
+        };
+        ok = (0 != state.telem.file) && (1 == fwrite(&header, sizeof(header), 1, state.telem.file));
+    }
+    if (ok && requested) {
+        #if defined(_WIN32)
+            state.telem.thread = CreateThread(0, 0, telem_thread_func, 0, 0, 0);
+            ok = 0 != state.telem.thread;
+        #else
+            ok = 0 == pthread_create(&state.telem.thread, 0, telem_thread_func, 0);
+        #endif
+    }
+    if (ok && requested) {
+        state.telem.active = true;
+    }
+    else if (!ok) {
+        if (state.telem.file) {
+            fclose(state.telem.file);
+            state.telem.file = 0;
+        }
+        #if PACMAN_NETPLAY
+            net_socket_close(&state.telem.sock);
+        #endif
+    }
+    return ok;
+}
+
+// connect a game to the telemetry log (does nothing if the log is off)
+static void telem_attach(game_ctx_t* ctx, int game) {
+    if (!state.telem.active) {
+        return;
+    }
+    const uint32_t num_rings = state.telem.num_rings;
+    assert(num_rings < TELEM_MAX_GAMES);
+    telem_ring_t* ring = (telem_ring_t*) calloc(1, sizeof(telem_ring_t));
+    assert(ring);
+    ring->game = (uint16_t)game;
+    state.telem.rings[num_rings] = ring;
+    telem_atomic_store(&state.telem.num_rings, num_rings + 1);
+    ctx->telem = ring;
+}
+
+// stop the writer thread after it has drained the remaining records, this
+// must be called after the last tick of the attached games
+static void telem_shutdown(void) {
+    if (!state.telem.active) {
+        return;
+    }
+    telem_atomic_store(&state.telem.stop, 1);
+    #if defined(_WIN32)
+        WaitForSingleObject(state.telem.thread, INFINITE);
+        CloseHandle(state.telem.thread);
+    #else
+        pthread_join(state.telem.thread, 0);
+    #endif
+    telem_drain();
+    if (state.telem.file) {
+        fclose(state.telem.file);
+        state.telem.file = 0;
+    }
+    #if PACMAN_NETPLAY
+        net_socket_close(&state.telem.sock);
+    #endif
+    for (uint32_t i = 0; i < state.telem.num_rings; i++) {
+        free(state.telem.rings[i]);
+        state.telem.rings[i] = 0;
+    }
+    state.telem.num_rings = 0;
+    state.telem.active = false;
+}
+#endif // !PACMAN_BENCH
+#endif // PACMAN_TELEMETRY
+
+/*== AUTOPLAY BOT ============================================================*/
+#if PACMAN_AUTOPLAY
+/*
+    The autoplay bot steers a Pacman for the attract mode and for tuning the
+    difficulty of levels without human players. It plays through one of the
+    two key sets (the arrow keys or WASD), so the same bot drives the first
+    or the second Pacman of the regular game (or player 0 in battle mode):
+
+        pacman -autoplay [1|2] [-autoplay-threads num]
+        pacman_headless -autoplay [-autoplay-threads num] [-autoplay-iters num] [-seed num]
+
+    Every BOT_STEP_TICKS ticks the bot picks a direction with a Monte Carlo
+    tree search on copies of the real simulation: an action holds one
+    direction key for BOT_STEP_TICKS ticks, a tree node is the game after a
+    sequence of actions from the current tick. Each iteration copies the
+    game, walks down the tree along the best actions (the mean reward plus
+    the exploration term of PUCT with uniform priors, which doesn't need a
+    logarithm), expands one new node, and then plays out the rollout up to
+    BOT_MAX_DEPTH actions from the current tick. The rollout policy heads
+    for the nearest dot (found by a breadth-first search over the maze) and
+    takes a random direction every 4th action on average, with uniformly
+    random rollouts the first actions all look alike and the bot dithers.
+    The reward of a rollout is 0 if Pacman was caught, 1 if the round was
+    won, and otherwise grows with the score gained and with the closeness to
+    the nearest remaining dot (so that the bot also finds dots beyond the
+    rollout horizon).
+
+    The search is root-parallel: each worker thread searches its own tree
+    from the same game, and the action with the best mean reward over all
+    trees is played. The calling thread is one of the workers, the others
+    are started per move. In the game window, the search ends after
+    BOT_BUDGET_NS, which leaves the other half of a 60Hz frame for the game
+    itself, and when fast-forwarding, the bot only searches once per frame.
+    The headless runner limits the number of rollouts per worker instead,
+    so that its games are reproducible for a given number of workers.
+*/
+static uint32_t bot_random(bot_worker_t* w) {
+    uint32_t x = w->rng;
+    x ^= x<<13;
+    x ^= x>>17;
+    x ^= x<<5;
+    w->rng = x;
+    return x;
+}
+
+// integer square root, for the exploration term of the tree search
+static uint32_t bot_isqrt(uint32_t val) {
+    uint32_t res = 0;
+    uint32_t bit = 1u<<30;
+    while (bit > val) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (val >= (res + bit)) {
+            val -= res + bit;
+            res = (res>>1) + bit;
+        }
+        else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return res;
+}
+
+// the player steered by the bot's key set (see input_key() and input_player_dir())
+static int bot_player(const game_ctx_t* ctx) {
+    if (ctx->game.battle) {
+        return 0;
+    }
+    return (state.bot.key_set == 1) ? 1 : 0;
+}
+
+// the key of the bot's key set for a direction
+static inputkey_t bot_dir_key(dir_t dir) {
+    static const inputkey_t keys[2][NUM_DIRS] = {
+        { INPUTKEY_RIGHT, INPUTKEY_DOWN, INPUTKEY_LEFT, INPUTKEY_UP },
+        { INPUTKEY_D, INPUTKEY_S, INPUTKEY_A, INPUTKEY_W },
+    };
+    return keys[state.bot.key_set - 1][dir];
+}
+
+// play one action on a worker's game copy, returns false if the rollout
+// ends because Pacman was caught or the round was won
+static bool bot_step(game_ctx_t* ctx, dir_t dir) {
+    for (int d = 0; d < NUM_DIRS; d++) {
+        if (d != (int)dir) {
+            input_key(ctx, bot_dir_key((dir_t)d), false);
+        }
+    }
+    input_key(ctx, bot_dir_key(dir), true);
+    for (int i = 0; i < BOT_STEP_TICKS; i++) {
+        sim_tick(ctx);
+        if (ctx->game.freeze & (FREEZETYPE_DEAD | FREEZETYPE_WON)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* find the nearest dot or pill from a player's tile with a breadth-first
+   search over the maze's navigation table, returns the distance in tiles
+   (BOT_DOT_RANGE if no dot is closer) and the first direction on the way
+*/
+static int bot_dot_search(game_ctx_t* ctx, int player, dir_t* out_dir) {
+    // distance plus one, and the first direction on the way to each tile
+    uint8_t seen[DISPLAY_TILES_Y][DISPLAY_TILES_X] = { { 0 } };
+    uint8_t first_dir[DISPLAY_TILES_Y][DISPLAY_TILES_X];
+    int2_t queue[DISPLAY_TILES_Y * DISPLAY_TILES_X];
+    int head = 0;
+    int tail = 0;
+    const int2_t start = clamped_tile_pos(pixel_to_tile_pos(i2(ctx->game.players.pos_x[player], ctx->game.players.pos_y[player])));
+    queue[tail++] = start;
+    seen[start.y][start.x] = 1;
+    first_dir[start.y][start.x] = ctx->game.players.dir[player];
+    while (head != tail) {
+        const int2_t pos = queue[head++];
+        const int dist = seen[pos.y][pos.x] - 1;
+        if (dist >= BOT_DOT_RANGE) {
+            break;
+        }
+        if (is_dot(ctx, pos) || is_pill(ctx, pos)) {
+            *out_dir = (dir_t)first_dir[pos.y][pos.x];
+            return dist;
+        }
+        const uint8_t nav = nav_at(ctx, pos);
+        for (int dir = 0; dir < NUM_DIRS; dir++) {
+            if (nav & (1<<dir)) {
+                int2_t next = add_i2(pos, dir_to_vec((dir_t)dir));
+                // wrap around through the teleport tunnel
+                if (next.x < 0) {
+                    next.x = DISPLAY_TILES_X - 1;
+                }
+                else if (next.x >= DISPLAY_TILES_X) {
+                    next.x = 0;
+                }
+                next = clamped_tile_pos(next);
+                if (!seen[next.y][next.x]) {
+                    seen[next.y][next.x] = (uint8_t)(dist + 2);
+                    first_dir[next.y][next.x] = (dist == 0) ? (uint8_t)dir : first_dir[pos.y][pos.x];
+                    queue[tail++] = next;
+                }
+            }
+        }
+    }
+    *out_dir = (dir_t)ctx->game.players.dir[player];
+    return BOT_DOT_RANGE;
+}
+
+// the reward of a rollout in the range 0..1, dot_dist is the player's
+// distance to the nearest dot at the end of the rollout
+static float bot_reward(const game_ctx_t* ctx, const game_ctx_t* root, int dot_dist) {
+    if (ctx->game.freeze & FREEZETYPE_DEAD) {
+        return 0.0f;
+    }
+    if (ctx->game.freeze & FREEZETYPE_WON) {
+        return 1.0f;
+    }
+    const uint32_t gain = ctx->game.score - root->game.score;
+    const float score = (gain >= BOT_SCORE_SCALE) ? 1.0f : ((float)gain / BOT_SCORE_SCALE);
+    const float closeness = 1.0f - ((float)dot_dist / BOT_DOT_RANGE);
+    return 0.2f + 0.5f * score + 0.3f * closeness;
+}
+
+// select the action to follow from a tree node, actions which haven't been
+// tried yet come first
+static dir_t bot_select(const bot_worker_t* w, const bot_node_t* node) {
+    const float explore = BOT_EXPLORATION * (float)bot_isqrt(node->visits);
+    dir_t best_dir = DIR_RIGHT;
+    float best = -1.0f;
+    for (int dir = 0; dir < NUM_DIRS; dir++) {
+        if (0 == node->child[dir]) {
+            return (dir_t)dir;
+        }
+        const bot_node_t* child = &w->nodes[node->child[dir]];
+        const float val = (child->value / (float)child->visits) + (explore / (float)(1 + child->visits));
+        if (val > best) {
+            best = val;
+            best_dir = (dir_t)dir;
+        }
+    }
+    return best_dir;
+}
+
+// run the search of a worker until the iteration limit or deadline is reached
+static void bot_search(bot_worker_t* w) {
+    const game_ctx_t* root = state.bot.root;
+    const int player = bot_player(root);
+    memset(&w->nodes[0], 0, sizeof(bot_node_t));
+    w->num_nodes = 1;
+    w->num_iterations = 0;
+    while (((0 == state.bot.max_iterations) || (w->num_iterations < state.bot.max_iterations)) &&
+           ((0 == state.bot.deadline_ns) || (time_now_ns() < state.bot.deadline_ns)))
+    {
+        // the rollouts don't log telemetry or play sounds
+        w->ctx = *root;
+        w->ctx.audible = false;
+        #if PACMAN_TELEMETRY
+            w->ctx.telem = 0;
+        #endif
+
+        // walk down the tree and expand one new node
+        uint16_t path[BOT_MAX_DEPTH + 1];
+        int depth = 0;
+        path[0] = 0;
+        bool alive = true;
+        dir_t dir = (dir_t)root->game.players.dir[player];
+        while (alive && (depth < BOT_MAX_DEPTH)) {
+            bot_node_t* node = &w->nodes[path[depth]];
+            dir = bot_select(w, node);
+            const bool expand = 0 == node->child[dir];
+            if (expand) {
+                if (w->num_nodes == BOT_MAX_NODES) {
+                    break;
+                }
+                node->child[dir] = (uint16_t)w->num_nodes;
+                memset(&w->nodes[w->num_nodes++], 0, sizeof(bot_node_t));
+            }
+            path[depth + 1] = node->child[dir];
+            depth++;
+            alive = bot_step(&w->ctx, dir);
+            if (expand) {
+                break;
+            }
+        }
+
+        // continue with the rollout policy, which mostly heads for the
+        // nearest dot and sometimes takes a random direction
+        for (int i = depth; alive && (i < BOT_MAX_DEPTH); i++) {
+            const uint32_t r = bot_random(w);
+            if (r & 3) {
+                bot_dot_search(&w->ctx, player, &dir);
+            }
+            else {
+                dir = (dir_t)((r>>2) & 3);
+            }
+            alive = bot_step(&w->ctx, dir);
+        }
+        const int dot_dist = alive ? bot_dot_search(&w->ctx, player, &dir) : BOT_DOT_RANGE;
+
+        // propagate the reward back to the root
+        const float reward = bot_reward(&w->ctx, root, dot_dist);
+        for (int i = 0; i <= depth; i++) {
+            w->nodes[path[i]].visits++;
+            w->nodes[path[i]].value += reward;
+        }
+        w->num_iterations++;
+    }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI bot_thread_func(LPVOID arg) {
+    bot_search((bot_worker_t*)arg);
+    return 0;
+}
+#else
+static void* bot_thread_func(void* arg) {
+    bot_search((bot_worker_t*)arg);
+    return 0;
+}
+#endif
+
+// search the next move from a game, returns the direction to play, or
+// NUM_DIRS if no rollout finished in time
+static dir_t bot_move(const game_ctx_t* ctx) {
+    const uint64_t start_ns = time_now_ns();
+    state.bot.root = ctx;
+    state.bot.deadline_ns = (state.bot.budget_ns > 0) ? (start_ns + state.bot.budget_ns) : 0;
+    for (int i = 0; i < state.bot.num_threads; i++) {
+        bot_worker_t* w = &state.bot.workers[i];
+        w->rng = ((ctx->timing.tick * 0x9E3779B1) ^ ((uint32_t)(i + 1) * 0x85EBCA77)) | 1;
+        w->running = false;
+    }
+    // the calling thread is worker 0, if a thread can't be started, its
+    // worker also runs on the calling thread
+    for (int i = 1; i < state.bot.num_threads; i++) {
+        bot_worker_t* w = &state.bot.workers[i];
+        #if defined(_WIN32)
+            w->thread = CreateThread(0, 0, bot_thread_func, w, 0, 0);
+            w->running = 0 != w->thread;
+        #else
+            w->running = 0 == pthread_create(&w->thread, 0, bot_thread_func, w);
+        #endif
+    }
+    for (int i = 0; i < state.bot.num_threads; i++) {
+        bot_worker_t* w = &state.bot.workers[i];
+        if (!w->running) {
+            bot_search(w);
+        }
+    }
+    for (int i = 1; i < state.bot.num_threads; i++) {
+        bot_worker_t* w = &state.bot.workers[i];
+        if (w->running) {
+            #if defined(_WIN32)
+                WaitForSingleObject(w->thread, INFINITE);
+                CloseHandle(w->thread);
+            #else
+                pthread_join(w->thread, 0);
+            #endif
+        }
+    }
+
+    // play the root action with the best mean reward over all trees
+    uint32_t visits[NUM_DIRS] = { 0 };
+    float value[NUM_DIRS] = { 0.0f };
+    for (int i = 0; i < state.bot.num_threads; i++) {
+        const bot_worker_t* w = &state.bot.workers[i];
+        for (int dir = 0; dir < NUM_DIRS; dir++) {
+            if (w->nodes[0].child[dir]) {
+                visits[dir] += w->nodes[w->nodes[0].child[dir]].visits;
+                value[dir] += w->nodes[w->nodes[0].child[dir]].value;
+            }
+        }
+        state.bot.num_iterations += w->num_iterations;
+    }
+    dir_t best_dir = NUM_DIRS;
+    float best = -1.0f;
+    for (int dir = 0; dir < NUM_DIRS; dir++) {
+        if ((visits[dir] > 0) && ((value[dir] / (float)visits[dir]) > best)) {
+            best = value[dir] / (float)visits[dir];
+            best_dir = (dir_t)dir;
+        }
+    }
+    state.bot.root = 0;
+    state.bot.num_moves++;
+    state.bot.search_ns += time_now_ns() - start_ns;
+    return best_dir;
+}
+
+// the keys held by the bot in the next tick of a game, a new move is
+// searched every BOT_STEP_TICKS ticks while the game is running and
+// may_search is true
+static uint16_t bot_keys(game_ctx_t* ctx, bool may_search) {
+    if (ctx->gamestate != GAMESTATE_GAME) {
+        // tap a key to start a new game from the intro screen
+        state.bot.keys = ((ctx->timing.tick / BOT_STEP_TICKS) & 1) ? 0 : (uint16_t)(1<<INPUTKEY_OTHER);
+        return state.bot.keys;
+    }
+    if (ctx->game.freeze || !may_search || ((ctx->timing.tick - state.bot.move_tick) < BOT_STEP_TICKS)) {
+        return state.bot.keys;
+    }
+    const dir_t dir = bot_move(ctx);
+    state.bot.move_tick = ctx->timing.tick;
+    if (dir != NUM_DIRS) {
+        state.bot.keys = (uint16_t)(1<<bot_dir_key(dir));
+    }
+    return state.bot.keys;
+}
+
+#if !PACMAN_HEADLESS
+// the number of search workers if not given on the command line
+static int bot_num_cores(void) {
+    #if defined(_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return (int)info.dwNumberOfProcessors;
+    #else
+        return (int)sysconf(_SC_NPROCESSORS_ONLN);
+    #endif
+}
+
+static void bot_parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-autoplay")) {
+            state.bot.active = true;
+            state.bot.key_set = 1;
+            // the optional key set
+            if (((i + 1) < argc) && ((0 == strcmp(argv[i + 1], "1")) || (0 == strcmp(argv[i + 1], "2")))) {
+                state.bot.key_set = atoi(argv[++i]);
+            }
+        }
+        else if ((0 == strcmp(argv[i], "-autoplay-threads")) && ((i + 1) < argc)) {
+            state.bot.num_threads = atoi(argv[++i]);
+        }
+    }
+    if (state.bot.num_threads <= 0) {
+        state.bot.num_threads = bot_num_cores();
+    }
+    state.bot.budget_ns = BOT_BUDGET_NS;
+}
+
+// let the bot press or release keys for the next tick of the game driven
+// by the app callbacks, the keys take the same way as keyboard input
+static void bot_tick(game_ctx_t* ctx) {
+    if (!state.bot.active) {
+        return;
+    }
+    #if PACMAN_REPLAY
+    if (state.replay.playing) {
+        // the bot takes over at the end of a replay
+        return;
+    }
+    #endif
+    const uint16_t old_keys = state.bot.keys;
+    // only search once per frame when fast-forwarding, and keep the
+    // worker threads' simulation ticks out of the profiler
+    const bool may_search = state.bot.search_frame != sapp_frame_count();
+    PROF_BEGIN(PROF_AUTOPLAY);
+    #if PACMAN_PROFILER
+        const bool prof_enabled = state.prof.enabled;
+        state.prof.enabled = false;
+    #endif
+    const uint64_t num_moves = state.bot.num_moves;
+    const uint16_t keys = bot_keys(ctx, may_search);
+    if (num_moves != state.bot.num_moves) {
+        state.bot.search_frame = sapp_frame_count();
+    }
+    #if PACMAN_PROFILER
+        state.prof.enabled = prof_enabled;
+    #endif
+    PROF_END(PROF_AUTOPLAY);
+    const uint16_t changed = old_keys ^ keys;
+    for (int key = 0; key < NUM_INPUTKEYS; key++) {
+        if (changed & (1<<key)) {
+            input_forward_key((inputkey_t)key, 0 != (keys & (1<<key)));
+        }
+    }
+}
+#endif
+
+// allocate the search workers if the bot is active, returns false if this failed
+static bool bot_init(void) {
+    if (!state.bot.active) {
+        return true;
+    }
+    if (state.bot.num_threads > BOT_MAX_THREADS) {
+        state.bot.num_threads = BOT_MAX_THREADS;
+    }
+    state.bot.workers = (bot_worker_t*) calloc((size_t)state.bot.num_threads, sizeof(bot_worker_t));
+    if (!state.bot.workers) {
+        state.bot.active = false;
+        return false;
+    }
+    return true;
+}
+
+static void bot_shutdown(void) {
+    free(state.bot.workers);
+    state.bot.workers = 0;
+    state.bot.active = false;
+}
+#endif // PACMAN_AUTOPLAY
+
+/*== INPUT RECORDING AND REPLAY ==============================================*/
+#if PACMAN_REPLAY
+/*
+    The keys held down per tick can be recorded into a replay file, and a
+    replay file can be played back, either in the game window or in the
+    headless runner (which plays back as fast as the CPU allows):
+
+        pacman -record file
+        pacman -replay file [-seek tick]
+        pacman_headless -record file [-script file] [-ticks num] [-seed num]
+        pacman_headless -replay file [-seek tick] [-ticks num]
+
+    Recording starts at the intro screen, and since the simulation is
+    deterministic, the recorded input (which drives input1/input2 and
+    input_dir()) and the xorshift seed are enough to reproduce the game.
+    Recording and replays are not available in netplay, and a replay file
+    is only played back with the level pack it was recorded with.
+
+    The replay file is a stream of little-endian records after a header:
+
+        u32 magic ('PMRP')
+        u32 version
+        u32 snapshot size in bytes
+        u32 xorshift seed
+        u64 level pack hash (see LEVEL PACKS)
+
+        u8 REPLAYTAG_INPUT      u16 keys, u16 number of ticks the keys are held
+        u8 REPLAYTAG_SNAPSHOT   u32 tick, u64 game_hash(), the game_snapshot_t before that tick
+        u8 REPLAYTAG_END        u32 number of ticks, u64 game_hash() after the last tick
+
+    The input is run-length encoded, so a minute of play takes one or two
+    KBytes of input. Every REPLAY_SNAPSHOT_TICKS, a snapshot of the
+    simulation state is embedded which allows to seek to any tick by
+    restoring the closest snapshot and simulating less than
+    REPLAY_SNAPSHOT_TICKS ticks. Since a
+    snapshot is a raw copy of game_ctx_t, snapshots are ignored (and seeking
+    simulates from the start) if the snapshot size doesn't match. A file
+    with a snapshot which isn't taken at the end of the preceding input
+    runs, or doesn't match its recorded state hash, is rejected.
+
+    The file is flushed after each snapshot, so if the game crashes at most
+    the last REPLAY_SNAPSHOT_TICKS are lost. When playback reaches the END
+    record, the state hash is compared with the recorded one, and in the
+    game window, the player takes over when the replay has finished.
+*/
+typedef enum {
+    REPLAYTAG_INPUT = 1,
+    REPLAYTAG_SNAPSHOT,
+    REPLAYTAG_END,
+} replaytag_t;
+
+// grow a malloc'ed array so that it has room for at least one more item
+static void* replay_grow(void* ptr, uint32_t* capacity, uint32_t num_items, size_t item_size) {
+    if (num_items >= *capacity) {
+        *capacity = (*capacity == 0) ? 256 : (*capacity * 2);
+        ptr = realloc(ptr, *capacity * item_size);
+        assert(ptr);
+    }
+    return ptr;
+}
+
+// write the current input run into the replay file
+static void replay_flush_run(void) {
+    if (state.replay.run_ticks > 0) {
+        uint8_t data[5] = { REPLAYTAG_INPUT };
+        put_u16(data + 1, state.replay.run_keys);
+        put_u16(data + 3, (uint16_t)state.replay.run_ticks);
+        fwrite(data, sizeof(data), 1, state.replay.file);
+        state.replay.run_ticks = 0;
+    }
+}
+
+// start recording into a replay file, the game instance must be freshly initialized
+static bool replay_record_begin(const char* path, const game_ctx_t* ctx) {
+    assert(0 == ctx->timing.tick);
+    state.replay.file = fopen(path, "wb");
+    if (!state.replay.file) {
+        return false;
+    }
+    uint8_t data[24];
+    put_u32(data, REPLAY_MAGIC);
+    put_u32(data + 4, REPLAY_VERSION);
+    put_u32(data + 8, sizeof(game_snapshot_t));
+    put_u32(data + 12, ctx->game.seed);
+    put_u32(data + 16, (uint32_t)levelpack.hash);
+    put_u32(data + 20, (uint32_t)(levelpack.hash>>32));
+    fwrite(data, sizeof(data), 1, state.replay.file);
+    state.replay.recording = true;
+    state.replay.run_ticks = 0;
+    return true;
+}
+
+// record the keys for the next tick, must be called before sim_tick()
+static void replay_record_tick(const game_ctx_t* ctx, uint16_t keys) {
+    const uint32_t tick = ctx->timing.tick;
+    if ((tick % REPLAY_SNAPSHOT_TICKS) == 0) {
+        replay_flush_run();
+        static game_snapshot_t snapshot;
+        game_snapshot(ctx, &snapshot);
+        const uint64_t hash = game_hash(ctx);
+        uint8_t data[13] = { REPLAYTAG_SNAPSHOT };
+        put_u32(data + 1, tick);
+        put_u32(data + 5, (uint32_t)hash);
+        put_u32(data + 9, (uint32_t)(hash>>32));
+        fwrite(data, sizeof(data), 1, state.replay.file);
+        fwrite(&snapshot, sizeof(snapshot), 1, state.replay.file);
+        fflush(state.replay.file);
+    }
+    if ((keys != state.replay.run_keys) || (state.replay.run_ticks == 0xFFFF)) {
+        replay_flush_run();
+        state.replay.run_keys = keys;
+    }
+    state.replay.run_ticks++;
+}
+
+// finish recording, writes the number of ticks and the final state hash
+static void replay_record_end(const game_ctx_t* ctx) {
+    if (!state.replay.recording) {
+        return;
+    }
+    replay_flush_run();
+    const uint64_t hash = game_hash(ctx);
+    uint8_t data[13] = { REPLAYTAG_END };
+    put_u32(data + 1, ctx->timing.tick);
+    put_u32(data + 5, (uint32_t)hash);
+    put_u32(data + 9, (uint32_t)(hash>>32));
+    fwrite(data, sizeof(data), 1, state.replay.file);
+    fclose(state.replay.file);
+    state.replay.file = 0;
+    state.replay.recording = false;
+}
+
+// free the playback data
+static void replay_unload(void) {
+    free(state.replay.runs);
+    free(state.replay.snapshots);
+    state.replay.runs = 0;
+    state.replay.snapshots = 0;
+    state.replay.num_runs = 0;
+    state.replay.num_snapshots = 0;
+    state.replay.playing = false;
+}
+
+// true if an actor's pixel position and the tile it looks ahead into are on the display
+static bool replay_valid_pos(int16_t x, int16_t y) {
+    return (x >= 0) && (x < DISPLAY_PIXELS_X) && (y >= TILE_HEIGHT) && (y < (DISPLAY_PIXELS_Y - TILE_HEIGHT));
+}
+
+// check a snapshot loaded from a replay file before it can be restored, all
+// fields which game_restore() and sim_tick() use as table indices are
+// range-checked, the video RAM must match its incrementally updated hash,
+// and the simulation state must match the recorded state hash
+static bool replay_valid_snapshot(const replay_snapshot_t* snapshot) {
+    static game_ctx_t ctx;
+    memcpy(&ctx, &snapshot->snapshot, sizeof(game_snapshot_t));
+    bool valid = (ctx.timing.tick == snapshot->tick) &&
+        ((uint32_t)ctx.gamestate <= GAMESTATE_GAME) &&
+        (ctx.game.nav_index < NUM_MAZENAVS) &&
+        (ctx.game.num_players <= MAX_PLAYERS) &&
+        (ctx.game.active_player < ctx.game.num_players) &&
+        ((uint32_t)ctx.game.active_fruit < NUM_FRUITS);
+    // the actor positions are only used while a game is running
+    const bool in_game = ctx.gamestate == GAMESTATE_GAME;
+    for (int i = 0; valid && (i < NUM_GHOSTS); i++) {
+        const ghost_t* ghost = &ctx.game.ghost[i];
+        valid = ((uint32_t)ghost->type < NUM_GHOSTS) &&
+            ((uint32_t)ghost->state <= GHOSTSTATE_ENTERHOUSE) &&
+            ((uint32_t)ghost->actor.dir < NUM_DIRS) &&
+            ((uint32_t)ghost->next_dir < NUM_DIRS) &&
+            (!in_game || replay_valid_pos(ghost->actor.pos.x, ghost->actor.pos.y));
+    }
+    for (int p = 0; valid && (p < MAX_PLAYERS); p++) {
+        valid = (ctx.game.players.dir[p] < NUM_DIRS) && (ctx.battle_dirs[p] < NUM_DIRS) &&
+            (!in_game || (p >= ctx.game.num_players) || replay_valid_pos(ctx.game.players.pos_x[p], ctx.game.players.pos_y[p]));
+    }
+    return valid &&
+        (ctx.vid.tile_hash == vid_full_hash(&ctx)) &&
+        (game_hash(&ctx) == snapshot->hash);
+}
+
+// load a replay file for playback, a truncated file (without END record) plays back up to the last input
+static bool replay_load(const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    const long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t* data = (size > 0) ? (uint8_t*) malloc((size_t)size) : 0;
+    const bool read_ok = data && (1 == fread(data, (size_t)size, 1, fp));
+    fclose(fp);
+    if (!read_ok || (size < 24) || (get_u32(data) != REPLAY_MAGIC) || (get_u32(data + 4) != REPLAY_VERSION) ||
+        (((uint64_t)get_u32(data + 16) | ((uint64_t)get_u32(data + 20)<<32)) != levelpack.hash))
+    {
+        free(data);
+        return false;
+    }
+    const bool snapshots_valid = get_u32(data + 8) == sizeof(game_snapshot_t);
+    state.replay.seed = get_u32(data + 12);
+    state.replay.num_ticks = 0;
+    state.replay.has_end = false;
+    uint32_t run_capacity = 0;
+    uint32_t snapshot_capacity = 0;
+    size_t pos = 24;
+    bool valid = true;
+    while (valid && (pos < (size_t)size)) {
+        const uint8_t tag = data[pos++];
+        const size_t remaining = (size_t)size - pos;
+        if ((tag == REPLAYTAG_INPUT) && (remaining >= 4)) {
+            state.replay.runs = (replay_run_t*) replay_grow(state.replay.runs, &run_capacity, state.replay.num_runs, sizeof(replay_run_t));
+            state.replay.runs[state.replay.num_runs++] = (replay_run_t) {
+                .tick = state.replay.num_ticks,
+                .keys = get_u16(data + pos),
+            };
+            state.replay.num_ticks += get_u16(data + pos + 2);
+            pos += 4;
+        }
+        else if ((tag == REPLAYTAG_SNAPSHOT) && (remaining >= (12 + get_u32(data + 8)))) {
+            // snapshots are recorded at the end of the preceding input runs
+            valid = get_u32(data + pos) == state.replay.num_ticks;
+            if (valid && snapshots_valid) {
+                state.replay.snapshots = (replay_snapshot_t*) replay_grow(state.replay.snapshots, &snapshot_capacity, state.replay.num_snapshots, sizeof(replay_snapshot_t));
+                replay_snapshot_t* snapshot = &state.replay.snapshots[state.replay.num_snapshots++];
+                snapshot->tick = get_u32(data + pos);
+                snapshot->hash = (uint64_t)get_u32(data + pos + 4) | ((uint64_t)get_u32(data + pos + 8)<<32);
+                memcpy(&snapshot->snapshot, data + pos + 12, sizeof(game_snapshot_t));
+                valid = replay_valid_snapshot(snapshot);
+            }
+            pos += 12 + get_u32(data + 8);
+        }
+        else if ((tag == REPLAYTAG_END) && (remaining >= 12)) {
+            state.replay.has_end = true;
+            state.replay.num_ticks = get_u32(data + pos);
+            state.replay.end_hash = (uint64_t)get_u32(data + pos + 4) | ((uint64_t)get_u32(data + pos + 8)<<32);
+            break;
+        }
+        else {
+            // unknown or truncated record
+            break;
+        }
+    }
+    free(data);
+    if (!valid) {
+        replay_unload();
+        return false;
+    }
+    state.replay.cur_run = 0;
+    state.replay.playing = true;
+    return true;
+}
+
+// the recorded keys for a tick
+static uint16_t replay_keys(uint32_t tick) {
+    if (0 == state.replay.num_runs) {
+        return 0;
+    }
+    // ticks are usually played back in order, so continue at the last run
+    uint32_t i = state.replay.cur_run;
+    if (tick < state.replay.runs[i].tick) {
+        i = 0;
+    }
+    while (((i + 1) < state.replay.num_runs) && (tick >= state.replay.runs[i + 1].tick)) {
+        i++;
+    }
+    state.replay.cur_run = i;
+    return state.replay.runs[i].keys;
+}
+
+// start playback at the beginning of the replay
+static void replay_rewind(game_ctx_t* ctx) {
+    const bool audible = ctx->audible;
+    #if PACMAN_TELEMETRY
+        telem_ring_t* telem = ctx->telem;
+    #endif
+    sim_init(ctx);
+    ctx->game.seed = state.replay.seed;
+    ctx->audible = audible;
+    #if PACMAN_TELEMETRY
+        ctx->telem = telem;
+    #endif
+    TELEM(ctx, TELEM_REWIND, 0, i2(0, 0), 0);
+}
+
+// simulate the next tick with the recorded input
+static void replay_step(game_ctx_t* ctx) {
+    input_keys(ctx, replay_keys(ctx->timing.tick));
+    sim_tick(ctx);
+}
+
+// fast-forward (or rewind) the game to a tick using the closest preceding snapshot
+static void replay_seek(game_ctx_t* ctx, uint32_t tick) {
+    if (tick > state.replay.num_ticks) {
+        tick = state.replay.num_ticks;
+    }
+    const replay_snapshot_t* snapshot = 0;
+    for (uint32_t i = 0; i < state.replay.num_snapshots; i++) {
+        if (state.replay.snapshots[i].tick <= tick) {
+            snapshot = &state.replay.snapshots[i];
+        }
+    }
+    if (snapshot && ((snapshot->tick > ctx->timing.tick) || (tick < ctx->timing.tick))) {
+        game_restore(ctx, &snapshot->snapshot);
+    }
+    else if (tick < ctx->timing.tick) {
+        replay_rewind(ctx);
+    }
+    const bool audible = ctx->audible;
+    ctx->audible = false;
+    while (ctx->timing.tick < tick) {
+        replay_step(ctx);
+    }
+    ctx->audible = audible;
+}
+
+// check the state at the end of playback against the recorded state hash
+static bool replay_verify(const game_ctx_t* ctx) {
+    return !state.replay.has_end || ((ctx->timing.tick == state.replay.num_ticks) && (game_hash(ctx) == state.replay.end_hash));
+}
+
+#if !PACMAN_HEADLESS
+// parse the replay command line args, called from sokol_main()
+static void replay_parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < (argc - 1); i++) {
+        if (0 == strcmp(argv[i], "-record")) {
+            state.replay.record_path = argv[++i];
+        }
+        else if (0 == strcmp(argv[i], "-replay")) {
+            state.replay.replay_path = argv[++i];
+        }
+        else if (0 == strcmp(argv[i], "-seek")) {
+            state.replay.seek_tick = (uint32_t) strtoul(argv[++i], 0, 10);
+        }
+    }
+}
+
+// start recording or playback for the game instance driven by the app callbacks
+static void replay_init(game_ctx_t* ctx) {
+    if (state.replay.replay_path) {
+        if (replay_load(state.replay.replay_path)) {
+            state.replay.active = true;
+            replay_rewind(ctx);
+            replay_seek(ctx, state.replay.seek_tick);
+        }
+        else {
+            slog_func("pacman", 2, 0, "replay: failed to load replay file", __LINE__, __FILE__, 0);
+        }
+    }
+    else if (state.replay.record_path) {
+        if (replay_record_begin(state.replay.record_path, ctx)) {
+            state.replay.active = true;
+        }
+        else {
+            slog_func("pacman", 2, 0, "replay: failed to open file for recording", __LINE__, __FILE__, 0);
+        }
+    }
+}
+
+// keyboard input from the event callback while recording or playing back
+static void replay_key(inputkey_t key, bool btn_down) {
+    if (btn_down) {
+        state.replay.live_keys |= (uint16_t)(1<<key);
+    }
+    else {
+        state.replay.live_keys &= (uint16_t)~(1<<key);
+    }
+}
+
+// apply the recorded or live input for the next tick, called before sim_tick()
+static void replay_tick(game_ctx_t* ctx) {
+    if (!state.replay.active) {
+        return;
+    }
+    if (state.replay.playing) {
+        if (ctx->timing.tick < state.replay.num_ticks) {
+            input_keys(ctx, replay_keys(ctx->timing.tick));
+            return;
+        }
+        // end of replay reached, the player takes over
+        if (!replay_verify(ctx)) {
+            slog_func("pacman", 2, 0, "replay: state at end of replay differs from recording", __LINE__, __FILE__, 0);
+        }
+        replay_unload();
+    }
+    if (state.replay.recording) {
+        replay_record_tick(ctx, state.replay.live_keys);
+    }
+    input_keys(ctx, state.replay.live_keys);
+}
+
+static void replay_shutdown(game_ctx_t* ctx) {
+    replay_record_end(ctx);
+    replay_unload();
+}
+#endif // !PACMAN_HEADLESS
+#endif // PACMAN_REPLAY
+
+/*== HEADLESS SIMULATION RUNNER ==============================================*/
+#if PACMAN_HEADLESS && !PACMAN_ATLASGEN
+/*
+    The headless runner steps the simulation as fast as the CPU allows,
+    without window, GPU or audio device. Input comes either from an input
+    script, or from a simple random-walk input policy:
+
+        pacman_headless [-script file] [-ticks num] [-seed num]
+
+    An input script is a text file where each line holds a number of ticks
+    followed by the keys that are held down during those ticks, lines
+    starting with '#' are comments:
+
+        # start the game and wait until the prelude has finished
+        1 any
+        300
+        # run left for 2 seconds, then up for 1 second
+        120 left
+        60 up
+
+    Valid key names are: up down left right esc w a s d l any
+
+    Without a script, the random-walk policy holds a random arrow key for
+    16 ticks at a time, this also starts a new game from the intro screen.
+    With -autoplay, the autoplay bot plays with the arrow keys instead (see
+    AUTOPLAY BOT).
+
+    With -battle num, the games are played in battle mode with 2..8 players
+    moving at the same time. Player 0 is steered by the script or random-walk
+    keys, and the other players by their own random-walk policy, which is
+    derived from the seed, the player index and the tick (also when a script
+    is used). Battle games can't be recorded into replay files.
+
+    See further below for the multithreaded batch mode.
+*/
+#define HEADLESS_MAX_SCRIPT_LINES (4096)
+#define HEADLESS_DEFAULT_TICKS (60*60*60)   // one hour of game time
+
+// the random-walk input policy, uses its own xorshift state so that
+// the game's random number generator isn't affected
+static uint16_t headless_random_keys(uint32_t* rng, uint32_t tick, uint16_t cur_keys) {
+    if ((tick % 16) == 0) {
+        static const inputkey_t dirs[4] = { INPUTKEY_UP, INPUTKEY_DOWN, INPUTKEY_LEFT, INPUTKEY_RIGHT };
+        uint32_t x = *rng;
+        x ^= x<<13;
+        x ^= x>>17;
+        x ^= x<<5;
+        *rng = x;
+        return (uint16_t)(1<<dirs[x & 3]);
+    }
+    return cur_keys;
+}
+
+// the benchmark suite only shares the random-walk policy with the runner
+#if !PACMAN_BENCH
+static int headless_battle_players;     // 0 for the regular game
+
+typedef struct {
+    uint32_t ticks;         // number of ticks the keys are held
+    uint16_t keys;          // bit mask of (1<<inputkey_t)
+} headless_line_t;
+
+typedef struct {
+    uint32_t num_lines;
+    uint32_t num_ticks;     // overall script length in ticks
+    headless_line_t lines[HEADLESS_MAX_SCRIPT_LINES];
+} headless_script_t;
+
+// convert a key name from an input script into an inputkey_t bit mask
+static uint16_t headless_key_mask(const char* name) {
+    static const struct { const char* name; inputkey_t key; } keys[] = {
+        { "up", INPUTKEY_UP }, { "down", INPUTKEY_DOWN }, { "left", INPUTKEY_LEFT }, { "right", INPUTKEY_RIGHT },
+        { "esc", INPUTKEY_ESC }, { "w", INPUTKEY_W }, { "a", INPUTKEY_A }, { "s", INPUTKEY_S }, { "d", INPUTKEY_D },
+        { "l", INPUTKEY_L }, { "any", INPUTKEY_OTHER },
+    };
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (0 == strcmp(name, keys[i].name)) {
+            return (uint16_t)(1<<keys[i].key);
+        }
+    }
+    return 0;
+}
+
+// load an input script, return false on error
+static bool headless_load_script(const char* path, headless_script_t* script) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "failed to open input script '%s'\n", path);
+        return false;
+    }
+    bool ok = true;
+    int line_nr = 0;
+    char line[256];
+    while (ok && fgets(line, sizeof(line), fp)) {
+        line_nr++;
+        char* tok = strtok(line, " \t\r\n");
+        if (!tok || (tok[0] == '#')) {
+            continue;
+        }
+        if (script->num_lines == HEADLESS_MAX_SCRIPT_LINES) {
+            fprintf(stderr, "%s:%d: too many lines in input script\n", path, line_nr);
+            ok = false;
+            break;
+        }
+        headless_line_t* l = &script->lines[script->num_lines++];
+        l->ticks = (uint32_t) strtoul(tok, 0, 10);
+        while ((tok = strtok(0, " \t\r\n"))) {
+            uint16_t mask = headless_key_mask(tok);
+            if (0 == mask) {
+                fprintf(stderr, "%s:%d: unknown key '%s'\n", path, line_nr, tok);
+                ok = false;
+                break;
+            }
+            l->keys |= mask;
+        }
+        script->num_ticks += l->ticks;
+    }
+    fclose(fp);
+    return ok;
+}
+
+// return the keys held down at a specific tick of an input script
+static uint16_t headless_script_keys(const headless_script_t* script, uint32_t tick) {
+    for (uint32_t i = 0; i < script->num_lines; i++) {
+        if (tick < script->lines[i].ticks) {
+            return script->lines[i].keys;
+        }
+        tick -= script->lines[i].ticks;
+    }
+    return 0;
+}
+
+// the random-walk policy of the battle mode players without keyboard, a
+// function of the tick so that re-simulated ticks get the same directions
+static void headless_battle_dirs(game_ctx_t* ctx, uint32_t seed, uint32_t tick) {
+    if (ctx->game.battle && ((tick % 16) == 0)) {
+        for (int p = 1; p < ctx->game.num_players; p++) {
+            uint32_t x = (seed ^ ((tick / 16) * 0x9E3779B1) ^ ((uint32_t)p * 0x85EBCA77)) | 1;
+            x ^= x<<13;
+            x ^= x>>17;
+            x ^= x<<5;
+            ctx->battle_dirs[p] = (uint8_t)(x & 3);
+        }
+    }
+}
+
+// start a game instance into the intro screen, in battle mode if requested on the command line
+static void headless_init(game_ctx_t* ctx) {
+    sim_init(ctx);
+    if (headless_battle_players > 0) {
+        ctx->game.battle = true;
+        ctx->game.num_players = (uint8_t)headless_battle_players;
+    }
+}
+
+// run a game instance with scripted or random-walk input, optionally stop
+// at game over, returns the number of simulated ticks
+static uint32_t headless_run(game_ctx_t* ctx, const headless_script_t* script, uint32_t seed, uint32_t max_ticks, bool stop_at_game_over) {
+    const uint32_t battle_seed = seed;
+    uint16_t keys = 0;
+    uint32_t tick = 0;
+    while (tick < max_ticks) {
+        headless_battle_dirs(ctx, battle_seed, tick);
+        if (script) {
+            keys = headless_script_keys(script, tick);
+        }
+        #if PACMAN_AUTOPLAY
+        else if (state.bot.active) {
+            keys = bot_keys(ctx, true);
+        }
+        #endif
+        else {
+            keys = headless_random_keys(&seed, tick, keys);
+        }
+        if (state.replay.recording) {
+            replay_record_tick(ctx, keys);
+        }
+        input_keys(ctx, keys);
+        sim_tick(ctx);
+        tick++;
+        if (stop_at_game_over && now(ctx, ctx->game.game_over)) {
+            break;
+        }
+    }
+    return tick;
+}
+
+// FNV-1a hash over the emulated video hardware state and game progress
+static uint64_t headless_hash_bytes(uint64_t hash, const void* ptr, size_t num_bytes) {
+    const uint8_t* bytes = (const uint8_t*) ptr;
+    for (size_t i = 0; i < num_bytes; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+static uint64_t headless_hash(const game_ctx_t* ctx) {
+    uint64_t hash = 0xCBF29CE484222325;
+    hash = headless_hash_bytes(hash, ctx->vid.video_ram, sizeof(ctx->vid.video_ram));
+    hash = headless_hash_bytes(hash, ctx->vid.color_ram, sizeof(ctx->vid.color_ram));
+    // the sprites of the battle mode players are only hashed in battle mode
+    const int num_sprites = ctx->game.battle ? NUM_SPRITES : SPRITE_PLAYERS;
+    for (int i = 0; i < num_sprites; i++) {
+        const sprite_t* spr = &ctx->vid.sprite[i];
+        const int32_t vals[7] = { spr->enabled, spr->tile, spr->color, spr->flipx, spr->flipy, spr->pos.x, spr->pos.y };
+        hash = headless_hash_bytes(hash, vals, sizeof(vals));
+    }
+    const uint32_t progress[4] = { ctx->timing.tick, ctx->game.score, ctx->game.round, (uint32_t)ctx->game.num_lives };
+    return headless_hash_bytes(hash, progress, sizeof(progress));
+}
+
+/*
+    The snapshot check verifies that game_snapshot() captures the complete
+    simulation state: every HEADLESS_REWIND_TICKS the game is rewound to
+    the last snapshot and the same ticks are simulated again with the same
+    input, which must end in the same state. It also verifies that the
+    incrementally updated video_ram hash matches a full rehash. Afterwards
+    the cost of taking and restoring a snapshot and of game_hash() is
+    measured:
+
+        pacman_headless -snapcheck [-script file] [-ticks num] [-seed num]
+*/
+#define HEADLESS_REWIND_TICKS (60)
+#define HEADLESS_SNAPSHOT_ROUNDS (1000000)
+
+static bool headless_snapshot_check(game_ctx_t* ctx, const headless_script_t* script, uint32_t seed, uint32_t num_ticks) {
+    static game_snapshot_t snapshot;
+    const uint32_t battle_seed = seed;
+    uint16_t keys[HEADLESS_REWIND_TICKS];
+    uint16_t cur_keys = 0;
+    uint32_t tick = 0;
+    while (tick < num_ticks) {
+        game_snapshot(ctx, &snapshot);
+        const uint32_t num_rewind_ticks = ((num_ticks - tick) < HEADLESS_REWIND_TICKS) ? (num_ticks - tick) : HEADLESS_REWIND_TICKS;
+        for (uint32_t i = 0; i < num_rewind_ticks; i++) {
+            cur_keys = script ? headless_script_keys(script, tick + i) : headless_random_keys(&seed, tick + i, cur_keys);
+            keys[i] = cur_keys;
+            headless_battle_dirs(ctx, battle_seed, tick + i);
+            input_keys(ctx, keys[i]);
+            sim_tick(ctx);
+        }
+        const uint64_t hash = headless_hash(ctx);
+
+        // rewind and simulate the same ticks again
+        game_restore(ctx, &snapshot);
+        for (uint32_t i = 0; i < num_rewind_ticks; i++) {
+            headless_battle_dirs(ctx, battle_seed, tick + i);
+            input_keys(ctx, keys[i]);
+            sim_tick(ctx);
+        }
+        if (hash != headless_hash(ctx)) {
+            fprintf(stderr, "snapshot check failed between tick %u and %u\n", tick, tick + num_rewind_ticks);
+            return false;
+        }
+        if (ctx->vid.tile_hash != vid_full_hash(ctx)) {
+            fprintf(stderr, "incremental video_ram hash differs from full hash at tick %u\n", tick + num_rewind_ticks);
+            return false;
+        }
+        tick += num_rewind_ticks;
+    }
+
+    // measure snapshot and restore cost
+    uint64_t start_ns = time_now_ns();
+    for (int i = 0; i < HEADLESS_SNAPSHOT_ROUNDS; i++) {
+        game_snapshot(ctx, &snapshot);
+    }
+    const uint64_t snapshot_ns = time_now_ns() - start_ns;
+    start_ns = time_now_ns();
+    for (int i = 0; i < HEADLESS_SNAPSHOT_ROUNDS; i++) {
+        game_restore(ctx, &snapshot);
+    }
+    const uint64_t restore_ns = time_now_ns() - start_ns;
+    uint64_t hash = 0;
+    start_ns = time_now_ns();
+    for (int i = 0; i < HEADLESS_SNAPSHOT_ROUNDS; i++) {
+        // modify the state a little to keep the compiler from hoisting game_hash() out of the loop
+        ctx->timing.tick ^= (uint32_t)hash;
+        hash = game_hash(ctx);
+    }
+    const uint64_t hash_ns = time_now_ns() - start_ns;
+    game_restore(ctx, &snapshot);
+    printf("snapshot_check: ok\n");
+    printf("snapshot_bytes: %u\n", (unsigned)sizeof(game_snapshot_t));
+    printf("snapshot_ns: %.1f\n", (double)snapshot_ns / HEADLESS_SNAPSHOT_ROUNDS);
+    printf("restore_ns: %.1f\n", (double)restore_ns / HEADLESS_SNAPSHOT_ROUNDS);
+    printf("hash_ns: %.1f\n", (double)hash_ns / HEADLESS_SNAPSHOT_ROUNDS);
+    return true;
+}
+
+/*
+    Batch mode simulates many independent games in parallel on all CPU
+    cores, each game runs until game over or until the tick limit is
+    reached:
+
+        pacman_headless -batch num [-threads num] [-ticks num] [-seed num] [-script file]...
+
+    '-batch num' adds num random-walk games with seeds derived from '-seed',
+    each '-script file' adds a game driven by an input script. Per game,
+    the final score, the round reached, the ticks survived and a state
+    hash are printed.
+
+    Since game durations vary a lot, jobs are distributed with a simple
+    work-stealing scheduler: each worker thread owns a contiguous range of
+    job indices packed into a single 64-bit word. The owner pops jobs from
+    the front of its range, and a worker which runs out of jobs steals the
+    back half of another worker's range, both with a compare-and-swap on
+    the packed range. Jobs are never added after the start, so a worker
+    which finds all ranges empty can quit.
+
+    With '-scaling num' instead of '-batch num', the same batch is
+    simulated with 1, 2, 4... threads up to the number of CPU cores, the
+    throughput of each pass is printed together with the speedup over the
+    single-threaded pass, and the per-game results are checked to be
+    identical across all passes.
+*/
+#define HEADLESS_MAX_THREADS (64)
+
+typedef struct {
+    // job description
+    const char* script_path;
+    const headless_script_t* script;    // null for random-walk input
+    uint32_t seed;
+    uint32_t max_ticks;
+    // job results
+    uint32_t score;
+    uint32_t round;
+    uint32_t ticks;
+    uint64_t hash;
+} headless_job_t;
+
+// a worker's job range, padded to a cache line to prevent false sharing
+typedef struct {
+    volatile uint64_t range;    // (begin<<32)|end
+    uint32_t num_steals;
+    uint8_t pad[52];
+} headless_queue_t;
+
+static struct {
+    headless_job_t* jobs;
+    uint32_t num_jobs;
+    int num_threads;
+    headless_queue_t queue[HEADLESS_MAX_THREADS];
+} headless_batch;
+
+#if defined(_MSC_VER)
+static uint64_t headless_atomic_load(volatile uint64_t* ptr) {
+    return (uint64_t)_InterlockedCompareExchange64((volatile long long*)ptr, 0, 0);
+}
+
+static void headless_atomic_store(volatile uint64_t* ptr, uint64_t val) {
+    _InterlockedExchange64((volatile long long*)ptr, (long long)val);
+}
+
+static bool headless_atomic_cas(volatile uint64_t* ptr, uint64_t expected, uint64_t desired) {
+    return expected == (uint64_t)_InterlockedCompareExchange64((volatile long long*)ptr, (long long)desired, (long long)expected);
+}
+#else
+static uint64_t headless_atomic_load(volatile uint64_t* ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static void headless_atomic_store(volatile uint64_t* ptr, uint64_t val) {
+    __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+static bool headless_atomic_cas(volatile uint64_t* ptr, uint64_t expected, uint64_t desired) {
+    return __atomic_compare_exchange_n(ptr, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#endif
+
+static uint64_t headless_range(uint32_t begin, uint32_t end) {
+    return ((uint64_t)begin<<32) | end;
+}
+
+// pop the next job from the front of a worker's own range, return false if empty
+static bool headless_pop_job(headless_queue_t* queue, uint32_t* out_job) {
+    while (true) {
+        const uint64_t range = headless_atomic_load(&queue->range);
+        const uint32_t begin = (uint32_t)(range>>32);
+        const uint32_t end = (uint32_t)range;
+        if (begin >= end) {
+            return false;
+        }
+        if (headless_atomic_cas(&queue->range, range, headless_range(begin + 1, end))) {
+            *out_job = begin;
+            return true;
+        }
+    }
+}
+
+// steal the back half of another worker's range, run the first stolen
+// job immediately and move the rest into the own (empty) range
+static bool headless_steal_job(int thief, uint32_t* out_job) {
+    headless_queue_t* own = &headless_batch.queue[thief];
+    for (int i = 1; i < headless_batch.num_threads; i++) {
+        headless_queue_t* victim = &headless_batch.queue[(thief + i) % headless_batch.num_threads];
+        while (true) {
+            const uint64_t range = headless_atomic_load(&victim->range);
+            const uint32_t begin = (uint32_t)(range>>32);
+            const uint32_t end = (uint32_t)range;
+            if (begin >= end) {
+                break;
+            }
+            const uint32_t split = end - (end - begin + 1) / 2;
+            if (headless_atomic_cas(&victim->range, range, headless_range(begin, split))) {
+                headless_atomic_store(&own->range, headless_range(split + 1, end));
+                own->num_steals++;
+                *out_job = split;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void headless_worker(int index) {
+    game_ctx_t* ctx = (game_ctx_t*) malloc(sizeof(game_ctx_t));
+    assert(ctx);
+    uint32_t job_index;
+    while (headless_pop_job(&headless_batch.queue[index], &job_index) || headless_steal_job(index, &job_index)) {
+        headless_job_t* job = &headless_batch.jobs[job_index];
+        headless_init(ctx);
+        job->ticks = headless_run(ctx, job->script, job->seed, job->max_ticks, true);
+        job->score = ctx->game.score * 10;
+        job->round = ctx->game.round;
+        job->hash = game_hash(ctx);
+    }
+    free(ctx);
+}
+
+#if defined(_WIN32)
+typedef HANDLE headless_thread_t;
+
+static DWORD WINAPI headless_thread_func(LPVOID arg) {
+    headless_worker((int)(intptr_t)arg);
+    return 0;
+}
+
+static headless_thread_t headless_thread_start(int index) {
+    return CreateThread(0, 0, headless_thread_func, (LPVOID)(intptr_t)index, 0, 0);
+}
+
+static void headless_thread_join(headless_thread_t thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+static int headless_num_cores(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+#else
+typedef pthread_t headless_thread_t;
+
+static void* headless_thread_func(void* arg) {
+    headless_worker((int)(intptr_t)arg);
+    return 0;
+}
+
+static headless_thread_t headless_thread_start(int index) {
+    pthread_t thread;
+    pthread_create(&thread, 0, headless_thread_func, (void*)(intptr_t)index);
+    return thread;
+}
+
+static void headless_thread_join(headless_thread_t thread) {
+    pthread_join(thread, 0);
+}
+
+static int headless_num_cores(void) {
+    return (int)sysconf(_SC_NPROCESSORS_ONLN);
+}
+#endif
+
+// simulate all jobs of the batch with a number of worker threads, return the duration in seconds
+static double headless_batch_run(int num_threads, uint32_t* out_num_steals) {
+    headless_batch.num_threads = num_threads;
+    for (int i = 0; i < num_threads; i++) {
+        headless_queue_t* queue = &headless_batch.queue[i];
+        queue->range = headless_range(
+            (uint32_t)(((uint64_t)headless_batch.num_jobs * i) / num_threads),
+            (uint32_t)(((uint64_t)headless_batch.num_jobs * (i + 1)) / num_threads));
+        queue->num_steals = 0;
+    }
+    headless_thread_t threads[HEADLESS_MAX_THREADS];
+    const uint64_t start_ns = time_now_ns();
+    // the main thread works as worker 0
+    for (int i = 1; i < num_threads; i++) {
+        threads[i] = headless_thread_start(i);
+    }
+    headless_worker(0);
+    for (int i = 1; i < num_threads; i++) {
+        headless_thread_join(threads[i]);
+    }
+    const uint64_t duration_ns = time_now_ns() - start_ns;
+    *out_num_steals = 0;
+    for (int i = 0; i < num_threads; i++) {
+        *out_num_steals += headless_batch.queue[i].num_steals;
+    }
+    return (double)duration_ns / 1000000000.0;
+}
+
+static uint64_t headless_batch_ticks(void) {
+    uint64_t num_ticks = 0;
+    for (uint32_t i = 0; i < headless_batch.num_jobs; i++) {
+        num_ticks += headless_batch.jobs[i].ticks;
+    }
+    return num_ticks;
+}
+
+static void headless_print_jobs(void) {
+    for (uint32_t i = 0; i < headless_batch.num_jobs; i++) {
+        const headless_job_t* job = &headless_batch.jobs[i];
+        if (job->script) {
+            printf("job %u: script=%s", i, job->script_path);
+        }
+        else {
+            printf("job %u: seed=0x%08X", i, job->seed);
+        }
+        printf(" score=%u round=%u ticks=%u hash=%016llX\n", job->score, job->round, job->ticks, (unsigned long long)job->hash);
+    }
+}
+
+// run a scaling benchmark over 1, 2, 4... threads, return false if the results differ between passes
+static bool headless_batch_scaling(int max_threads) {
+    const size_t jobs_size = headless_batch.num_jobs * sizeof(headless_job_t);
+    headless_job_t* ref_jobs = (headless_job_t*) malloc(jobs_size);
+    assert(ref_jobs);
+    bool ok = true;
+    double ref_secs = 0.0;
+    printf("%8s %10s %14s %14s %8s %8s\n", "threads", "seconds", "ticks", "ticks_per_sec", "speedup", "steals");
+    int num_threads = 1;
+    while (ok) {
+        uint32_t num_steals;
+        const double secs = headless_batch_run(num_threads, &num_steals);
+        const uint64_t num_ticks = headless_batch_ticks();
+        if (num_threads == 1) {
+            ref_secs = secs;
+            memcpy(ref_jobs, headless_batch.jobs, jobs_size);
+        }
+        else {
+            for (uint32_t i = 0; i < headless_batch.num_jobs; i++) {
+                if ((ref_jobs[i].hash != headless_batch.jobs[i].hash) || (ref_jobs[i].ticks != headless_batch.jobs[i].ticks)) {
+                    fprintf(stderr, "job %u: result with %d threads differs from single-threaded result\n", i, num_threads);
+                    ok = false;
+                }
+            }
+        }
+        printf("%8d %10.3f %14llu %14.0f %8.2f %8u\n", num_threads, secs, (unsigned long long)num_ticks,
+            (secs > 0.0) ? (num_ticks / secs) : 0.0, (secs > 0.0) ? (ref_secs / secs) : 0.0, num_steals);
+        if (num_threads == max_threads) {
+            break;
+        }
+        num_threads = ((num_threads * 2) < max_threads) ? (num_threads * 2) : max_threads;
+    }
+    free(ref_jobs);
+    return ok;
+}
+
+static int headless_batch_main(const char** script_paths, int num_scripts, uint32_t num_seeds, uint32_t num_ticks, uint32_t seed, int num_threads, bool scaling) {
+    if (num_threads <= 0) {
+        num_threads = headless_num_cores();
+    }
+    if (num_threads > HEADLESS_MAX_THREADS) {
+        num_threads = HEADLESS_MAX_THREADS;
+    }
+    headless_batch.num_jobs = num_seeds + (uint32_t)num_scripts;
+    if (0 == headless_batch.num_jobs) {
+        fprintf(stderr, "no jobs in batch\n");
+        return 10;
+    }
+    headless_batch.jobs = (headless_job_t*) calloc(headless_batch.num_jobs, sizeof(headless_job_t));
+    headless_script_t* scripts = (headless_script_t*) calloc((size_t)num_scripts + 1, sizeof(headless_script_t));
+    assert(headless_batch.jobs && scripts);
+    int result = 0;
+    uint32_t job_index = 0;
+    for (int i = 0; i < num_scripts; i++) {
+        if (!headless_load_script(script_paths[i], &scripts[i])) {
+            result = 10;
+        }
+        headless_job_t* job = &headless_batch.jobs[job_index++];
+        job->script_path = script_paths[i];
+        job->script = &scripts[i];
+        job->max_ticks = num_ticks ? num_ticks : scripts[i].num_ticks;
+    }
+    for (uint32_t i = 0; i < num_seeds; i++) {
+        headless_job_t* job = &headless_batch.jobs[job_index++];
+        // spread consecutive seeds over the xorshift state space
+        job->seed = (seed + i) * 0x9E3779B1;
+        if (0 == job->seed) {
+            job->seed = 1;
+        }
+        job->max_ticks = num_ticks ? num_ticks : HEADLESS_DEFAULT_TICKS;
+    }
+    if (0 == result) {
+        if (scaling) {
+            if (!headless_batch_scaling(num_threads)) {
+                result = 10;
+            }
+        }
+        else {
+            uint32_t num_steals;
+            const double secs = headless_batch_run(num_threads, &num_steals);
+            const uint64_t total_ticks = headless_batch_ticks();
+            headless_print_jobs();
+            printf("jobs: %u\n", headless_batch.num_jobs);
+            printf("threads: %d\n", num_threads);
+            printf("game_bytes: %u\n", (unsigned)sizeof(game_ctx_t));
+            printf("steals: %u\n", num_steals);
+            printf("ticks: %llu\n", (unsigned long long)total_ticks);
+            printf("seconds: %.6f\n", secs);
+            printf("ticks_per_sec: %.0f\n", (secs > 0.0) ? (total_ticks / secs) : 0.0);
+        }
+    }
+    free(scripts);
+    free(headless_batch.jobs);
+    return result;
+}
+
+/*
+    The stream check encodes the video state of every tick into a spectator
+    stream (see SPECTATOR STREAM), decodes each completed packet into a
+    second game instance the same way a viewer does, and verifies that the
+    decoded video state matches the encoded one. Afterwards the stream's
+    bandwidth is printed, with and without the keyframes:
+
+        pacman_headless -streamcheck [-battle num] [-script file] [-ticks num] [-seed num]
+*/
+static bool headless_stream_check(game_ctx_t* ctx, const headless_script_t* script, uint32_t seed, uint32_t num_ticks) {
+    static spec_stream_t stream;
+    static spec_frame_t expected;
+    static spec_frame_t viewer_ref;
+    static game_ctx_t viewer;
+    memset(&stream, 0, sizeof(stream));
+    memset(&viewer_ref, 0, sizeof(viewer_ref));
+    sim_init(&viewer);
+    const uint32_t battle_seed = seed;
+    uint16_t keys = 0;
+    uint32_t num_packets = 0;
+    uint32_t num_keyframes = 0;
+    uint64_t num_bytes = 0;
+    uint64_t num_keyframe_bytes = 0;
+    for (uint32_t tick = 0; tick <= num_ticks; tick++) {
+        // the last completed packet holds the state before this tick's record
+        expected = stream.ref;
+        int size;
+        if (tick < num_ticks) {
+            headless_battle_dirs(ctx, battle_seed, tick);
+            keys = script ? headless_script_keys(script, tick) : headless_random_keys(&seed, tick, keys);
+            input_keys(ctx, keys);
+            sim_tick(ctx);
+            size = spec_stream_tick(&stream, ctx, false);
+            if (!spec_frame_equal(&stream.ref, ctx)) {
+                fprintf(stderr, "stream reference state differs from video state at tick %u\n", tick);
+                return false;
+            }
+        }
+        else {
+            size = spec_stream_flush(&stream);
+        }
+        if (0 == size) {
+            continue;
+        }
+        uint32_t seq, num_records;
+        bool keyframe;
+        spec_bits_t bits;
+        if (!spec_packet_header(stream.out, size, &seq, &num_records, &keyframe)) {
+            fprintf(stderr, "invalid stream packet header at tick %u\n", tick);
+            return false;
+        }
+        spec_bits_init(&bits, stream.out + SPEC_PACKET_HEADER_SIZE, (uint32_t)(size - SPEC_PACKET_HEADER_SIZE));
+        for (uint32_t i = 0; i < num_records; i++) {
+            if (!spec_decode(&viewer_ref, &bits, &viewer)) {
+                fprintf(stderr, "malformed stream record at tick %u\n", tick);
+                return false;
+            }
+            if (keyframe && (0 == i)) {
+                num_keyframes++;
+                num_keyframe_bytes += (bits.pos + 7) / 8;
+            }
+        }
+        if (!spec_frame_equal(&expected, &viewer)) {
+            fprintf(stderr, "decoded video state differs at tick %u\n", tick);
+            return false;
+        }
+        num_packets++;
+        num_bytes += (uint64_t)size;
+    }
+    const double secs = (double)num_ticks / 60.0;
+    printf("packets: %u\n", num_packets);
+    printf("keyframes: %u\n", num_keyframes);
+    printf("stream_bytes: %llu\n", (unsigned long long)num_bytes);
+    printf("bytes_per_sec: %.0f\n", (secs > 0.0) ? (num_bytes / secs) : 0.0);
+    printf("delta_bytes_per_sec: %.0f\n", (secs > 0.0) ? ((num_bytes - num_keyframe_bytes) / secs) : 0.0);
+    return true;
+}
+
+// run a single game for a fixed number of ticks (continuing into new games after game over)
+static int headless_single_main(const char* script_path, const char* record_path, uint32_t num_ticks, uint32_t seed, bool snapcheck, bool streamcheck) {
+    static headless_script_t script;
+    if (script_path && !headless_load_script(script_path, &script)) {
+        return 10;
+    }
+    if (0 == num_ticks) {
+        num_ticks = script_path ? script.num_ticks : HEADLESS_DEFAULT_TICKS;
+    }
+
+    // start into intro screen (same as the init callback)
+    game_ctx_t* ctx = &state.ctx;
+    headless_init(ctx);
+    #if PACMAN_TELEMETRY
+        telem_attach(ctx, 0);
+    #endif
+    if (record_path && !replay_record_begin(record_path, ctx)) {
+        fprintf(stderr, "failed to open replay file '%s' for recording\n", record_path);
+        return 10;
+    }
+
+    if (snapcheck) {
+        if (!headless_snapshot_check(ctx, script_path ? &script : 0, seed, num_ticks)) {
+            return 10;
+        }
+    }
+    else if (streamcheck) {
+        if (!headless_stream_check(ctx, script_path ? &script : 0, seed, num_ticks)) {
+            return 10;
+        }
+    }
+    else {
+        const uint64_t start_ns = time_now_ns();
+        headless_run(ctx, script_path ? &script : 0, seed, num_ticks, false);
+        const uint64_t duration_ns = time_now_ns() - start_ns;
+        replay_record_end(ctx);
+        const double secs = (double)duration_ns / 1000000000.0;
+        printf("ticks: %u\n", num_ticks);
+        printf("seconds: %.6f\n", secs);
+        printf("ticks_per_sec: %.0f\n", (secs > 0.0) ? (num_ticks / secs) : 0.0);
+        #if PACMAN_AUTOPLAY
+        if (state.bot.active) {
+            printf("autoplay_moves: %llu\n", (unsigned long long)state.bot.num_moves);
+            printf("autoplay_rollouts: %llu\n", (unsigned long long)state.bot.num_iterations);
+            printf("autoplay_us_per_move: %.1f\n", state.bot.num_moves ? (state.bot.search_ns / 1000.0 / state.bot.num_moves) : 0.0);
+        }
+        #endif
+    }
+    printf("score: %u\n", ctx->game.score * 10);
+    printf("hiscore: %u\n", ctx->game.hiscore * 10);
+    printf("round: %u\n", ctx->game.round);
+    printf("lives: %d\n", ctx->game.num_lives);
+    printf("state_hash: %016llX\n", (unsigned long long)game_hash(ctx));
+    return 0;
+}
+
+// play back a replay file as fast as possible, optionally starting at a tick
+static int headless_replay_main(const char* replay_path, uint32_t seek_tick, uint32_t num_ticks) {
+    if (!replay_load(replay_path)) {
+        fprintf(stderr, "failed to load replay file '%s'\n", replay_path);
+        return 10;
+    }
+    game_ctx_t* ctx = &state.ctx;
+    #if PACMAN_TELEMETRY
+        telem_attach(ctx, 0);
+    #endif
+    replay_rewind(ctx);
+
+    // seek to the start tick (via the closest embedded snapshot)
+    uint64_t start_ns = time_now_ns();
+    replay_seek(ctx, seek_tick);
+    const uint64_t seek_ns = time_now_ns() - start_ns;
+    const uint32_t start_tick = ctx->timing.tick;
+
+    // play back until the end of the replay or for a number of ticks
+    uint32_t end_tick = state.replay.num_ticks;
+    if ((num_ticks > 0) && ((start_tick + num_ticks) < end_tick)) {
+        end_tick = start_tick + num_ticks;
+    }
+    start_ns = time_now_ns();
+    while (ctx->timing.tick < end_tick) {
+        replay_step(ctx);
+    }
+    const uint64_t duration_ns = time_now_ns() - start_ns;
+    const double secs = (double)duration_ns / 1000000000.0;
+    const uint32_t played_ticks = end_tick - start_tick;
+    printf("replay_ticks: %u\n", state.replay.num_ticks);
+    printf("replay_snapshots: %u\n", state.replay.num_snapshots);
+    printf("seek_tick: %u\n", start_tick);
+    printf("seek_ms: %.3f\n", (double)seek_ns / 1000000.0);
+    printf("ticks: %u\n", played_ticks);
+    printf("seconds: %.6f\n", secs);
+    printf("ticks_per_sec: %.0f\n", (secs > 0.0) ? (played_ticks / secs) : 0.0);
+    printf("score: %u\n", ctx->game.score * 10);
+    printf("round: %u\n", ctx->game.round);
+    printf("lives: %d\n", ctx->game.num_lives);
+    printf("state_hash: %016llX\n", (unsigned long long)game_hash(ctx));
+    int result = 0;
+    if (end_tick == state.replay.num_ticks) {
+        if (!state.replay.has_end) {
+            printf("replay_check: skipped (truncated replay file)\n");
+        }
+        else if (replay_verify(ctx)) {
+            printf("replay_check: ok\n");
+        }
+        else {
+            printf("replay_check: failed\n");
+            result = 10;
+        }
+    }
+    replay_unload();
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    const char** script_paths = (const char**) malloc((size_t)argc * sizeof(char*));
+    const char** maze_paths = (const char**) malloc((size_t)argc * sizeof(char*));
+    assert(script_paths && maze_paths);
+    int num_scripts = 0;
+    int num_mazes = 0;
+    uint32_t num_ticks = 0;
+    uint32_t seed = 0x2545F491;
+    uint32_t num_seeds = 0;
+    int num_threads = 0;
+    bool batch = false;
+    bool scaling = false;
+    bool snapcheck = false;
+    bool streamcheck = false;
+    bool usage = false;
+    const char* record_path = 0;
+    const char* replay_path = 0;
+    const char* levels_path = 0;
+    const char* write_levels_path = 0;
+    const char* telemetry_path = 0;
+    uint32_t seek_tick = 0;
+    for (int i = 1; i < argc; i++) {
+        if ((0 == strcmp(argv[i], "-script")) && ((i + 1) < argc)) {
+            script_paths[num_scripts++] = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-ticks")) && ((i + 1) < argc)) {
+            num_ticks = (uint32_t) strtoul(argv[++i], 0, 10);
+        }
+        else if ((0 == strcmp(argv[i], "-seed")) && ((i + 1) < argc)) {
+            seed = (uint32_t) strtoul(argv[++i], 0, 0);
+        }
+        else if (((0 == strcmp(argv[i], "-batch")) || (0 == strcmp(argv[i], "-scaling"))) && ((i + 1) < argc)) {
+            batch = true;
+            scaling = (0 == strcmp(argv[i], "-scaling"));
+            num_seeds = (uint32_t) strtoul(argv[++i], 0, 10);
+        }
+        else if ((0 == strcmp(argv[i], "-threads")) && ((i + 1) < argc)) {
+            num_threads = atoi(argv[++i]);
+        }
+        else if (0 == strcmp(argv[i], "-snapcheck")) {
+            snapcheck = true;
+        }
+        else if (0 == strcmp(argv[i], "-streamcheck")) {
+            streamcheck = true;
+        }
+        else if ((0 == strcmp(argv[i], "-record")) && ((i + 1) < argc)) {
+            record_path = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-replay")) && ((i + 1) < argc)) {
+            replay_path = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-seek")) && ((i + 1) < argc)) {
+            seek_tick = (uint32_t) strtoul(argv[++i], 0, 10);
+        }
+        else if ((0 == strcmp(argv[i], "-battle")) && ((i + 1) < argc)) {
+            headless_battle_players = atoi(argv[++i]);
+            if ((headless_battle_players < 2) || (headless_battle_players > MAX_PLAYERS)) {
+                usage = true;
+            }
+        }
+        else if ((0 == strcmp(argv[i], "-levels")) && ((i + 1) < argc)) {
+            levels_path = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-write-levels")) && ((i + 1) < argc)) {
+            write_levels_path = argv[++i];
+        }
+        else if ((0 == strcmp(argv[i], "-maze")) && ((i + 1) < argc)) {
+            maze_paths[num_mazes++] = argv[++i];
+        }
+        #if PACMAN_TELEMETRY
+        else if ((0 == strcmp(argv[i], "-telemetry")) && ((i + 1) < argc)) {
+            telemetry_path = argv[++i];
+        }
+        #endif
+        #if PACMAN_AUTOPLAY
+        else if (0 == strcmp(argv[i], "-autoplay")) {
+            state.bot.active = true;
+            state.bot.key_set = 1;
+        }
+        else if ((0 == strcmp(argv[i], "-autoplay-threads")) && ((i + 1) < argc)) {
+            state.bot.num_threads = atoi(argv[++i]);
+        }
+        else if ((0 == strcmp(argv[i], "-autoplay-iters")) && ((i + 1) < argc)) {
+            state.bot.max_iterations = (uint32_t) strtoul(argv[++i], 0, 10);
+        }
+        #endif
+        else {
+            usage = true;
+        }
+    }
+    bool autoplay = false;
+    #if PACMAN_AUTOPLAY
+        autoplay = state.bot.active;
+        if (0 == state.bot.num_threads) {
+            state.bot.num_threads = BOT_DEFAULT_THREADS;
+        }
+        if (0 == state.bot.max_iterations) {
+            state.bot.max_iterations = BOT_DEFAULT_ITERATIONS;
+        }
+    #endif
+    const bool replay = 0 != replay_path;
+    if (usage || (!batch && (num_scripts > 1)) || (batch && (snapcheck || streamcheck || record_path || replay)) || (snapcheck && (record_path || streamcheck)) || (streamcheck && (record_path || replay)) || (replay && (snapcheck || record_path || num_scripts)) || (headless_battle_players && (record_path || replay)) || ((0 != num_mazes) && !write_levels_path) || (batch && telemetry_path) || (autoplay && (batch || replay || snapcheck || streamcheck || num_scripts))) {
+        fprintf(stderr, "usage: %s [-levels file] [-telemetry file] [-battle players] [-snapcheck|-streamcheck] [-record file] [-script file] [-ticks num] [-seed num]\n", argv[0]);
+        fprintf(stderr, "       %s [-levels file] [-telemetry file] [-battle players] [-record file] -autoplay [-autoplay-threads num] [-autoplay-iters num] [-ticks num] [-seed num]\n", argv[0]);
+        fprintf(stderr, "       %s [-levels file] [-telemetry file] -replay file [-seek tick] [-ticks num]\n", argv[0]);
+        fprintf(stderr, "       %s [-levels file] -batch|-scaling num [-battle players] [-threads num] [-ticks num] [-seed num] [-script file]...\n", argv[0]);
+        fprintf(stderr, "       %s -write-levels file [-maze file]...\n", argv[0]);
+        free(script_paths);
+        free(maze_paths);
+        return 10;
+    }
+    if (!levelpack_init(levels_path)) {
+        fprintf(stderr, "failed to load level pack '%s'\n", levels_path);
+        free(script_paths);
+        free(maze_paths);
+        return 10;
+    }
+    if (write_levels_path) {
+        const bool ok = levelpack_write(write_levels_path, maze_paths, num_mazes);
+        free(script_paths);
+        free(maze_paths);
+        return ok ? 0 : 10;
+    }
+    if (0 == seed) {
+        // a zero seed would lock up the xorshift generator
+        seed = 1;
+    }
+    #if PACMAN_TELEMETRY
+        state.telem.path = telemetry_path;
+        if (!telem_init()) {
+            fprintf(stderr, "failed to open telemetry log '%s'\n", telemetry_path);
+            free(script_paths);
+            free(maze_paths);
+            return 10;
+        }
+    #endif
+    #if PACMAN_AUTOPLAY
+        if (!bot_init()) {
+            fprintf(stderr, "failed to allocate the autoplay workers\n");
+            free(script_paths);
+            free(maze_paths);
+            return 10;
+        }
+    #endif
+    int result;
+    if (batch) {
+        result = headless_batch_main(script_paths, num_scripts, num_seeds, num_ticks, seed, num_threads, scaling);
+    }
+    else if (replay) {
+        result = headless_replay_main(replay_path, seek_tick, num_ticks);
+    }
+    else {
+        result = headless_single_main(num_scripts ? script_paths[0] : 0, record_path, num_ticks, seed, snapcheck, streamcheck);
+    }
+    #if PACMAN_TELEMETRY
+        if (state.telem.active) {
+            telem_shutdown();
+            printf("telemetry_records: %llu\n", (unsigned long long)state.telem.num_written);
+            printf("telemetry_dropped: %llu\n", (unsigned long long)state.telem.num_dropped);
+        }
+    #endif
+    #if PACMAN_AUTOPLAY
+        bot_shutdown();
+    #endif
+    free(script_paths);
+    free(maze_paths);
+    return result;
+}
+#endif // !PACMAN_BENCH
+#endif // PACMAN_HEADLESS && !PACMAN_ATLASGEN
+
+/*== TILE AND COLOR PALETTE DECODING =========================================*/
+#if PACMAN_ATLASGEN || (!PACMAN_HEADLESS && !PACMAN_ATLAS)
+/*
+    8x4 tile decoder (taken from: https://github.com/floooh/chips/blob/master/systems/namco.h)
+
+    This decodes 2-bit-per-pixel tile data from Pacman ROM dumps into
+    8-bit-per-pixel texture data (without doing the RGB palette lookup,
+    this happens during rendering in the pixel shader).
+
+    The Pacman ROM tile layout isn't exactly strightforward, both 8x8 tiles
+    and 16x16 sprites are built from 8x4 pixel blocks layed out linearly
+    in memory, and to add to the confusion, since Pacman is an arcade machine
+    with the display 90 degree rotated, all the ROM tile data is counter-rotated.
+
+    Tile decoding happens either once at startup from ROM dumps into a
+    texture, or at build time in the tile atlas generator (see PACMAN_ATLAS).
+*/
+static inline void gfx_decode_tile_8x4(
+    uint8_t pixels[TILE_TEXTURE_HEIGHT][TILE_TEXTURE_WIDTH],
+    uint32_t tex_x,
+    uint32_t tex_y,
+    const uint8_t* tile_base,
+    uint32_t tile_stride,
+    uint32_t tile_offset,
+    uint8_t tile_code)
+{
+    for (uint32_t tx = 0; tx < TILE_WIDTH; tx++) {
+        uint32_t ti = tile_code * tile_stride + tile_offset + (7 - tx);
+        for (uint32_t ty = 0; ty < (TILE_HEIGHT/2); ty++) {
+            uint8_t p_hi = (tile_base[ti] >> (7 - ty)) & 1;
+            uint8_t p_lo = (tile_base[ti] >> (3 - ty)) & 1;
+            uint8_t p = (p_hi << 1) | p_lo;
+            pixels[tex_y + ty][tex_x + tx] = p;
+        }
+    }
+}
+
+// decode an 8x8 tile into the tile texture's upper half
+static inline void gfx_decode_tile(uint8_t pixels[TILE_TEXTURE_HEIGHT][TILE_TEXTURE_WIDTH], uint8_t tile_code) {
+    uint32_t x = tile_code * TILE_WIDTH;
+    uint32_t y0 = 0;
+    uint32_t y1 = y0 + (TILE_HEIGHT / 2);
+    gfx_decode_tile_8x4(pixels, x, y0, rom_tiles, 16, 8, tile_code);
+    gfx_decode_tile_8x4(pixels, x, y1, rom_tiles, 16, 0, tile_code);
+}
+
+// decode a 16x16 sprite into the tile texture's lower half
+static inline void gfx_decode_sprite(uint8_t pixels[TILE_TEXTURE_HEIGHT][TILE_TEXTURE_WIDTH], uint8_t sprite_code) {
+    uint32_t x0 = sprite_code * SPRITE_WIDTH;
+    uint32_t x1 = x0 + TILE_WIDTH;
+    uint32_t y0 = TILE_HEIGHT;
+    uint32_t y1 = y0 + (TILE_HEIGHT / 2);
+    uint32_t y2 = y1 + (TILE_HEIGHT / 2);
+    uint32_t y3 = y2 + (TILE_HEIGHT / 2);
+    gfx_decode_tile_8x4(pixels, x0, y0, rom_sprites, 64, 40, sprite_code);
+    gfx_decode_tile_8x4(pixels, x1, y0, rom_sprites, 64,  8, sprite_code);
+    gfx_decode_tile_8x4(pixels, x0, y1, rom_sprites, 64, 48, sprite_code);
+    gfx_decode_tile_8x4(pixels, x1, y1, rom_sprites, 64, 16, sprite_code);
+    gfx_decode_tile_8x4(pixels, x0, y2, rom_sprites, 64, 56, sprite_code);
+    gfx_decode_tile_8x4(pixels, x1, y2, rom_sprites, 64, 24, sprite_code);
+    gfx_decode_tile_8x4(pixels, x0, y3, rom_sprites, 64, 32, sprite_code);
+    gfx_decode_tile_8x4(pixels, x1, y3, rom_sprites, 64,  0, sprite_code);
+}
+
+// decode the Pacman tile- and sprite-ROM-dumps into a 8bpp texture
+static void gfx_decode_tiles(uint8_t pixels[TILE_TEXTURE_HEIGHT][TILE_TEXTURE_WIDTH]) {
+    for (uint32_t tile_code = 0; tile_code < 256; tile_code++) {
+        gfx_decode_tile(pixels, tile_code);
+    }
+    for (uint32_t sprite_code = 0; sprite_code < 64; sprite_code++) {
+        gfx_decode_sprite(pixels, sprite_code);
+    }
+    // write a special opaque 16x16 block which will be used for the fade-effect
+    for (uint32_t y = TILE_HEIGHT; y < TILE_TEXTURE_HEIGHT; y++) {
+        for (uint32_t x = 64*SPRITE_WIDTH; x < 65*SPRITE_WIDTH; x++) {
+            pixels[y][x] = 1;
+        }
+    }
+}
+
+/* decode the Pacman color palette into a palette texture, on the original
+    hardware, color lookup happens in two steps, first through 256-entry
+    palette which indirects into a 32-entry hardware-color palette
+    (of which only 16 entries are used on the Pacman hardware)
+*/
+static void gfx_decode_color_palette(uint32_t palette[256]) {
+    uint32_t hw_colors[32];
+    for (int i = 0; i < 32; i++) {
+       /*
+           Each color ROM entry describes an RGB color in 1 byte:
+
+           | 7| 6| 5| 4| 3| 2| 1| 0|
+           |B1|B0|G2|G1|G0|R2|R1|R0|
+
+           Intensities are: 0x97 + 0x47 + 0x21
+        */
+        uint8_t rgb = rom_hwcolors[i];
+        uint8_t r = ((rgb>>0)&1) * 0x21 + ((rgb>>1)&1) * 0x47 + ((rgb>>2)&1) * 0x97;
+        uint8_t g = ((rgb>>3)&1) * 0x21 + ((rgb>>4)&1) * 0x47 + ((rgb>>5)&1) * 0x97;
+        uint8_t b = ((rgb>>6)&1) * 0x47 + ((rgb>>7)&1) * 0x97;
+        hw_colors[i] = 0xFF000000 | (b<<16) | (g<<8) | r;
+    }
+    for (int i = 0; i < 256; i++) {
+        palette[i] = hw_colors[rom_palette[i] & 0xF];
+        // first color in each color block is transparent
+        if ((i & 3) == 0) {
+            palette[i] &= 0x00FFFFFF;
+        }
+    }
+}
+#endif
+
+/*== TILE ATLAS GENERATOR ====================================================*/
+#if PACMAN_ATLASGEN
+/*
+    The tile atlas generator runs the tile and color palette decoders at
+    build time, and writes the decoded 8bpp tile texture and RGBA palette
+    as C arrays into a header file:
+
+        pacman_atlasgen pacman_atlas.h
+
+    A game build with PACMAN_ATLAS=1 includes this header and uploads
+    the arrays directly into textures, so that it neither needs to decode
+    the ROM dumps at startup, nor keep the decode scratch buffers around.
+*/
+static uint8_t atlasgen_tile_pixels[TILE_TEXTURE_HEIGHT][TILE_TEXTURE_WIDTH];
+static uint32_t atlasgen_color_palette[256];
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s output.h\n", argv[0]);
+        return 10;
+    }
+    gfx_decode_tiles(atlasgen_tile_pixels);
+    gfx_decode_color_palette(atlasgen_color_palette);
+
+    FILE* fp = fopen(argv[1], "w");
+    if (!fp) {
+        fprintf(stderr, "failed to open '%s'\n", argv[1]);
+        return 10;
+    }
+    fprintf(fp, "// generated by pacman_atlasgen from the ROM dumps in pacman.c, don't edit!\n\n");
+    fprintf(fp, "static const uint8_t atlas_tile_pixels[%d][%d] = {\n", TILE_TEXTURE_HEIGHT, TILE_TEXTURE_WIDTH);
+    for (int y = 0; y < TILE_TEXTURE_HEIGHT; y++) {
+        fprintf(fp, "    {\n");
+        for (int x = 0; x < TILE_TEXTURE_WIDTH; x++) {
+            fprintf(fp, "%s%d,%s", ((x & 31) == 0) ? "        " : "", atlasgen_tile_pixels[y][x], ((x & 31) == 31) ? "\n" : "");
+        }
+        fprintf(fp, "    },\n");
+    }
+    fprintf(fp, "};\n\n");
+    fprintf(fp, "static const uint32_t atlas_color_palette[256] = {\n");
+    for (int i = 0; i < 256; i++) {
+        fprintf(fp, "%s0x%08X,%s", ((i & 7) == 0) ? "    " : " ", (unsigned)atlasgen_color_palette[i], ((i & 7) == 7) ? "\n" : "");
+    }
+    fprintf(fp, "};\n");
+    const bool failed = ferror(fp);
+    fclose(fp);
+    if (failed) {
+        fprintf(stderr, "failed to write '%s'\n", argv[1]);
+        return 10;
+    }
+    return 0;
+}
+#endif // PACMAN_ATLASGEN
+
+/*== NETPLAY (ROLLBACK NETCODE) ==============================================*/
+#if PACMAN_NETPLAY
+/*
+    The two-player mode can be played over the network, one side hosts the
+    game and controls player 1, the other side joins and controls player 0,
+    both players can use either the arrow keys or WASD:
+
+        pacman -host [port]
+        pacman -join address[:port]
+
+    Both sides run the complete simulation, and only the keys held down
+    per tick are exchanged over UDP. To hide the network latency, the
+    remote input is predicted (by repeating the last received input) so
+    that the local game never waits for the remote side. When the actual
+    remote input arrives and differs from the prediction, the game is
+    rolled back to the snapshot taken before the mispredicted tick, and
+    the ticks since then are simulated again with the corrected input
+    (without triggering sound effects). A simulation tick takes about
+    a microsecond, so a rollback over the full window of NET_MAX_ROLLBACK
+    ticks is negligible compared to the frame duration.
+
+    The local side never runs more than NET_MAX_ROLLBACK ticks ahead of
+    the last received remote input, and the side which is ahead of the
+    other skips a tick now and then (comparing the tick advantage both
+    sides see, which cancels out the network latency).
+
+    Each packet contains all local inputs the other side hasn't
+    acknowledged yet, so lost packets are simply covered by the next one.
+    It also carries the state hash (see game_hash()) of the sender's last
+    tick with known input from both sides, which the other side compares
+    with its own hash of the same tick to detect a desync.
+
+    Until the other side has connected, the game runs locally as usual,
+    and when the connection is established both sides restart the game
+    from the intro screen. Each packet also carries the hash of the
+    sender's level pack, packets from a side with a different level pack
+    are ignored, so that a game can't connect with mismatching mazes.
+*/
+// parse the netplay command line args, called from sokol_main()
+static void net_parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-host")) {
+            state.net.active = true;
+            state.net.host = true;
+            state.net.port = ((i + 1) < argc) ? (uint16_t)atoi(argv[++i]) : 0;
+        }
+        else if ((0 == strcmp(argv[i], "-join")) && ((i + 1) < argc)) {
+            static char address[256];
+            strncpy(address, argv[++i], sizeof(address) - 1);
+            char* sep = strchr(address, ':');
+            if (sep) {
+                *sep = 0;
+                state.net.port = (uint16_t)atoi(sep + 1);
+            }
+            state.net.active = true;
+            state.net.host = false;
+            state.net.address = address;
+        }
+    }
+    if (0 == state.net.port) {
+        state.net.port = NET_DEFAULT_PORT;
+    }
+}
+
+// open a non-blocking UDP socket, bound to bind_port unless it is 0, and
+// resolve address:port into out_peer unless address is null
+static bool net_socket_open(net_socket_t* sock, uint16_t bind_port, const char* address, uint16_t port, struct sockaddr_in* out_peer) {
+    #if defined(_WIN32)
+        WSADATA wsa_data;
+        WSAStartup(MAKEWORD(2, 2), &wsa_data);
+    #endif
+    *sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    bool ok = *sock != NET_INVALID_SOCKET;
+    if (ok && bind_port) {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(bind_port);
+        ok = 0 == bind(*sock, (struct sockaddr*)&addr, sizeof(addr));
+    }
+    if (ok && address) {
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        struct addrinfo* info = 0;
+        ok = (0 == getaddrinfo(address, 0, &hints, &info)) && info;
+        if (ok) {
+            *out_peer = *(struct sockaddr_in*)info->ai_addr;
+            out_peer->sin_port = htons(port);
+            freeaddrinfo(info);
+        }
+    }
+    if (ok) {
+        #if defined(_WIN32)
+            u_long non_blocking = 1;
+            ok = 0 == ioctlsocket(*sock, FIONBIO, &non_blocking);
+        #else
+            ok = 0 == fcntl(*sock, F_SETFL, fcntl(*sock, F_GETFL, 0) | O_NONBLOCK);
+        #endif
+    }
+    if (!ok) {
+        net_socket_close(sock);
+    }
+    return ok;
+}
+
+static void net_socket_close(net_socket_t* sock) {
+    if (*sock != NET_INVALID_SOCKET) {
+        #if defined(_WIN32)
+            closesocket(*sock);
+            WSACleanup();
+        #else
+            close(*sock);
+        #endif
+        *sock = NET_INVALID_SOCKET;
+    }
+}
+
+// open the UDP socket and allocate the rollback snapshots, netplay is deactivated on any error
+static void net_init(void) {
+    state.net.sock = NET_INVALID_SOCKET;
+    if (!state.net.active) {
+        return;
+    }
+    if (state.net.host) {
+        state.net.active = net_socket_open(&state.net.sock, state.net.port, 0, 0, 0);
+    }
+    else {
+        state.net.active = net_socket_open(&state.net.sock, 0, state.net.address, state.net.port, &state.net.peer);
+    }
+    if (state.net.active) {
+        state.net.snapshot = (game_snapshot_t*) calloc(NET_NUM_SNAPSHOTS, sizeof(game_snapshot_t));
+        assert(state.net.snapshot);
+    }
+}
+
+static void net_shutdown(void) {
+    net_socket_close(&state.net.sock);
+    free(state.net.snapshot);
+    state.net.snapshot = 0;
+}
+
+// keyboard input from the event callback, both the arrow keys and WASD move the local player
+static void net_key(inputkey_t key, bool btn_down) {
+    switch (key) {
+        case INPUTKEY_W: key = INPUTKEY_UP; break;
+        case INPUTKEY_S: key = INPUTKEY_DOWN; break;
+        case INPUTKEY_A: key = INPUTKEY_LEFT; break;
+        case INPUTKEY_D: key = INPUTKEY_RIGHT; break;
+        default: break;
+    }
+    if (btn_down) {
+        state.net.local_keys |= (uint16_t)(1<<key);
+    }
+    else {
+        state.net.local_keys &= (uint16_t)~(1<<key);
+    }
+}
+
+// convert canonical player keys into the game's keys for player 0 (WASD)
+static uint16_t net_player2_keys(uint16_t keys) {
+    static const inputkey_t map[4][2] = {
+        { INPUTKEY_UP, INPUTKEY_W }, { INPUTKEY_DOWN, INPUTKEY_S }, { INPUTKEY_LEFT, INPUTKEY_A }, { INPUTKEY_RIGHT, INPUTKEY_D }
+    };
+    for (int i = 0; i < 4; i++) {
+        if (keys & (1<<map[i][0])) {
+            keys = (uint16_t)((keys & ~(1<<map[i][0])) | (1<<map[i][1]));
+        }
+    }
+    return keys;
+}
+
+// the combined keys of both players for a tick
+static uint16_t net_tick_keys(uint32_t tick) {
+    const uint16_t local_keys = state.net.local_input[tick & (NET_INPUT_RING_SIZE - 1)];
+    const uint16_t remote_keys = state.net.remote_input[tick & (NET_INPUT_RING_SIZE - 1)];
+    if (state.net.host) {
+        return local_keys | net_player2_keys(remote_keys);
+    }
+    else {
+        return remote_keys | net_player2_keys(local_keys);
+    }
+}
+
+// predict the remote input for a tick by repeating the last received remote input
+static void net_predict(uint32_t tick) {
+    if (tick >= state.net.remote_tick) {
+        state.net.remote_input[tick & (NET_INPUT_RING_SIZE - 1)] = (state.net.remote_tick > 0) ? state.net.remote_input[(state.net.remote_tick - 1) & (NET_INPUT_RING_SIZE - 1)] : 0;
+    }
+}
+
+// take a snapshot for rollback and simulate one tick with the input of both players
+static void net_sim_tick(uint32_t tick) {
+    game_snapshot(&state.ctx, &state.net.snapshot[tick % NET_NUM_SNAPSHOTS]);
+    input_keys(&state.ctx, net_tick_keys(tick));
+    sim_tick(&state.ctx);
+    state.net.hash[tick & (NET_INPUT_RING_SIZE - 1)] = game_hash(&state.ctx);
+}
+
+// restart the game when the other side has connected
+static void net_connect(const struct sockaddr_in* peer) {
+    state.net.connected = true;
+    state.net.peer = *peer;
+    state.net.tick = 0;
+    state.net.remote_tick = 0;
+    state.net.acked_tick = 0;
+    state.net.remote_cur_tick = 0;
+    state.net.remote_advantage = 0;
+    state.net.rollback_tick = DISABLED_TICKS;
+    state.net.sync_cooldown = 0;
+    state.net.remote_hash_tick = DISABLED_TICKS;
+    state.net.desync = false;
+    memset(state.net.local_input, 0, sizeof(state.net.local_input));
+    memset(state.net.remote_input, 0, sizeof(state.net.remote_input));
+    game_snd_clear(&state.ctx);
+    sim_init(&state.ctx);
+    state.ctx.audible = true;
+}
+
+/* check the header of a received packet, packets from a side with a
+   different level pack are ignored (and logged once)
+*/
+static bool net_valid_packet(const uint8_t* data, int size) {
+    if ((size < NET_PACKET_HEADER_SIZE) || (get_u32(data) != NET_MAGIC)) {
+        return false;
+    }
+    const uint64_t pack_hash = (uint64_t)get_u32(data + 4) | ((uint64_t)get_u32(data + 8)<<32);
+    if (pack_hash != levelpack.hash) {
+        if (!state.net.pack_mismatch) {
+            state.net.pack_mismatch = true;
+            slog_func("pacman", 2, 0, "netplay: the other side uses a different level pack", __LINE__, __FILE__, 0);
+        }
+        return false;
+    }
+    return true;
+}
+
+/* handle a received packet which passed net_valid_packet():
+
+    u32 magic
+    u64 sender's level pack hash
+    u32 sender's current tick
+    u32 sender's tick advantage
+    u32 ack tick (sender has received the receiver's input for all ticks before this one)
+    u32 tick of the first input
+    u32 tick of the state hash (the sender's last tick with known input from both sides), or DISABLED_TICKS
+    u64 state hash after that tick
+    u8  number of inputs
+    u16 inputs...
+*/
+static void net_receive_packet(const uint8_t* data, int size) {
+    const uint32_t cur_tick = get_u32(data + 12);
+    const int32_t advantage = (int32_t)get_u32(data + 16);
+    const uint32_t ack_tick = get_u32(data + 20);
+    const uint32_t first_tick = get_u32(data + 24);
+    const uint32_t hash_tick = get_u32(data + 28);
+    const uint64_t hash = (uint64_t)get_u32(data + 32) | ((uint64_t)get_u32(data + 36)<<32);
+    const int num_inputs = data[40];
+    if (size < (NET_PACKET_HEADER_SIZE + num_inputs * 2)) {
+        return;
+    }
+    if (cur_tick >= state.net.remote_cur_tick) {
+        state.net.remote_cur_tick = cur_tick;
+        state.net.remote_advantage = advantage;
+    }
+    if ((ack_tick > state.net.acked_tick) && (ack_tick <= state.net.tick)) {
+        state.net.acked_tick = ack_tick;
+    }
+    if (hash_tick != DISABLED_TICKS) {
+        // compared in net_check_hash() after a pending rollback
+        state.net.remote_hash_tick = hash_tick;
+        state.net.remote_hash = hash;
+    }
+    for (int i = 0; i < num_inputs; i++) {
+        const uint32_t tick = first_tick + (uint32_t)i;
+        if (tick < state.net.remote_tick) {
+            // already received
+            continue;
+        }
+        if ((tick > state.net.remote_tick) || ((tick >= state.net.tick) && ((tick - state.net.tick) >= (NET_INPUT_RING_SIZE - NET_MAX_ROLLBACK)))) {
+            // a gap (an older packet got lost or reordered), or too far ahead
+            break;
+        }
+        const uint16_t keys = get_u16(data + NET_PACKET_HEADER_SIZE + i*2);
+        uint16_t* slot = &state.net.remote_input[tick & (NET_INPUT_RING_SIZE - 1)];
+        if ((tick < state.net.tick) && (*slot != keys) && (tick < state.net.rollback_tick)) {
+            // the tick was already simulated with a wrong prediction
+            state.net.rollback_tick = tick;
+        }
+        *slot = keys;
+        state.net.remote_tick++;
+    }
+}
+
+// compare the other side's last state hash with the local one to detect a desync
+static void net_check_hash(void) {
+    const uint32_t tick = state.net.remote_hash_tick;
+    if ((tick == DISABLED_TICKS) || state.net.desync) {
+        return;
+    }
+    // only compare ticks which were simulated with known input from both
+    // sides, and for which the local hash is still in the ring buffer
+    if ((tick < state.net.tick) && (tick < state.net.remote_tick) && ((state.net.tick - tick) <= NET_INPUT_RING_SIZE)) {
+        if (state.net.remote_hash != state.net.hash[tick & (NET_INPUT_RING_SIZE - 1)]) {
+            state.net.desync = true;
+            slog_func("pacman", 2, 0, "netplay: game states diverged (desync)", __LINE__, __FILE__, 0);
+        }
+        state.net.remote_hash_tick = DISABLED_TICKS;
+    }
+}
+
+// receive all pending packets, and roll back if remote input was mispredicted, called once per frame
+static void net_poll(void) {
+    if (!state.net.active) {
+        return;
+    }
+    uint8_t data[NET_PACKET_HEADER_SIZE + NET_MAX_PACKET_INPUTS * 2];
+    while (true) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        const int size = (int)recvfrom(state.net.sock, (char*)data, sizeof(data), 0, (struct sockaddr*)&from, &from_len);
+        if (size <= 0) {
+            break;
+        }
+        if (!net_valid_packet(data, size)) {
+            continue;
+        }
+        if (!state.net.connected) {
+            net_connect(&from);
+        }
+        else if ((from.sin_addr.s_addr != state.net.peer.sin_addr.s_addr) || (from.sin_port != state.net.peer.sin_port)) {
+            // ignore packets from anybody else
+            continue;
+        }
+        net_receive_packet(data, size);
+    }
+    if (state.net.rollback_tick != DISABLED_TICKS) {
+        game_restore(&state.ctx, &state.net.snapshot[state.net.rollback_tick % NET_NUM_SNAPSHOTS]);
+        state.ctx.audible = false;
+        for (uint32_t tick = state.net.rollback_tick; tick < state.net.tick; tick++) {
+            net_predict(tick);
+            net_sim_tick(tick);
+        }
+        state.ctx.audible = true;
+        state.net.rollback_tick = DISABLED_TICKS;
+    }
+    net_check_hash();
+}
+
+// advance the game by one tick, called instead of sim_tick() in netplay games
+static void net_tick(void) {
+    if (!state.net.connected) {
+        // local game until the other side has connected
+        input_keys(&state.ctx, state.net.local_keys);
+        sim_tick(&state.ctx);
+        return;
+    }
+    // don't predict further than the rollback window, and don't
+    // overwrite local input the other side hasn't received yet
+    if (((int32_t)(state.net.tick - state.net.remote_tick) >= NET_MAX_ROLLBACK) || ((state.net.tick - state.net.acked_tick) >= NET_INPUT_RING_SIZE)) {
+        return;
+    }
+    // if this side is ahead of the other, skip a tick to let it catch up
+    if (state.net.sync_cooldown > 0) {
+        state.net.sync_cooldown--;
+    }
+    else if (((int32_t)(state.net.tick - state.net.remote_cur_tick) - state.net.remote_advantage) >= 2) {
+        state.net.sync_cooldown = NET_MAX_ROLLBACK;
+        return;
+    }
+    state.net.local_input[state.net.tick & (NET_INPUT_RING_SIZE - 1)] = state.net.local_keys;
+    net_predict(state.net.tick);
+    net_sim_tick(state.net.tick);
+    state.net.tick++;
+}
+
+// send all unacknowledged local input to the other side, called once per frame
+static void net_send(void) {
+    if (!state.net.active || (!state.net.connected && state.net.host)) {
+        return;
+    }
+    // until connected, the joining side sends empty packets to the host
+    uint32_t num_inputs = state.net.tick - state.net.acked_tick;
+    if (num_inputs > NET_MAX_PACKET_INPUTS) {
+        num_inputs = NET_MAX_PACKET_INPUTS;
+    }
+    uint8_t data[NET_PACKET_HEADER_SIZE + NET_MAX_PACKET_INPUTS * 2];
+    put_u32(data, NET_MAGIC);
+    put_u32(data + 4, (uint32_t)levelpack.hash);
+    put_u32(data + 8, (uint32_t)(levelpack.hash>>32));
+    put_u32(data + 12, state.net.tick);
+    put_u32(data + 16, state.net.tick - state.net.remote_cur_tick);
+    put_u32(data + 20, state.net.remote_tick);
+    put_u32(data + 24, state.net.acked_tick);
+    const uint32_t confirmed_tick = (state.net.tick < state.net.remote_tick) ? state.net.tick : state.net.remote_tick;
+    const uint32_t hash_tick = (confirmed_tick > 0) ? (confirmed_tick - 1) : DISABLED_TICKS;
+    const uint64_t hash = (confirmed_tick > 0) ? state.net.hash[hash_tick & (NET_INPUT_RING_SIZE - 1)] : 0;
+    put_u32(data + 28, hash_tick);
+    put_u32(data + 32, (uint32_t)hash);
+    put_u32(data + 36, (uint32_t)(hash>>32));
+    data[40] = (uint8_t)num_inputs;
+    for (uint32_t i = 0; i < num_inputs; i++) {
+        const uint16_t keys = state.net.local_input[(state.net.acked_tick + i) & (NET_INPUT_RING_SIZE - 1)];
+        put_u16(data + NET_PACKET_HEADER_SIZE + i*2, keys);
+    }
+    sendto(state.net.sock, (const char*)data, (int)(NET_PACKET_HEADER_SIZE + num_inputs * 2), 0, (const struct sockaddr*)&state.net.peer, sizeof(state.net.peer));
+}
+#endif // PACMAN_NETPLAY
+
+/*== SPECTATOR STREAM ========================================================*/
+#if PACMAN_SPECTATE || (PACMAN_HEADLESS && !PACMAN_ATLASGEN && !PACMAN_BENCH)
+/*
+    A running game can be watched by many remote viewers at once, without
+    sending video and without running the simulation on the viewer side.
+    Each tick, the difference of the 'video hardware' state (video_ram,
+    color_ram, the sprites and the fade value) to the previous tick is
+    encoded into a small bit-packed record, and SPEC_PACKET_TICKS records
+    at a time are sent over UDP to all subscribed viewers:
+
+        pacman -broadcast [port]
+        pacman -spectate address[:port]
+
+    The broadcasting side can be any game (local, replay or netplay). The
+    viewer applies one record per tick to its video state and renders it
+    with the regular gfx_draw(), when records arrive faster than they are
+    played back (after a network hiccup, or when the broadcaster runs
+    fast-forward), two records are applied per tick to catch up.
+
+    A record is either a keyframe with the complete video state (video_ram
+    and color_ram run-length encoded, see spec_put_rle()), or a delta:
+
+        1 bit   keyframe (0)
+        1 bit   fade changed, followed by 8 bits fade value
+        for each changed tile:
+            1 bit   1 (a tile follows)
+            10 bits tile index (y * DISPLAY_TILES_X + x)
+            1 bit   tile code changed, followed by 8 bits tile code
+            1 bit   color code changed, followed by 8 bits color code
+        1 bit   0 (no more tiles)
+        1 bit   any sprite changed, followed for each sprite by:
+            1 bit   sprite changed, followed by:
+            2 bits  position: 0 unchanged, 1 moved like last time (see
+                    spec_frame_t.move), 2 moved by -4..3 pixels (2x3 bits),
+                    3 moved elsewhere (2x16 bits absolute position)
+            1 bit   tile changed, followed by 8 bits tile
+            1 bit   attributes changed, followed by 8 bits color and
+                    1 bit each enabled, flipx, flipy
+
+    In a typical tick, a few sprites move exactly like in the previous tick,
+    and now and then a dot and a score digit change, this costs a few bytes
+    per tick, see "pacman_headless -streamcheck" for the actual bandwidth.
+
+    Keyframes are sent every SPEC_KEYFRAME_TICKS, when a viewer subscribes
+    or lost track because a packet got lost, and when more than
+    SPEC_MAX_DELTA_CELLS tiles changed (e.g. when a round starts). A
+    keyframe always starts a new packet, so that a viewer which lost track
+    simply skips packets until one starts with a keyframe. Stream packet:
+
+        u32 magic
+        u32 stream tick of the first record
+        u8  number of records
+        u8  flags (1: the first record is a keyframe)
+        bit stream of the records (least significant bit first)
+
+    Viewers send a subscribe packet every SPEC_HELLO_TICKS (u32 magic and
+    u8 flags, 1: a keyframe is needed), viewers which stop sending them are
+    dropped after SPEC_VIEWER_TIMEOUT_TICKS.
+*/
+static void spec_bits_init(spec_bits_t* bits, uint8_t* data, uint32_t num_bytes) {
+    bits->data = data;
+    bits->num_bits = num_bytes * 8;
+    bits->pos = 0;
+    bits->overflow = false;
+}
+
+// write the lowest num_bits bits of a value
+static void spec_put_bits(spec_bits_t* bits, uint32_t val, int num_bits) {
+    for (int i = 0; i < num_bits; i++) {
+        if (bits->pos >= bits->num_bits) {
+            bits->overflow = true;
+            return;
+        }
+        const uint8_t mask = (uint8_t)(1<<(bits->pos & 7));
+        if ((val>>i) & 1) {
+            bits->data[bits->pos>>3] |= mask;
+        }
+        else {
+            bits->data[bits->pos>>3] &= (uint8_t)~mask;
+        }
+        bits->pos++;
+    }
+}
+
+static uint32_t spec_get_bits(spec_bits_t* bits, int num_bits) {
+    uint32_t val = 0;
+    for (int i = 0; i < num_bits; i++) {
+        if (bits->pos >= bits->num_bits) {
+            bits->overflow = true;
+            return 0;
+        }
+        if ((bits->data[bits->pos>>3]>>(bits->pos & 7)) & 1) {
+            val |= 1u<<i;
+        }
+        bits->pos++;
+    }
+    return val;
+}
+
+// read a sign-extended value
+static int16_t spec_get_signed(spec_bits_t* bits, int num_bits) {
+    const uint32_t sign = 1u<<(num_bits - 1);
+    return (int16_t)((int32_t)(spec_get_bits(bits, num_bits) ^ sign) - (int32_t)sign);
+}
+
+/* run-length encode a keyframe's video_ram or color_ram: a control byte
+   0..127 is followed by 1..128 literal bytes, and a control byte 128..255
+   by a byte which is repeated 2..129 times
+*/
+static void spec_put_rle(spec_bits_t* bits, const uint8_t* src, int num_bytes) {
+    int i = 0;
+    while (i < num_bytes) {
+        int run = 1;
+        while (((i + run) < num_bytes) && (run < 129) && (src[i + run] == src[i])) {
+            run++;
+        }
+        if (run >= 2) {
+            spec_put_bits(bits, (uint32_t)(run + 126), 8);
+            spec_put_bits(bits, src[i], 8);
+            i += run;
+        }
+        else {
+            // literals until the next run
+            int num_literals = 1;
+            while (((i + num_literals) < num_bytes) && (num_literals < 128)) {
+                if (((i + num_literals + 1) < num_bytes) && (src[i + num_literals] == src[i + num_literals + 1])) {
+                    break;
+                }
+                num_literals++;
+            }
+            spec_put_bits(bits, (uint32_t)(num_literals - 1), 8);
+            for (int k = 0; k < num_literals; k++) {
+                spec_put_bits(bits, src[i + k], 8);
+            }
+            i += num_literals;
+        }
+    }
+}
+
+static void spec_get_rle(spec_bits_t* bits, uint8_t* dst, int num_bytes) {
+    int i = 0;
+    while ((i < num_bytes) && !bits->overflow) {
+        const uint32_t ctrl = spec_get_bits(bits, 8);
+        const bool repeat = ctrl >= 128;
+        const int num = repeat ? (int)(ctrl - 126) : (int)(ctrl + 1);
+        if ((i + num) > num_bytes) {
+            // malformed data
+            bits->overflow = true;
+            return;
+        }
+        uint8_t val = (uint8_t)spec_get_bits(bits, 8);
+        for (int k = 0; k < num; k++) {
+            if ((k > 0) && !repeat) {
+                val = (uint8_t)spec_get_bits(bits, 8);
+            }
+            dst[i++] = val;
+        }
+    }
+}
+
+static bool spec_sprite_equal(const sprite_t* a, const sprite_t* b) {
+    return (a->enabled == b->enabled) && (a->tile == b->tile) && (a->color == b->color) &&
+           (a->flipx == b->flipx) && (a->flipy == b->flipy) && equal_i2(a->pos, b->pos);
+}
+
+#if PACMAN_HEADLESS
+// true if a stream's reference state matches a game instance's video state (see headless_stream_check())
+static bool spec_frame_equal(const spec_frame_t* frame, const game_ctx_t* ctx) {
+    if ((frame->fade != ctx->vid.fade) ||
+        (0 != memcmp(frame->video_ram, ctx->vid.video_ram, sizeof(frame->video_ram))) ||
+        (0 != memcmp(frame->color_ram, ctx->vid.color_ram, sizeof(frame->color_ram))))
+    {
+        return false;
+    }
+    for (int i = 0; i < NUM_SPRITES; i++) {
+        if (!spec_sprite_equal(&frame->sprite[i], &ctx->vid.sprite[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+// true if more tiles changed than a delta record should carry
+static bool spec_many_changes(const spec_frame_t* ref, const game_ctx_t* ctx) {
+    int num_changed = 0;
+    for (int y = 0; y < DISPLAY_TILES_Y; y++) {
+        for (int x = 0; x < DISPLAY_TILES_X; x++) {
+            if ((ref->video_ram[y][x] != ctx->vid.video_ram[y][x]) || (ref->color_ram[y][x] != ctx->vid.color_ram[y][x])) {
+                if (++num_changed > SPEC_MAX_DELTA_CELLS) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// encode the video state of a tick as a record, and update the reference state
+static void spec_encode(spec_frame_t* ref, const game_ctx_t* ctx, bool keyframe, spec_bits_t* bits) {
+    spec_put_bits(bits, keyframe, 1);
+    if (keyframe) {
+        spec_put_bits(bits, ctx->vid.fade, 8);
+        spec_put_rle(bits, &ctx->vid.video_ram[0][0], sizeof(ctx->vid.video_ram));
+        spec_put_rle(bits, &ctx->vid.color_ram[0][0], sizeof(ctx->vid.color_ram));
+        for (int i = 0; i < NUM_SPRITES; i++) {
+            const sprite_t* spr = &ctx->vid.sprite[i];
+            spec_put_bits(bits, ((uint32_t)spr->enabled<<2) | ((uint32_t)spr->flipx<<1) | spr->flipy, 3);
+            spec_put_bits(bits, spr->tile, 8);
+            spec_put_bits(bits, spr->color, 8);
+            spec_put_bits(bits, (uint16_t)spr->pos.x, 16);
+            spec_put_bits(bits, (uint16_t)spr->pos.y, 16);
+            ref->sprite[i] = *spr;
+            ref->move[i] = i2(0, 0);
+        }
+        memcpy(ref->video_ram, ctx->vid.video_ram, sizeof(ref->video_ram));
+        memcpy(ref->color_ram, ctx->vid.color_ram, sizeof(ref->color_ram));
+        ref->fade = ctx->vid.fade;
+        return;
+    }
+
+    const bool fade_changed = ref->fade != ctx->vid.fade;
+    spec_put_bits(bits, fade_changed, 1);
+    if (fade_changed) {
+        spec_put_bits(bits, ctx->vid.fade, 8);
+        ref->fade = ctx->vid.fade;
+    }
+
+    for (int y = 0; y < DISPLAY_TILES_Y; y++) {
+        if ((0 == memcmp(ref->video_ram[y], ctx->vid.video_ram[y], DISPLAY_TILES_X)) &&
+            (0 == memcmp(ref->color_ram[y], ctx->vid.color_ram[y], DISPLAY_TILES_X)))
+        {
+            continue;
+        }
+        for (int x = 0; x < DISPLAY_TILES_X; x++) {
+            const bool tile_changed = ref->video_ram[y][x] != ctx->vid.video_ram[y][x];
+            const bool color_changed = ref->color_ram[y][x] != ctx->vid.color_ram[y][x];
+            if (tile_changed || color_changed) {
+                spec_put_bits(bits, 1, 1);
+                spec_put_bits(bits, (uint32_t)(y * DISPLAY_TILES_X + x), 10);
+                spec_put_bits(bits, tile_changed, 1);
+                if (tile_changed) {
+                    spec_put_bits(bits, ctx->vid.video_ram[y][x], 8);
+                    ref->video_ram[y][x] = ctx->vid.video_ram[y][x];
+                }
+                spec_put_bits(bits, color_changed, 1);
+                if (color_changed) {
+                    spec_put_bits(bits, ctx->vid.color_ram[y][x], 8);
+                    ref->color_ram[y][x] = ctx->vid.color_ram[y][x];
+                }
+            }
+        }
+    }
+    spec_put_bits(bits, 0, 1);
+
+    bool any_sprite_changed = false;
+    for (int i = 0; i < NUM_SPRITES; i++) {
+        if (!spec_sprite_equal(&ref->sprite[i], &ctx->vid.sprite[i])) {
+            any_sprite_changed = true;
+        }
+    }
+    spec_put_bits(bits, any_sprite_changed, 1);
+    if (!any_sprite_changed) {
+        return;
+    }
+    for (int i = 0; i < NUM_SPRITES; i++) {
+        const sprite_t* spr = &ctx->vid.sprite[i];
+        sprite_t* ref_spr = &ref->sprite[i];
+        const bool changed = !spec_sprite_equal(ref_spr, spr);
+        spec_put_bits(bits, changed, 1);
+        if (!changed) {
+            continue;
+        }
+        const int2_t move = sub_i2(spr->pos, ref_spr->pos);
+        if (equal_i2(move, i2(0, 0))) {
+            spec_put_bits(bits, 0, 2);
+        }
+        else if (equal_i2(move, ref->move[i])) {
+            spec_put_bits(bits, 1, 2);
+        }
+        else if ((move.x >= -4) && (move.x <= 3) && (move.y >= -4) && (move.y <= 3)) {
+            spec_put_bits(bits, 2, 2);
+            spec_put_bits(bits, (uint32_t)move.x & 7, 3);
+            spec_put_bits(bits, (uint32_t)move.y & 7, 3);
+            ref->move[i] = move;
+        }
+        else {
+            spec_put_bits(bits, 3, 2);
+            spec_put_bits(bits, (uint16_t)spr->pos.x, 16);
+            spec_put_bits(bits, (uint16_t)spr->pos.y, 16);
+            ref->move[i] = move;
+        }
+        const bool tile_changed = ref_spr->tile != spr->tile;
+        spec_put_bits(bits, tile_changed, 1);
+        if (tile_changed) {
+            spec_put_bits(bits, spr->tile, 8);
+        }
+        const bool attrs_changed = (ref_spr->color != spr->color) || (ref_spr->enabled != spr->enabled) || (ref_spr->flipx != spr->flipx) || (ref_spr->flipy != spr->flipy);
+        spec_put_bits(bits, attrs_changed, 1);
+        if (attrs_changed) {
+            spec_put_bits(bits, spr->color, 8);
+            spec_put_bits(bits, ((uint32_t)spr->enabled<<2) | ((uint32_t)spr->flipx<<1) | spr->flipy, 3);
+        }
+        *ref_spr = *spr;
+    }
+}
+
+// decode a record into the reference state and a game instance's video state, false on malformed data
+static bool spec_decode(spec_frame_t* ref, spec_bits_t* bits, game_ctx_t* ctx) {
+    if (spec_get_bits(bits, 1)) {
+        ref->fade = (uint8_t)spec_get_bits(bits, 8);
+        spec_get_rle(bits, &ref->video_ram[0][0], sizeof(ref->video_ram));
+        spec_get_rle(bits, &ref->color_ram[0][0], sizeof(ref->color_ram));
+        for (int i = 0; i < NUM_SPRITES; i++) {
+            sprite_t* spr = &ref->sprite[i];
+            const uint32_t flags = spec_get_bits(bits, 3);
+            spr->enabled = 0 != (flags & 4);
+            spr->flipx = 0 != (flags & 2);
+            spr->flipy = 0 != (flags & 1);
+            spr->tile = (uint8_t)spec_get_bits(bits, 8);
+            spr->color = (uint8_t)spec_get_bits(bits, 8);
+            spr->pos.x = spec_get_signed(bits, 16);
+            spr->pos.y = spec_get_signed(bits, 16);
+            ref->move[i] = i2(0, 0);
+        }
+        memcpy(ctx->vid.video_ram, ref->video_ram, sizeof(ctx->vid.video_ram));
+        memcpy(ctx->vid.color_ram, ref->color_ram, sizeof(ctx->vid.color_ram));
+        vid_dirty_all(ctx);
+    }
+    else {
+        if (spec_get_bits(bits, 1)) {
+            ref->fade = (uint8_t)spec_get_bits(bits, 8);
+        }
+        while (spec_get_bits(bits, 1)) {
+            const uint32_t index = spec_get_bits(bits, 10);
+            if (index >= (DISPLAY_TILES_X * DISPLAY_TILES_Y)) {
+                return false;
+            }
+            const int x = (int)(index % DISPLAY_TILES_X);
+            const int y = (int)(index / DISPLAY_TILES_X);
+            if (spec_get_bits(bits, 1)) {
+                ctx->vid.video_ram[y][x] = ref->video_ram[y][x] = (uint8_t)spec_get_bits(bits, 8);
+            }
+            if (spec_get_bits(bits, 1)) {
+                ctx->vid.color_ram[y][x] = ref->color_ram[y][x] = (uint8_t)spec_get_bits(bits, 8);
+            }
+            vid_dirty(ctx, x, y);
+        }
+        if (spec_get_bits(bits, 1)) {
+            for (int i = 0; i < NUM_SPRITES; i++) {
+                if (!spec_get_bits(bits, 1)) {
+                    continue;
+                }
+                sprite_t* spr = &ref->sprite[i];
+                switch (spec_get_bits(bits, 2)) {
+                    case 1:
+                        spr->pos = add_i2(spr->pos, ref->move[i]);
+                        break;
+                    case 2:
+                        {
+                            const int16_t dx = spec_get_signed(bits, 3);
+                            const int16_t dy = spec_get_signed(bits, 3);
+                            ref->move[i] = i2(dx, dy);
+                            spr->pos = add_i2(spr->pos, ref->move[i]);
+                        }
+                        break;
+                    case 3:
+                        {
+                            const int16_t x = spec_get_signed(bits, 16);
+                            const int16_t y = spec_get_signed(bits, 16);
+                            ref->move[i] = sub_i2(i2(x, y), spr->pos);
+                            spr->pos = i2(x, y);
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                if (spec_get_bits(bits, 1)) {
+                    spr->tile = (uint8_t)spec_get_bits(bits, 8);
+                }
+                if (spec_get_bits(bits, 1)) {
+                    spr->color = (uint8_t)spec_get_bits(bits, 8);
+                    const uint32_t flags = spec_get_bits(bits, 3);
+                    spr->enabled = 0 != (flags & 4);
+                    spr->flipx = 0 != (flags & 2);
+                    spr->flipy = 0 != (flags & 1);
+                }
+            }
+        }
+    }
+    memcpy(ctx->vid.sprite, ref->sprite, sizeof(ctx->vid.sprite));
+    ctx->vid.fade = ref->fade;
+    return !bits->overflow;
+}
+
+// complete the current packet into stream->out, returns its size, or 0 if there are no records
+static int spec_stream_flush(spec_stream_t* stream) {
+    if (0 == stream->num_records) {
+        return 0;
+    }
+    const uint32_t size = SPEC_PACKET_HEADER_SIZE + (stream->bits.pos + 7) / 8;
+    put_u32(stream->packet + 4, stream->seq - stream->num_records);
+    stream->packet[8] = (uint8_t)stream->num_records;
+    memcpy(stream->out, stream->packet, size);
+    stream->num_records = 0;
+    return (int)size;
+}
+
+/* encode the video state of a tick into a stream, a packet is completed
+   when the next record doesn't belong into it anymore, returns the size of
+   the completed packet in stream->out, or 0
+*/
+static int spec_stream_tick(spec_stream_t* stream, const game_ctx_t* ctx, bool keyframe) {
+    keyframe |= (0 == stream->seq) || ((stream->seq - stream->keyframe_seq) >= SPEC_KEYFRAME_TICKS) || spec_many_changes(&stream->ref, ctx);
+    int size = 0;
+    if (stream->num_records > 0) {
+        const uint32_t used = SPEC_PACKET_HEADER_SIZE + (stream->bits.pos + 7) / 8;
+        if (keyframe || (stream->num_records == SPEC_PACKET_TICKS) || ((used + SPEC_MAX_RECORD_SIZE) > SPEC_MAX_PACKET_SIZE)) {
+            size = spec_stream_flush(stream);
+        }
+    }
+    if (0 == stream->num_records) {
+        put_u32(stream->packet, SPEC_MAGIC);
+        stream->packet[9] = keyframe ? 1 : 0;
+        spec_bits_init(&stream->bits, stream->packet + SPEC_PACKET_HEADER_SIZE, SPEC_MAX_PACKET_SIZE - SPEC_PACKET_HEADER_SIZE);
+    }
+    if (keyframe) {
+        stream->keyframe_seq = stream->seq;
+    }
+    spec_encode(&stream->ref, ctx, keyframe, &stream->bits);
+    assert(!stream->bits.overflow);
+    stream->num_records++;
+    stream->seq++;
+    return size;
+}
+
+static bool spec_packet_header(const uint8_t* data, int size, uint32_t* out_seq, uint32_t* out_num_records, bool* out_keyframe) {
+    if ((size < SPEC_PACKET_HEADER_SIZE) || (get_u32(data) != SPEC_MAGIC)) {
+        return false;
+    }
+    *out_seq = get_u32(data + 4);
+    *out_num_records = data[8];
+    *out_keyframe = 0 != (data[9] & 1);
+    return true;
+}
+#endif // PACMAN_SPECTATE || (PACMAN_HEADLESS && !PACMAN_ATLASGEN && !PACMAN_BENCH)
+
+#if PACMAN_SPECTATE
+// parse the spectator command line args, called from sokol_main()
+static void spec_parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-broadcast")) {
+            state.spec.broadcasting = true;
+            if (((i + 1) < argc) && (argv[i + 1][0] >= '0') && (argv[i + 1][0] <= '9')) {
+                state.spec.port = (uint16_t)atoi(argv[++i]);
+            }
+        }
+        else if ((0 == strcmp(argv[i], "-spectate")) && ((i + 1) < argc)) {
+            static char address[256];
+            strncpy(address, argv[++i], sizeof(address) - 1);
+            char* sep = strchr(address, ':');
+            if (sep) {
+                *sep = 0;
+                state.spec.port = (uint16_t)atoi(sep + 1);
+            }
+            state.spec.viewing = true;
+            state.spec.address = address;
+        }
+    }
+    if (0 == state.spec.port) {
+        state.spec.port = SPEC_DEFAULT_PORT;
+    }
+}
+
+// open the UDP socket and allocate the buffers of the broadcaster or viewer
+// side, in viewer mode the local game doesn't run, so netplay is off
+static void spec_init(void) {
+    state.spec.sock = NET_INVALID_SOCKET;
+    bool ok = true;
+    if (state.spec.viewing) {
+        state.spec.broadcasting = false;
+        net_shutdown();
+        state.net.active = false;
+        ok = net_socket_open(&state.spec.sock, 0, state.spec.address, state.spec.port, &state.spec.peer);
+    }
+    else if (state.spec.broadcasting) {
+        ok = net_socket_open(&state.spec.sock, state.spec.port, 0, 0, 0);
+    }
+    if (!ok) {
+        slog_func("pacman", 2, 0, "spectate: failed to open the UDP socket", __LINE__, __FILE__, 0);
+        state.spec.viewing = false;
+        state.spec.broadcasting = false;
+    }
+    if (state.spec.viewing) {
+        state.spec.recv = (spec_recv_t*) calloc(1, sizeof(spec_recv_t));
+        assert(state.spec.recv);
+    }
+    else if (state.spec.broadcasting) {
+        state.spec.stream = (spec_stream_t*) calloc(1, sizeof(spec_stream_t));
+        assert(state.spec.stream);
+    }
+}
+
+static void spec_shutdown(void) {
+    net_socket_close(&state.spec.sock);
+    free(state.spec.stream);
+    free(state.spec.recv);
+    state.spec.stream = 0;
+    state.spec.recv = 0;
+}
+
+// subscribe a viewer, or keep its subscription alive
+static void spec_receive_hello(const uint8_t* data, int size, const struct sockaddr_in* from) {
+    if ((size < 5) || (get_u32(data) != SPEC_HELLO_MAGIC)) {
+        return;
+    }
+    int index = 0;
+    while ((index < state.spec.num_viewers) && ((state.spec.viewers[index].addr.sin_addr.s_addr != from->sin_addr.s_addr) || (state.spec.viewers[index].addr.sin_port != from->sin_port))) {
+        index++;
+    }
+    if (index == state.spec.num_viewers) {
+        if (state.spec.num_viewers == SPEC_MAX_VIEWERS) {
+            return;
+        }
+        state.spec.num_viewers++;
+        state.spec.viewers[index].addr = *from;
+        state.spec.keyframe = true;
+    }
+    state.spec.viewers[index].last_seen = state.spec.stream->seq;
+    if (data[4] & 1) {
+        state.spec.keyframe = true;
+    }
+}
+
+// queue a received stream packet for playback
+static void spec_receive_packet(const uint8_t* data, int size, const struct sockaddr_in* from) {
+    uint32_t seq, num_records;
+    bool keyframe;
+    if ((from->sin_addr.s_addr != state.spec.peer.sin_addr.s_addr) || (from->sin_port != state.spec.peer.sin_port) ||
+        !spec_packet_header(data, size, &seq, &num_records, &keyframe))
+    {
+        return;
+    }
+    if ((state.spec.head - state.spec.tail) == SPEC_NUM_PACKETS) {
+        // playback is too far behind, drop the oldest packet (this loses track until the next keyframe)
+        state.spec.tail++;
+    }
+    const uint32_t slot = state.spec.head++ & (SPEC_NUM_PACKETS - 1);
+    memcpy(state.spec.recv->packet[slot], data, (size_t)size);
+    state.spec.recv->packet_size[slot] = (uint16_t)size;
+}
+
+// receive all pending packets, called once per frame
+static void spec_poll(void) {
+    if (state.spec.sock == NET_INVALID_SOCKET) {
+        return;
+    }
+    uint8_t data[SPEC_MAX_PACKET_SIZE];
+    while (true) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        const int size = (int)recvfrom(state.spec.sock, (char*)data, sizeof(data), 0, (struct sockaddr*)&from, &from_len);
+        if (size <= 0) {
+            break;
+        }
+        if (state.spec.viewing) {
+            spec_receive_packet(data, size, &from);
+        }
+        else {
+            spec_receive_hello(data, size, &from);
+        }
+    }
+}
+
+// encode the current tick and send completed packets to all viewers, called after each game tick
+static void spec_tick(game_ctx_t* ctx) {
+    if (!state.spec.broadcasting) {
+        return;
+    }
+    spec_stream_t* stream = state.spec.stream;
+    for (int i = 0; i < state.spec.num_viewers;) {
+        if ((stream->seq - state.spec.viewers[i].last_seen) > SPEC_VIEWER_TIMEOUT_TICKS) {
+            state.spec.viewers[i] = state.spec.viewers[--state.spec.num_viewers];
+        }
+        else {
+            i++;
+        }
+    }
+    if (0 == state.spec.num_viewers) {
+        // nobody is watching, the next viewer starts with a keyframe
+        return;
+    }
+    // requested keyframes are sent at most once per SPEC_HELLO_TICKS
+    const bool keyframe = state.spec.keyframe && ((stream->seq - stream->keyframe_seq) >= SPEC_HELLO_TICKS);
+    if (keyframe) {
+        state.spec.keyframe = false;
+    }
+    const int size = spec_stream_tick(stream, ctx, keyframe);
+    if (size > 0) {
+        for (int i = 0; i < state.spec.num_viewers; i++) {
+            sendto(state.spec.sock, (const char*)stream->out, size, 0, (const struct sockaddr*)&state.spec.viewers[i].addr, sizeof(state.spec.viewers[i].addr));
+        }
+    }
+}
+
+// apply the next record of the received stream to the video state
+static void spec_view_record(game_ctx_t* ctx) {
+    while (0 == state.spec.num_records) {
+        if (state.spec.tail == state.spec.head) {
+            // nothing to play back, keep showing the last frame
+            return;
+        }
+        const uint32_t slot = state.spec.tail++ & (SPEC_NUM_PACKETS - 1);
+        const int size = state.spec.recv->packet_size[slot];
+        uint32_t seq, num_records;
+        bool keyframe;
+        if (!spec_packet_header(state.spec.recv->packet[slot], size, &seq, &num_records, &keyframe)) {
+            // can't happen, spec_receive_packet() only queues valid packets
+            continue;
+        }
+        if (state.spec.synced && (seq < state.spec.next_seq)) {
+            // a duplicate or late packet
+            continue;
+        }
+        if (!keyframe && (!state.spec.synced || (seq != state.spec.next_seq))) {
+            // a packet got lost, wait for the next keyframe
+            state.spec.synced = false;
+            continue;
+        }
+        memcpy(state.spec.recv->cur_packet, state.spec.recv->packet[slot], (size_t)size);
+        spec_bits_init(&state.spec.bits, state.spec.recv->cur_packet + SPEC_PACKET_HEADER_SIZE, (uint32_t)(size - SPEC_PACKET_HEADER_SIZE));
+        state.spec.num_records = num_records;
+        state.spec.next_seq = seq;
+    }
+    if (spec_decode(&state.spec.recv->ref, &state.spec.bits, ctx)) {
+        state.spec.synced = true;
+        state.spec.next_seq++;
+        state.spec.num_records--;
+    }
+    else {
+        state.spec.synced = false;
+        state.spec.num_records = 0;
+    }
+}
+
+// advance the viewer by one tick, called instead of sim_tick() in viewer mode
+static void spec_view_tick(game_ctx_t* ctx) {
+    // subscribe once per SPEC_HELLO_TICKS, which also keeps the subscription alive
+    if (0 == state.spec.hello_ticks) {
+        uint8_t data[5];
+        put_u32(data, SPEC_HELLO_MAGIC);
+        data[4] = state.spec.synced ? 0 : 1;
+        sendto(state.spec.sock, (const char*)data, sizeof(data), 0, (const struct sockaddr*)&state.spec.peer, sizeof(state.spec.peer));
+        state.spec.hello_ticks = SPEC_HELLO_TICKS;
+    }
+    state.spec.hello_ticks--;
+    // play back one record per tick, and two to catch up when packets pile up
+    const int num_records = ((state.spec.head - state.spec.tail) > 2) ? 2 : 1;
+    for (int i = 0; i < num_records; i++) {
+        spec_view_record(ctx);
+    }
+}
+#endif // PACMAN_SPECTATE
+
+/*== CABINET WALL ============================================================*/
+#if !PACMAN_HEADLESS
+/*
+    With "-wall K", one process runs K games (up to MAX_WALL_GAMES) side by
+    side in one window, e.g. for a wall of screens driven by a single small
+    PC. The first game is the regular game driven by the keyboard (or a
+    replay, netplay or a spectator stream), the other games run in attract
+    mode with the random-walk input policy of the headless runner and
+    without sound.
+
+    All games are rendered together: the offscreen render target is an
+    atlas of cols x rows cells of DISPLAY_PIXELS_X x DISPLAY_PIXELS_Y
+    (upscaled 2x), each game's quads carry its cell index in their flags
+    (see QUADFLAG_CELL), and the vertex shader moves them into the cell and
+    clips them to it. The quads of all games go into one instance buffer
+    which is drawn with one draw call, and the display pass draws the whole
+    atlas with one quad. The tilemap renderer isn't available in the wall
+    mode.
+*/
+
+// parse the cabinet wall command line arg, called from sokol_main()
+static void wall_parse_args(int argc, char* argv[]) {
+    state.wall.cols = 1;
+    state.wall.rows = 1;
+    for (int i = 1; i < (argc - 1); i++) {
+        if (0 == strcmp(argv[i], "-wall")) {
+            const int num_games = atoi(argv[++i]);
+            if (num_games >= 2) {
+                state.wall.num_games = (num_games < MAX_WALL_GAMES) ? num_games : MAX_WALL_GAMES;
+            }
+        }
+    }
+    if (state.wall.num_games > 0) {
+        // the most square grid of cells which fits all games
+        while ((state.wall.cols * state.wall.cols) < state.wall.num_games) {
+            state.wall.cols++;
+        }
+        state.wall.rows = (state.wall.num_games + state.wall.cols - 1) / state.wall.cols;
+    }
+}
+
+// the game in a cell of the wall, the first cell is the regular game
+static game_ctx_t* wall_ctx(int index) {
+    assert((index >= 0) && (index < state.wall.num_games));
+    return (index == 0) ? &state.ctx : &state.wall.ctx[index - 1];
+}
+
+// the capacity of the wall's instance data for the number of games
+static int wall_max_quads(void) {
+    return state.wall.num_games * WALL_GAME_QUADS + PROF_HUD_QUADS;
+}
+
+// start the attract-mode games, each with its own random-walk input seed
+static void wall_init(void) {
+    if (0 == state.wall.num_games) {
+        return;
+    }
+    state.wall.ctx = (game_ctx_t*) calloc((size_t)(state.wall.num_games - 1), sizeof(game_ctx_t));
+    state.wall.quads = (instance_t*) calloc((size_t)wall_max_quads(), sizeof(instance_t));
+    assert(state.wall.ctx && state.wall.quads);
+    for (int i = 1; i < state.wall.num_games; i++) {
+        sim_init(wall_ctx(i));
+        state.wall.rng[i] = 0x2545F491 * (uint32_t)i;
+        state.wall.key[i] = INPUTKEY_OTHER;
+    }
+}
+
+static void wall_shutdown(void) {
+    free(state.wall.ctx);
+    free(state.wall.quads);
+    state.wall.ctx = 0;
+    state.wall.quads = 0;
+}
+
+// advance the attract-mode games by one tick
+static void wall_tick(void) {
+    for (int i = 1; i < state.wall.num_games; i++) {
+        game_ctx_t* ctx = wall_ctx(i);
+        if ((ctx->timing.tick % 16) == 0) {
+            // the same random walk as headless_random_keys(), one arrow key at a time
+            static const inputkey_t dirs[4] = { INPUTKEY_UP, INPUTKEY_DOWN, INPUTKEY_LEFT, INPUTKEY_RIGHT };
+            uint32_t x = state.wall.rng[i];
+            x ^= x<<13;
+            x ^= x>>17;
+            x ^= x<<5;
+            state.wall.rng[i] = x;
+            input_key(ctx, (inputkey_t)state.wall.key[i], false);
+            state.wall.key[i] = (uint8_t)dirs[x & 3];
+            input_key(ctx, dirs[x & 3], true);
+        }
+        sim_tick(ctx);
+    }
+}
+#endif // !PACMAN_HEADLESS
+
+/*== GFX SUBSYSTEM ===========================================================*/
+#if !PACMAN_HEADLESS
+////////////////////////IMAGES AND PIXELING/////////////////////////////////////////
+/* create all sokol-gfx resources */
+static void gfx_create_resources(void) {
+    // pass action for clearing the background to black
+    state.gfx.pass_action = (sg_pass_action) {
+        .colors[0] = { .load_action = SG_LOADACTION_CLEAR, .clear_value = { 0.0f, 0.0f, 0.0f, 1.0f } }
+    };
+
+    // create a dynamic instance buffer for the sprite quads, in the cabinet
+    // wall mode this takes the playfield and sprite quads of all games
+    state.gfx.offscreen.vbuf = sg_make_buffer(&(sg_buffer_desc){
+        .type = SG_BUFFERTYPE_VERTEXBUFFER,
+        .usage = SG_USAGE_STREAM,
+        .size = (state.wall.num_games > 0) ? ((size_t)wall_max_quads() * sizeof(instance_t)) : sizeof(state.gfx.quads),
+    });
+
+    // create one instance buffer per band of playfield rows, these are only
+    // updated when a tile in the band has changed
+    for (int i = 0; i < PLAYFIELD_BANDS; i++) {
+        state.gfx.offscreen.playfield_vbuf[i] = sg_make_buffer(&(sg_buffer_desc){
+            .type = SG_BUFFERTYPE_VERTEXBUFFER,
+            .usage = SG_USAGE_DYNAMIC,
+            .size = PLAYFIELD_BAND_QUADS * sizeof(instance_t),
+        });
+    }
+
+    /* create a simple quad vertex buffer for rendering the offscreen render
+       target to the display, this also provides the corners of the
+       instanced tile- and sprite-quads
+    */
+    float quad_verts[]= { 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f };
+    state.gfx.display.quad_vbuf = sg_make_buffer(&(sg_buffer_desc){
+        .data = SG_RANGE(quad_verts)
+    });
+
+    // shader sources for all platforms (FIXME: should we use precompiled shader blobs instead?)
+    const char* offscreen_vs_src = 0;
+    const char* offscreen_fs_src = 0;
+    const char* display_vs_src = 0;
+    const char* display_fs_src = 0;
+    const char* tilemap_vs_src = 0;
+    const char* tilemap_fs_src = 0;
+    switch (sg_query_backend()) {
+        case SG_BACKEND_METAL_MACOS:
+            offscreen_vs_src =
+                "#include <metal_stdlib>\n"
+                "using namespace metal;\n"
+                "struct vs_in {\n"
+                "  float2 corner [[attribute(0)]];\n"
+                "  float2 quad_pos [[attribute(1)]];\n"
+                "  float4 quad_data [[attribute(2)]];\n"
+                "};\n"
+                "struct vs_out {\n"
+                "  float4 pos [[position]];\n"
+                "  float2 uv;\n"
+                "  float4 data;\n"
+                "};\n"
+                "struct vs_params {\n"
+                "  float4 atlas;\n"
+                "};\n"
+                "vertex vs_out _main(vs_in in [[stage_in]], constant vs_params& params [[buffer(0)]]) {\n"
+                "  vs_out out;\n"
+                "  float2 pix_pos = floor(in.quad_pos * 65535.0 + 0.5) - 256.0;\n"
+                "  float tile = floor(in.quad_data.x * 255.0 + 0.5);\n"
+                "  float flags = floor(in.quad_data.w * 255.0 + 0.5);\n"
+                "  float kind = fmod(flags, 4.0);\n"
+                "  float2 flip = fmod(floor(flags / float2(4.0, 8.0)), 2.0);\n"
+                "  float cell = floor(flags / 16.0);\n"
+                "  float cell_row = floor((cell + 0.5) / params.atlas.z);\n"
+                "  float2 cell_pos = float2(cell - cell_row * params.atlas.z, cell_row) * float2(224.0, 288.0);\n"
+                "  float size = (kind == 0.0) ? 8.0 : 16.0;\n"
+                "  float2 ext = (kind == 2.0) ? float2(224.0, 288.0) : float2(size, size);\n"
+                "  float2 c = (clamp(pix_pos + in.corner * ext, float2(0.0, 0.0), float2(224.0, 288.0)) - pix_pos) / ext;\n"
+                "  float2 pos = (cell_pos + pix_pos + c * ext) / params.atlas.xy;\n"
+                "  float2 tc = mix(c, 1.0 - c, flip);\n"
+                "  out.pos = float4((pos - 0.5) * float2(2.0, -2.0), 0.5, 1.0);\n"
+                "  out.uv = float2((tile + tc.x) * size / 2048.0, (((kind == 0.0) ? 0.0 : 8.0) + tc.y * size) / 24.0);\n"
+                "  out.data = float4(in.quad_data.yz, 0.0, 0.0);\n"
+                "  return out;\n"
+                "}\n";
+            offscreen_fs_src =
+                "#include <metal_stdlib>\n"
+                "using namespace metal;\n"
+                "struct ps_in {\n"
+                "  float2 uv;\n"
+                "  float4 data;\n"
+                "};\n"
+                "fragment float4 _main(ps_in in [[stage_in]],\n"
+                "                      texture2d<float> tile_tex [[texture(0)]],\n"
+                "                      texture2d<float> pal_tex [[texture(1)]],\n"
+                "                      sampler tile_smp [[sampler(0)]],\n"
+                "                      sampler pal_smp [[sampler(1)]])\n"
+                "{\n"
+                "  float color_code = in.data.x;\n" // (0..31) / 255
+                "  float tile_color = tile_tex.sample(tile_smp, in.uv).x;\n" // (0..3) / 255
+                "  float2 pal_uv = float2(color_code * 4 + tile_color, 0);\n"
+                "  float4 color = pal_tex.sample(pal_smp, pal_uv) * float4(1, 1, 1, in.data.y);\n"
+                "  return color;\n"
+                "}\n";
+            display_vs_src =
+                "#include <metal_stdlib>\n"
+                "using namespace metal;\n"
+                "struct vs_in {\n"
+                "  float4 pos [[attribute(0)]];\n"
+                "};\n"
+                "struct vs_out {\n"
+                "  float4 pos [[position]];\n"
+                "  float2 uv;\n"
+                "};\n"
+                "vertex vs_out _main(vs_in in[[stage_in]]) {\n"
+                "  vs_out out;\n"
+                "  out.pos = float4((in.pos.xy - 0.5) * float2(2.0, -2.0), 0.0, 1.0);\n"
+                "  out.uv = in.pos.xy;\n"
+                "  return out;\n"
+                "}\n";
+            display_fs_src =
+                "#include <metal_stdlib>\n"
                 "using namespace metal;\n"
                 "struct ps_in {\n"
                 "  float2 uv;\n"
@@ -2793,24 +8310,78 @@ static void gfx_create_resources(void) {
                 "{\n"
                 "  return tex.sample(smp, in.uv);\n"
                 "}\n";
+            tilemap_vs_src =
+                "#include <metal_stdlib>\n"
+                "using namespace metal;\n"
+                "struct vs_in {\n"
+                "  float4 pos [[attribute(0)]];\n"
+                "};\n"
+                "struct vs_out {\n"
+                "  float4 pos [[position]];\n"
+                "  float2 uv;\n"
+                "};\n"
+                "vertex vs_out _main(vs_in in[[stage_in]]) {\n"
+                "  vs_out out;\n"
+                "  out.pos = float4((in.pos.xy - 0.5) * float2(2.0, -2.0), 0.5, 1.0);\n"
+                "  out.uv = in.pos.xy;\n"
+                "  return out;\n"
+                "}\n";
+            tilemap_fs_src =
+                "#include <metal_stdlib>\n"
+                "using namespace metal;\n"
+                "struct ps_in {\n"
+                "  float2 uv;\n"
+                "};\n"
+                "fragment float4 _main(ps_in in [[stage_in]],\n"
+                "                      texture2d<float> tile_tex [[texture(0)]],\n"
+                "                      texture2d<float> pal_tex [[texture(1)]],\n"
+                "                      texture2d<float> video_tex [[texture(2)]],\n"
+                "                      texture2d<float> color_tex [[texture(3)]],\n"
+                "                      sampler tile_smp [[sampler(0)]],\n"
+                "                      sampler pal_smp [[sampler(1)]])\n"
+                "{\n"
+                "  float2 tile_pos = in.uv * float2(28.0, 36.0);\n"
+                "  float tile_code = floor(video_tex.sample(tile_smp, in.uv).x * 255.0 + 0.5);\n"
+                "  float color_code = fmod(floor(color_tex.sample(tile_smp, in.uv).x * 255.0 + 0.5), 32.0);\n"
+                "  float2 tile_uv = float2((tile_code + fract(tile_pos.x)) * 8.0 / 2048.0, fract(tile_pos.y) * 8.0 / 24.0);\n"
+                "  float tile_color = floor(tile_tex.sample(tile_smp, tile_uv).x * 255.0 + 0.5);\n"
+                "  float2 pal_uv = float2((color_code * 4.0 + tile_color + 0.5) / 256.0, 0.5);\n"
+                "  return pal_tex.sample(pal_smp, pal_uv);\n"
+                "}\n";
             break;
         case SG_BACKEND_D3D11:
             offscreen_vs_src =
                 "struct vs_in {\n"
-                "  float4 pos: POSITION;\n"
-                "  float2 uv: TEXCOORD0;\n"
-                "  float4 data: TEXCOORD1;\n"
+                "  float2 corner: POSITION;\n"
+                "  float2 quad_pos: TEXCOORD0;\n"
+                "  float4 quad_data: TEXCOORD1;\n"
                 "};\n"
                 "struct vs_out {\n"
                 "  float2 uv: UV;\n"
                 "  float4 data: DATA;\n"
                 "  float4 pos: SV_Position;\n"
                 "};\n"
+                "cbuffer vs_params: register(b0) {\n"
+                "  float4 atlas;\n"
+                "};\n"
                 "vs_out main(vs_in inp) {\n"
-                "  vs_out outp;"
-                "  outp.pos = float4(inp.pos.xy * float2(2.0, -2.0) + float2(-1.0, 1.0), 0.0, 1.0);\n"
-                "  outp.uv  = inp.uv;"
-                "  outp.data = inp.data;\n"
+                "  vs_out outp;\n"
+                "  float2 pix_pos = floor(inp.quad_pos * 65535.0 + 0.5) - 256.0;\n"
+                "  float tile = floor(inp.quad_data.x * 255.0 + 0.5);\n"
+                "  float flags = floor(inp.quad_data.w * 255.0 + 0.5);\n"
+                "  float kind = fmod(flags, 4.0);\n"
+                "  float2 flip = fmod(floor(flags / float2(4.0, 8.0)), 2.0);\n"
+                "  float cell = floor(flags / 16.0);\n"
+                "  float cell_row = floor((cell + 0.5) / atlas.z);\n"
+                "  float2 cell_pos = float2(cell - cell_row * atlas.z, cell_row) * float2(224.0, 288.0);\n"
+                "  float size = (kind == 0.0) ? 8.0 : 16.0;\n"
+                "  float2 ext = (kind == 2.0) ? float2(224.0, 288.0) : float2(size, size);\n"
+                "  float2 c = (clamp(pix_pos + inp.corner * ext, float2(0.0, 0.0), float2(224.0, 288.0)) - pix_pos) / ext;\n"
+                "  float2 pos = (cell_pos + pix_pos + c * ext) / atlas.xy;\n"
+                "  float2 tc = lerp(c, 1.0 - c, flip);\n"
+                "  outp.pos = float4(pos * float2(2.0, -2.0) + float2(-1.0, 1.0), 0.0, 1.0);\n"
+                "  outp.uv = float2((tile + tc.x) * size / 2048.0, (((kind == 0.0) ? 0.0 : 8.0) + tc.y * size) / 24.0);\n"
+                "  outp.data = float4(inp.quad_data.yz, 0.0, 0.0);\n"
                 "  return outp;\n"
                 "}\n";
             offscreen_fs_src =
@@ -2842,19 +8413,60 @@ static void gfx_create_resources(void) {
                 "float4 main(float2 uv: UV): SV_Target0 {\n"
                 "  return tex.Sample(smp, uv);\n"
                 "}\n";
+            tilemap_vs_src =
+                "struct vs_out {\n"
+                "  float2 uv: UV;\n"
+                "  float4 pos: SV_Position;\n"
+                "};\n"
+                "vs_out main(float4 pos: POSITION) {\n"
+                "  vs_out outp;\n"
+                "  outp.pos = float4(pos.xy * float2(2.0, -2.0) + float2(-1.0, 1.0), 0.0, 1.0);\n"
+                "  outp.uv = pos.xy;\n"
+                "  return outp;\n"
+                "}\n";
+            tilemap_fs_src =
+                "Texture2D<float4> tile_tex: register(t0);\n"
+                "Texture2D<float4> pal_tex: register(t1);\n"
+                "Texture2D<float4> video_tex: register(t2);\n"
+                "Texture2D<float4> color_tex: register(t3);\n"
+                "sampler tile_smp: register(s0);\n"
+                "sampler pal_smp: register(s1);\n"
+                "float4 main(float2 uv: UV): SV_Target0 {\n"
+                "  float2 tile_pos = uv * float2(28.0, 36.0);\n"
+                "  float tile_code = floor(video_tex.Sample(tile_smp, uv).x * 255.0 + 0.5);\n"
+                "  float color_code = fmod(floor(color_tex.Sample(tile_smp, uv).x * 255.0 + 0.5), 32.0);\n"
+                "  float2 tile_uv = float2((tile_code + frac(tile_pos.x)) * 8.0 / 2048.0, frac(tile_pos.y) * 8.0 / 24.0);\n"
+                "  float tile_color = floor(tile_tex.Sample(tile_smp, tile_uv).x * 255.0 + 0.5);\n"
+                "  float2 pal_uv = float2((color_code * 4.0 + tile_color + 0.5) / 256.0, 0.5);\n"
+                "  return pal_tex.Sample(pal_smp, pal_uv);\n"
+                "}\n";
             break;
         case SG_BACKEND_GLCORE33:
             offscreen_vs_src =
                 "#version 330\n"
-                "layout(location=0) in vec4 pos;\n"
-                "layout(location=1) in vec2 uv_in;\n"
-                "layout(location=2) in vec4 data_in;\n"
+                "layout(location=0) in vec2 corner;\n"
+                "layout(location=1) in vec2 quad_pos;\n"
+                "layout(location=2) in vec4 quad_data;\n"
+                "uniform vec4 atlas;\n"
                 "out vec2 uv;\n"
                 "out vec4 data;\n"
                 "void main() {\n"
-                "  gl_Position = vec4((pos.xy - 0.5) * vec2(2.0, -2.0), 0.5, 1.0);\n"
-                "  uv  = uv_in;"
-                "  data = data_in;\n"
+                "  vec2 pix_pos = floor(quad_pos * 65535.0 + 0.5) - 256.0;\n"
+                "  float tile = floor(quad_data.x * 255.0 + 0.5);\n"
+                "  float flags = floor(quad_data.w * 255.0 + 0.5);\n"
+                "  float kind = mod(flags, 4.0);\n"
+                "  vec2 flip = mod(floor(flags / vec2(4.0, 8.0)), 2.0);\n"
+                "  float cell = floor(flags / 16.0);\n"
+                "  float cell_row = floor((cell + 0.5) / atlas.z);\n"
+                "  vec2 cell_pos = vec2(cell - cell_row * atlas.z, cell_row) * vec2(224.0, 288.0);\n"
+                "  float size = (kind == 0.0) ? 8.0 : 16.0;\n"
+                "  vec2 ext = (kind == 2.0) ? vec2(224.0, 288.0) : vec2(size);\n"
+                "  vec2 c = (clamp(pix_pos + corner * ext, vec2(0.0), vec2(224.0, 288.0)) - pix_pos) / ext;\n"
+                "  vec2 pos = (cell_pos + pix_pos + c * ext) / atlas.xy;\n"
+                "  vec2 tc = mix(c, 1.0 - c, flip);\n"
+                "  gl_Position = vec4((pos - 0.5) * vec2(2.0, -2.0), 0.5, 1.0);\n"
+                "  uv = vec2((tile + tc.x) * size / 2048.0, (((kind == 0.0) ? 0.0 : 8.0) + tc.y * size) / 24.0);\n"
+                "  data = vec4(quad_data.yz, 0.0, 0.0);\n"
                 "}\n";
             offscreen_fs_src =
                 "#version 330\n"
@@ -2869,34 +8481,73 @@ static void gfx_create_resources(void) {
                 "  vec2 pal_uv = vec2(color_code * 4 + tile_color, 0);\n"
                 "  frag_color = texture(pal_tex, pal_uv) * vec4(1, 1, 1, data.y);\n"
                 "}\n";
-            display_vs_src =
+            display_vs_src =
+                "#version 330\n"
+                "layout(location=0) in vec4 pos;\n"
+                "out vec2 uv;\n"
+                "void main() {\n"
+                "  gl_Position = vec4((pos.xy - 0.5) * 2.0, 0.0, 1.0);\n"
+                "  uv = pos.xy;\n"
+                "}\n";
+            display_fs_src =
+                "#version 330\n"
+                "uniform sampler2D tex;\n"
+                "in vec2 uv;\n"
+                "out vec4 frag_color;\n"
+                "void main() {\n"
+                "  frag_color = texture(tex, uv);\n"
+                "}\n";
+            tilemap_vs_src =
                 "#version 330\n"
                 "layout(location=0) in vec4 pos;\n"
                 "out vec2 uv;\n"
                 "void main() {\n"
-                "  gl_Position = vec4((pos.xy - 0.5) * 2.0, 0.0, 1.0);\n"
+                "  gl_Position = vec4((pos.xy - 0.5) * vec2(2.0, -2.0), 0.5, 1.0);\n"
                 "  uv = pos.xy;\n"
                 "}\n";
-            display_fs_src =
+            tilemap_fs_src =
                 "#version 330\n"
-                "uniform sampler2D tex;\n"
+                "uniform sampler2D tile_tex;\n"
+                "uniform sampler2D pal_tex;\n"
+                "uniform sampler2D video_tex;\n"
+                "uniform sampler2D color_tex;\n"
                 "in vec2 uv;\n"
                 "out vec4 frag_color;\n"
                 "void main() {\n"
-                "  frag_color = texture(tex, uv);\n"
+                "  vec2 tile_pos = uv * vec2(28.0, 36.0);\n"
+                "  float tile_code = floor(texture(video_tex, uv).x * 255.0 + 0.5);\n"
+                "  float color_code = mod(floor(texture(color_tex, uv).x * 255.0 + 0.5), 32.0);\n"
+                "  vec2 tile_uv = vec2((tile_code + fract(tile_pos.x)) * 8.0 / 2048.0, fract(tile_pos.y) * 8.0 / 24.0);\n"
+                "  float tile_color = floor(texture(tile_tex, tile_uv).x * 255.0 + 0.5);\n"
+                "  vec2 pal_uv = vec2((color_code * 4.0 + tile_color + 0.5) / 256.0, 0.5);\n"
+                "  frag_color = texture(pal_tex, pal_uv);\n"
                 "}\n";
                 break;
         case SG_BACKEND_GLES3:
             offscreen_vs_src =
-                "attribute vec4 pos;\n"
-                "attribute vec2 uv_in;\n"
-                "attribute vec4 data_in;\n"
+                "attribute vec2 corner;\n"
+                "attribute vec2 quad_pos;\n"
+                "attribute vec4 quad_data;\n"
+                "uniform vec4 atlas;\n"
                 "varying vec2 uv;\n"
                 "varying vec4 data;\n"
                 "void main() {\n"
-                "  gl_Position = vec4((pos.xy - 0.5) * vec2(2.0, -2.0), 0.5, 1.0);\n"
-                "  uv  = uv_in;"
-                "  data = data_in;\n"
+                "  vec2 pix_pos = floor(quad_pos * 65535.0 + 0.5) - 256.0;\n"
+                "  float tile = floor(quad_data.x * 255.0 + 0.5);\n"
+                "  float flags = floor(quad_data.w * 255.0 + 0.5);\n"
+                "  float kind = mod(flags, 4.0);\n"
+                "  vec2 flip = mod(floor(flags / vec2(4.0, 8.0)), 2.0);\n"
+                "  float cell = floor(flags / 16.0);\n"
+                "  float cell_row = floor((cell + 0.5) / atlas.z);\n"
+                "  vec2 cell_pos = vec2(cell - cell_row * atlas.z, cell_row) * vec2(224.0, 288.0);\n"
+                "  float size = (kind == 0.0) ? 8.0 : 16.0;\n"
+                "  vec2 ext = (kind == 2.0) ? vec2(224.0, 288.0) : vec2(size);\n"
+                "  vec2 c = (clamp(pix_pos + corner * ext, vec2(0.0), vec2(224.0, 288.0)) - pix_pos) / ext;\n"
+                "  vec2 pos = (cell_pos + pix_pos + c * ext) / atlas.xy;\n"
+                "  vec2 tc = mix(c, 1.0 - c, flip);\n"
+                "  gl_Position = vec4((pos - 0.5) * vec2(2.0, -2.0), 0.5, 1.0);\n"
+                "  uv = vec2((tile + tc.x) * size / 2048.0, (((kind == 0.0) ? 0.0 : 8.0) + tc.y * size) / 24.0);\n"
+                "  data = vec4(quad_data.yz, 0.0, 0.0);\n"
                 "}\n";
             offscreen_fs_src =
                 "precision mediump float;\n"
@@ -2924,20 +8575,68 @@ static void gfx_create_resources(void) {
                 "void main() {\n"
                 "  gl_FragColor = texture2D(tex, uv);\n"
                 "}\n";
+            tilemap_vs_src =
+                "attribute vec4 pos;\n"
+                "varying vec2 uv;\n"
+                "void main() {\n"
+                "  gl_Position = vec4((pos.xy - 0.5) * vec2(2.0, -2.0), 0.5, 1.0);\n"
+                "  uv = pos.xy;\n"
+                "}\n";
+            // NOTE: needs highp, the tile texture coordinates don't fit into mediump
+            tilemap_fs_src =
+                "precision highp float;\n"
+                "uniform sampler2D tile_tex;\n"
+                "uniform sampler2D pal_tex;\n"
+                "uniform sampler2D video_tex;\n"
+                "uniform sampler2D color_tex;\n"
+                "varying vec2 uv;\n"
+                "void main() {\n"
+                "  vec2 tile_pos = uv * vec2(28.0, 36.0);\n"
+                "  float tile_code = floor(texture2D(video_tex, uv).x * 255.0 + 0.5);\n"
+                "  float color_code = mod(floor(texture2D(color_tex, uv).x * 255.0 + 0.5), 32.0);\n"
+                "  vec2 tile_uv = vec2((tile_code + fract(tile_pos.x)) * 8.0 / 2048.0, fract(tile_pos.y) * 8.0 / 24.0);\n"
+                "  float tile_color = floor(texture2D(tile_tex, tile_uv).x * 255.0 + 0.5);\n"
+                "  vec2 pal_uv = vec2((color_code * 4.0 + tile_color + 0.5) / 256.0, 0.5);\n"
+                "  gl_FragColor = texture2D(pal_tex, pal_uv);\n"
+                "}\n";
                 break;
         default:
             assert(false);
     }
 
-    // create pipeline and shader object for rendering into offscreen render target
-    state.gfx.offscreen.pip = sg_make_pipeline(&(sg_pipeline_desc){
+    /* create pipeline and shader object for rendering into offscreen render target,
+       tiles and sprites are drawn as instanced quads, the per-vertex buffer
+       only holds the 4 corners of a unit quad, and each instance_t is
+       decoded and expanded into a tile, sprite or fullscreen quad in the
+       vertex shader:
+
+        quad_pos:   USHORT2N pixel position of the top-left corner (plus QUAD_POS_BIAS)
+        quad_data:  UBYTE4N tile code, color code, opacity, and QUADFLAG_* bits
+
+       the vertex shaders hardcode QUAD_POS_BIAS (256.0), and pass the color
+       code and opacity to the fragment shader in data.x and data.y
+
+       the render target is an atlas of playfield-sized cells (only one
+       outside the cabinet wall mode), the upper 4 QUADFLAG_* bits select the
+       quad's cell, the uniform atlas.xy is the size of the render target in
+       (not upscaled) pixels and atlas.z the number of cell columns, quads
+       are clipped to their cell, so that a sprite in the tunnel doesn't
+       spill into the neighbour cell
+    */
+    sg_pipeline_desc quad_pip_desc = {
         .shader = sg_make_shader(&(sg_shader_desc){
            .attrs = {
-                [0] = { .name="pos", .sem_name="POSITION" },
-                [1] = { .name="uv_in", .sem_name="TEXCOORD", .sem_index=0 },
-                [2] = { .name="data_in", .sem_name="TEXCOORD", .sem_index=1 },
+                [0] = { .name="corner", .sem_name="POSITION" },
+                [1] = { .name="quad_pos", .sem_name="TEXCOORD", .sem_index=0 },
+                [2] = { .name="quad_data", .sem_name="TEXCOORD", .sem_index=1 },
+            },
+            .vs = {
+                .uniform_blocks[0] = {
+                    .size = 4 * sizeof(float),
+                    .uniforms[0] = { .name = "atlas", .type = SG_UNIFORMTYPE_FLOAT4 },
+                },
+                .source = offscreen_vs_src,
             },
-            .vs.source = offscreen_vs_src,
             .fs = {
                 .images = {
                     [0] = { .used = true },
@@ -2955,22 +8654,69 @@ static void gfx_create_resources(void) {
             }
         }),
         .layout = {
+            .buffers[1].step_func = SG_VERTEXSTEP_PER_INSTANCE,
             .attrs = {
-                [0].format = SG_VERTEXFORMAT_FLOAT2,
-                [1].format = SG_VERTEXFORMAT_FLOAT2,
-                [2].format = SG_VERTEXFORMAT_UBYTE4N,
+                [0] = { .format = SG_VERTEXFORMAT_FLOAT2, .buffer_index = 0 },
+                [1] = { .format = SG_VERTEXFORMAT_USHORT2N, .buffer_index = 1 },
+                [2] = { .format = SG_VERTEXFORMAT_UBYTE4N, .buffer_index = 1 },
             }
         },
-        .depth.pixel_format = SG_PIXELFORMAT_NONE,
-        .colors[0] = {
-            .pixel_format = SG_PIXELFORMAT_RGBA8,
-            .blend = {
-                .enabled = true,
-                .src_factor_rgb = SG_BLENDFACTOR_SRC_ALPHA,
-                .dst_factor_rgb = SG_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+        .primitive_type = SG_PRIMITIVETYPE_TRIANGLE_STRIP,
+        .colors[0].blend = {
+            .enabled = true,
+            .src_factor_rgb = SG_BLENDFACTOR_SRC_ALPHA,
+            .dst_factor_rgb = SG_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+        }
+    };
+    // the same shader once with the default pass pixel formats for the
+    // direct mode, and once for the offscreen render target
+    state.gfx.direct.pip = sg_make_pipeline(&quad_pip_desc);
+    quad_pip_desc.depth.pixel_format = SG_PIXELFORMAT_NONE;
+    quad_pip_desc.colors[0].pixel_format = SG_PIXELFORMAT_RGBA8;
+    state.gfx.offscreen.pip = sg_make_pipeline(&quad_pip_desc);
+
+    /* create pipeline and shader for the tilemap playfield renderer, this draws
+       a single quad over the offscreen render target, and the fragment shader
+       looks up the tile and color code in the video- and color-ram textures,
+       and the tile pixel in the tile-ROM-texture (which has 256 8x8 tiles
+       in the upper 8 of its 24 pixel rows)
+    */
+    sg_pipeline_desc tilemap_pip_desc = {
+        .shader = sg_make_shader(&(sg_shader_desc){
+            .attrs[0] = { .name="pos", .sem_name="POSITION" },
+            .vs.source = tilemap_vs_src,
+            .fs = {
+                .images = {
+                    [0] = { .used = true },
+                    [1] = { .used = true },
+                    [2] = { .used = true },
+                    [3] = { .used = true },
+                },
+                .samplers = {
+                    [0] = { .used = true },
+                    [1] = { .used = true },
+                },
+                .image_sampler_pairs = {
+                    [0] = { .used = true, .image_slot = 0, .sampler_slot = 0, .glsl_name = "tile_tex" },
+                    [1] = { .used = true, .image_slot = 1, .sampler_slot = 1, .glsl_name = "pal_tex" },
+                    [2] = { .used = true, .image_slot = 2, .sampler_slot = 0, .glsl_name = "video_tex" },
+                    [3] = { .used = true, .image_slot = 3, .sampler_slot = 0, .glsl_name = "color_tex" },
+                },
+                .source = tilemap_fs_src
             }
+        }),
+        .layout.attrs[0].format = SG_VERTEXFORMAT_FLOAT2,
+        .primitive_type = SG_PRIMITIVETYPE_TRIANGLE_STRIP,
+        .colors[0].blend = {
+            .enabled = true,
+            .src_factor_rgb = SG_BLENDFACTOR_SRC_ALPHA,
+            .dst_factor_rgb = SG_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
         }
-    });
+    };
+    state.gfx.direct.tilemap_pip = sg_make_pipeline(&tilemap_pip_desc);
+    tilemap_pip_desc.depth.pixel_format = SG_PIXELFORMAT_NONE;
+    tilemap_pip_desc.colors[0].pixel_format = SG_PIXELFORMAT_RGBA8;
+    state.gfx.tilemap.pip = sg_make_pipeline(&tilemap_pip_desc);
 
     // create pipeline and shader for rendering into display
     state.gfx.display.pip = sg_make_pipeline(&(sg_pipeline_desc){
@@ -2988,11 +8734,12 @@ static void gfx_create_resources(void) {
         .primitive_type = SG_PRIMITIVETYPE_TRIANGLE_STRIP
     });
 
-    // create a render target image with a fixed upscale ratio
+    // create a render target image with a fixed upscale ratio, with one
+    // playfield-sized cell per game in the cabinet wall mode
     state.gfx.offscreen.render_target = sg_make_image(&(sg_image_desc){
         .render_target = true,
-        .width = DISPLAY_PIXELS_X * 2,
-        .height = DISPLAY_PIXELS_Y * 2,
+        .width = DISPLAY_PIXELS_X * 2 * state.wall.cols,
+        .height = DISPLAY_PIXELS_Y * 2 * state.wall.rows,
         .pixel_format = SG_PIXELFORMAT_RGBA8,
     });
 
@@ -3009,12 +8756,30 @@ static void gfx_create_resources(void) {
         .color_attachments[0].image = state.gfx.offscreen.render_target
     });
 
+    // the decoded tile pixels and color palette either come from the
+    // pre-decoded atlas, or are decoded into a scratch buffer which is
+    // freed again once the textures have been created
+    #if PACMAN_ATLAS
+        const sg_range tile_pixels = SG_RANGE(atlas_tile_pixels);
+        const sg_range color_palette = SG_RANGE(atlas_color_palette);
+    #else
+        struct {
+            uint8_t tile_pixels[TILE_TEXTURE_HEIGHT][TILE_TEXTURE_WIDTH];
+            uint32_t color_palette[256];
+        }* scratch = malloc(sizeof(*scratch));
+        assert(scratch);
+        gfx_decode_tiles(scratch->tile_pixels);
+        gfx_decode_color_palette(scratch->color_palette);
+        const sg_range tile_pixels = SG_RANGE(scratch->tile_pixels);
+        const sg_range color_palette = SG_RANGE(scratch->color_palette);
+    #endif
+
     // create the 'tile-ROM-texture'
     state.gfx.offscreen.tile_img = sg_make_image(&(sg_image_desc){
         .width  = TILE_TEXTURE_WIDTH,
         .height = TILE_TEXTURE_HEIGHT,
         .pixel_format = SG_PIXELFORMAT_R8,
-        .data.subimage[0][0] = SG_RANGE(state.gfx.tile_pixels)
+        .data.subimage[0][0] = tile_pixels
     });
 
     // create the palette texture
@@ -3022,7 +8787,24 @@ static void gfx_create_resources(void) {
         .width = 256,
         .height = 1,
         .pixel_format = SG_PIXELFORMAT_RGBA8,
-        .data.subimage[0][0] = SG_RANGE(state.gfx.color_palette)
+        .data.subimage[0][0] = color_palette
+    });
+    #if !PACMAN_ATLAS
+        free(scratch);
+    #endif
+
+    // create the video- and color-ram textures for the tilemap renderer
+    state.gfx.tilemap.video_img = sg_make_image(&(sg_image_desc){
+        .width = DISPLAY_TILES_X,
+        .height = DISPLAY_TILES_Y,
+        .pixel_format = SG_PIXELFORMAT_R8,
+        .usage = SG_USAGE_DYNAMIC,
+    });
+    state.gfx.tilemap.color_img = sg_make_image(&(sg_image_desc){
+        .width = DISPLAY_TILES_X,
+        .height = DISPLAY_TILES_Y,
+        .pixel_format = SG_PIXELFORMAT_R8,
+        .usage = SG_USAGE_DYNAMIC,
     });
 
     // create a sampler with nearest filtering for the offscreen pass
@@ -3034,130 +8816,17 @@ static void gfx_create_resources(void) {
     });
 }
 ///////////////////////////////////GFX//////////////////////////////////////////////////
-/*
-    8x4 tile decoder (taken from: https://github.com/floooh/chips/blob/master/systems/namco.h)
-
-    This decodes 2-bit-per-pixel tile data from Pacman ROM dumps into
-    8-bit-per-pixel texture data (without doing the RGB palette lookup,
-    this happens during rendering in the pixel shader).
-
-    The Pacman ROM tile layout isn't exactly strightforward, both 8x8 tiles
-    and 16x16 sprites are built from 8x4 pixel blocks layed out linearly
-    in memory, and to add to the confusion, since Pacman is an arcade machine
-    with the display 90 degree rotated, all the ROM tile data is counter-rotated.
-
-    Tile decoding only happens once at startup from ROM dumps into a texture.
-*/
-static inline void gfx_decode_tile_8x4(
-    uint32_t tex_x,
-    uint32_t tex_y,
-    const uint8_t* tile_base,
-    uint32_t tile_stride,
-    uint32_t tile_offset,
-    uint8_t tile_code)
-{
-    for (uint32_t tx = 0; tx < TILE_WIDTH; tx++) {
-        uint32_t ti = tile_code * tile_stride + tile_offset + (7 - tx);
-        for (uint32_t ty = 0; ty < (TILE_HEIGHT/2); ty++) {
-            uint8_t p_hi = (tile_base[ti] >> (7 - ty)) & 1;
-            uint8_t p_lo = (tile_base[ti] >> (3 - ty)) & 1;
-            uint8_t p = (p_hi << 1) | p_lo;
-            state.gfx.tile_pixels[tex_y + ty][tex_x + tx] = p;
-        }
-    }
-}
-
-// decode an 8x8 tile into the tile texture's upper half
-static inline void gfx_decode_tile(uint8_t tile_code) {
-    uint32_t x = tile_code * TILE_WIDTH;
-    uint32_t y0 = 0;
-    uint32_t y1 = y0 + (TILE_HEIGHT / 2);
-    gfx_decode_tile_8x4(x, y0, rom_tiles, 16, 8, tile_code);
-    gfx_decode_tile_8x4(x, y1, rom_tiles, 16, 0, tile_code);
-}
-
-// decode a 16x16 sprite into the tile texture's lower half
-static inline void gfx_decode_sprite(uint8_t sprite_code) {
-    uint32_t x0 = sprite_code * SPRITE_WIDTH;
-    uint32_t x1 = x0 + TILE_WIDTH;
-    uint32_t y0 = TILE_HEIGHT;
-    uint32_t y1 = y0 + (TILE_HEIGHT / 2);
-    uint32_t y2 = y1 + (TILE_HEIGHT / 2);
-    uint32_t y3 = y2 + (TILE_HEIGHT / 2);
-    gfx_decode_tile_8x4(x0, y0, rom_sprites, 64, 40, sprite_code);
-    gfx_decode_tile_8x4(x1, y0, rom_sprites, 64,  8, sprite_code);
-    gfx_decode_tile_8x4(x0, y1, rom_sprites, 64, 48, sprite_code);
-    gfx_decode_tile_8x4(x1, y1, rom_sprites, 64, 16, sprite_code);
-    gfx_decode_tile_8x4(x0, y2, rom_sprites, 64, 56, sprite_code);
-    gfx_decode_tile_8x4(x1, y2, rom_sprites, 64, 24, sprite_code);
-    gfx_decode_tile_8x4(x0, y3, rom_sprites, 64, 32, sprite_code);
-    gfx_decode_tile_8x4(x1, y3, rom_sprites, 64,  0, sprite_code);
-}
-
-// decode the Pacman tile- and sprite-ROM-dumps into a 8bpp texture
-static void gfx_decode_tiles(void) {
-    for (uint32_t tile_code = 0; tile_code < 256; tile_code++) {
-        gfx_decode_tile(tile_code);
-    }
-    for (uint32_t sprite_code = 0; sprite_code < 64; sprite_code++) {
-        gfx_decode_sprite(sprite_code);
-    }
-    // write a special opaque 16x16 block which will be used for the fade-effect
-    for (uint32_t y = TILE_HEIGHT; y < TILE_TEXTURE_HEIGHT; y++) {
-        for (uint32_t x = 64*SPRITE_WIDTH; x < 65*SPRITE_WIDTH; x++) {
-            state.gfx.tile_pixels[y][x] = 1;
-        }
-    }
-}
-
-/* decode the Pacman color palette into a palette texture, on the original
-    hardware, color lookup happens in two steps, first through 256-entry
-    palette which indirects into a 32-entry hardware-color palette
-    (of which only 16 entries are used on the Pacman hardware)
-*/
-static void gfx_decode_color_palette(void) {
-    uint32_t hw_colors[32];
-    for (int i = 0; i < 32; i++) {
-       /*
-           Each color ROM entry describes an RGB color in 1 byte:
-
-           | 7| 6| 5| 4| 3| 2| 1| 0|
-           |B1|B0|G2|G1|G0|R2|R1|R0|
-
-           Intensities are: 0x97 + 0x47 + 0x21
-        */
-        uint8_t rgb = rom_hwcolors[i];
-        uint8_t r = ((rgb>>0)&1) * 0x21 + ((rgb>>1)&1) * 0x47 + ((rgb>>2)&1) * 0x97;
-        uint8_t g = ((rgb>>3)&1) * 0x21 + ((rgb>>4)&1) * 0x47 + ((rgb>>5)&1) * 0x97;
-        uint8_t b = ((rgb>>6)&1) * 0x47 + ((rgb>>7)&1) * 0x97;
-        hw_colors[i] = 0xFF000000 | (b<<16) | (g<<8) | r;
-    }
-    for (int i = 0; i < 256; i++) {
-        state.gfx.color_palette[i] = hw_colors[rom_palette[i] & 0xF];
-        // first color in each color block is transparent
-        if ((i & 3) == 0) {
-            state.gfx.color_palette[i] &= 0x00FFFFFF;
-        }
-    }
-}
-
 static void gfx_init(void) {
     sg_setup(&(sg_desc){
         // reduce pool allocation size to what's actually needed
-        .buffer_pool_size = 2,
-        .image_pool_size = 3,
-        .shader_pool_size = 2,
-        .pipeline_pool_size = 2,
+        .buffer_pool_size = 2 + PLAYFIELD_BANDS,
+        .image_pool_size = 5,
+        .shader_pool_size = 3,
+        .pipeline_pool_size = 5,
         .pass_pool_size = 1,
         .context = sapp_sgcontext(),
         .logger.func = slog_func,
     });
-    disable(&state.gfx.fadein);
-    disable(&state.gfx.fadeout);
-    state.gfx.fade = 0xFF;
-    spr_clear();
-    gfx_decode_tiles();
-    gfx_decode_color_palette();
     gfx_create_resources();
 }
 
@@ -3165,128 +8834,175 @@ static void gfx_shutdown(void) {
     sg_shutdown();
 }
 
-static void gfx_add_vertex(float x, float y, float u, float v, uint8_t color_code, uint8_t opacity) {
-    assert(state.gfx.num_vertices < MAX_VERTICES);
-    vertex_t* vtx = &state.gfx.vertices[state.gfx.num_vertices++];
-    vtx->x = x;
-    vtx->y = y;
-    vtx->u = u;
-    vtx->v = v;
-    vtx->attr = (opacity<<8) | color_code;
+// parse the renderer command line args, called from sokol_main()
+static void gfx_parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-tilemap")) {
+            state.gfx.tilemap.enabled = true;
+        }
+        else if (0 == strcmp(argv[i], "-direct")) {
+            state.gfx.direct.forced = true;
+        }
+    }
+}
+
+// switch between the tile-quad and tilemap playfield renderer
+static void gfx_toggle_tilemap(game_ctx_t* ctx) {
+    if (state.wall.num_games > 0) {
+        // the cabinet wall only has the tile-quad renderer
+        return;
+    }
+    state.gfx.tilemap.enabled = !state.gfx.tilemap.enabled;
+    // the other renderer hasn't kept up with the changed tiles
+    vid_dirty_all(ctx);
+}
+#endif // !PACMAN_HEADLESS
+
+// the instance data is built on the CPU, this is also measured by the benchmark suite
+#if !PACMAN_HEADLESS || PACMAN_BENCH
+static void gfx_add_quad(int x, int y, uint8_t tile_code, uint8_t color_code, uint8_t opacity, uint8_t flags) {
+    assert(state.gfx.num_quads < MAX_QUADS);
+    assert(((x + QUAD_POS_BIAS) >= 0) && ((y + QUAD_POS_BIAS) >= 0));
+    state.gfx.quads[state.gfx.num_quads++] = (instance_t) {
+        .x = (uint16_t)(x + QUAD_POS_BIAS),
+        .y = (uint16_t)(y + QUAD_POS_BIAS),
+        .tile = tile_code,
+        .color = color_code,
+        .opacity = opacity,
+        .flags = (uint8_t)(flags | (state.gfx.cell * QUADFLAG_CELL)),
+    };
 }
 
-static void gfx_add_tile_vertices(uint32_t tx, uint32_t ty, uint8_t tile_code, uint8_t color_code) {
+// build the instance data of a tile quad
+static instance_t gfx_tile_quad(uint32_t tx, uint32_t ty, uint8_t tile_code, uint8_t color_code) {
     assert((tx < DISPLAY_TILES_X) && (ty < DISPLAY_TILES_Y));
-    const float dx = 1.0f / DISPLAY_TILES_X;
-    const float dy = 1.0f / DISPLAY_TILES_Y;
-    const float du = (float)TILE_WIDTH / TILE_TEXTURE_WIDTH;
-    const float dv = (float)TILE_HEIGHT / TILE_TEXTURE_HEIGHT;
-
-    const float x0 = tx * dx;
-    const float x1 = x0 + dx;
-    const float y0 = ty * dy;
-    const float y1 = y0 + dy;
-    const float u0 = tile_code * du;
-    const float u1 = u0 + du;
-    const float v0 = 0.0f;
-    const float v1 = dv;
-    /*
-        x0,y0
-        +-----+
-        | *   |
-        |   * |
-        +-----+
-                x1,y1
-    */
-    gfx_add_vertex(x0, y0, u0, v0, color_code, 0xFF);
-    gfx_add_vertex(x1, y0, u1, v0, color_code, 0xFF);
-    gfx_add_vertex(x1, y1, u1, v1, color_code, 0xFF);
-    gfx_add_vertex(x0, y0, u0, v0, color_code, 0xFF);
-    gfx_add_vertex(x1, y1, u1, v1, color_code, 0xFF);
-    gfx_add_vertex(x0, y1, u0, v1, color_code, 0xFF);
+    return (instance_t) {
+        .x = (uint16_t)(tx * TILE_WIDTH + QUAD_POS_BIAS),
+        .y = (uint16_t)(ty * TILE_HEIGHT + QUAD_POS_BIAS),
+        .tile = tile_code,
+        .color = color_code,
+        .opacity = 0xFF,
+        .flags = (uint8_t)(QUADFLAG_TILE | (state.gfx.cell * QUADFLAG_CELL)),
+    };
 }
 
-static void gfx_add_playfield_vertices(void) {
+// rebuild the quads of tiles which changed since the last frame in an
+// array of PLAYFIELD_QUADS, returns a bit mask of the changed bands
+static uint32_t gfx_update_playfield_quads(game_ctx_t* ctx, instance_t* quads) {
+    uint32_t dirty_bands = 0;
     for (uint32_t ty = 0; ty < DISPLAY_TILES_Y; ty++) {
-        for (uint32_t tx = 0; tx < DISPLAY_TILES_X; tx++) {
-            const uint8_t tile_code = state.gfx.video_ram[ty][tx];
-            const uint8_t color_code = state.gfx.color_ram[ty][tx] & 0x1F;
-            gfx_add_tile_vertices(tx, ty, tile_code, color_code);
+        const uint32_t dirty = ctx->dirty_tiles[ty];
+        if (0 == dirty) {
+            continue;
         }
-    }
-}
-
-static void gfx_add_debugmarker_vertices(void) {
-    for (int i = 0; i < NUM_DEBUG_MARKERS; i++) {
-        const debugmarker_t* dbg = &state.gfx.debug_marker[i];
-        if (dbg->enabled) {
-            gfx_add_tile_vertices(dbg->tile_pos.x, dbg->tile_pos.y, dbg->tile, dbg->color);
+        ctx->dirty_tiles[ty] = 0;
+        instance_t* row_quads = &quads[ty * DISPLAY_TILES_X];
+        for (uint32_t tx = 0; tx < DISPLAY_TILES_X; tx++) {
+            if (dirty & (1u<<tx)) {
+                const uint8_t tile_code = ctx->vid.video_ram[ty][tx];
+                const uint8_t color_code = ctx->vid.color_ram[ty][tx] & 0x1F;
+                row_quads[tx] = gfx_tile_quad(tx, ty, tile_code, color_code);
+            }
         }
+        dirty_bands |= 1u<<(ty / PLAYFIELD_BAND_TILES_Y);
     }
+    return dirty_bands;
 }
 
-static void gfx_add_sprite_vertices(void) {
-    const float dx = 1.0f / DISPLAY_PIXELS_X;
-    const float dy = 1.0f / DISPLAY_PIXELS_Y;
-    const float du = (float)SPRITE_WIDTH / TILE_TEXTURE_WIDTH;
-    const float dv = (float)SPRITE_HEIGHT / TILE_TEXTURE_HEIGHT;
+static void gfx_add_sprite_quads(game_ctx_t* ctx) {
     for (int i = 0; i < NUM_SPRITES; i++) {
-        const sprite_t* spr = &state.gfx.sprite[i];
+        const sprite_t* spr = &ctx->vid.sprite[i];
         if (spr->enabled) {
-            float x0, x1, y0, y1;
+            uint8_t flags = QUADFLAG_SPRITE;
             if (spr->flipx) {
-                x1 = spr->pos.x * dx;
-                x0 = x1 + dx * SPRITE_WIDTH;
-            }
-            else {
-                x0 = spr->pos.x * dx;
-                x1 = x0 + dx * SPRITE_WIDTH;
+                flags |= QUADFLAG_FLIPX;
             }
             if (spr->flipy) {
-                y1 = spr->pos.y * dy;
-                y0 = y1 + dy * SPRITE_HEIGHT;
-            }
-            else {
-                y0 = spr->pos.y * dy;
-                y1 = y0 + dy * SPRITE_HEIGHT;
+                flags |= QUADFLAG_FLIPY;
             }
-            const float u0 = spr->tile * du;
-            const float u1 = u0 + du;
-            const float v0 = ((float)TILE_HEIGHT / TILE_TEXTURE_HEIGHT);
-            const float v1 = v0 + dv;
-            const uint8_t color = spr->color;
-            gfx_add_vertex(x0, y0, u0, v0, color, 0xFF);
-            gfx_add_vertex(x1, y0, u1, v0, color, 0xFF);
-            gfx_add_vertex(x1, y1, u1, v1, color, 0xFF);
-            gfx_add_vertex(x0, y0, u0, v0, color, 0xFF);
-            gfx_add_vertex(x1, y1, u1, v1, color, 0xFF);
-            gfx_add_vertex(x0, y1, u0, v1, color, 0xFF);
+            gfx_add_quad(spr->pos.x, spr->pos.y, spr->tile, spr->color, 0xFF, flags);
+        }
+    }
+}
+#endif // !PACMAN_HEADLESS || PACMAN_BENCH
+
+#if !PACMAN_HEADLESS
+
+static void gfx_add_tile_quad(uint32_t tx, uint32_t ty, uint8_t tile_code, uint8_t color_code) {
+    assert(state.gfx.num_quads < MAX_QUADS);
+    state.gfx.quads[state.gfx.num_quads++] = gfx_tile_quad(tx, ty, tile_code, color_code);
+}
+
+static void gfx_add_debugmarker_quads(game_ctx_t* ctx) {
+    for (int i = 0; i < NUM_DEBUG_MARKERS; i++) {
+        const debugmarker_t* dbg = &ctx->debug_marker[i];
+        if (dbg->enabled) {
+            gfx_add_tile_quad(dbg->tile_pos.x, dbg->tile_pos.y, dbg->tile, dbg->color);
         }
     }
 }
 
-static void gfx_add_fade_vertices(void) {
+#if PACMAN_PROFILER
+// the profiler HUD as a layer of text tile quads over the playfield, the
+// video RAM isn't touched since it is part of the simulation state
+static void gfx_add_prof_text(uint32_t ty, const char* text) {
+    for (uint32_t tx = 0; tx < DISPLAY_TILES_X; tx++) {
+        const char chr = *text ? *text++ : ' ';
+        gfx_add_tile_quad(tx, ty, (uint8_t)conv_char(chr), COLOR_DEFAULT);
+    }
+}
+
+static void gfx_add_prof_quads(void) {
+    static const char* names[NUM_PROF_SCOPES] = {
+        "FRAME", "SNDTIK", "SIM", "ACTORS", "TILES", "SPRITE", "QUADS", "UPLOAD", "COMMIT", "SNDFRM", "BOT"
+    };
+    const uint32_t ty = 3;
+    gfx_add_prof_text(ty, "US        MIN   AVG   P99");
+    for (int i = 0; i < NUM_PROF_SCOPES; i++) {
+        char line[DISPLAY_TILES_X + 1];
+        snprintf(line, sizeof(line), "%-6s %6u%6u%6u", names[i],
+            (unsigned)state.prof.stats[i][0], (unsigned)state.prof.stats[i][1], (unsigned)state.prof.stats[i][2]);
+        gfx_add_prof_text(ty + 1 + (uint32_t)i, line);
+    }
+}
+#endif
+
+static void gfx_add_fade_quad(game_ctx_t* ctx) {
     // sprite tile 64 is a special 16x16 opaque block
-    const float du = (float)SPRITE_WIDTH / TILE_TEXTURE_WIDTH;
-    const float dv = (float)SPRITE_HEIGHT / TILE_TEXTURE_HEIGHT;
-    const float u0 = 64 * du;
-    const float u1 = u0 + du;
-    const float v0 = (float)TILE_HEIGHT / TILE_TEXTURE_HEIGHT;
-    const float v1 = v0 + dv;
-
-    const uint8_t fade = state.gfx.fade;
-    gfx_add_vertex(0.0f, 0.0f, u0, v0, 0, fade);
-    gfx_add_vertex(1.0f, 0.0f, u1, v0, 0, fade);
-    gfx_add_vertex(1.0f, 1.0f, u1, v1, 0, fade);
-    gfx_add_vertex(0.0f, 0.0f, u0, v0, 0, fade);
-    gfx_add_vertex(1.0f, 1.0f, u1, v1, 0, fade);
-    gfx_add_vertex(0.0f, 1.0f, u0, v1, 0, fade);
-}
-
-// adjust the viewport so that the aspect ratio is always correct
-static void gfx_adjust_viewport(int canvas_width, int canvas_height) {
+    gfx_add_quad(0, 0, 64, 0, ctx->vid.fade, QUADFLAG_FULLSCREEN);
+}
+
+/* the integer upscale factor of the direct mode, or 0 if the render target
+   must be upscaled in a separate display pass, without -direct, the direct
+   mode is only used if the canvas is an exact multiple of the playfield
+   size, so that all pixels are scaled by the same integer factor (e.g. at
+   the default window size, which saves the display pass and the texture
+   fetches of the upscale)
+*/
+static int gfx_direct_scale(int canvas_width, int canvas_height) {
+    const int width = DISPLAY_PIXELS_X * state.wall.cols;
+    const int height = DISPLAY_PIXELS_Y * state.wall.rows;
+    int scale = (canvas_width / width) < (canvas_height / height) ? (canvas_width / width) : (canvas_height / height);
+    if (scale < 1) {
+        scale = 1;
+    }
+    if (state.gfx.direct.forced || ((canvas_width == (width * scale)) && (canvas_height == (height * scale)))) {
+        return scale;
+    }
+    return 0;
+}
+
+// adjust the viewport so that the aspect ratio is always correct, in the
+// direct mode the viewport is centered with an integer scale
+static void gfx_adjust_viewport(int canvas_width, int canvas_height, int direct_scale) {
+    if (direct_scale > 0) {
+        const int vp_w = DISPLAY_PIXELS_X * state.wall.cols * direct_scale;
+        const int vp_h = DISPLAY_PIXELS_Y * state.wall.rows * direct_scale;
+        sg_apply_viewport((canvas_width - vp_w) / 2, (canvas_height - vp_h) / 2, vp_w, vp_h, true);
+        return;
+    }
     const float canvas_aspect = (float)canvas_width / (float)canvas_height;
-    const float playfield_aspect = (float)DISPLAY_TILES_X / (float)DISPLAY_TILES_Y;
+    const float playfield_aspect = (float)(DISPLAY_TILES_X * state.wall.cols) / (float)(DISPLAY_TILES_Y * state.wall.rows);
     int vp_x, vp_y, vp_w, vp_h;
     const int border = 10;
     if (playfield_aspect < canvas_aspect) {
@@ -3304,44 +9020,201 @@ static void gfx_adjust_viewport(int canvas_width, int canvas_height) {
     sg_apply_viewport(vp_x, vp_y, vp_w, vp_h, true);
 }
 
-// handle fadein/fadeout
-static void gfx_fade(void) {
-    if (between(state.gfx.fadein, 0, FADE_TICKS)) {
-        float t = (float)since(state.gfx.fadein) / FADE_TICKS;
-        state.gfx.fade = (uint8_t) (255.0f * (1.0f - t));
+// upload video- and color-ram into the tilemap textures if any tile has changed
+static void gfx_update_tilemap(game_ctx_t* ctx) {
+    bool dirty = false;
+    for (int ty = 0; ty < DISPLAY_TILES_Y; ty++) {
+        if (ctx->dirty_tiles[ty]) {
+            ctx->dirty_tiles[ty] = 0;
+            dirty = true;
+        }
+    }
+    if (dirty) {
+        PROF_BEGIN(PROF_GFX_UPLOAD);
+        sg_update_image(state.gfx.tilemap.video_img, &(sg_image_data){ .subimage[0][0] = SG_RANGE(ctx->vid.video_ram) });
+        sg_update_image(state.gfx.tilemap.color_img, &(sg_image_data){ .subimage[0][0] = SG_RANGE(ctx->vid.color_ram) });
+        PROF_END(PROF_GFX_UPLOAD);
+    }
+}
+
+// the offscreen vertex shader's uniforms, the render target size in pixels and its cell columns
+static void gfx_apply_offscreen_uniforms(void) {
+    const float atlas[4] = {
+        (float)(DISPLAY_PIXELS_X * state.wall.cols),
+        (float)(DISPLAY_PIXELS_Y * state.wall.rows),
+        (float)state.wall.cols,
+        0.0f
+    };
+    sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, &SG_RANGE(atlas));
+}
+
+// true if two sprites look the same (compared by field, the padding bytes are undefined)
+static bool gfx_sprite_equal(const sprite_t* a, const sprite_t* b) {
+    if (!a->enabled && !b->enabled) {
+        return true;
+    }
+    return (a->enabled == b->enabled) && (a->tile == b->tile) && (a->color == b->color) &&
+           (a->flipx == b->flipx) && (a->flipy == b->flipy) && (a->pos.x == b->pos.x) && (a->pos.y == b->pos.y);
+}
+
+static bool gfx_debugmarker_equal(const debugmarker_t* a, const debugmarker_t* b) {
+    if (!a->enabled && !b->enabled) {
+        return true;
+    }
+    return (a->enabled == b->enabled) && (a->tile == b->tile) && (a->color == b->color) &&
+           (a->tile_pos.x == b->tile_pos.x) && (a->tile_pos.y == b->tile_pos.y);
+}
+
+/* check if a game's picture changed since the last rendered frame, changed
+   tiles are tracked in dirty_tiles by vid_dirty(), but the gameplay code
+   writes the sprites in every tick even when they don't move (e.g. while
+   the game is frozen), so the sprites, debug markers and the fade value are
+   compared with a copy of the last rendered ones
+*/
+static bool gfx_game_changed(game_ctx_t* ctx, int index) {
+    bool changed = false;
+    for (int y = 0; y < DISPLAY_TILES_Y; y++) {
+        changed |= (0 != ctx->dirty_tiles[y]);
+    }
+    if (ctx->vid.fade != state.gfx.drawn.fade[index]) {
+        state.gfx.drawn.fade[index] = ctx->vid.fade;
+        changed = true;
+    }
+    for (int i = 0; i < NUM_SPRITES; i++) {
+        if (!gfx_sprite_equal(&ctx->vid.sprite[i], &state.gfx.drawn.sprite[index][i])) {
+            state.gfx.drawn.sprite[index][i] = ctx->vid.sprite[i];
+            changed = true;
+        }
+    }
+    for (int i = 0; i < NUM_DEBUG_MARKERS; i++) {
+        if (!gfx_debugmarker_equal(&ctx->debug_marker[i], &state.gfx.drawn.debug_marker[index][i])) {
+            state.gfx.drawn.debug_marker[index][i] = ctx->debug_marker[i];
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// check if the frame must be rendered, because the picture of any game
+// changed, or the profiler HUD is visible, or the direct mode was switched
+static bool gfx_frame_changed(game_ctx_t* ctx, bool direct) {
+    bool changed = !state.gfx.drawn.valid || (direct != state.gfx.drawn.direct);
+    state.gfx.drawn.valid = true;
+    state.gfx.drawn.direct = direct;
+    #if PACMAN_PROFILER
+        // the HUD shows new numbers in every frame
+        changed |= state.prof.enabled || state.gfx.drawn.prof_hud;
+        state.gfx.drawn.prof_hud = state.prof.enabled;
+    #endif
+    if (state.wall.num_games > 0) {
+        for (int i = 0; i < state.wall.num_games; i++) {
+            changed |= gfx_game_changed(wall_ctx(i), i);
+        }
+    }
+    else {
+        changed |= gfx_game_changed(ctx, 0);
     }
-    if (after_once(state.gfx.fadein, FADE_TICKS)) {
-        state.gfx.fade = 0;
+    return changed;
+}
+
+// begin the pass which renders the tiles and sprites, this is the default
+// pass in the direct mode (where the direct.* pipelines must be used)
+static void gfx_begin_playfield_pass(int direct_scale) {
+    if (direct_scale > 0) {
+        const int canvas_width = sapp_width();
+        const int canvas_height = sapp_height();
+        sg_begin_default_pass(&state.gfx.pass_action, canvas_width, canvas_height);
+        gfx_adjust_viewport(canvas_width, canvas_height, direct_scale);
+    }
+    else {
+        sg_begin_pass(state.gfx.offscreen.pass, &state.gfx.pass_action);
     }
-    if (between(state.gfx.fadeout, 0, FADE_TICKS)) {
-        float t = (float)since(state.gfx.fadeout) / FADE_TICKS;
-        state.gfx.fade = (uint8_t) (255.0f * t);
+}
+
+// upscale-render the offscreen render target into the display framebuffer
+static void gfx_draw_display(void) {
+    const int canvas_width = sapp_width();
+    const int canvas_height = sapp_height();
+    sg_begin_default_pass(&state.gfx.pass_action, canvas_width, canvas_height);
+    gfx_adjust_viewport(canvas_width, canvas_height, 0);
+    sg_apply_pipeline(state.gfx.display.pip);
+    sg_apply_bindings(&(sg_bindings){
+        .vertex_buffers[0] = state.gfx.display.quad_vbuf,
+        .fs = {
+            .images[0] = state.gfx.offscreen.render_target,
+            .samplers[0] = state.gfx.display.sampler,
+        }
+    });
+    sg_draw(0, 4, 1);
+    sg_end_pass();
+}
+
+// finish the frame, without the direct mode, this adds the display pass
+static void gfx_end_playfield_pass(int direct_scale) {
+    sg_end_pass();
+    if (0 == direct_scale) {
+        gfx_draw_display();
     }
-    if (after_once(state.gfx.fadeout, FADE_TICKS)) {
-        state.gfx.fade = 255;
+    sg_commit();
+}
+
+// move the sprite-, debug-marker and fade quads of a game from the
+// intermediate instance buffer into the cabinet wall's instance data
+static int gfx_add_wall_game_quads(game_ctx_t* ctx, int num_quads) {
+    state.gfx.num_quads = 0;
+    gfx_add_sprite_quads(ctx);
+    gfx_add_debugmarker_quads(ctx);
+    if (ctx->vid.fade > 0) {
+        gfx_add_fade_quad(ctx);
+    }
+    assert((num_quads + state.gfx.num_quads) <= wall_max_quads());
+    memcpy(&state.wall.quads[num_quads], state.gfx.quads, (size_t)state.gfx.num_quads * sizeof(instance_t));
+    return num_quads + state.gfx.num_quads;
+}
+
+/* render all games of the cabinet wall into their cells of the render target
+   with a single draw call, the playfield quads of all games are at the start
+   of the instance data (only the quads of changed tiles are rebuilt), and
+   the sprite quads of all games follow, the whole instance data is uploaded
+   once per changed frame
+*/
+static void gfx_draw_wall(int direct_scale, bool changed) {
+    if (changed) {
+        PROF_BEGIN(PROF_GFX_QUADS);
+        for (int i = 0; i < state.wall.num_games; i++) {
+            state.gfx.cell = (uint8_t)i;
+            gfx_update_playfield_quads(wall_ctx(i), &state.wall.quads[i * PLAYFIELD_QUADS]);
+        }
+        int num_quads = state.wall.num_games * PLAYFIELD_QUADS;
+        for (int i = 0; i < state.wall.num_games; i++) {
+            state.gfx.cell = (uint8_t)i;
+            num_quads = gfx_add_wall_game_quads(wall_ctx(i), num_quads);
+        }
+        state.gfx.cell = 0;
+        #if PACMAN_PROFILER
+        if (state.prof.enabled) {
+            // the profiler HUD goes over the first game
+            state.gfx.num_quads = 0;
+            gfx_add_prof_quads();
+            memcpy(&state.wall.quads[num_quads], state.gfx.quads, (size_t)state.gfx.num_quads * sizeof(instance_t));
+            num_quads += state.gfx.num_quads;
+        }
+        #endif
+        state.wall.num_quads = num_quads;
+        PROF_END(PROF_GFX_QUADS);
+        PROF_BEGIN(PROF_GFX_UPLOAD);
+        sg_update_buffer(state.gfx.offscreen.vbuf, &(sg_range){ .ptr=state.wall.quads, .size=(size_t)num_quads * sizeof(instance_t) });
+        PROF_END(PROF_GFX_UPLOAD);
     }
-}
 
-static void gfx_draw(void) {
-    // handle fade in/out
-    gfx_fade();
-
-    // update the playfield and sprite vertex buffer
-    state.gfx.num_vertices = 0;
-    gfx_add_playfield_vertices();
-    gfx_add_sprite_vertices();
-    gfx_add_debugmarker_vertices();
-    if (state.gfx.fade > 0) {
-        gfx_add_fade_vertices();
-    }
-    assert(state.gfx.num_vertices <= MAX_VERTICES);
-    sg_update_buffer(state.gfx.offscreen.vbuf, &(sg_range){ .ptr=state.gfx.vertices, .size=state.gfx.num_vertices * sizeof(vertex_t) });
-
-    // render tiles and sprites into offscreen render target
-    sg_begin_pass(state.gfx.offscreen.pass, &state.gfx.pass_action);
-    sg_apply_pipeline(state.gfx.offscreen.pip);
+    PROF_BEGIN(PROF_GFX_COMMIT);
+    gfx_begin_playfield_pass(direct_scale);
+    sg_apply_pipeline((direct_scale > 0) ? state.gfx.direct.pip : state.gfx.offscreen.pip);
     sg_apply_bindings(&(sg_bindings){
-        .vertex_buffers[0] = state.gfx.offscreen.vbuf,
+        .vertex_buffers = {
+            [0] = state.gfx.display.quad_vbuf,
+            [1] = state.gfx.offscreen.vbuf,
+        },
         .fs = {
             .images = {
                 [0] = state.gfx.offscreen.tile_img,
@@ -3351,30 +9224,157 @@ static void gfx_draw(void) {
             .samplers[1] = state.gfx.offscreen.sampler,
         }
     });
-    sg_draw(0, state.gfx.num_vertices, 1);
-    sg_end_pass();
+    gfx_apply_offscreen_uniforms();
+    sg_draw(0, 4, state.wall.num_quads);
+    gfx_end_playfield_pass(direct_scale);
+    PROF_END(PROF_GFX_COMMIT);
+}
 
-    // upscale-render the offscreen render target into the display framebuffer
-    const int canvas_width = sapp_width();
-    const int canvas_height = sapp_height();
-    sg_begin_default_pass(&state.gfx.pass_action, canvas_width, canvas_height);
-    gfx_adjust_viewport(canvas_width, canvas_height);
-    sg_apply_pipeline(state.gfx.display.pip);
-    sg_apply_bindings(&(sg_bindings){
+static void gfx_draw(game_ctx_t* ctx) {
+    const int direct_scale = gfx_direct_scale(sapp_width(), sapp_height());
+    const bool changed = gfx_frame_changed(ctx, direct_scale > 0);
+    if (!changed && (0 == direct_scale)) {
+        // the offscreen render target still holds the unchanged picture, only
+        // the display pass runs (which also follows changes of the window size)
+        PROF_BEGIN(PROF_GFX_COMMIT);
+        gfx_draw_display();
+        sg_commit();
+        PROF_END(PROF_GFX_COMMIT);
+        return;
+    }
+    if (state.wall.num_games > 0) {
+        gfx_draw_wall(direct_scale, changed);
+        return;
+    }
+
+    // the default framebuffer isn't preserved between frames, so in the
+    // direct mode, an unchanged frame is drawn again from the unchanged
+    // instance buffers
+    if (changed) {
+        if (state.gfx.tilemap.enabled) {
+            gfx_update_tilemap(ctx);
+        }
+        else {
+            // update the instance buffers of playfield bands with changed tiles
+            PROF_BEGIN(PROF_GFX_QUADS);
+            const uint32_t dirty_bands = gfx_update_playfield_quads(ctx, state.gfx.playfield_quads);
+            PROF_END(PROF_GFX_QUADS);
+            PROF_BEGIN(PROF_GFX_UPLOAD);
+            for (int i = 0; i < PLAYFIELD_BANDS; i++) {
+                if (dirty_bands & (1u<<i)) {
+                    sg_update_buffer(state.gfx.offscreen.playfield_vbuf[i], &(sg_range){
+                        .ptr = &state.gfx.playfield_quads[i * PLAYFIELD_BAND_QUADS],
+                        .size = PLAYFIELD_BAND_QUADS * sizeof(instance_t)
+                    });
+                }
+            }
+            PROF_END(PROF_GFX_UPLOAD);
+        }
+
+        // update the sprite instance buffer
+        PROF_BEGIN(PROF_GFX_QUADS);
+        state.gfx.num_quads = 0;
+        gfx_add_sprite_quads(ctx);
+        gfx_add_debugmarker_quads(ctx);
+        if (ctx->vid.fade > 0) {
+            gfx_add_fade_quad(ctx);
+        }
+        #if PACMAN_PROFILER
+        if (state.prof.enabled) {
+            gfx_add_prof_quads();
+        }
+        #endif
+        assert(state.gfx.num_quads <= MAX_QUADS);
+        PROF_END(PROF_GFX_QUADS);
+        if (state.gfx.num_quads > 0) {
+            PROF_BEGIN(PROF_GFX_UPLOAD);
+            sg_update_buffer(state.gfx.offscreen.vbuf, &(sg_range){ .ptr=state.gfx.quads, .size=state.gfx.num_quads * sizeof(instance_t) });
+            PROF_END(PROF_GFX_UPLOAD);
+        }
+    }
+
+    // render tiles and sprites into offscreen render target (or directly
+    // into the display framebuffer)
+    PROF_BEGIN(PROF_GFX_COMMIT);
+    gfx_begin_playfield_pass(direct_scale);
+    const bool direct = direct_scale > 0;
+    if (state.gfx.tilemap.enabled) {
+        sg_apply_pipeline(direct ? state.gfx.direct.tilemap_pip : state.gfx.tilemap.pip);
+        sg_apply_bindings(&(sg_bindings){
+            .vertex_buffers[0] = state.gfx.display.quad_vbuf,
+            .fs = {
+                .images = {
+                    [0] = state.gfx.offscreen.tile_img,
+                    [1] = state.gfx.offscreen.palette_img,
+                    [2] = state.gfx.tilemap.video_img,
+                    [3] = state.gfx.tilemap.color_img,
+                },
+                .samplers[0] = state.gfx.offscreen.sampler,
+                .samplers[1] = state.gfx.offscreen.sampler,
+            }
+        });
+        sg_draw(0, 4, 1);
+    }
+    sg_apply_pipeline(direct ? state.gfx.direct.pip : state.gfx.offscreen.pip);
+    gfx_apply_offscreen_uniforms();
+    sg_bindings bind = {
         .vertex_buffers[0] = state.gfx.display.quad_vbuf,
         .fs = {
-            .images[0] = state.gfx.offscreen.render_target,
-            .samplers[0] = state.gfx.display.sampler,
+            .images = {
+                [0] = state.gfx.offscreen.tile_img,
+                [1] = state.gfx.offscreen.palette_img,
+            },
+            .samplers[0] = state.gfx.offscreen.sampler,
+            .samplers[1] = state.gfx.offscreen.sampler,
         }
-    });
-    sg_draw(0, 4, 1);
-    sg_end_pass();
-    sg_commit();
+    };
+    for (int i = 0; !state.gfx.tilemap.enabled && (i < PLAYFIELD_BANDS); i++) {
+        bind.vertex_buffers[1] = state.gfx.offscreen.playfield_vbuf[i];
+        sg_apply_bindings(&bind);
+        sg_draw(0, 4, PLAYFIELD_BAND_QUADS);
+    }
+    if (state.gfx.num_quads > 0) {
+        bind.vertex_buffers[1] = state.gfx.offscreen.vbuf;
+        sg_apply_bindings(&bind);
+        sg_draw(0, 4, state.gfx.num_quads);
+    }
+    gfx_end_playfield_pass(direct_scale);
+    PROF_END(PROF_GFX_COMMIT);
 }
+#endif // !PACMAN_HEADLESS
 //////////////////////////////////////////AUDIO/////////////////////////////////////////////
 /*== AUDIO SUBSYSTEM =========================================================*/
+#if !PACMAN_HEADLESS
+#if PACMAN_AUDIO_STREAM
+#if defined(_MSC_VER)
+static uint32_t snd_atomic_load(volatile uint32_t* ptr) {
+    return (uint32_t)_InterlockedCompareExchange((volatile long*)ptr, 0, 0);
+}
+
+static void snd_atomic_store(volatile uint32_t* ptr, uint32_t val) {
+    _InterlockedExchange((volatile long*)ptr, (long)val);
+}
+#else
+static uint32_t snd_atomic_load(volatile uint32_t* ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static void snd_atomic_store(volatile uint32_t* ptr, uint32_t val) {
+    __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+#endif
+
+static void snd_stream(float* buffer, int num_frames, int num_channels);
+#endif
+#if PACMAN_SOUND_CACHE
+static void snd_cache_init(void);
+#endif
+
 static void snd_init(void) {
     saudio_setup(&(saudio_desc){
+        #if PACMAN_AUDIO_STREAM
+        .stream_cb = snd_stream,
+        #endif
         .logger.func = slog_func,
     });
 
@@ -3386,60 +9386,295 @@ static void snd_init(void) {
         runs at 96kHz), times 1000 for increased precision
     */
     state.audio.voice_tick_period = 96000000 / samples_per_sec;
+    #if PACMAN_SOUND_CACHE
+        snd_cache_init();
+    #endif
+    #if PACMAN_AUDIO_STREAM
+        // the audio thread may already be running, and outputs silence until now
+        snd_atomic_store(&state.audio.stream.ready, 1);
+    #endif
 }
 
 static void snd_shutdown(void) {
     saudio_shutdown();
+    #if PACMAN_SOUND_CACHE
+        free(state.audio.cache.samples);
+        state.audio.cache.samples = 0;
+    #endif
 }
+#endif // !PACMAN_HEADLESS
 
-// the snd_voice_tick() function updates the Namco sound generator and must be called with 96 kHz
-static void snd_voice_tick(void) {
-    for (int i = 0; i < NUM_VOICES; i++) {
-        voice_t* voice = &state.audio.voice[i];
-        voice->counter += voice->frequency;
-        /* lookup current 4-bit sample from the waveform number and the
-            topmost 5 bits of the 20-bit sample counter
-        */
-        uint32_t wave_index = ((voice->waveform<<5) | ((voice->counter>>15) & 0x1F)) & 0xFF;
-        int sample = (((int)(rom_wavetable[wave_index] & 0xF)) - 8) * voice->volume;
-        voice->sample_acc += (float)sample; // sample is (-8..+7 wavetable value) * 16 (volume)
-        voice->sample_div += 128.0f;
+// the voice emulation itself doesn't need an audio device (see BENCHMARK SUITE)
+#if !PACMAN_HEADLESS || PACMAN_BENCH
+
+/* render one voice of the Namco sound generator into a block of samples,
+   the sound generator runs at 96 kHz, and each output sample is the sum
+   of the 4-bit wavetable values of the generator ticks which fall into
+   that sample (see snd_frame()), the voice registers don't change within
+   a block, so silent and constant voices only need to advance the counter
+*/
+static void snd_voice_block(voice_t* voice, float* dst, const uint8_t* sample_ticks, uint32_t num_samples, uint32_t num_ticks) {
+    // the wavetable values of the voice's current waveform scaled by volume, (-8..+7) * (0..15)
+    int wave[32];
+    for (int i = 0; i < 32; i++) {
+        wave[i] = (((int)(rom_wavetable[((voice->waveform<<5) | i) & 0xFF] & 0xF)) - 8) * voice->volume;
+    }
+    if (voice->volume == 0) {
+        for (uint32_t i = 0; i < num_samples; i++) {
+            dst[i] = 0.0f;
+        }
     }
+    else if (voice->frequency == 0) {
+        // the top 5 bits of the 20-bit counter select the wavetable value
+        const int sample = wave[(voice->counter>>15) & 0x1F];
+        for (uint32_t i = 0; i < num_samples; i++) {
+            dst[i] = (float)(sample * sample_ticks[i]);
+        }
+    }
+    else {
+        const uint32_t freq = voice->frequency;
+        uint32_t counter = voice->counter;
+        for (uint32_t i = 0; i < num_samples; i++) {
+            int acc = 0;
+            for (uint32_t t = 0; t < sample_ticks[i]; t++) {
+                counter += freq;
+                acc += wave[(counter>>15) & 0x1F];
+            }
+            dst[i] = (float)acc;
+        }
+    }
+    voice->counter += voice->frequency * num_ticks;
 }
 
-// the snd_sample_tick() function must be called with sample frequency (e.g. 44.1kHz)
-static void snd_sample_tick(void) {
-    float sm = 0.0f;
-    for (int i = 0; i < NUM_VOICES; i++) {
-        voice_t* voice = &state.audio.voice[i];
-        if (voice->sample_div > 0.0f) {
-            sm += voice->sample_acc / voice->sample_div;
-            voice->sample_acc = voice->sample_div = 0.0f;
+/* render a block of samples, each voice is box-filtered down to the sample
+   rate by dividing its accumulated wavetable values by 128 times the number
+   of generator ticks in the sample, and the voices are mixed in order
+*/
+static void snd_render_block(voice_t* voices, float* dst, const uint8_t* sample_ticks, uint32_t num_samples, uint32_t num_ticks) {
+    float voice_samples[NUM_SAMPLES];
+    float div[NUM_SAMPLES];
+    for (uint32_t i = 0; i < num_samples; i++) {
+        dst[i] = 0.0f;
+        div[i] = 128.0f * sample_ticks[i];
+    }
+    for (int v = 0; v < NUM_VOICES; v++) {
+        snd_voice_block(&voices[v], voice_samples, sample_ticks, num_samples, num_ticks);
+        for (uint32_t i = 0; i < num_samples; i++) {
+            dst[i] += (div[i] > 0.0f) ? (voice_samples[i] / div[i]) : 0.0f;
+        }
+    }
+    for (uint32_t i = 0; i < num_samples; i++) {
+        dst[i] = dst[i] * 0.333333f * AUDIO_VOLUME;
+    }
+}
+
+// the number of 96 kHz generator ticks which fall into the next sample
+static uint8_t snd_sample_ticks(void) {
+    uint8_t ticks = 0;
+    state.audio.voice_tick_accum -= state.audio.voice_tick_period;
+    while (state.audio.voice_tick_accum < 0) {
+        state.audio.voice_tick_accum += 1000;
+        ticks++;
+    }
+    return ticks;
+}
+
+// the number of samples until the next 60Hz sound tick
+static uint32_t snd_tick_samples(int32_t* tick_accum) {
+    *tick_accum += TICK_DURATION_NS;
+    const uint32_t num_samples = (uint32_t)(*tick_accum / state.audio.sample_duration_ns);
+    *tick_accum -= (int32_t)num_samples * state.audio.sample_duration_ns;
+    return num_samples;
+}
+#endif // !PACMAN_HEADLESS || PACMAN_BENCH
+
+#if !PACMAN_HEADLESS
+
+// start, continue or stop the playback of the pre-rendered sound in a sound slot
+static void snd_pcm_sync(snd_pcm_play_t* play, const snd_pcm_t* pcm, uint32_t tick) {
+    if (0 == pcm) {
+        play->pcm = 0;
+    }
+    else if ((pcm != play->pcm) || (tick == 0)) {
+        // the sound has been started (or its first ticks have been skipped)
+        const uint32_t pos = (uint32_t)(((uint64_t)tick * TICK_DURATION_NS) / (uint64_t)state.audio.sample_duration_ns);
+        play->pcm = pcm;
+        play->pos = (pos < pcm->num_samples) ? pos : pcm->num_samples;
+    }
+}
+
+// mix the playing pre-rendered sounds into a block of samples
+static void snd_mix_pcm(snd_pcm_play_t* play, float* dst, uint32_t num_samples) {
+    for (int slot = 0; slot < NUM_SOUNDS; slot++) {
+        const snd_pcm_t* pcm = play[slot].pcm;
+        if (pcm) {
+            uint32_t n = pcm->num_samples - play[slot].pos;
+            if (n > num_samples) {
+                n = num_samples;
+            }
+            const int16_t* src = &pcm->samples[play[slot].pos];
+            for (uint32_t i = 0; i < n; i++) {
+                dst[i] += (float)src[i] * (1.0f / SND_PCM_SCALE);
+            }
+            play[slot].pos += n;
+        }
+    }
+}
+
+#if PACMAN_AUDIO_STREAM
+// post the voice registers of the current 60Hz tick to the audio thread
+static void snd_queue_push(void) {
+    const uint32_t head = state.audio.queue.head;
+    const uint32_t tail = snd_atomic_load(&state.audio.queue.tail);
+    if ((head - tail) == SND_QUEUE_SIZE) {
+        // the audio thread isn't running, drop the update
+        return;
+    }
+    snd_regs_t* regs = &state.audio.queue.regs[head & (SND_QUEUE_SIZE-1)];
+    if (state.audio.muted) {
+        *regs = (snd_regs_t) { 0 };
+    }
+    else {
+        memcpy(regs->voice, state.audio.voice, sizeof(state.audio.voice));
+        for (int slot = 0; slot < NUM_SOUNDS; slot++) {
+            regs->pcm[slot] = state.audio.sound[slot].pcm;
+            regs->pcm_tick[slot] = state.audio.sound[slot].cur_tick - 1;
         }
     }
-    state.audio.sample_buffer[state.audio.num_samples++] = sm * 0.333333f * AUDIO_VOLUME;
-    if (state.audio.num_samples == NUM_SAMPLES) {
-        saudio_push(state.audio.sample_buffer, state.audio.num_samples);
-        state.audio.num_samples = 0;
+    snd_atomic_store(&state.audio.queue.head, head + 1);
+}
+
+/* apply the next queued voice registers in the audio thread, if the queue
+   is empty (the main thread is late) the voices keep playing with their
+   current registers, and if the main thread has run too far ahead, stale
+   updates are skipped to bound the latency
+*/
+static void snd_queue_pop(void) {
+    const uint32_t tail = state.audio.queue.tail;
+    const uint32_t head = snd_atomic_load(&state.audio.queue.head);
+    if (head == tail) {
+        return;
+    }
+    const uint32_t next = ((head - tail) > SND_QUEUE_MAX_BACKLOG) ? (head - SND_QUEUE_MAX_BACKLOG) : tail;
+    const snd_regs_t* regs = &state.audio.queue.regs[next & (SND_QUEUE_SIZE-1)];
+    for (int i = 0; i < NUM_VOICES; i++) {
+        voice_t* voice = &state.audio.stream.voice[i];
+        voice->frequency = regs->voice[i].frequency;
+        voice->waveform = regs->voice[i].waveform;
+        voice->volume = regs->voice[i].volume;
     }
+    for (int slot = 0; slot < NUM_SOUNDS; slot++) {
+        snd_pcm_sync(&state.audio.stream.play[slot], regs->pcm[slot], regs->pcm_tick[slot]);
+    }
+    snd_atomic_store(&state.audio.queue.tail, next + 1);
 }
 
+// the sokol-audio stream callback, called on the audio thread
+static void snd_stream(float* buffer, int num_frames, int num_channels) {
+    assert(num_channels == 1); (void)num_channels;
+    if (!snd_atomic_load(&state.audio.stream.ready)) {
+        memset(buffer, 0, (size_t)num_frames * sizeof(float));
+        return;
+    }
+    uint32_t pos = 0;
+    while (pos < (uint32_t)num_frames) {
+        // apply the next queued voice registers once per 60Hz tick of audio time
+        if (state.audio.stream.tick_samples == 0) {
+            snd_queue_pop();
+            state.audio.stream.tick_samples = snd_tick_samples(&state.audio.stream.tick_accum);
+            continue;
+        }
+        uint32_t num_samples = (uint32_t)num_frames - pos;
+        if (num_samples > state.audio.stream.tick_samples) {
+            num_samples = state.audio.stream.tick_samples;
+        }
+        if (num_samples > NUM_SAMPLES) {
+            num_samples = NUM_SAMPLES;
+        }
+        uint8_t sample_ticks[NUM_SAMPLES];
+        uint32_t num_ticks = 0;
+        for (uint32_t i = 0; i < num_samples; i++) {
+            sample_ticks[i] = snd_sample_ticks();
+            num_ticks += sample_ticks[i];
+        }
+        snd_render_block(state.audio.stream.voice, &buffer[pos], sample_ticks, num_samples, num_ticks);
+        snd_mix_pcm(state.audio.stream.play, &buffer[pos], num_samples);
+        state.audio.stream.tick_samples -= num_samples;
+        pos += num_samples;
+    }
+}
+#else
 // the sound subsystem's per-frame function
 static void snd_frame(int32_t frame_time_ns) {
-    // for each sample to generate...
     state.audio.sample_accum -= frame_time_ns;
     while (state.audio.sample_accum < 0) {
-        state.audio.sample_accum += state.audio.sample_duration_ns;
-        // tick the sound generator at 96 KHz
-        state.audio.voice_tick_accum -= state.audio.voice_tick_period;
-        while (state.audio.voice_tick_accum < 0) {
-            state.audio.voice_tick_accum += 1000;
-            snd_voice_tick();
+        // gather the number of 96 kHz generator ticks for each sample
+        // until the local sample buffer is full, or the frame is done
+        uint8_t sample_ticks[NUM_SAMPLES];
+        uint32_t num_samples = 0;
+        uint32_t num_ticks = 0;
+        while ((state.audio.sample_accum < 0) && ((state.audio.num_samples + num_samples) < NUM_SAMPLES)) {
+            state.audio.sample_accum += state.audio.sample_duration_ns;
+            sample_ticks[num_samples] = snd_sample_ticks();
+            num_ticks += sample_ticks[num_samples++];
+        }
+        // render the samples, and push out to sokol-audio when local sample buffer full
+        float* dst = &state.audio.sample_buffer[state.audio.num_samples];
+        if (state.audio.muted) {
+            memset(dst, 0, num_samples * sizeof(float));
+        }
+        else {
+            snd_render_block(state.audio.voice, dst, sample_ticks, num_samples, num_ticks);
+            snd_mix_pcm(state.audio.play, dst, num_samples);
+        }
+        state.audio.num_samples += num_samples;
+        if (state.audio.num_samples == NUM_SAMPLES) {
+            saudio_push(state.audio.sample_buffer, state.audio.num_samples);
+            state.audio.num_samples = 0;
         }
-        // generate a new sample, and push out to sokol-audio when local sample buffer full
-        snd_sample_tick();
     }
 }
+#endif
+
+// advance one sound effect by one 60Hz tick
+static void snd_tick_sound(int sound_slot) {
+    sound_t* snd = &state.audio.sound[sound_slot];
+    if (snd->pcm) {
+        // pre-rendered sound effect, only the length needs to be tracked
+        if (snd->cur_tick == snd->pcm->num_ticks) {
+            snd_stop(sound_slot);
+            return;
+        }
+    }
+    else if (snd->func) {
+        // procedural sound effect
+        snd->func(sound_slot);
+    }
+    else if (snd->flags & SOUNDFLAG_ALL_VOICES) {
+        // register-dump sound effect
+        assert(snd->data);
+        if (snd->cur_tick == snd->num_ticks) {
+            snd_stop(sound_slot);
+            return;
+        }
+
+        // decode register dump values into voice 'registers'
+        const uint32_t* cur_ptr = &snd->data[snd->cur_tick * snd->stride];
+        for (int i = 0; i < NUM_VOICES; i++) {
+            if (snd->flags & (1<<i)) {
+                voice_t* voice = &state.audio.voice[i];
+                uint32_t val = *cur_ptr++;
+                // 20 bits frequency
+                voice->frequency = val & ((1<<20)-1);
+                // 3 bits waveform
+                voice->waveform = (val>>24) & 7;
+                // 4 bits volume
+                voice->volume = (val>>28) & 0xF;
+            }
+        }
+    }
+    snd->cur_tick++;
+}
 
 /* The sound system's 60 Hz tick function (called from game tick).
     Updates the sound 'hardware registers' for all active sound effects.
@@ -3447,36 +9682,23 @@ static void snd_frame(int32_t frame_time_ns) {
 static void snd_tick(void) {
     // for each active sound effect...
     for (int sound_slot = 0; sound_slot < NUM_SOUNDS; sound_slot++) {
-        sound_t* snd = &state.audio.sound[sound_slot];
-        if (snd->func) {
-            // procedural sound effect
-            snd->func(sound_slot);
-        }
-        else if (snd->flags & SOUNDFLAG_ALL_VOICES) {
-            // register-dump sound effect
-            assert(snd->data);
-            if (snd->cur_tick == snd->num_ticks) {
-                snd_stop(sound_slot);
-                continue;
-            }
-
-            // decode register dump values into voice 'registers'
-            const uint32_t* cur_ptr = &snd->data[snd->cur_tick * snd->stride];
-            for (int i = 0; i < NUM_VOICES; i++) {
-                if (snd->flags & (1<<i)) {
-                    voice_t* voice = &state.audio.voice[i];
-                    uint32_t val = *cur_ptr++;
-                    // 20 bits frequency
-                    voice->frequency = val & ((1<<20)-1);
-                    // 3 bits waveform
-                    voice->waveform = (val>>24) & 7;
-                    // 4 bits volume
-                    voice->volume = (val>>28) & 0xF;
-                }
-            }
-        }
-        snd->cur_tick++;
+        snd_tick_sound(sound_slot);
     }
+    #if PACMAN_AUDIO_STREAM
+        snd_queue_push();
+    #else
+        for (int sound_slot = 0; sound_slot < NUM_SOUNDS; sound_slot++) {
+            const sound_t* snd = &state.audio.sound[sound_slot];
+            snd_pcm_sync(&state.audio.play[sound_slot], state.audio.muted ? 0 : snd->pcm, snd->cur_tick - 1);
+        }
+    #endif
+}
+
+/* mute or unmute the audio output, the sound effects keep running so that
+   they are in sync with the game when unmuted (used when fast-forwarding)
+*/
+static void snd_mute(bool muted) {
+    state.audio.muted = muted;
 }
 
 // clear all active sound effects and start outputting silence
@@ -3500,6 +9722,14 @@ static void snd_start(int slot, const sound_desc_t* desc) {
             num_voices++;
         }
     }
+    #if PACMAN_SOUND_CACHE
+        for (uint32_t i = 0; i < state.audio.cache.num_pcm; i++) {
+            if (state.audio.cache.pcm[i].desc == desc) {
+                snd->pcm = &state.audio.cache.pcm[i];
+                return;
+            }
+        }
+    #endif
     if (desc->func) {
         // procedural sounds only need a callback function
         snd->func = desc->func;
@@ -3528,6 +9758,96 @@ static void snd_stop(int slot) {
     state.audio.sound[slot] = (sound_t) { 0 };
 }
 
+#if PACMAN_SOUND_CACHE
+/* play a sound effect through the voice emulation in sound slot 0 (before
+   any game sound is started), and render its samples at the device sample
+   rate, or only count them if samples is null, returns the number of
+   samples, or 0 if the sound effect doesn't fit into max_samples, the
+   samples are stored as int16 (the output is well within -1..+1, so this
+   halves the pool without audible loss)
+*/
+static uint32_t snd_cache_render(const sound_desc_t* desc, int16_t* samples, uint32_t max_samples, uint32_t* out_num_ticks) {
+    uint32_t pos = 0;
+    uint32_t num_ticks = 0;
+    int32_t tick_accum = 0;
+    bool fits = true;
+    snd_start(0, desc);
+    while (fits) {
+        snd_tick_sound(0);
+        if (0 == state.audio.sound[0].flags) {
+            // the sound effect has stopped itself
+            break;
+        }
+        num_ticks++;
+        uint32_t tick_samples = snd_tick_samples(&tick_accum);
+        if ((pos + tick_samples) > max_samples) {
+            fits = false;
+            break;
+        }
+        if (0 == samples) {
+            pos += tick_samples;
+            continue;
+        }
+        while (tick_samples > 0) {
+            const uint32_t num_samples = (tick_samples < NUM_SAMPLES) ? tick_samples : NUM_SAMPLES;
+            uint8_t sample_ticks[NUM_SAMPLES];
+            uint32_t num_voice_ticks = 0;
+            for (uint32_t s = 0; s < num_samples; s++) {
+                sample_ticks[s] = snd_sample_ticks();
+                num_voice_ticks += sample_ticks[s];
+            }
+            float block[NUM_SAMPLES];
+            snd_render_block(state.audio.voice, block, sample_ticks, num_samples, num_voice_ticks);
+            for (uint32_t s = 0; s < num_samples; s++) {
+                const float val = block[s] * SND_PCM_SCALE;
+                samples[pos + s] = (int16_t)((val < 0.0f) ? (val - 0.5f) : (val + 0.5f));
+            }
+            pos += num_samples;
+            tick_samples -= num_samples;
+        }
+    }
+    snd_clear();
+    *out_num_ticks = num_ticks;
+    return fits ? pos : 0;
+}
+
+/* pre-render the sound effects in snd_cached[], the sample pool is sized
+   for the device sample rate by counting the samples first, sound effects
+   which don't fit into SND_CACHE_SAMPLES (at very high sample rates) keep
+   using the voice emulation
+*/
+static void snd_cache_init(void) {
+    uint32_t num_samples[NUM_CACHED_SOUNDS];
+    uint32_t total_samples = 0;
+    for (int i = 0; i < NUM_CACHED_SOUNDS; i++) {
+        uint32_t num_ticks;
+        num_samples[i] = snd_cache_render(snd_cached[i], 0, SND_CACHE_SAMPLES - total_samples, &num_ticks);
+        total_samples += num_samples[i];
+    }
+    if (0 == total_samples) {
+        return;
+    }
+    state.audio.cache.samples = (int16_t*) malloc(total_samples * sizeof(int16_t));
+    assert(state.audio.cache.samples);
+    state.audio.cache.num_samples = total_samples;
+    uint32_t pos = 0;
+    for (int i = 0; i < NUM_CACHED_SOUNDS; i++) {
+        if (0 == num_samples[i]) {
+            continue;
+        }
+        uint32_t num_ticks;
+        snd_cache_render(snd_cached[i], &state.audio.cache.samples[pos], num_samples[i], &num_ticks);
+        state.audio.cache.pcm[state.audio.cache.num_pcm++] = (snd_pcm_t) {
+            .desc = snd_cached[i],
+            .samples = &state.audio.cache.samples[pos],
+            .num_samples = num_samples[i],
+            .num_ticks = num_ticks,
+        };
+        pos += num_samples[i];
+    }
+}
+#endif
+
 // procedural sound effects
 static void snd_func_eatdot1(int slot) {
     assert((slot >= 0) && (slot < NUM_SOUNDS));
@@ -3634,7 +9954,462 @@ static void snd_func_frightened(int slot) {
     }
 }
 
+#endif // !PACMAN_HEADLESS
+
+/*== FRAME PROFILER ==========================================================*/
+#if PACMAN_PROFILER
+/*
+    The frame profiler measures the time spent in the subsystems of each
+    frame (see profscope_t), the durations of a scope are accumulated over
+    all game ticks of a frame, and each frame is recorded into a ring of
+    the last PROF_NUM_FRAMES frames. While the profiler is off, the
+    instrumentation is only a branch on state.prof.enabled.
+
+    Start with -profile (or press F4) to record and show the min/avg/p99
+    durations in microseconds as HUD, with -profile-csv file.csv the
+    recorded frames are written into a CSV file on exit.
+*/
+static void prof_begin(profscope_t scope) {
+    state.prof.begin_ns[scope] = time_now_ns();
+}
+
+static void prof_end(profscope_t scope) {
+    state.prof.cur[scope] += (uint32_t)(time_now_ns() - state.prof.begin_ns[scope]);
+}
+
+static int prof_cmp(const void* a, const void* b) {
+    const uint32_t va = *(const uint32_t*)a;
+    const uint32_t vb = *(const uint32_t*)b;
+    return (va > vb) - (va < vb);
+}
+
+// update the min/avg/p99 durations shown in the HUD from the recorded frames
+static void prof_update_stats(void) {
+    const uint32_t num = (state.prof.num_frames < PROF_NUM_FRAMES) ? state.prof.num_frames : PROF_NUM_FRAMES;
+    if (num == 0) {
+        return;
+    }
+    uint32_t* sorted = state.prof.sorted;
+    for (int scope = 0; scope < NUM_PROF_SCOPES; scope++) {
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < num; i++) {
+            sorted[i] = state.prof.frames[i][scope];
+            sum += sorted[i];
+        }
+        qsort(sorted, num, sizeof(uint32_t), prof_cmp);
+        state.prof.stats[scope][0] = sorted[0] / 1000;
+        state.prof.stats[scope][1] = (uint32_t)(sum / num / 1000);
+        state.prof.stats[scope][2] = sorted[(num * 99) / 100] / 1000;
+    }
+}
+
+// record the durations of the current frame, called at the end of frame()
+static void prof_frame_end(void) {
+    if (!state.prof.enabled) {
+        return;
+    }
+    memcpy(state.prof.frames[state.prof.num_frames % PROF_NUM_FRAMES], state.prof.cur, sizeof(state.prof.cur));
+    memset(state.prof.cur, 0, sizeof(state.prof.cur));
+    state.prof.num_frames++;
+    if ((state.prof.num_frames % 30) == 0) {
+        prof_update_stats();
+    }
+}
+
+// allocate the sample ring when the profiler is switched on for the first time
+static void prof_alloc(void) {
+    if (!state.prof.frames) {
+        state.prof.frames = (uint32_t(*)[NUM_PROF_SCOPES]) calloc(PROF_NUM_FRAMES, sizeof(state.prof.frames[0]));
+        state.prof.sorted = (uint32_t*) calloc(PROF_NUM_FRAMES, sizeof(uint32_t));
+        assert(state.prof.frames && state.prof.sorted);
+    }
+}
+
+// switch recording and the HUD on or off, called between frames
+static void prof_toggle(void) {
+    prof_alloc();
+    state.prof.enabled = !state.prof.enabled;
+    memset(state.prof.cur, 0, sizeof(state.prof.cur));
+}
+
+// parse the profiler command line args, called from sokol_main()
+static void prof_parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-profile")) {
+            state.prof.enabled = true;
+        }
+        else if ((0 == strcmp(argv[i], "-profile-csv")) && ((i + 1) < argc)) {
+            state.prof.enabled = true;
+            state.prof.csv_path = argv[++i];
+        }
+    }
+    if (state.prof.enabled) {
+        prof_alloc();
+    }
+}
+
+// write the recorded frames as CSV file (oldest first, durations in microseconds)
+static void prof_write_csv(void) {
+    FILE* fp = fopen(state.prof.csv_path, "w");
+    if (!fp) {
+        slog_func("pacman", 2, 0, "profiler: failed to open CSV file", __LINE__, __FILE__, 0);
+        return;
+    }
+    fprintf(fp, "frame,frame_us,snd_tick_us,sim_tick_us,actors_us,tiles_us,sprites_us,gfx_quads_us,gfx_upload_us,gfx_commit_us,snd_frame_us,autoplay_us\n");
+    const uint32_t num = (state.prof.num_frames < PROF_NUM_FRAMES) ? state.prof.num_frames : PROF_NUM_FRAMES;
+    for (uint32_t i = state.prof.num_frames - num; i < state.prof.num_frames; i++) {
+        const uint32_t* frame = state.prof.frames[i % PROF_NUM_FRAMES];
+        fprintf(fp, "%u", (unsigned)i);
+        for (int scope = 0; scope < NUM_PROF_SCOPES; scope++) {
+            fprintf(fp, ",%.3f", frame[scope] / 1000.0);
+        }
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+}
+
+static void prof_shutdown(void) {
+    if (state.prof.csv_path && (state.prof.num_frames > 0)) {
+        prof_write_csv();
+    }
+    free(state.prof.frames);
+    free(state.prof.sorted);
+    state.prof.frames = 0;
+    state.prof.sorted = 0;
+}
+#endif // PACMAN_PROFILER
+
+/*== BENCHMARK SUITE =========================================================*/
+#if PACMAN_BENCH
+/*
+    The benchmark suite measures the hot paths of the game on a fixed
+    workload, so that a performance regression shows up as a change in
+    the numbers of two builds on the same machine:
+
+        pacman_bench [-reps num] [-ticks num] [-seed num]
+
+    First, a long game is recorded with the random-walk input policy of
+    the headless runner (one hour of game time by default). The recording
+    keeps the keys of each tick, snapshots of the game state spread over
+    the whole game, and copies of ghosts which are about to take a
+    direction decision. Then each benchmark runs '-reps' times over the
+    recording, and the median of the runs is printed:
+
+        sim         sim_tick() over the whole recorded game
+        playfield   rebuild all playfield quads of a snapshot
+        sprites     build the sprite quads of a snapshot
+        snd         synthesize one minute of the prelude and death sound
+                    register dumps at 44.1 kHz with snd_render_block()
+        snapshot    game_snapshot() and game_restore()
+        ghost_dir   game_update_ghost_dir() on the recorded decisions
+
+    Each result is printed as a 'name: value' line where the name ends
+    with the unit. The state hash at the end of the recorded game is
+    printed too, if it differs between two builds the simulation has
+    changed and the workloads aren't comparable.
+
+    The benchmark suite is a headless build with PACMAN_BENCH=1, this
+    includes the CPU-side parts of the renderer and audio subsystem
+    (building the quad instance data and the voice emulation).
+*/
+#define BENCH_DEFAULT_REPS (5)
+#define BENCH_MAX_REPS (64)
+#define BENCH_NUM_SNAPSHOTS (64)
+#define BENCH_SNAPSHOT_ROUNDS (256)     // quad rebuilds per snapshot and run
+#define BENCH_MAX_DECISIONS (4096)
+#define BENCH_DECISION_ROUNDS (256)     // passes over the recorded decisions per run
+#define BENCH_COPY_ROUNDS (200000)      // snapshots and restores per run
+#define BENCH_SAMPLE_RATE (44100)
+#define BENCH_SND_TICKS (60*60)         // one minute of audio
+
+// the recorded game all benchmarks run on
+static struct {
+    uint32_t seed;
+    uint32_t num_ticks;
+    uint16_t* keys;                             // keys held down per tick
+    uint64_t end_hash;                          // game_hash() after the last tick
+    game_snapshot_t snapshots[BENCH_NUM_SNAPSHOTS];
+    uint32_t num_decisions;
+    ghost_t decisions[BENCH_MAX_DECISIONS];     // ghosts at a tile midpoint before their next tick
+    game_snapshot_t copies[2];                  // snapshot_ns destination
+} bench;
+
+// the median of a number of run durations in nanoseconds
+static int bench_cmp(const void* a, const void* b) {
+    const uint64_t va = *(const uint64_t*)a;
+    const uint64_t vb = *(const uint64_t*)b;
+    return (va < vb) ? -1 : ((va > vb) ? 1 : 0);
+}
+
+static double bench_median(uint64_t* ns, int num_reps) {
+    qsort(ns, (size_t)num_reps, sizeof(uint64_t), bench_cmp);
+    if (num_reps & 1) {
+        return (double)ns[num_reps/2];
+    }
+    return ((double)ns[num_reps/2 - 1] + (double)ns[num_reps/2]) * 0.5;
+}
+
+// true if a ghost is going to pick a new direction in game_update_ghost_dir()
+static bool bench_is_decision(const ghost_t* ghost) {
+    switch (ghost->state) {
+        case GHOSTSTATE_CHASE:
+        case GHOSTSTATE_SCATTER:
+        case GHOSTSTATE_FRIGHTENED:
+        case GHOSTSTATE_EYES: {
+            const int2_t dist_to_mid = dist_to_tile_mid(ghost->actor.pos);
+            return (dist_to_mid.x == 0) && (dist_to_mid.y == 0);
+        }
+        default:
+            return false;
+    }
+}
+
+// record the game the benchmarks run on
+static void bench_record(game_ctx_t* ctx) {
+    bench.keys = (uint16_t*) malloc(bench.num_ticks * sizeof(uint16_t));
+    assert(bench.keys);
+    const uint32_t snapshot_interval = (bench.num_ticks + BENCH_NUM_SNAPSHOTS - 1) / BENCH_NUM_SNAPSHOTS;
+    // every decision_interval'th decision is recorded, to spread the recorded
+    // decisions over the whole game, the interval doubles whenever the array is full
+    uint32_t decision_interval = 1;
+    uint32_t num_candidates = 0;
+    uint32_t seed = bench.seed;
+    uint16_t keys = 0;
+    sim_init(ctx);
+    for (uint32_t tick = 0; tick < bench.num_ticks; tick++) {
+        if ((tick % snapshot_interval) == 0) {
+            game_snapshot(ctx, &bench.snapshots[tick / snapshot_interval]);
+        }
+        keys = headless_random_keys(&seed, tick, keys);
+        bench.keys[tick] = keys;
+        input_keys(ctx, keys);
+        sim_tick(ctx);
+        if (ctx->gamestate == GAMESTATE_GAME) {
+            for (int i = 0; i < NUM_GHOSTS; i++) {
+                if (!bench_is_decision(&ctx->game.ghost[i]) || ((num_candidates++ % decision_interval) != 0)) {
+                    continue;
+                }
+                if (bench.num_decisions == BENCH_MAX_DECISIONS) {
+                    for (uint32_t d = 0; d < BENCH_MAX_DECISIONS/2; d++) {
+                        bench.decisions[d] = bench.decisions[d*2];
+                    }
+                    bench.num_decisions = BENCH_MAX_DECISIONS/2;
+                    decision_interval *= 2;
+                    if (((num_candidates - 1) % decision_interval) != 0) {
+                        continue;
+                    }
+                }
+                bench.decisions[bench.num_decisions++] = ctx->game.ghost[i];
+            }
+        }
+    }
+    bench.end_hash = game_hash(ctx);
+}
+
+// replay the recorded game, this is mostly game_tick() since the random-walk input starts a game right away
+static uint64_t bench_sim(game_ctx_t* ctx) {
+    const uint64_t start_ns = time_now_ns();
+    sim_init(ctx);
+    for (uint32_t tick = 0; tick < bench.num_ticks; tick++) {
+        input_keys(ctx, bench.keys[tick]);
+        sim_tick(ctx);
+    }
+    const uint64_t duration_ns = time_now_ns() - start_ns;
+    if (game_hash(ctx) != bench.end_hash) {
+        fprintf(stderr, "replaying the recorded game ended in a different state\n");
+        exit(10);
+    }
+    return duration_ns;
+}
+
+// rebuild all playfield quads, as after a snapshot restore or a renderer switch
+static uint64_t bench_playfield(game_ctx_t* ctx) {
+    uint64_t duration_ns = 0;
+    for (int i = 0; i < BENCH_NUM_SNAPSHOTS; i++) {
+        game_restore(ctx, &bench.snapshots[i]);
+        const uint64_t start_ns = time_now_ns();
+        for (int r = 0; r < BENCH_SNAPSHOT_ROUNDS; r++) {
+            vid_dirty_all(ctx);
+            gfx_update_playfield_quads(ctx, state.gfx.playfield_quads);
+        }
+        duration_ns += time_now_ns() - start_ns;
+    }
+    return duration_ns;
+}
+
+static uint64_t bench_sprites(game_ctx_t* ctx) {
+    uint64_t duration_ns = 0;
+    for (int i = 0; i < BENCH_NUM_SNAPSHOTS; i++) {
+        game_restore(ctx, &bench.snapshots[i]);
+        const uint64_t start_ns = time_now_ns();
+        for (int r = 0; r < BENCH_SNAPSHOT_ROUNDS; r++) {
+            state.gfx.num_quads = 0;
+            gfx_add_sprite_quads(ctx);
+        }
+        duration_ns += time_now_ns() - start_ns;
+    }
+    return duration_ns;
+}
+
+// play the prelude on voices 0 and 1 and the death sound on voice 2, both in a loop
+static uint64_t bench_snd(float* checksum) {
+    static float samples[NUM_SAMPLES];
+    memset(state.audio.voice, 0, sizeof(state.audio.voice));
+    state.audio.voice_tick_accum = 0;
+    state.audio.voice_tick_period = 96000000 / BENCH_SAMPLE_RATE;
+    state.audio.sample_duration_ns = 1000000000 / BENCH_SAMPLE_RATE;
+    const uint32_t prelude_ticks = (uint32_t)(sizeof(snd_dump_prelude) / sizeof(uint32_t)) / 2;
+    const uint32_t dead_ticks = (uint32_t)(sizeof(snd_dump_dead) / sizeof(uint32_t));
+    int32_t tick_accum = 0;
+    float sum = 0.0f;
+    const uint64_t start_ns = time_now_ns();
+    for (uint32_t tick = 0; tick < BENCH_SND_TICKS; tick++) {
+        // decode the register dumps like snd_tick() does
+        const uint32_t regs[NUM_VOICES] = {
+            snd_dump_prelude[(tick % prelude_ticks) * 2 + 0],
+            snd_dump_prelude[(tick % prelude_ticks) * 2 + 1],
+            snd_dump_dead[tick % dead_ticks],
+        };
+        for (int i = 0; i < NUM_VOICES; i++) {
+            state.audio.voice[i].frequency = regs[i] & ((1<<20)-1);
+            state.audio.voice[i].waveform = (regs[i]>>24) & 7;
+            state.audio.voice[i].volume = (regs[i]>>28) & 0xF;
+        }
+        uint32_t tick_samples = snd_tick_samples(&tick_accum);
+        while (tick_samples > 0) {
+            const uint32_t num_samples = (tick_samples < NUM_SAMPLES) ? tick_samples : NUM_SAMPLES;
+            uint8_t sample_ticks[NUM_SAMPLES];
+            uint32_t num_ticks = 0;
+            for (uint32_t i = 0; i < num_samples; i++) {
+                sample_ticks[i] = snd_sample_ticks();
+                num_ticks += sample_ticks[i];
+            }
+            snd_render_block(state.audio.voice, samples, sample_ticks, num_samples, num_ticks);
+            // use the output, so that the compiler can't drop the synthesis
+            sum += samples[num_samples - 1];
+            tick_samples -= num_samples;
+        }
+    }
+    const uint64_t duration_ns = time_now_ns() - start_ns;
+    *checksum = sum;
+    return duration_ns;
+}
+
+static uint64_t bench_snapshot(game_ctx_t* ctx) {
+    const uint64_t start_ns = time_now_ns();
+    for (int i = 0; i < BENCH_COPY_ROUNDS; i++) {
+        game_snapshot(ctx, &bench.copies[i & 1]);
+    }
+    return time_now_ns() - start_ns;
+}
+
+static uint64_t bench_restore(game_ctx_t* ctx) {
+    const uint64_t start_ns = time_now_ns();
+    for (int i = 0; i < BENCH_COPY_ROUNDS; i++) {
+        game_restore(ctx, &bench.snapshots[i & (BENCH_NUM_SNAPSHOTS-1)]);
+    }
+    return time_now_ns() - start_ns;
+}
+
+// take all recorded ghost decisions again, the maze layout is the same in every round
+static uint64_t bench_ghost_dir(game_ctx_t* ctx, uint32_t* checksum) {
+    game_restore(ctx, &bench.snapshots[BENCH_NUM_SNAPSHOTS-1]);
+    uint32_t sum = 0;
+    const uint64_t start_ns = time_now_ns();
+    for (int r = 0; r < BENCH_DECISION_ROUNDS; r++) {
+        for (uint32_t i = 0; i < bench.num_decisions; i++) {
+            ghost_t ghost = bench.decisions[i];
+            game_update_ghost_dir(ctx, &ghost);
+            sum += ghost.next_dir;
+        }
+    }
+    const uint64_t duration_ns = time_now_ns() - start_ns;
+    *checksum = sum;
+    return duration_ns;
+}
+
+int main(int argc, char* argv[]) {
+    int num_reps = BENCH_DEFAULT_REPS;
+    bench.seed = 0x2545F491;
+    bench.num_ticks = HEADLESS_DEFAULT_TICKS;
+    bool usage = false;
+    for (int i = 1; i < argc; i++) {
+        if ((0 == strcmp(argv[i], "-reps")) && ((i + 1) < argc)) {
+            num_reps = atoi(argv[++i]);
+        }
+        else if ((0 == strcmp(argv[i], "-ticks")) && ((i + 1) < argc)) {
+            bench.num_ticks = (uint32_t) strtoul(argv[++i], 0, 10);
+        }
+        else if ((0 == strcmp(argv[i], "-seed")) && ((i + 1) < argc)) {
+            bench.seed = (uint32_t) strtoul(argv[++i], 0, 0);
+        }
+        else {
+            usage = true;
+        }
+    }
+    if (usage || (num_reps < 1) || (num_reps > BENCH_MAX_REPS) || (bench.num_ticks < BENCH_NUM_SNAPSHOTS)) {
+        fprintf(stderr, "usage: %s [-reps 1..%d] [-ticks num] [-seed num]\n", argv[0], BENCH_MAX_REPS);
+        return 10;
+    }
+    if (0 == bench.seed) {
+        // a zero seed would lock up the xorshift generator
+        bench.seed = 1;
+    }
+    levelpack_init(0);
+    game_ctx_t* ctx = &state.ctx;
+    bench_record(ctx);
+    if (0 == bench.num_decisions) {
+        fprintf(stderr, "the recorded game has no ghost decisions, try more ticks\n");
+        return 10;
+    }
+
+    enum { SIM, PLAYFIELD, SPRITES, SND, SNAPSHOT, RESTORE, GHOST_DIR, NUM_BENCHES };
+    uint64_t ns[NUM_BENCHES][BENCH_MAX_REPS];
+    float snd_checksum = 0.0f;
+    uint32_t ghost_checksum = 0;
+    for (int rep = 0; rep < num_reps; rep++) {
+        ns[SIM][rep] = bench_sim(ctx);
+        ns[PLAYFIELD][rep] = bench_playfield(ctx);
+        ns[SPRITES][rep] = bench_sprites(ctx);
+        ns[SND][rep] = bench_snd(&snd_checksum);
+        ns[SNAPSHOT][rep] = bench_snapshot(ctx);
+        ns[RESTORE][rep] = bench_restore(ctx);
+        ns[GHOST_DIR][rep] = bench_ghost_dir(ctx, &ghost_checksum);
+    }
+    const double sim_ns = bench_median(ns[SIM], num_reps);
+    const double playfield_ns = bench_median(ns[PLAYFIELD], num_reps);
+    const double sprites_ns = bench_median(ns[SPRITES], num_reps);
+    const double snd_ns = bench_median(ns[SND], num_reps);
+    const double snapshot_ns = bench_median(ns[SNAPSHOT], num_reps);
+    const double restore_ns = bench_median(ns[RESTORE], num_reps);
+    const double ghost_dir_ns = bench_median(ns[GHOST_DIR], num_reps);
+    const double snd_samples = (double)BENCH_SND_TICKS * BENCH_SAMPLE_RATE / 60.0;
+    const double num_decisions = (double)bench.num_decisions * BENCH_DECISION_ROUNDS;
+
+    printf("reps: %d\n", num_reps);
+    printf("seed: 0x%08X\n", (unsigned)bench.seed);
+    printf("ticks: %u\n", bench.num_ticks);
+    printf("state_hash: %016llX\n", (unsigned long long)bench.end_hash);
+    printf("sim_ns_per_tick: %.1f\n", sim_ns / bench.num_ticks);
+    printf("sim_ticks_per_sec: %.0f\n", bench.num_ticks * 1e9 / sim_ns);
+    printf("playfield_ns_per_call: %.1f\n", playfield_ns / (BENCH_NUM_SNAPSHOTS * BENCH_SNAPSHOT_ROUNDS));
+    printf("sprites_ns_per_call: %.1f\n", sprites_ns / (BENCH_NUM_SNAPSHOTS * BENCH_SNAPSHOT_ROUNDS));
+    printf("snd_samples_per_sec: %.0f\n", snd_samples * 1e9 / snd_ns);
+    printf("snd_realtime_factor: %.1f\n", (BENCH_SND_TICKS * 1e9 / 60.0) / snd_ns);
+    printf("snapshot_ns: %.1f\n", snapshot_ns / BENCH_COPY_ROUNDS);
+    printf("restore_ns: %.1f\n", restore_ns / BENCH_COPY_ROUNDS);
+    printf("ghost_dir_decisions: %u\n", bench.num_decisions);
+    printf("ghost_dir_ns_per_decision: %.1f\n", ghost_dir_ns / num_decisions);
+    printf("ghost_dir_decisions_per_sec: %.0f\n", num_decisions * 1e9 / ghost_dir_ns);
+    // keep the results of the benchmarked functions alive
+    printf("checksum: %08X\n", (unsigned)(ghost_checksum ^ (uint32_t)(int32_t)snd_checksum ^ (uint32_t)state.gfx.num_quads));
+    free(bench.keys);
+    return 0;
+}
+#endif // PACMAN_BENCH
+
 /*== EMBEDDED DATA ===========================================================*/
+#if PACMAN_ATLASGEN || (!PACMAN_HEADLESS && !PACMAN_ATLAS)
 
 // Pacman sprite ROM dump
 static const uint8_t rom_tiles[4096] = {
@@ -4179,7 +10954,9 @@ static const uint8_t rom_palette[256] = {
     0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
     0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
 };
+#endif
 
+#if !PACMAN_HEADLESS || PACMAN_BENCH
 static const uint8_t rom_wavetable[256] = {
     0x7, 0x9, 0xa, 0xb, 0xc, 0xd, 0xd, 0xe, 0xe, 0xe, 0xd, 0xd, 0xc, 0xb, 0xa, 0x9,
     0x7, 0x5, 0x4, 0x3, 0x2, 0x1, 0x1, 0x0, 0x0, 0x0, 0x1, 0x1, 0x2, 0x3, 0x4, 0x5,
@@ -4552,3 +11329,4 @@ static const uint32_t snd_dump_dead[90] = {
     0x80005000,
     0x80005800,
 };
+#endif // !PACMAN_HEADLESS || PACMAN_BENCH